@@ -190,9 +190,6 @@ void gst_mpg123_base_init(gpointer klass)
 void gst_mpg123_class_init(GstMpg123Class *klass)
 {
 	GstAudioDecoderClass *base_class;
-	int error;
-
-	GST_DEBUG_CATEGORY_INIT(mpg123_debug, "mpg123", 0, "mpg123 mp3 decoder");
 
 	base_class = GST_AUDIO_DECODER_CLASS(klass);
 
@@ -201,18 +198,13 @@ void gst_mpg123_class_init(GstMpg123Class *klass)
 	base_class->handle_frame = GST_DEBUG_FUNCPTR(gst_mpg123_handle_frame);
 	base_class->set_format   = GST_DEBUG_FUNCPTR(gst_mpg123_set_format);
 	base_class->flush        = GST_DEBUG_FUNCPTR(gst_mpg123_flush);
-
-	error = mpg123_init();
-	if (G_UNLIKELY(error != MPG123_OK))
-		GST_ERROR("Could not initialize mpg123 library: %s", mpg123_plain_strerror(error));
-	else
-		GST_INFO("mpg123 library initialized");
 }
 
 
 void gst_mpg123_init(GstMpg123 *mpg123_decoder, GstMpg123Class *klass)
 {
 	klass = klass;
+	mpg123_decoder->core = NULL;
 	mpg123_decoder->handle = NULL;
 }
 
@@ -221,43 +213,25 @@ static gboolean gst_mpg123_start(GstAudioDecoder *dec)
 {
 	GstMpg123 *mpg123_decoder;
 	int error;
+	GstMpg123CoreConfig config;
 
 	mpg123_decoder = GST_MPG123(dec);
 	error = 0;
 
-	mpg123_decoder->handle = mpg123_new(NULL, &error);
-	mpg123_decoder->next_srccaps = NULL;
-	mpg123_decoder->frame_offset = 0;
-
-	/*
-	Initially, the mpg123 handle comes with a set of default formats supported. This clears this set. 
-	This is necessary, since only one format shall be supported (see set_format for more).
-	*/
-	mpg123_format_none(mpg123_decoder->handle);
-
-	/* Built-in mpg123 support for gapless decoding is disabled for now, since it does not work well with seeking */
-	mpg123_param(mpg123_decoder->handle, MPG123_REMOVE_FLAGS,  MPG123_GAPLESS,       0);
-	/* Tells mpg123 to use a small read-ahead buffer for better MPEG sync; essential for MP3 radio streams */
-	mpg123_param(mpg123_decoder->handle, MPG123_ADD_FLAGS,     MPG123_SEEKBUFFER,    0);
-	/* Sets the resync limit to the end of the stream (e.g. don't give up prematurely) */
-	mpg123_param(mpg123_decoder->handle, MPG123_RESYNC_LIMIT,  -1,                   0);
-	/* Don't let mpg123 resample output */
-	mpg123_param (mpg123_decoder->handle, MPG123_REMOVE_FLAGS, MPG123_AUTO_RESAMPLE, 0);
-	/* Don't let mpg123 print messages to stdout/stderr */
-	mpg123_param (mpg123_decoder->handle, MPG123_ADD_FLAGS,    MPG123_QUIET,         0);
-
-	/* Open in feed mode (= encoded data is fed manually into the handle). */
-	error = mpg123_open_feed(mpg123_decoder->handle);
+	gst_mpg123_core_config_init(&config);
 
-	if (G_UNLIKELY(error != MPG123_OK))
+	/* The core sets up the handle and opens it in feed mode (= encoded data is fed manually into the handle) */
+	mpg123_decoder->core = gst_mpg123_core_new(&config, &error);
+	if (G_UNLIKELY(mpg123_decoder->core == NULL))
 	{
-		GST_ELEMENT_ERROR(dec, LIBRARY, INIT, (NULL), ("%s", mpg123_strerror(mpg123_decoder->handle)));
-		mpg123_close(mpg123_decoder->handle);
-		mpg123_delete(mpg123_decoder->handle);
+		GST_ELEMENT_ERROR(dec, LIBRARY, INIT, (NULL), ("%s", mpg123_plain_strerror(error)));
 		mpg123_decoder->handle = NULL;
 		return FALSE;
 	}
 
+	mpg123_decoder->handle = gst_mpg123_core_get_handle(mpg123_decoder->core);
+	mpg123_decoder->next_srccaps = NULL;
+
 	GST_INFO_OBJECT(dec, "mpg123 decoder started");
 
 	return TRUE;
@@ -268,10 +242,10 @@ static gboolean gst_mpg123_stop(GstAudioDecoder *dec)
 {
 	GstMpg123 *mpg123_decoder = GST_MPG123(dec);
 
-	if (G_LIKELY(mpg123_decoder->handle != NULL))
+	if (G_LIKELY(mpg123_decoder->core != NULL))
 	{
-		mpg123_close(mpg123_decoder->handle);
-		mpg123_delete(mpg123_decoder->handle);
+		gst_mpg123_core_free(mpg123_decoder->core);
+		mpg123_decoder->core = NULL;
 		mpg123_decoder->handle = NULL;
 	}
 
@@ -344,18 +318,13 @@ static GstFlowReturn gst_mpg123_handle_frame(GstAudioDecoder *dec, GstBuffer *in
 			inmemory = (unsigned char const *)(GST_BUFFER_DATA(input_buffer));
 			inmemsize = GST_BUFFER_SIZE(input_buffer);
 
-			mpg123_feed(mpg123_decoder->handle, inmemory, inmemsize);
+			gst_mpg123_core_feed(mpg123_decoder->core, inmemory, inmemsize);
 		}
 
 		/* Try to decode a frame */
 		decoded_bytes = NULL;
 		num_decoded_bytes = 0;
-		decode_error = mpg123_decode_frame(
-			mpg123_decoder->handle,
-			&mpg123_decoder->frame_offset,
-			&decoded_bytes,
-			&num_decoded_bytes
-		);
+		decode_error = gst_mpg123_core_decode_frame(mpg123_decoder->core, &decoded_bytes, &num_decoded_bytes);
 	}
 
 	retval = GST_FLOW_OK;
@@ -608,9 +577,7 @@ static gboolean gst_mpg123_set_format(GstAudioDecoder *dec, GstCaps *input_caps)
 		{
 			int err;
 
-			/* Cleanup old formats & set new one */
-			mpg123_format_none(mpg123_decoder->handle);
-			err = mpg123_format(mpg123_decoder->handle, rate, channels, encoding);
+			err = gst_mpg123_core_set_output_format(mpg123_decoder->core, rate, channels, encoding);
 			if (err != MPG123_OK)
 			{
 				GST_DEBUG_OBJECT(
@@ -677,8 +644,7 @@ static void gst_mpg123_flush(GstAudioDecoder *dec, gboolean hard)
 	g_assert(mpg123_decoder->handle != NULL);
 
 	/* Flush by reopening the feed */
-	mpg123_close(mpg123_decoder->handle);
-	error = mpg123_open_feed(mpg123_decoder->handle);
+	error = gst_mpg123_core_reset(mpg123_decoder->core);
 
 	if (G_UNLIKELY(error != MPG123_OK))
 	{
@@ -687,8 +653,8 @@ static void gst_mpg123_flush(GstAudioDecoder *dec, gboolean hard)
 			 mpg123_plain_strerror(error)
 			)
 		);
-		mpg123_close(mpg123_decoder->handle);
-		mpg123_delete(mpg123_decoder->handle);
+		gst_mpg123_core_free(mpg123_decoder->core);
+		mpg123_decoder->core = NULL;
 		mpg123_decoder->handle = NULL;
 	}
 
@@ -711,6 +677,20 @@ static void gst_mpg123_flush(GstAudioDecoder *dec, gboolean hard)
 
 static gboolean plugin_init(GstPlugin *plugin)
 {
+	int error;
+
+	GST_DEBUG_CATEGORY_INIT(mpg123_debug, "mpg123", 0, "mpg123 mp3 decoder");
+
+	/* Done once here instead of in class_init, so that a failure can be reported, and no element is registered */
+	error = gst_mpg123_core_global_init();
+	if (G_UNLIKELY(error != MPG123_OK))
+	{
+		GST_ERROR("Could not initialize mpg123 library: %s", mpg123_plain_strerror(error));
+		return FALSE;
+	}
+
+	GST_INFO("mpg123 library initialized");
+
 	return gst_element_register(plugin, "mpg123", GST_RANK_SECONDARY + 1, gst_mpg123_get_type());
 }
 
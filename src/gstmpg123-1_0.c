@@ -23,6 +23,14 @@
 #include <string.h>
 #include <config.h>
 #include "gstmpg123.h"
+#include "gstmpg123simd.h"
+#include "gstmpg123tracer.h"
+#include "gstmpg123pcmcache.h"
+#include "gstmpg123multidec.h"
+
+#ifdef HAVE_GST_SHM_ALLOCATOR
+#include <gst/allocators/allocators.h>
+#endif
 
 
 GST_DEBUG_CATEGORY_STATIC(mpg123_debug);
@@ -60,12 +68,200 @@ static GstStaticPadTemplate static_sink_template = GST_STATIC_PAD_TEMPLATE(
 );
 
 
+enum
+{
+	PROP_0,
+	PROP_FAST_SCAN,
+	PROP_ASYNC_DECODE,
+	PROP_ASYNC_QUEUE_DEPTH,
+	PROP_SHARED_THREAD_POOL,
+	PROP_THREAD_POOL_STATS,
+	PROP_FEED_POOL_SIZE,
+	PROP_FEED_BUFFER_SIZE,
+	PROP_SEEK_BUFFER,
+	PROP_DOWN_SAMPLE,
+	PROP_STATE_HISTORY_SIZE,
+	PROP_SHM_OUTPUT,
+	PROP_CPU_BUDGET,
+	PROP_FORCE_RATE,
+	PROP_PCM_CACHE_SIZE,
+	PROP_PCM_CACHE_STATS,
+	PROP_DECODER,
+	PROP_SUPPORTED_DECODERS,
+	PROP_SILENCE_GAPS,
+	PROP_GAP_FRAMES,
+	PROP_MEMORY_USAGE
+};
+
+
+#define DEFAULT_FAST_SCAN          FALSE
+#define DEFAULT_ASYNC_DECODE       FALSE
+#define DEFAULT_ASYNC_QUEUE_DEPTH  8
+#define DEFAULT_SHARED_THREAD_POOL FALSE
+#define DEFAULT_FEED_POOL_SIZE     -1
+#define DEFAULT_FEED_BUFFER_SIZE   -1
+#define DEFAULT_SEEK_BUFFER        TRUE
+#define DEFAULT_DOWN_SAMPLE        0
+#define DEFAULT_STATE_HISTORY_SIZE 0
+#define DEFAULT_SHM_OUTPUT         FALSE
+#define DEFAULT_CPU_BUDGET         0
+#define DEFAULT_FORCE_RATE         FALSE
+#define DEFAULT_PCM_CACHE_SIZE     0
+#define DEFAULT_DECODER            NULL
+#define DEFAULT_SILENCE_GAPS       FALSE
+
+
+enum
+{
+	SIGNAL_SAVE_STATE,
+	SIGNAL_RESTORE_STATE,
+	LAST_SIGNAL
+};
+
+static guint gst_mpg123_signals[LAST_SIGNAL] = { 0 };
+
+
+/*
+Process-wide thread pool for decoding in async mode. It is created on first use and
+lives until the process ends. The statistics are protected by gst_mpg123_thread_pool_mutex.
+*/
+static GMutex gst_mpg123_thread_pool_mutex;
+static GThreadPool *gst_mpg123_thread_pool = NULL;
+static guint64 gst_mpg123_thread_pool_num_jobs = 0;
+static guint64 gst_mpg123_thread_pool_total_wait_time = 0;
+static guint64 gst_mpg123_thread_pool_max_wait_time = 0;
+static guint64 gst_mpg123_thread_pool_total_run_time = 0;
+
+
+/*
+Number of frames before the segment start which are decoded (and discarded), so that the first frame
+inside the segment has its bit reservoir data and synthesis history
+*/
+#define GST_MPG123_SEGMENT_PREROLL_FRAMES 2
+
+
+/*
+Catching up after PCM cache hits or a quality level change needs more history than a segment preroll,
+since low bitrate frames are small, and the bit reservoir can reach back over many of them: main_data_begin
+can point up to 511 bytes back (MPEG-1; 255 bytes with MPEG-2/2.5). Every frame also has a header, an
+optional CRC and up to 32 bytes of side info, which do not contain main data. GST_MPG123_MAX_CATCH_UP_FRAMES
+bounds the history in case frames are tiny or broken.
+*/
+#define GST_MPG123_MAX_RESERVOIR_SIZE 511
+#define GST_MPG123_MAX_FRAME_OVERHEAD (4 + 2 + 32)
+#define GST_MPG123_MAX_CATCH_UP_FRAMES 64
+
+
+/*
+Quality levels of the cpu-budget mode: 0 = full quality, 1 = at least half rate, 2 = half rate and mono.
+A level is kept for at least GST_MPG123_QUALITY_HOLDOFF_FRAMES frames, so that the load estimate
+settles after a change, and the decoder does not flip back and forth between levels.
+*/
+#define GST_MPG123_MAX_QUALITY_LEVEL 2
+#define GST_MPG123_QUALITY_HOLDOFF_FRAMES 50
+
+
+/*
+Number of silent frames that must precede a silent frame before it is output as a GAP buffer. Layer III
+synthesis overlaps each granule with the previous one, and the polyphase filterbank keeps a history
+of 512 samples, so the first frames of a silent stretch still carry the fading end of the audio before it.
+Once two silent frames were decoded, the whole synthesis state is zero, and stays zero while frames are
+only parsed.
+*/
+#define GST_MPG123_SILENCE_HISTORY_FRAMES 2
+
+/*
+GAP buffers share this read-only memory, which is large enough for the largest possible frame
+(1152 samples, 2 channels, 32 bit); it is created on first use and lives until the process ends
+*/
+#define GST_MPG123_SILENCE_MEMORY_SIZE (1152 * 2 * 4)
+static GMutex gst_mpg123_silence_memory_mutex;
+static GstMemory *gst_mpg123_silence_memory = NULL;
+
+
+/* What to do with an incoming frame, depending on the output segment */
+typedef enum
+{
+	GST_MPG123_FRAME_ACTION_DECODE,  /* decode and push the frame */
+	GST_MPG123_FRAME_ACTION_PREROLL, /* decode the frame to fill the bit reservoir and synthesis history, but discard the output */
+	GST_MPG123_FRAME_ACTION_RESYNC,  /* like PREROLL, but start over with a fresh decoder state first */
+	GST_MPG123_FRAME_ACTION_SKIP,    /* only parse the frame */
+	GST_MPG123_FRAME_ACTION_EOS      /* the frame is past the end of the segment; drop it and stop */
+}
+GstMpg123FrameAction;
+
+
+/* Results the async decoding thread hands over to the streaming thread */
+typedef enum
+{
+	GST_MPG123_ASYNC_OUTPUT_FINISH_FRAME, /* item is the output buffer (or NULL) for gst_audio_decoder_finish_frame() */
+	GST_MPG123_ASYNC_OUTPUT_FORMAT,       /* item is a GstAudioInfo to pass to gst_audio_decoder_set_output_format() */
+	GST_MPG123_ASYNC_OUTPUT_TAGS,         /* item is a GstTagList to pass to gst_audio_decoder_merge_tags() */
+	GST_MPG123_ASYNC_OUTPUT_FLOW          /* item is a GstFlowReturn (stored with GINT_TO_POINTER) */
+}
+GstMpg123AsyncOutputType;
+
+
+/* Worst case number of output queue entries per input frame: format, tags, finished frame, flow return */
+#define GST_MPG123_MAX_OUTPUTS_PER_INPUT 4
+
+
+static void gst_mpg123_set_property(GObject *object, guint prop_id, GValue const *value, GParamSpec *pspec);
+static void gst_mpg123_get_property(GObject *object, guint prop_id, GValue *value, GParamSpec *pspec);
+static void gst_mpg123_finalize(GObject *object);
+static guint64 gst_mpg123_get_memory_usage(GstMpg123 *mpg123_decoder);
+static void gst_mpg123_update_buffered_input_size(GstMpg123 *mpg123_decoder);
 static gboolean gst_mpg123_start(GstAudioDecoder *dec);
 static gboolean gst_mpg123_stop(GstAudioDecoder *dec);
-static GstFlowReturn gst_mpg123_push_decoded_bytes(GstMpg123 *mpg123_decoder, unsigned char const *decoded_bytes, size_t const num_decoded_bytes);
+static GstFlowReturn gst_mpg123_finish_frame(GstMpg123 *mpg123_decoder, GstBuffer *output_buffer);
+static GstFlowReturn gst_mpg123_push_decoded_bytes(GstMpg123 *mpg123_decoder, unsigned char *decoded_bytes, size_t const num_decoded_bytes);
+static void gst_mpg123_set_output_pool(GstMpg123 *mpg123_decoder, GstBufferPool *pool);
+static void gst_mpg123_clear_state_history(GstMpg123 *mpg123_decoder);
+static void gst_mpg123_update_state_history(GstMpg123 *mpg123_decoder, GstBuffer *input_buffer);
+static void gst_mpg123_replay_restored_frames(GstMpg123 *mpg123_decoder);
+static GstStructure* gst_mpg123_save_state(GstMpg123 *mpg123_decoder);
+static gboolean gst_mpg123_restore_state(GstMpg123 *mpg123_decoder, GstStructure *state);
+static GstFlowReturn gst_mpg123_apply_next_audioinfo(GstMpg123 *mpg123_decoder);
+static void gst_mpg123_post_stream_info(GstMpg123 *mpg123_decoder);
+static GstFlowReturn gst_mpg123_skip_frame(GstMpg123 *mpg123_decoder, GstBuffer *input_buffer);
+static gsize gst_mpg123_get_silent_frame_size(GstMpg123 *mpg123_decoder, GstBuffer *input_buffer);
+static GstMemory* gst_mpg123_get_silence_memory(void);
+static GstFlowReturn gst_mpg123_push_gap_frame(GstMpg123 *mpg123_decoder, GstBuffer *input_buffer, gsize num_frames);
+static GstMpg123FrameAction gst_mpg123_get_frame_action(GstMpg123 *mpg123_decoder, GstBuffer *input_buffer);
+static gboolean gst_mpg123_reopen_feed(GstMpg123 *mpg123_decoder);
+static void gst_mpg123_replay_frames(GstMpg123 *mpg123_decoder, GPtrArray *frames, gboolean decode_last_frame);
+static void gst_mpg123_add_catch_up_frame(GPtrArray *frames, GstBuffer *input_buffer);
+static gboolean gst_mpg123_pcm_cache_catch_up(GstMpg123 *mpg123_decoder);
+static void gst_mpg123_pcm_cache_add_skipped_frame(GstMpg123 *mpg123_decoder, GstBuffer *input_buffer);
+static gboolean gst_mpg123_pcm_cache_lookup_input(GstMpg123 *mpg123_decoder, GstBuffer *input_buffer, gboolean discard_output, GstFlowReturn *retval);
+static int gst_mpg123_configure_output(GstMpg123 *mpg123_decoder);
+static gboolean gst_mpg123_set_quality_level(GstMpg123 *mpg123_decoder, guint quality_level);
+static gboolean gst_mpg123_update_decode_load(GstMpg123 *mpg123_decoder, gint64 elapsed, size_t num_decoded_bytes);
+static GstFlowReturn gst_mpg123_decode_input(GstMpg123 *mpg123_decoder, GstBuffer *input_buffer, GstMpg123FrameAction action);
 static GstFlowReturn gst_mpg123_handle_frame(GstAudioDecoder *dec, GstBuffer *input_buffer);
+static void gst_mpg123_async_start(GstMpg123 *mpg123_decoder);
+static void gst_mpg123_async_stop(GstMpg123 *mpg123_decoder);
+static void gst_mpg123_async_wait_for_worker(GstMpg123 *mpg123_decoder, gint progress);
+static void gst_mpg123_async_wait_for_streaming(GstMpg123 *mpg123_decoder, gint progress);
+static void gst_mpg123_async_push_output(GstMpg123 *mpg123_decoder, gpointer item, GstMpg123AsyncOutputType type);
+static GstFlowReturn gst_mpg123_async_publish_output(GstMpg123 *mpg123_decoder, gboolean discard);
+static GstFlowReturn gst_mpg123_async_push_input(GstMpg123 *mpg123_decoder, GstBuffer *input_buffer, GstMpg123FrameAction action);
+static GstFlowReturn gst_mpg123_async_wait_until_idle(GstMpg123 *mpg123_decoder, gboolean discard);
+static gboolean gst_mpg123_async_decode_next_input(GstMpg123 *mpg123_decoder);
+static gpointer gst_mpg123_async_thread_func(gpointer user_data);
+static GThreadPool* gst_mpg123_get_thread_pool(void);
+static void gst_mpg123_thread_pool_schedule(GstMpg123 *mpg123_decoder);
+static void gst_mpg123_thread_pool_func(gpointer data, gpointer user_data);
+static GstStructure* gst_mpg123_get_thread_pool_stats(GstMpg123 *mpg123_decoder);
 static gboolean gst_mpg123_set_format(GstAudioDecoder *dec, GstCaps *input_caps);
+static GstCaps* gst_mpg123_sink_getcaps(GstAudioDecoder *dec, GstCaps *filter);
 static void gst_mpg123_flush(GstAudioDecoder *dec, gboolean hard);
+static gboolean gst_mpg123_sink_event(GstAudioDecoder *dec, GstEvent *event);
+static void gst_mpg123_begin_stream(GstMpg123 *mpg123_decoder);
+static gboolean gst_mpg123_query_duration(GstMpg123 *mpg123_decoder, gint64 *duration);
+static gboolean gst_mpg123_src_query(GstAudioDecoder *dec, GstQuery *query);
+static gboolean gst_mpg123_src_event(GstAudioDecoder *dec, GstEvent *event);
+static gboolean gst_mpg123_decide_allocation(GstAudioDecoder *dec, GstQuery *query);
 
 
 G_DEFINE_TYPE(GstMpg123, gst_mpg123, GST_TYPE_AUDIO_DECODER)
@@ -74,16 +270,281 @@ G_DEFINE_TYPE(GstMpg123, gst_mpg123, GST_TYPE_AUDIO_DECODER)
 
 void gst_mpg123_class_init(GstMpg123Class *klass)
 {
+	GObjectClass *object_class;
 	GstAudioDecoderClass *base_class;
 	GstElementClass *element_class;
 	GstPadTemplate *src_template, *sink_template;
-	int error;
-
-	GST_DEBUG_CATEGORY_INIT(mpg123_debug, "mpg123", 0, "mpg123 mp3 decoder");
 
+	object_class = G_OBJECT_CLASS(klass);
 	base_class = GST_AUDIO_DECODER_CLASS(klass);
 	element_class = GST_ELEMENT_CLASS(klass);
 
+	object_class->set_property = GST_DEBUG_FUNCPTR(gst_mpg123_set_property);
+	object_class->get_property = GST_DEBUG_FUNCPTR(gst_mpg123_get_property);
+	object_class->finalize     = GST_DEBUG_FUNCPTR(gst_mpg123_finalize);
+
+	g_object_class_install_property(
+		object_class,
+		PROP_FAST_SCAN,
+		g_param_spec_boolean(
+			"fast-scan",
+			"Fast scan",
+			"Decode only the first frame after start or flush, and just parse the headers of all following frames; "
+			"meant for metadata discovery, where only duration, bitrate and format are of interest",
+			DEFAULT_FAST_SCAN,
+			G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS
+		)
+	);
+	g_object_class_install_property(
+		object_class,
+		PROP_ASYNC_DECODE,
+		g_param_spec_boolean(
+			"async-decode",
+			"Asynchronous decoding",
+			"Decode in a separate thread, so that upstream I/O and decoding can run in parallel; "
+			"output is pushed from the streaming thread, which adds up to async-queue-depth frames of latency "
+			"(only takes effect when the element starts)",
+			DEFAULT_ASYNC_DECODE,
+			G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS
+		)
+	);
+	g_object_class_install_property(
+		object_class,
+		PROP_ASYNC_QUEUE_DEPTH,
+		g_param_spec_uint(
+			"async-queue-depth",
+			"Asynchronous decoding queue depth",
+			"Maximum number of input frames queued for the decoding thread (rounded up to a power of two; "
+			"only takes effect when the element starts)",
+			1, 1024,
+			DEFAULT_ASYNC_QUEUE_DEPTH,
+			G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS
+		)
+	);
+	g_object_class_install_property(
+		object_class,
+		PROP_SHARED_THREAD_POOL,
+		g_param_spec_boolean(
+			"shared-thread-pool",
+			"Shared thread pool",
+			"In async-decode mode, decode in a thread pool shared by all mpg123 decoders in the process "
+			"(sized to the number of CPU cores) instead of a dedicated thread per decoder "
+			"(only takes effect when the element starts)",
+			DEFAULT_SHARED_THREAD_POOL,
+			G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS
+		)
+	);
+	g_object_class_install_property(
+		object_class,
+		PROP_THREAD_POOL_STATS,
+		g_param_spec_boxed(
+			"thread-pool-stats",
+			"Thread pool statistics",
+			"Statistics of the shared decoding thread pool and of this decoder's input queue",
+			GST_TYPE_STRUCTURE,
+			G_PARAM_READABLE | G_PARAM_STATIC_STRINGS
+		)
+	);
+	g_object_class_install_property(
+		object_class,
+		PROP_FEED_POOL_SIZE,
+		g_param_spec_int(
+			"feed-pool-size",
+			"Feed pool size",
+			"Number of input buffers mpg123 keeps around for reuse; lower values save memory at the expense of "
+			"more allocations (-1 = mpg123 default; only takes effect when the element starts)",
+			-1, G_MAXINT,
+			DEFAULT_FEED_POOL_SIZE,
+			G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS
+		)
+	);
+	g_object_class_install_property(
+		object_class,
+		PROP_FEED_BUFFER_SIZE,
+		g_param_spec_int(
+			"feed-buffer-size",
+			"Feed buffer size",
+			"Minimum size of the input buffers mpg123 allocates, in bytes "
+			"(-1 = mpg123 default; only takes effect when the element starts)",
+			-1, G_MAXINT,
+			DEFAULT_FEED_BUFFER_SIZE,
+			G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS
+		)
+	);
+	g_object_class_install_property(
+		object_class,
+		PROP_SEEK_BUFFER,
+		g_param_spec_boolean(
+			"seek-buffer",
+			"Seek buffer",
+			"Let mpg123 keep a small read-ahead buffer for better resynchronization; "
+			"disabling it saves memory, but makes decoding of damaged streams less robust "
+			"(only takes effect when the element starts)",
+			DEFAULT_SEEK_BUFFER,
+			G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS
+		)
+	);
+	g_object_class_install_property(
+		object_class,
+		PROP_DOWN_SAMPLE,
+		g_param_spec_uint(
+			"down-sample",
+			"Down-sample",
+			"Output at a reduced rate, decoding only the lower part of the spectrum, which saves a large part "
+			"of the synthesis work; meant for analysis that does not need the full bandwidth "
+			"(0 = full rate, 1 = half rate, 2 = quarter rate; lowered where the reduced rate is not supported; "
+			"only takes effect when the element starts)",
+			0, 2,
+			DEFAULT_DOWN_SAMPLE,
+			G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS
+		)
+	);
+	g_object_class_install_property(
+		object_class,
+		PROP_STATE_HISTORY_SIZE,
+		g_param_spec_uint(
+			"state-history-size",
+			"State history size",
+			"Number of most recent input frames to keep for the save-state action signal "
+			"(0 = disabled; 3 or more is recommended, since layer III frames can refer to data in earlier frames; "
+			"only takes effect when the element starts)",
+			0, 32,
+			DEFAULT_STATE_HISTORY_SIZE,
+			G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS
+		)
+	);
+	g_object_class_install_property(
+		object_class,
+		PROP_SHM_OUTPUT,
+		g_param_spec_boolean(
+			"shm-output",
+			"Shared memory output",
+			"Allocate output buffers in shared memory (memfd) if downstream does not propose a file descriptor "
+			"based allocator itself, so elements like unixfdsink can pass them to other processes without copying "
+			"(requires the plugin to be built against GStreamer 1.24 or newer; takes effect with the next allocation query)",
+			DEFAULT_SHM_OUTPUT,
+			G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS
+		)
+	);
+	g_object_class_install_property(
+		object_class,
+		PROP_CPU_BUDGET,
+		g_param_spec_uint(
+			"cpu-budget",
+			"CPU budget",
+			"Maximum time decoding may take, in percent of the playback duration of the decoded audio; if decoding "
+			"takes longer, or downstream reports that buffers arrive late, the output quality is lowered step by step "
+			"(first half rate, then half rate and mono), and raised again once there is enough headroom; "
+			"an element message named mpg123-quality is posted on each change (0 = disabled)",
+			0, 100,
+			DEFAULT_CPU_BUDGET,
+			G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS
+		)
+	);
+	g_object_class_install_property(
+		object_class,
+		PROP_FORCE_RATE,
+		g_param_spec_boolean(
+			"force-rate",
+			"Force rate",
+			"If downstream does not accept the rate of the bitstream, resample to the closest rate it accepts with "
+			"mpg123's NtoM synthesis, which is cheaper than a separate audioresample element, but of lower quality; "
+			"down-sampling (also by cpu-budget) does not apply while resampling (takes effect with the next caps)",
+			DEFAULT_FORCE_RATE,
+			G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS
+		)
+	);
+	g_object_class_install_property(
+		object_class,
+		PROP_PCM_CACHE_SIZE,
+		g_param_spec_uint64(
+			"pcm-cache-size",
+			"PCM cache size",
+			"Size limit in bytes for the process-wide cache of decoded audio, for content that is decoded over and over "
+			"again; decoders with the same input and output format then reuse the decoded buffers instead of decoding "
+			"(0 = this decoder does not use the cache; the cache is shared by all decoders, and its limit is the largest "
+			"one requested by any of them; only takes effect when the element starts)",
+			0, G_MAXUINT64,
+			DEFAULT_PCM_CACHE_SIZE,
+			G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS
+		)
+	);
+	g_object_class_install_property(
+		object_class,
+		PROP_PCM_CACHE_STATS,
+		g_param_spec_boxed(
+			"pcm-cache-stats",
+			"PCM cache statistics",
+			"Hit and miss counters and the fill level of the process-wide decoded audio cache",
+			GST_TYPE_STRUCTURE,
+			G_PARAM_READABLE | G_PARAM_STATIC_STRINGS
+		)
+	);
+	g_object_class_install_property(
+		object_class,
+		PROP_DECODER,
+		g_param_spec_string(
+			"decoder",
+			"Decoder",
+			"mpg123 decoder core (synthesis implementation) to use, one of supported-decoders; this allows comparing "
+			"the accuracy and speed of the cores, for example against conformance streams "
+			"(NULL = let mpg123 pick the fastest one for the CPU; only takes effect when the element starts)",
+			DEFAULT_DECODER,
+			G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS
+		)
+	);
+	g_object_class_install_property(
+		object_class,
+		PROP_SUPPORTED_DECODERS,
+		g_param_spec_boxed(
+			"supported-decoders",
+			"Supported decoders",
+			"Names of the mpg123 decoder cores the decoder property accepts on this CPU",
+			G_TYPE_STRV,
+			G_PARAM_READABLE | G_PARAM_STATIC_STRINGS
+		)
+	);
+	g_object_class_install_property(
+		object_class,
+		PROP_SILENCE_GAPS,
+		g_param_spec_boolean(
+			"silence-gaps",
+			"Silence gaps",
+			"Detect layer III frames of digital silence from their side info, and output them as GAP buffers "
+			"with shared zeroed memory instead of decoding them; downstream elements can then skip them as well. "
+			"Not done with unsigned sample formats or with force-rate resampling "
+			"(only takes effect when the element starts)",
+			DEFAULT_SILENCE_GAPS,
+			G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS
+		)
+	);
+	g_object_class_install_property(
+		object_class,
+		PROP_GAP_FRAMES,
+		g_param_spec_uint64(
+			"gap-frames",
+			"GAP frames",
+			"Number of frames output as GAP buffers without decoding them since the element was started (see silence-gaps)",
+			0, G_MAXUINT64,
+			0,
+			G_PARAM_READABLE | G_PARAM_STATIC_STRINGS
+		)
+	);
+	g_object_class_install_property(
+		object_class,
+		PROP_MEMORY_USAGE,
+		g_param_spec_uint64(
+			"memory-usage",
+			"Memory usage",
+			"Approximate number of bytes held by this decoder: the element itself, the mpg123 feed pool, "
+			"output block and buffered input, and input queued for asynchronous decoding; "
+			"mpg123's internal decoder tables are not included",
+			0, G_MAXUINT64,
+			0,
+			G_PARAM_READABLE | G_PARAM_STATIC_STRINGS
+		)
+	);
+
 	gst_element_class_set_static_metadata(
 		element_class,
 		"mpg123 mp3 decoder",
@@ -153,7 +614,12 @@ void gst_mpg123_class_init(GstMpg123Class *klass)
 		g_string_append(s, "}, ");
 
 		g_string_append(s, "channels = (int) [ 1, 2 ], ");
+#if GST_CHECK_VERSION(1, 16, 0)
+		/* Planar output requires GstAudioMeta support in the GstAudioDecoder base class */
+		g_string_append(s, "layout = (string) { interleaved, non-interleaved }");
+#else
 		g_string_append(s, "layout = (string) interleaved");
+#endif
 
 		src_template_caps = gst_caps_from_string(s->str);
 		src_template = gst_pad_template_new("src", GST_PAD_SRC, GST_PAD_ALWAYS, src_template_caps);
@@ -169,19 +635,331 @@ void gst_mpg123_class_init(GstMpg123Class *klass)
 	base_class->stop         = GST_DEBUG_FUNCPTR(gst_mpg123_stop);
 	base_class->handle_frame = GST_DEBUG_FUNCPTR(gst_mpg123_handle_frame);
 	base_class->set_format   = GST_DEBUG_FUNCPTR(gst_mpg123_set_format);
+	base_class->getcaps      = GST_DEBUG_FUNCPTR(gst_mpg123_sink_getcaps);
 	base_class->flush        = GST_DEBUG_FUNCPTR(gst_mpg123_flush);
+	base_class->sink_event   = GST_DEBUG_FUNCPTR(gst_mpg123_sink_event);
+	base_class->src_query    = GST_DEBUG_FUNCPTR(gst_mpg123_src_query);
+	base_class->src_event    = GST_DEBUG_FUNCPTR(gst_mpg123_src_event);
+	base_class->decide_allocation = GST_DEBUG_FUNCPTR(gst_mpg123_decide_allocation);
+
+	klass->save_state    = GST_DEBUG_FUNCPTR(gst_mpg123_save_state);
+	klass->restore_state = GST_DEBUG_FUNCPTR(gst_mpg123_restore_state);
+
+	/**
+	 * GstMpg123::save-state:
+	 *
+	 * Returns the most recent input frames whose output is done (see the state-history-size property) and
+	 * the position after the last one as a GstStructure, or NULL if there is no history. The frame mpg123
+	 * holds back and frames still queued for asynchronous decoding are not part of it; the position tells
+	 * where the output ends. Passing this structure to the restore-state signal of another decoder lets it
+	 * continue decoding the same stream from that position without the glitch caused by a missing bit
+	 * reservoir and synthesis history.
+	 */
+	gst_mpg123_signals[SIGNAL_SAVE_STATE] = g_signal_new(
+		"save-state",
+		G_TYPE_FROM_CLASS(klass),
+		G_SIGNAL_RUN_LAST | G_SIGNAL_ACTION,
+		G_STRUCT_OFFSET(GstMpg123Class, save_state),
+		NULL, NULL, NULL,
+		GST_TYPE_STRUCTURE, 0
+	);
 
-	error = mpg123_init();
-	if (G_UNLIKELY(error != MPG123_OK))
-		GST_ERROR("Could not initialize mpg123 library: %s", mpg123_plain_strerror(error));
-	else
-		GST_INFO("mpg123 library initialized");
+	/**
+	 * GstMpg123::restore-state:
+	 * @state: a structure obtained from save-state
+	 *
+	 * Replays the frames in @state (decoding them, but discarding the output) before the next input frame
+	 * is decoded. Returns FALSE if @state is invalid.
+	 */
+	gst_mpg123_signals[SIGNAL_RESTORE_STATE] = g_signal_new(
+		"restore-state",
+		G_TYPE_FROM_CLASS(klass),
+		G_SIGNAL_RUN_LAST | G_SIGNAL_ACTION,
+		G_STRUCT_OFFSET(GstMpg123Class, restore_state),
+		NULL, NULL, NULL,
+		G_TYPE_BOOLEAN, 1, GST_TYPE_STRUCTURE
+	);
 }
 
 
 void gst_mpg123_init(GstMpg123 *mpg123_decoder)
 {
+	mpg123_decoder->core = NULL;
 	mpg123_decoder->handle = NULL;
+	mpg123_decoder->fast_scan = DEFAULT_FAST_SCAN;
+	mpg123_decoder->async_decode = DEFAULT_ASYNC_DECODE;
+	mpg123_decoder->async_queue_depth = DEFAULT_ASYNC_QUEUE_DEPTH;
+	mpg123_decoder->async_input_queue = NULL;
+	mpg123_decoder->async_output_queue = NULL;
+	mpg123_decoder->async_thread = NULL;
+	mpg123_decoder->shared_thread_pool = DEFAULT_SHARED_THREAD_POOL;
+	mpg123_decoder->feed_pool_size = DEFAULT_FEED_POOL_SIZE;
+	mpg123_decoder->feed_buffer_size = DEFAULT_FEED_BUFFER_SIZE;
+	mpg123_decoder->seek_buffer = DEFAULT_SEEK_BUFFER;
+	mpg123_decoder->down_sample = DEFAULT_DOWN_SAMPLE;
+	mpg123_decoder->shm_output = DEFAULT_SHM_OUTPUT;
+	mpg123_decoder->cpu_budget = DEFAULT_CPU_BUDGET;
+	mpg123_decoder->force_rate = DEFAULT_FORCE_RATE;
+	mpg123_decoder->pcm_cache_size = DEFAULT_PCM_CACHE_SIZE;
+	mpg123_decoder->decoder = g_strdup(DEFAULT_DECODER);
+	mpg123_decoder->silence_gaps = DEFAULT_SILENCE_GAPS;
+	mpg123_decoder->num_gap_frames = 0;
+	mpg123_decoder->use_pcm_cache = FALSE;
+	mpg123_decoder->pcm_cache_skipped_frames = NULL;
+	mpg123_decoder->quality_level = 0;
+	mpg123_decoder->quality_replay_frames = NULL;
+	mpg123_decoder->fixed_memory_usage = 0;
+	mpg123_decoder->buffered_input_size = 0;
+	mpg123_decoder->async_queued_input_size = 0;
+	mpg123_decoder->output_pool = NULL;
+	mpg123_decoder->state_history_size = DEFAULT_STATE_HISTORY_SIZE;
+	mpg123_decoder->state_history = NULL;
+	mpg123_decoder->state_history_pos = 0;
+	mpg123_decoder->state_history_fill = 0;
+	mpg123_decoder->state_position = GST_CLOCK_TIME_NONE;
+	mpg123_decoder->state_pending_frame = NULL;
+	mpg123_decoder->restore_frames = NULL;
+	g_mutex_init(&(mpg123_decoder->async_mutex));
+	g_cond_init(&(mpg123_decoder->async_cond));
+}
+
+
+static void gst_mpg123_finalize(GObject *object)
+{
+	GstMpg123 *mpg123_decoder = GST_MPG123(object);
+
+	g_mutex_clear(&(mpg123_decoder->async_mutex));
+	g_cond_clear(&(mpg123_decoder->async_cond));
+
+	if (mpg123_decoder->restore_frames != NULL)
+		g_ptr_array_unref(mpg123_decoder->restore_frames);
+
+	g_free(mpg123_decoder->decoder);
+
+	G_OBJECT_CLASS(gst_mpg123_parent_class)->finalize(object);
+}
+
+
+static void gst_mpg123_set_property(GObject *object, guint prop_id, GValue const *value, GParamSpec *pspec)
+{
+	GstMpg123 *mpg123_decoder = GST_MPG123(object);
+
+	switch (prop_id)
+	{
+		case PROP_FAST_SCAN:
+			GST_OBJECT_LOCK(object);
+			mpg123_decoder->fast_scan = g_value_get_boolean(value);
+			GST_OBJECT_UNLOCK(object);
+			break;
+		case PROP_ASYNC_DECODE:
+			GST_OBJECT_LOCK(object);
+			mpg123_decoder->async_decode = g_value_get_boolean(value);
+			GST_OBJECT_UNLOCK(object);
+			break;
+		case PROP_ASYNC_QUEUE_DEPTH:
+			GST_OBJECT_LOCK(object);
+			mpg123_decoder->async_queue_depth = g_value_get_uint(value);
+			GST_OBJECT_UNLOCK(object);
+			break;
+		case PROP_SHARED_THREAD_POOL:
+			GST_OBJECT_LOCK(object);
+			mpg123_decoder->shared_thread_pool = g_value_get_boolean(value);
+			GST_OBJECT_UNLOCK(object);
+			break;
+		case PROP_FEED_POOL_SIZE:
+			GST_OBJECT_LOCK(object);
+			mpg123_decoder->feed_pool_size = g_value_get_int(value);
+			GST_OBJECT_UNLOCK(object);
+			break;
+		case PROP_FEED_BUFFER_SIZE:
+			GST_OBJECT_LOCK(object);
+			mpg123_decoder->feed_buffer_size = g_value_get_int(value);
+			GST_OBJECT_UNLOCK(object);
+			break;
+		case PROP_SEEK_BUFFER:
+			GST_OBJECT_LOCK(object);
+			mpg123_decoder->seek_buffer = g_value_get_boolean(value);
+			GST_OBJECT_UNLOCK(object);
+			break;
+		case PROP_DOWN_SAMPLE:
+			GST_OBJECT_LOCK(object);
+			mpg123_decoder->down_sample = g_value_get_uint(value);
+			GST_OBJECT_UNLOCK(object);
+			break;
+		case PROP_STATE_HISTORY_SIZE:
+			GST_OBJECT_LOCK(object);
+			mpg123_decoder->state_history_size = g_value_get_uint(value);
+			GST_OBJECT_UNLOCK(object);
+			break;
+		case PROP_SHM_OUTPUT:
+			GST_OBJECT_LOCK(object);
+			mpg123_decoder->shm_output = g_value_get_boolean(value);
+			GST_OBJECT_UNLOCK(object);
+			break;
+		case PROP_CPU_BUDGET:
+			g_atomic_int_set(&(mpg123_decoder->cpu_budget), (gint)g_value_get_uint(value));
+			break;
+		case PROP_FORCE_RATE:
+			GST_OBJECT_LOCK(object);
+			mpg123_decoder->force_rate = g_value_get_boolean(value);
+			GST_OBJECT_UNLOCK(object);
+			break;
+		case PROP_PCM_CACHE_SIZE:
+			GST_OBJECT_LOCK(object);
+			mpg123_decoder->pcm_cache_size = g_value_get_uint64(value);
+			GST_OBJECT_UNLOCK(object);
+			break;
+		case PROP_DECODER:
+			GST_OBJECT_LOCK(object);
+			g_free(mpg123_decoder->decoder);
+			mpg123_decoder->decoder = g_value_dup_string(value);
+			GST_OBJECT_UNLOCK(object);
+			break;
+		case PROP_SILENCE_GAPS:
+			GST_OBJECT_LOCK(object);
+			mpg123_decoder->silence_gaps = g_value_get_boolean(value);
+			GST_OBJECT_UNLOCK(object);
+			break;
+		default:
+			G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+			break;
+	}
+}
+
+
+static void gst_mpg123_get_property(GObject *object, guint prop_id, GValue *value, GParamSpec *pspec)
+{
+	GstMpg123 *mpg123_decoder = GST_MPG123(object);
+
+	switch (prop_id)
+	{
+		case PROP_FAST_SCAN:
+			GST_OBJECT_LOCK(object);
+			g_value_set_boolean(value, mpg123_decoder->fast_scan);
+			GST_OBJECT_UNLOCK(object);
+			break;
+		case PROP_ASYNC_DECODE:
+			GST_OBJECT_LOCK(object);
+			g_value_set_boolean(value, mpg123_decoder->async_decode);
+			GST_OBJECT_UNLOCK(object);
+			break;
+		case PROP_ASYNC_QUEUE_DEPTH:
+			GST_OBJECT_LOCK(object);
+			g_value_set_uint(value, mpg123_decoder->async_queue_depth);
+			GST_OBJECT_UNLOCK(object);
+			break;
+		case PROP_SHARED_THREAD_POOL:
+			GST_OBJECT_LOCK(object);
+			g_value_set_boolean(value, mpg123_decoder->shared_thread_pool);
+			GST_OBJECT_UNLOCK(object);
+			break;
+		case PROP_THREAD_POOL_STATS:
+			g_value_take_boxed(value, gst_mpg123_get_thread_pool_stats(mpg123_decoder));
+			break;
+		case PROP_FEED_POOL_SIZE:
+			GST_OBJECT_LOCK(object);
+			g_value_set_int(value, mpg123_decoder->feed_pool_size);
+			GST_OBJECT_UNLOCK(object);
+			break;
+		case PROP_FEED_BUFFER_SIZE:
+			GST_OBJECT_LOCK(object);
+			g_value_set_int(value, mpg123_decoder->feed_buffer_size);
+			GST_OBJECT_UNLOCK(object);
+			break;
+		case PROP_SEEK_BUFFER:
+			GST_OBJECT_LOCK(object);
+			g_value_set_boolean(value, mpg123_decoder->seek_buffer);
+			GST_OBJECT_UNLOCK(object);
+			break;
+		case PROP_DOWN_SAMPLE:
+			GST_OBJECT_LOCK(object);
+			g_value_set_uint(value, mpg123_decoder->down_sample);
+			GST_OBJECT_UNLOCK(object);
+			break;
+		case PROP_STATE_HISTORY_SIZE:
+			GST_OBJECT_LOCK(object);
+			g_value_set_uint(value, mpg123_decoder->state_history_size);
+			GST_OBJECT_UNLOCK(object);
+			break;
+		case PROP_SHM_OUTPUT:
+			GST_OBJECT_LOCK(object);
+			g_value_set_boolean(value, mpg123_decoder->shm_output);
+			GST_OBJECT_UNLOCK(object);
+			break;
+		case PROP_CPU_BUDGET:
+			g_value_set_uint(value, (guint)g_atomic_int_get(&(mpg123_decoder->cpu_budget)));
+			break;
+		case PROP_FORCE_RATE:
+			GST_OBJECT_LOCK(object);
+			g_value_set_boolean(value, mpg123_decoder->force_rate);
+			GST_OBJECT_UNLOCK(object);
+			break;
+		case PROP_PCM_CACHE_SIZE:
+			GST_OBJECT_LOCK(object);
+			g_value_set_uint64(value, mpg123_decoder->pcm_cache_size);
+			GST_OBJECT_UNLOCK(object);
+			break;
+		case PROP_PCM_CACHE_STATS:
+			g_value_take_boxed(value, gst_mpg123_pcm_cache_get_stats());
+			break;
+		case PROP_DECODER:
+			GST_OBJECT_LOCK(object);
+			g_value_set_string(value, mpg123_decoder->decoder);
+			GST_OBJECT_UNLOCK(object);
+			break;
+		case PROP_SUPPORTED_DECODERS:
+			/* mpg123's list is NULL terminated, just like a GStrv */
+			g_value_set_boxed(value, mpg123_supported_decoders());
+			break;
+		case PROP_SILENCE_GAPS:
+			GST_OBJECT_LOCK(object);
+			g_value_set_boolean(value, mpg123_decoder->silence_gaps);
+			GST_OBJECT_UNLOCK(object);
+			break;
+		case PROP_GAP_FRAMES:
+			GST_OBJECT_LOCK(object);
+			g_value_set_uint64(value, mpg123_decoder->num_gap_frames);
+			GST_OBJECT_UNLOCK(object);
+			break;
+		case PROP_MEMORY_USAGE:
+			g_value_set_uint64(value, gst_mpg123_get_memory_usage(mpg123_decoder));
+			break;
+		default:
+			G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+			break;
+	}
+}
+
+
+static guint64 gst_mpg123_get_memory_usage(GstMpg123 *mpg123_decoder)
+{
+	guint64 usage;
+
+	/*
+	The fixed part is determined in start(), the rest is updated by the decoding code, so this never
+	needs to access the mpg123 handle, which may be in use in another thread
+	*/
+	GST_OBJECT_LOCK(mpg123_decoder);
+	usage = sizeof(GstMpg123) + mpg123_decoder->fixed_memory_usage;
+	GST_OBJECT_UNLOCK(mpg123_decoder);
+
+	usage += (guint64)g_atomic_int_get(&(mpg123_decoder->buffered_input_size));
+	usage += (guint64)g_atomic_int_get(&(mpg123_decoder->async_queued_input_size));
+
+	return usage;
+}
+
+
+static void gst_mpg123_update_buffered_input_size(GstMpg123 *mpg123_decoder)
+{
+#ifdef HAVE_MPG123_BUFFERFILL
+	long buffer_fill;
+
+	if (mpg123_getstate(mpg123_decoder->handle, MPG123_BUFFERFILL, &buffer_fill, NULL) == MPG123_OK)
+		g_atomic_int_set(&(mpg123_decoder->buffered_input_size), (gint)MIN(buffer_fill, G_MAXINT));
+#else
+	(void)mpg123_decoder;
+#endif
 }
 
 
@@ -189,41 +967,108 @@ static gboolean gst_mpg123_start(GstAudioDecoder *dec)
 {
 	GstMpg123 *mpg123_decoder;
 	int error;
+	GstMpg123CoreConfig config;
+	guint64 pcm_cache_size;
+	gchar *decoder_name;
 
 	mpg123_decoder = GST_MPG123(dec);
 	error = 0;
 
-	mpg123_decoder->handle = mpg123_new(NULL, &error);
+	gst_mpg123_core_config_init(&config);
+	GST_OBJECT_LOCK(mpg123_decoder);
+	config.feed_pool_size = mpg123_decoder->feed_pool_size;
+	config.feed_buffer_size = mpg123_decoder->feed_buffer_size;
+	config.seek_buffer = mpg123_decoder->seek_buffer;
+	config.down_sample = mpg123_decoder->down_sample;
+	/* The sink caps require parsed input, so each input buffer is exactly one frame */
+	config.frame_by_frame = TRUE;
+	if (mpg123_decoder->state_history_size > 0)
+		mpg123_decoder->state_history = g_new0(GstBuffer *, mpg123_decoder->state_history_size);
+	mpg123_decoder->state_history_pos = 0;
+	mpg123_decoder->state_history_fill = 0;
+	mpg123_decoder->state_position = GST_CLOCK_TIME_NONE;
+	pcm_cache_size = mpg123_decoder->pcm_cache_size;
+	mpg123_decoder->use_silence_gaps = mpg123_decoder->silence_gaps;
+	mpg123_decoder->num_gap_frames = 0;
+	/* Copied, since the property may be set again as soon as the object lock is released */
+	decoder_name = g_strdup(mpg123_decoder->decoder);
+	config.decoder = decoder_name;
+	GST_OBJECT_UNLOCK(mpg123_decoder);
+
+	/* The core sets up the handle and opens it in feed mode (= encoded data is fed manually into the handle) */
+	mpg123_decoder->core = gst_mpg123_core_new(&config, &error);
+	if (G_UNLIKELY(mpg123_decoder->core == NULL))
+	{
+		if (decoder_name != NULL)
+			GST_ELEMENT_ERROR(dec, LIBRARY, INIT, (NULL), ("could not use decoder \"%s\": %s", decoder_name, mpg123_plain_strerror(error)));
+		else
+			GST_ELEMENT_ERROR(dec, LIBRARY, INIT, (NULL), ("%s", mpg123_plain_strerror(error)));
+		g_free(decoder_name);
+		mpg123_decoder->handle = NULL;
+		return FALSE;
+	}
+	g_free(decoder_name);
+
+	mpg123_decoder->handle = gst_mpg123_core_get_handle(mpg123_decoder->core);
+	GST_INFO_OBJECT(dec, "using mpg123 decoder \"%s\"", mpg123_current_decoder(mpg123_decoder->handle));
 	mpg123_decoder->has_next_audioinfo = FALSE;
-	mpg123_decoder->frame_offset = 0;
+	gst_audio_info_init(&(mpg123_decoder->output_audioinfo));
+	mpg123_decoder->scanning = FALSE;
+	mpg123_decoder->stream_info_posted = FALSE;
+	mpg123_decoder->num_scanned_samples = 0;
+	mpg123_decoder->num_scanned_input_samples = 0;
+	mpg123_decoder->scan_complete = FALSE;
+	mpg123_decoder->stream_length = 0;
+	mpg123_decoder->stream_rate = 0;
+	mpg123_decoder->trick_frame_counter = 0;
+	mpg123_decoder->quality_level = 0;
+	mpg123_decoder->decode_load = 0.0;
+	mpg123_decoder->frames_since_quality_change = 0;
+	g_atomic_int_set(&(mpg123_decoder->qos_late), 0);
+	mpg123_decoder->input_rate = 0;
+	mpg123_decoder->input_channels = 0;
+	mpg123_decoder->forced_rate = 0;
+	mpg123_decoder->conversion = GST_MPG123_CONVERSION_NONE;
+	mpg123_decoder->next_conversion = GST_MPG123_CONVERSION_NONE;
+	mpg123_decoder->use_pcm_cache = (pcm_cache_size > 0);
+	mpg123_decoder->num_silent_frames = 0;
+	mpg123_decoder->pcm_cache_hash_valid = TRUE;
+	mpg123_decoder->pcm_cache_store = FALSE;
+	mpg123_decoder->pcm_cache_hash = GST_MPG123_PCM_CACHE_INITIAL_HASH;
+	memset(&(mpg123_decoder->pcm_cache_decoder_info), 0, sizeof(mpg123_decoder->pcm_cache_decoder_info));
+	if (mpg123_decoder->use_pcm_cache)
+	{
+		gst_mpg123_pcm_cache_request_max_size(pcm_cache_size);
+		mpg123_decoder->pcm_cache_skipped_frames = g_ptr_array_new_with_free_func((GDestroyNotify)gst_buffer_unref);
+	}
+	mpg123_decoder->quality_replay_frames = g_ptr_array_new_with_free_func((GDestroyNotify)gst_buffer_unref);
+	g_atomic_int_set(&(mpg123_decoder->buffered_input_size), 0);
+	g_atomic_int_set(&(mpg123_decoder->async_queued_input_size), 0);
+
+	gst_mpg123_async_start(mpg123_decoder);
 
 	/*
-	Initially, the mpg123 handle comes with a set of default formats supported. This clears this set. 
-	This is necessary, since only one format shall be supported (see set_format for more).
+	Memory that stays allocated for the lifetime of the handle: the feed pool (in the worst case, all
+	pooled buffers are at least as large as the feed buffer size), the output block mpg123 decodes
+	frames into, and the async queues
 	*/
-	mpg123_format_none(mpg123_decoder->handle);
-
-	/* Built-in mpg123 support for gapless decoding is disabled for now, since it does not work well with seeking */
-	mpg123_param(mpg123_decoder->handle, MPG123_REMOVE_FLAGS,  MPG123_GAPLESS,       0);
-	/* Tells mpg123 to use a small read-ahead buffer for better MPEG sync; essential for MP3 radio streams */
-	mpg123_param(mpg123_decoder->handle, MPG123_ADD_FLAGS,     MPG123_SEEKBUFFER,    0);
-	/* Sets the resync limit to the end of the stream (e.g. don't give up prematurely) */
-	mpg123_param(mpg123_decoder->handle, MPG123_RESYNC_LIMIT,  -1,                   0);
-	/* Don't let mpg123 resample output */
-	mpg123_param (mpg123_decoder->handle, MPG123_REMOVE_FLAGS, MPG123_AUTO_RESAMPLE, 0);
-	/* Don't let mpg123 print messages to stdout/stderr */
-	mpg123_param (mpg123_decoder->handle, MPG123_ADD_FLAGS,    MPG123_QUIET,         0);
-
-	/* Open in feed mode (= encoded data is fed manually into the handle). */
-	error = mpg123_open_feed(mpg123_decoder->handle);
-
-	if (G_UNLIKELY(error != MPG123_OK))
 	{
-		GST_ELEMENT_ERROR(dec, LIBRARY, INIT, (NULL), ("%s", mpg123_strerror(mpg123_decoder->handle)));
-		mpg123_close(mpg123_decoder->handle);
-		mpg123_delete(mpg123_decoder->handle);
-		mpg123_decoder->handle = NULL;
-		return FALSE;
+		long pool_size, buffer_size;
+		gsize fixed_memory_usage = mpg123_outblock(mpg123_decoder->handle);
+
+		if ((mpg123_getparam(mpg123_decoder->handle, MPG123_FEEDPOOL, &pool_size, NULL) == MPG123_OK)
+		 && (mpg123_getparam(mpg123_decoder->handle, MPG123_FEEDBUFFER, &buffer_size, NULL) == MPG123_OK))
+			fixed_memory_usage += (gsize)MAX(pool_size, 0) * (gsize)MAX(buffer_size, 0);
+
+		if (mpg123_decoder->async_input_queue != NULL)
+		{
+			fixed_memory_usage += gst_mpg123_spsc_queue_get_memory_usage(mpg123_decoder->async_input_queue);
+			fixed_memory_usage += gst_mpg123_spsc_queue_get_memory_usage(mpg123_decoder->async_output_queue);
+		}
+
+		GST_OBJECT_LOCK(mpg123_decoder);
+		mpg123_decoder->fixed_memory_usage = fixed_memory_usage;
+		GST_OBJECT_UNLOCK(mpg123_decoder);
 	}
 
 	GST_INFO_OBJECT(dec, "mpg123 decoder started");
@@ -236,26 +1081,127 @@ static gboolean gst_mpg123_stop(GstAudioDecoder *dec)
 {
 	GstMpg123 *mpg123_decoder = GST_MPG123(dec);
 
-	if (G_LIKELY(mpg123_decoder->handle != NULL))
+	/* The decoding thread must be gone before the handle is deleted */
+	gst_mpg123_async_stop(mpg123_decoder);
+
+	if (G_LIKELY(mpg123_decoder->core != NULL))
 	{
-		mpg123_close(mpg123_decoder->handle);
-		mpg123_delete(mpg123_decoder->handle);
+		gst_mpg123_core_free(mpg123_decoder->core);
+		mpg123_decoder->core = NULL;
 		mpg123_decoder->handle = NULL;
 	}
 
+	if (mpg123_decoder->pcm_cache_skipped_frames != NULL)
+	{
+		g_ptr_array_unref(mpg123_decoder->pcm_cache_skipped_frames);
+		mpg123_decoder->pcm_cache_skipped_frames = NULL;
+	}
+	if (mpg123_decoder->quality_replay_frames != NULL)
+	{
+		g_ptr_array_unref(mpg123_decoder->quality_replay_frames);
+		mpg123_decoder->quality_replay_frames = NULL;
+	}
+	mpg123_decoder->use_pcm_cache = FALSE;
+
+	GST_OBJECT_LOCK(mpg123_decoder);
+	mpg123_decoder->fixed_memory_usage = 0;
+	gst_mpg123_clear_state_history(mpg123_decoder);
+	g_free(mpg123_decoder->state_history);
+	mpg123_decoder->state_history = NULL;
+	GST_OBJECT_UNLOCK(mpg123_decoder);
+	gst_mpg123_set_output_pool(mpg123_decoder, NULL);
+	g_atomic_int_set(&(mpg123_decoder->buffered_input_size), 0);
+	g_atomic_int_set(&(mpg123_decoder->async_queued_input_size), 0);
+
 	GST_INFO_OBJECT(dec, "mpg123 decoder stopped");
 
 	return TRUE;
 }
 
 
-static GstFlowReturn gst_mpg123_push_decoded_bytes(GstMpg123 *mpg123_decoder, unsigned char const *decoded_bytes, size_t const num_decoded_bytes)
+static GstFlowReturn gst_mpg123_traced_finish_frame(GstMpg123 *mpg123_decoder, GstBuffer *output_buffer)
+{
+	GstClockTime trace_start;
+	GstFlowReturn retval;
+
+	GST_MPG123_PROBE(finish_frame__start);
+	trace_start = gst_mpg123_trace_start();
+
+	retval = gst_audio_decoder_finish_frame(GST_AUDIO_DECODER(mpg123_decoder), output_buffer, 1);
+
+	gst_mpg123_trace_stop(GST_MPG123_TRACE_PHASE_FINISH_FRAME, trace_start);
+	GST_MPG123_PROBE1(finish_frame__done, (int)retval);
+
+	return retval;
+}
+
+
+static GstFlowReturn gst_mpg123_finish_frame(GstMpg123 *mpg123_decoder, GstBuffer *output_buffer)
+{
+	/*
+	In async mode, this runs in the decoding thread, which must not call into the base class, since
+	that requires the stream lock. The result is handed over to the streaming thread instead.
+	*/
+	if (mpg123_decoder->async_output_queue != NULL)
+	{
+		gst_mpg123_async_push_output(mpg123_decoder, output_buffer, GST_MPG123_ASYNC_OUTPUT_FINISH_FRAME);
+		return GST_FLOW_OK;
+	}
+
+	return gst_mpg123_traced_finish_frame(mpg123_decoder, output_buffer);
+}
+
+
+static GstBuffer* gst_mpg123_allocate_output_buffer(GstMpg123 *mpg123_decoder, gsize size)
+{
+	GstBufferPool *pool;
+	GstBuffer *buffer;
+
+	/*
+	gst_audio_decoder_allocate_output_buffer() is not used, since it takes the stream lock, which the
+	decoding thread must not do in async mode. Also, it allocates new memory for every frame; with many
+	decoder instances, that puts a lot of pressure on the allocator. Buffers from the pool are reused
+	once downstream releases them.
+	*/
+	GST_OBJECT_LOCK(mpg123_decoder);
+	pool = (mpg123_decoder->output_pool != NULL) ? gst_object_ref(mpg123_decoder->output_pool) : NULL;
+	GST_OBJECT_UNLOCK(mpg123_decoder);
+
+	buffer = NULL;
+
+	if (pool != NULL)
+	{
+		/* This fails if the pool was deactivated by a renegotiation in the meantime */
+		if (gst_buffer_pool_acquire_buffer(pool, &buffer, NULL) == GST_FLOW_OK)
+		{
+			/* The pool resets the size when the buffer is released */
+			if (G_LIKELY(gst_buffer_get_size(buffer) >= size))
+				gst_buffer_set_size(buffer, size);
+			else
+			{
+				gst_buffer_unref(buffer);
+				buffer = NULL;
+			}
+		}
+
+		gst_object_unref(pool);
+	}
+
+	if (buffer == NULL)
+		buffer = gst_buffer_new_allocate(NULL, size, NULL);
+
+	return buffer;
+}
+
+
+static GstFlowReturn gst_mpg123_push_decoded_bytes(GstMpg123 *mpg123_decoder, unsigned char *decoded_bytes, size_t const num_decoded_bytes)
 {
 	GstBuffer *output_buffer;
-	GstAudioDecoder *dec;
+	GstClockTime trace_start;
+	GstMpg123Conversion conversion;
+	gsize num_samples, output_size;
 
 	output_buffer = NULL;
-	dec = GST_AUDIO_DECODER(mpg123_decoder);
 
 	if ((num_decoded_bytes == 0) || (decoded_bytes == NULL))
 	{
@@ -265,12 +1211,31 @@ static GstFlowReturn gst_mpg123_push_decoded_bytes(GstMpg123 *mpg123_decoder, un
 		return GST_FLOW_OK;
 	}
 
-	output_buffer = gst_buffer_new_allocate(NULL, num_decoded_bytes, NULL);
+	GST_MPG123_PROBE1(output__start, num_decoded_bytes);
+	trace_start = gst_mpg123_trace_start();
+
+	/* The converted samples may be smaller than the decoded ones (32 -> 24 bit) */
+	conversion = mpg123_decoder->conversion;
+	if (conversion != GST_MPG123_CONVERSION_NONE)
+	{
+		num_samples = num_decoded_bytes / gst_mpg123_conversion_get_source_size(conversion);
+		output_size = num_samples * gst_mpg123_conversion_get_dest_size(conversion);
+	}
+	else
+	{
+		num_samples = 0;
+		output_size = num_decoded_bytes;
+	}
+
+	output_buffer = gst_mpg123_allocate_output_buffer(mpg123_decoder, output_size);
 
 	if (output_buffer == NULL)
 	{
+		gst_mpg123_trace_stop(GST_MPG123_TRACE_PHASE_OUTPUT, trace_start);
+		GST_MPG123_PROBE1(output__done, 0);
+
 		/* This is necessary to advance playback in time, even when nothing was decoded. */
-		return gst_audio_decoder_finish_frame(dec, NULL, 1);
+		return gst_mpg123_finish_frame(mpg123_decoder, NULL);
 	}
 	else
 	{
@@ -278,8 +1243,31 @@ static GstFlowReturn gst_mpg123_push_decoded_bytes(GstMpg123 *mpg123_decoder, un
 
 		if (gst_buffer_map(output_buffer, &info, GST_MAP_WRITE))
 		{
-			memcpy(info.data, decoded_bytes, num_decoded_bytes);
-			gst_buffer_unmap(output_buffer, &info);
+#if GST_CHECK_VERSION(1, 16, 0)
+			GstAudioInfo *audioinfo = &(mpg123_decoder->output_audioinfo);
+
+			/* For planar output, the deinterleaving replaces the plain copy, so the samples are still written only once */
+			if (GST_AUDIO_INFO_LAYOUT(audioinfo) == GST_AUDIO_LAYOUT_NON_INTERLEAVED)
+			{
+				gsize num_frames = output_size / GST_AUDIO_INFO_BPF(audioinfo);
+				guint num_channels = GST_AUDIO_INFO_CHANNELS(audioinfo);
+
+				/* mpg123's output buffer is scratch space until the next decode call, so the samples are converted in place there first */
+				gst_mpg123_convert(decoded_bytes, decoded_bytes, num_samples, conversion);
+				gst_mpg123_deinterleave(info.data, decoded_bytes, num_frames, num_channels, GST_AUDIO_INFO_BPF(audioinfo) / num_channels);
+				gst_buffer_unmap(output_buffer, &info);
+				gst_buffer_add_audio_meta(output_buffer, audioinfo, num_frames, NULL);
+			}
+			else
+#endif
+			{
+				/* The conversion writes directly into the output buffer, and replaces the copy */
+				if (conversion != GST_MPG123_CONVERSION_NONE)
+					gst_mpg123_convert(info.data, decoded_bytes, num_samples, conversion);
+				else
+					memcpy(info.data, decoded_bytes, num_decoded_bytes);
+				gst_buffer_unmap(output_buffer, &info);
+			}
 		}
 		else
 		{
@@ -288,55 +1276,559 @@ static GstFlowReturn gst_mpg123_push_decoded_bytes(GstMpg123 *mpg123_decoder, un
 			output_buffer = NULL;
 		}
 
-		return gst_audio_decoder_finish_frame(dec, output_buffer, 1);
+		if (G_UNLIKELY(mpg123_decoder->pcm_cache_store) && (output_buffer != NULL))
+		{
+			gst_mpg123_pcm_cache_insert(mpg123_decoder->pcm_cache_hash, &(mpg123_decoder->output_audioinfo), &(mpg123_decoder->pcm_cache_decoder_info), output_buffer);
+			mpg123_decoder->pcm_cache_store = FALSE;
+		}
+
+		gst_mpg123_trace_stop(GST_MPG123_TRACE_PHASE_OUTPUT, trace_start);
+		GST_MPG123_PROBE1(output__done, (output_buffer != NULL) ? output_size : 0);
+
+		return gst_mpg123_finish_frame(mpg123_decoder, output_buffer);
 	}
 }
 
 
-static GstFlowReturn gst_mpg123_handle_frame(GstAudioDecoder *dec, GstBuffer *input_buffer)
+static GstFlowReturn gst_mpg123_apply_next_audioinfo(GstMpg123 *mpg123_decoder)
 {
-	GstMpg123 *mpg123_decoder;
-	int decode_error;
-	unsigned char *decoded_bytes;
-	size_t num_decoded_bytes;
-	GstFlowReturn retval;
+	GstFlowReturn retval = GST_FLOW_OK;
 
-	mpg123_decoder = GST_MPG123(dec);
+	/*
+	If there is a next audioinfo, use it, then set has_next_audioinfo to FALSE, to make sure
+	gst_audio_decoder_set_output_format() isn't called again until set_format is called by the base class
+	*/
+	if (mpg123_decoder->has_next_audioinfo)
+	{
+		mpg123_decoder->output_audioinfo = mpg123_decoder->next_audioinfo;
+		mpg123_decoder->conversion = mpg123_decoder->next_conversion;
 
-	g_assert(mpg123_decoder->handle != NULL);
+		/* The output is decoded with the settings configured along with the format from here on */
+		mpg123_decoder->pcm_cache_decoder_info.decoder = g_intern_string(mpg123_current_decoder(mpg123_decoder->handle));
+		mpg123_decoder->pcm_cache_decoder_info.down_sample = gst_mpg123_core_get_down_sample(mpg123_decoder->core);
+		mpg123_decoder->pcm_cache_decoder_info.forced_rate = mpg123_decoder->forced_rate;
 
-	/* The actual decoding */
-	{
-		/* feed input data (if there is any) */
-		if (G_LIKELY(input_buffer != NULL))
+		if (mpg123_decoder->async_output_queue != NULL)
 		{
-			GstMapInfo info;
-
-			if (gst_buffer_map(input_buffer, &info, GST_MAP_READ))
-			{
-				mpg123_feed(mpg123_decoder->handle, info.data, info.size);
-				gst_buffer_unmap(input_buffer, &info);
-			}
-			else
-			{
-				GST_ERROR_OBJECT(mpg123_decoder, "gst_memory_map() failed");
-				return GST_FLOW_ERROR;
-			}
+			GstAudioInfo *audioinfo = g_slice_new(GstAudioInfo);
+			*audioinfo = mpg123_decoder->next_audioinfo;
+			gst_mpg123_async_push_output(mpg123_decoder, audioinfo, GST_MPG123_ASYNC_OUTPUT_FORMAT);
 		}
-
-		/* Try to decode a frame */
-		decoded_bytes = NULL;
-		num_decoded_bytes = 0;
-		decode_error = mpg123_decode_frame(
-			mpg123_decoder->handle,
-			&mpg123_decoder->frame_offset,
-			&decoded_bytes,
-			&num_decoded_bytes
-		);
+		else if (!gst_audio_decoder_set_output_format(GST_AUDIO_DECODER(mpg123_decoder), &(mpg123_decoder->next_audioinfo)))
+		{
+			GST_WARNING_OBJECT(mpg123_decoder, "Unable to set output format");
+			retval = GST_FLOW_NOT_NEGOTIATED;
+		}
+		mpg123_decoder->has_next_audioinfo = FALSE;
 	}
 
-	retval = GST_FLOW_OK;
-
+	return retval;
+}
+
+
+static void gst_mpg123_post_stream_info(GstMpg123 *mpg123_decoder)
+{
+	struct mpg123_frameinfo frameinfo;
+	GstTagList *tags;
+	gchar const *bitrate_mode;
+
+	if (mpg123_info(mpg123_decoder->handle, &frameinfo) != MPG123_OK)
+	{
+		GST_DEBUG_OBJECT(mpg123_decoder, "no frame info available yet");
+		return;
+	}
+
+	mpg123_decoder->stream_info_posted = TRUE;
+
+	/*
+	Determine the stream length here, since duration queries can come from any thread, and must not
+	touch the mpg123 handle. mpg123_length() is exact if the stream has a Xing/Info header with a frame
+	count. Otherwise, mpg123 extrapolates from the stream size (exact for CBR), which has to be set
+	explicitly in feed mode. mpg123_scan() cannot be used here, since it requires a seekable reader.
+	*/
+	{
+		gint64 upstream_size;
+		off_t num_samples;
+		long rate;
+		int channels, encoding;
+
+		if (gst_pad_peer_query_duration(GST_AUDIO_DECODER_SINK_PAD(mpg123_decoder), GST_FORMAT_BYTES, &upstream_size) && (upstream_size > 0))
+			mpg123_set_filesize(mpg123_decoder->handle, upstream_size);
+
+		num_samples = mpg123_length(mpg123_decoder->handle);
+		if (mpg123_getformat(mpg123_decoder->handle, &rate, &channels, &encoding) != MPG123_OK)
+			rate = 0;
+
+		GST_OBJECT_LOCK(mpg123_decoder);
+		mpg123_decoder->stream_length = MAX(num_samples, 0);
+		mpg123_decoder->stream_rate = rate;
+		GST_OBJECT_UNLOCK(mpg123_decoder);
+	}
+
+	tags = gst_tag_list_new_empty();
+
+	/*
+	The bitrate mode is taken from the Xing/Info or VBRI header if the stream has one, otherwise
+	mpg123 reports CBR. For CBR streams, the bitrate of the current frame is the nominal bitrate.
+	*/
+	switch (frameinfo.vbr)
+	{
+		case MPG123_CBR:
+			bitrate_mode = "cbr";
+			gst_tag_list_add(tags, GST_TAG_MERGE_REPLACE, GST_TAG_NOMINAL_BITRATE, (guint)(frameinfo.bitrate * 1000), NULL);
+			break;
+		case MPG123_ABR:
+			bitrate_mode = "abr";
+			gst_tag_list_add(tags, GST_TAG_MERGE_REPLACE, GST_TAG_NOMINAL_BITRATE, (guint)(frameinfo.abr_rate * 1000), NULL);
+			break;
+		case MPG123_VBR:
+		default:
+			bitrate_mode = "vbr";
+			break;
+	}
+	gst_tag_list_add(tags, GST_TAG_MERGE_REPLACE, GST_MPG123_TAG_BITRATE_MODE, bitrate_mode, NULL);
+
+#ifdef HAVE_MPG123_ENC_DELAY
+	/* Encoder delay and padding are known only if the stream has a LAME tag; mpg123 reports -1 otherwise */
+	{
+		long value;
+
+		if ((mpg123_getstate(mpg123_decoder->handle, MPG123_ENC_DELAY, &value, NULL) == MPG123_OK) && (value >= 0))
+			gst_tag_list_add(tags, GST_TAG_MERGE_REPLACE, GST_MPG123_TAG_ENCODER_DELAY, (guint)value, NULL);
+		if ((mpg123_getstate(mpg123_decoder->handle, MPG123_ENC_PADDING, &value, NULL) == MPG123_OK) && (value >= 0))
+			gst_tag_list_add(tags, GST_TAG_MERGE_REPLACE, GST_MPG123_TAG_ENCODER_PADDING, (guint)value, NULL);
+	}
+#endif
+
+	GST_DEBUG_OBJECT(mpg123_decoder, "stream info: %" GST_PTR_FORMAT, (gpointer)tags);
+
+	/* merge_tags takes the stream lock, so in async mode, the streaming thread has to do it */
+	if (mpg123_decoder->async_output_queue != NULL)
+	{
+		gst_mpg123_async_push_output(mpg123_decoder, tags, GST_MPG123_ASYNC_OUTPUT_TAGS);
+		return;
+	}
+
+	gst_audio_decoder_merge_tags(GST_AUDIO_DECODER(mpg123_decoder), tags, GST_TAG_MERGE_REPLACE);
+	gst_tag_list_unref(tags);
+}
+
+
+static gboolean gst_mpg123_feed_buffer(GstMpg123 *mpg123_decoder, GstBuffer *input_buffer)
+{
+	GstMapInfo info;
+	GstClockTime trace_start;
+	gboolean mapped;
+
+	GST_MPG123_PROBE1(input_map__start, gst_buffer_get_size(input_buffer));
+	trace_start = gst_mpg123_trace_start();
+
+	mapped = gst_buffer_map(input_buffer, &info, GST_MAP_READ);
+
+	gst_mpg123_trace_stop(GST_MPG123_TRACE_PHASE_INPUT_MAP, trace_start);
+	GST_MPG123_PROBE1(input_map__done, (int)mapped);
+
+	if (!mapped)
+	{
+		GST_ERROR_OBJECT(mpg123_decoder, "gst_memory_map() failed");
+		return FALSE;
+	}
+
+	GST_MPG123_PROBE1(feed__start, info.size);
+	trace_start = gst_mpg123_trace_start();
+
+	gst_mpg123_core_feed(mpg123_decoder->core, info.data, info.size);
+
+	gst_mpg123_trace_stop(GST_MPG123_TRACE_PHASE_FEED, trace_start);
+	GST_MPG123_PROBE1(feed__done, info.size);
+
+	gst_buffer_unmap(input_buffer, &info);
+
+	return TRUE;
+}
+
+
+static GstFlowReturn gst_mpg123_skip_frame(GstMpg123 *mpg123_decoder, GstBuffer *input_buffer)
+{
+	int error;
+	GstFlowReturn retval;
+
+	if (!gst_mpg123_feed_buffer(mpg123_decoder, input_buffer))
+		return GST_FLOW_ERROR;
+
+	/*
+	Only read the frame without running the synthesis. This keeps mpg123's frame counter, bit reservoir
+	and bitrate statistics up to date at a fraction of the decoding cost.
+	*/
+	error = gst_mpg123_core_skip_frame(mpg123_decoder->core);
+	retval = GST_FLOW_OK;
+
+	gst_mpg123_update_buffered_input_size(mpg123_decoder);
+
+	switch (error)
+	{
+		case MPG123_NEW_FORMAT:
+			/* mpg123 reports a new format only once, so it has to be applied even though nothing is decoded */
+			retval = gst_mpg123_apply_next_audioinfo(mpg123_decoder);
+			/* fall through */
+		case MPG123_OK:
+			/*
+			mpg123_spf() counts samples at the bitstream rate, which differs from the output rate with
+			down-sample or force-rate; these are converted once the scan is complete, since converting
+			per frame would accumulate rounding errors
+			*/
+			mpg123_decoder->num_scanned_input_samples += mpg123_spf(mpg123_decoder->handle);
+			break;
+
+		case MPG123_NEED_MORE:
+			break;
+
+		case MPG123_DONE:
+			GST_LOG_OBJECT(mpg123_decoder, "mpg123 is done scanning");
+			return GST_FLOW_EOS;
+
+		default:
+			GST_ERROR_OBJECT(mpg123_decoder, "Reported error while scanning: %s", mpg123_strerror(mpg123_decoder->handle));
+			return GST_FLOW_ERROR;
+	}
+
+	if (retval != GST_FLOW_OK)
+		return retval;
+
+	/* No output, but the frame must still be marked as done to advance the base class */
+	return gst_mpg123_finish_frame(mpg123_decoder, NULL);
+}
+
+
+static gsize gst_mpg123_get_silent_frame_size(GstMpg123 *mpg123_decoder, GstBuffer *input_buffer)
+{
+	GstAudioInfo *audioinfo = &(mpg123_decoder->output_audioinfo);
+	GstMapInfo info;
+	size_t num_samples;
+
+	/*
+	The shared memory is all zeros, which is only silence with signed and float formats. With NtoM
+	resampling, the number of output samples varies from frame to frame, so it cannot be predicted.
+	*/
+	if ((GST_AUDIO_INFO_FORMAT(audioinfo) == GST_AUDIO_FORMAT_UNKNOWN) || !(GST_AUDIO_FORMAT_INFO_IS_SIGNED(audioinfo->finfo) || GST_AUDIO_FORMAT_INFO_IS_FLOAT(audioinfo->finfo)))
+		return 0;
+	if (mpg123_decoder->forced_rate != 0)
+		return 0;
+
+	if (!gst_buffer_map(input_buffer, &info, GST_MAP_READ))
+		return 0;
+	num_samples = gst_mpg123_core_check_silent_frame(info.data, info.size);
+	gst_buffer_unmap(input_buffer, &info);
+
+	return num_samples >> gst_mpg123_core_get_down_sample(mpg123_decoder->core);
+}
+
+
+static GstMemory* gst_mpg123_get_silence_memory(void)
+{
+	GstMemory *memory;
+
+	g_mutex_lock(&gst_mpg123_silence_memory_mutex);
+
+	if (gst_mpg123_silence_memory == NULL)
+	{
+		GstMapInfo info;
+
+		gst_mpg123_silence_memory = gst_allocator_alloc(NULL, GST_MPG123_SILENCE_MEMORY_SIZE, NULL);
+		gst_memory_map(gst_mpg123_silence_memory, &info, GST_MAP_WRITE);
+		memset(info.data, 0, info.size);
+		gst_memory_unmap(gst_mpg123_silence_memory, &info);
+		/* Writable mappings of the buffers then copy the memory instead of modifying it */
+		GST_MINI_OBJECT_FLAG_SET(gst_mpg123_silence_memory, GST_MEMORY_FLAG_READONLY);
+	}
+
+	memory = gst_mpg123_silence_memory;
+
+	g_mutex_unlock(&gst_mpg123_silence_memory_mutex);
+
+	return memory;
+}
+
+
+static GstFlowReturn gst_mpg123_push_gap_frame(GstMpg123 *mpg123_decoder, GstBuffer *input_buffer, gsize num_frames)
+{
+	GstAudioInfo *audioinfo;
+	GstBuffer *output_buffer;
+	GstFlowReturn retval;
+	int error;
+
+	/* As with skipped frames, mpg123 parses the frame, and its state no longer matches the hash chain */
+	if (mpg123_decoder->use_pcm_cache)
+	{
+		if (!gst_mpg123_pcm_cache_catch_up(mpg123_decoder))
+			return GST_FLOW_ERROR;
+		mpg123_decoder->pcm_cache_hash_valid = FALSE;
+	}
+
+	if (!gst_mpg123_feed_buffer(mpg123_decoder, input_buffer))
+		return GST_FLOW_ERROR;
+
+	/* Parsing keeps the bit reservoir up to date for the first frame after the silence */
+	error = gst_mpg123_core_skip_frame(mpg123_decoder->core);
+	retval = GST_FLOW_OK;
+
+	gst_mpg123_update_buffered_input_size(mpg123_decoder);
+
+	switch (error)
+	{
+		case MPG123_NEW_FORMAT:
+			retval = gst_mpg123_apply_next_audioinfo(mpg123_decoder);
+			/* fall through */
+		case MPG123_OK:
+			break;
+
+		case MPG123_NEED_MORE:
+			return gst_mpg123_finish_frame(mpg123_decoder, NULL);
+
+		case MPG123_DONE:
+			GST_LOG_OBJECT(mpg123_decoder, "mpg123 is done decoding");
+			return GST_FLOW_EOS;
+
+		default:
+			GST_ERROR_OBJECT(mpg123_decoder, "Reported error while parsing silent frame: %s", mpg123_strerror(mpg123_decoder->handle));
+			return GST_FLOW_ERROR;
+	}
+
+	if (retval != GST_FLOW_OK)
+		return retval;
+
+	audioinfo = &(mpg123_decoder->output_audioinfo);
+	output_buffer = gst_buffer_new();
+	gst_buffer_append_memory(output_buffer, gst_memory_share(gst_mpg123_get_silence_memory(), 0, num_frames * GST_AUDIO_INFO_BPF(audioinfo)));
+	GST_BUFFER_FLAG_SET(output_buffer, GST_BUFFER_FLAG_GAP);
+#if GST_CHECK_VERSION(1, 16, 0)
+	if (GST_AUDIO_INFO_LAYOUT(audioinfo) == GST_AUDIO_LAYOUT_NON_INTERLEAVED)
+		gst_buffer_add_audio_meta(output_buffer, audioinfo, num_frames, NULL);
+#endif
+
+	GST_OBJECT_LOCK(mpg123_decoder);
+	mpg123_decoder->num_gap_frames++;
+	GST_OBJECT_UNLOCK(mpg123_decoder);
+
+	GST_LOG_OBJECT(mpg123_decoder, "silent frame -> GAP buffer with %" G_GSIZE_FORMAT " samples", num_frames);
+
+	return gst_mpg123_finish_frame(mpg123_decoder, output_buffer);
+}
+
+
+static GstMpg123FrameAction gst_mpg123_get_frame_action(GstMpg123 *mpg123_decoder, GstBuffer *input_buffer)
+{
+	GstSegment const *segment;
+	gdouble abs_rate;
+	guint interval, position;
+
+	/* The output segment is protected by the stream lock, which is held while handle_frame is running */
+	segment = &(GST_AUDIO_DECODER(mpg123_decoder)->output_segment);
+
+	if (segment->flags & GST_SEGMENT_FLAG_TRICKMODE_NO_AUDIO)
+		return GST_MPG123_FRAME_ACTION_SKIP;
+
+	/*
+	In reverse playback, the base class collects chunks of frames (each one starting with a DISCONT
+	buffer) and passes them to handle_frame in forward order. The decoder state left over from the
+	previous chunk belongs to frames that come *after* this chunk in the stream, so it is useless.
+	*/
+	if ((segment->rate < 0.0) && GST_BUFFER_IS_DISCONT(input_buffer))
+	{
+		mpg123_decoder->trick_frame_counter = 0;
+		return GST_MPG123_FRAME_ACTION_RESYNC;
+	}
+
+	/*
+	In forward playback, frames which lie entirely outside of the segment would be clipped away by the
+	base class after decoding, so the synthesis is not done for them in the first place. This matters when
+	only a short excerpt of a long stream is played. Once the segment stop is reached, EOS is returned so
+	upstream stops sending data.
+	*/
+	if ((segment->rate > 0.0) && (segment->format == GST_FORMAT_TIME) && GST_BUFFER_PTS_IS_VALID(input_buffer) && GST_BUFFER_DURATION_IS_VALID(input_buffer))
+	{
+		GstClockTime start = GST_BUFFER_PTS(input_buffer);
+		GstClockTime duration = GST_BUFFER_DURATION(input_buffer);
+
+		if (GST_CLOCK_TIME_IS_VALID(segment->stop) && (start >= segment->stop))
+			return GST_MPG123_FRAME_ACTION_EOS;
+
+		if ((start + duration) <= segment->start)
+		{
+			if ((start + duration * (GST_MPG123_SEGMENT_PREROLL_FRAMES + 1)) > segment->start)
+				return GST_MPG123_FRAME_ACTION_PREROLL;
+			else
+				return GST_MPG123_FRAME_ACTION_SKIP;
+		}
+	}
+
+	/*
+	With a trickmode segment, only every Nth frame is output, N being the playback rate. The frame right
+	before such an output frame is decoded too, otherwise the output frame would lack its bit reservoir
+	data and synthesis/overlap history. All other frames are skipped. Below a rate of 3 there is nothing
+	to gain, since every other frame would be decoded anyway.
+	*/
+	abs_rate = ABS(segment->rate);
+	if (!(segment->flags & GST_SEGMENT_FLAG_TRICKMODE) || (abs_rate < 3.0))
+		return GST_MPG123_FRAME_ACTION_DECODE;
+
+	interval = (guint)(abs_rate + 0.5);
+	position = (mpg123_decoder->trick_frame_counter++) % interval;
+
+	if (position == (interval - 1))
+		return GST_MPG123_FRAME_ACTION_DECODE;
+	else if (position == (interval - 2))
+		return GST_MPG123_FRAME_ACTION_PREROLL;
+	else
+		return GST_MPG123_FRAME_ACTION_SKIP;
+}
+
+
+static GstFlowReturn gst_mpg123_decode_input(GstMpg123 *mpg123_decoder, GstBuffer *input_buffer, GstMpg123FrameAction action)
+{
+	GstAudioDecoder *dec;
+	int decode_error;
+	unsigned char *decoded_bytes;
+	size_t num_decoded_bytes;
+	GstFlowReturn retval;
+	GstClockTime trace_start;
+	gboolean discard_output;
+	gboolean measure_load;
+	gint64 decode_start;
+
+	dec = GST_AUDIO_DECODER(mpg123_decoder);
+
+	if (mpg123_decoder->scanning)
+	{
+		if (G_LIKELY(input_buffer != NULL))
+			return gst_mpg123_skip_frame(mpg123_decoder, input_buffer);
+
+		/*
+		Draining; all frames have been fed, but the last one is still buffered in mpg123, since reading lags
+		one frame behind the input (see gst_mpg123_replay_frames()). Once it is read, the scanned length is exact.
+		*/
+		while (TRUE)
+		{
+			int error = gst_mpg123_core_skip_frame(mpg123_decoder->core);
+			if ((error != MPG123_OK) && (error != MPG123_NEW_FORMAT))
+				break;
+			mpg123_decoder->num_scanned_input_samples += mpg123_spf(mpg123_decoder->handle);
+		}
+		gst_mpg123_update_buffered_input_size(mpg123_decoder);
+
+		GST_OBJECT_LOCK(mpg123_decoder);
+		if ((mpg123_decoder->input_rate > 0) && (mpg123_decoder->stream_rate > 0))
+			mpg123_decoder->num_scanned_samples += gst_util_uint64_scale_int(mpg123_decoder->num_scanned_input_samples, mpg123_decoder->stream_rate, mpg123_decoder->input_rate);
+		mpg123_decoder->num_scanned_input_samples = 0;
+		GST_DEBUG_OBJECT(dec, "scan complete: %" G_GUINT64_FORMAT " samples", mpg123_decoder->num_scanned_samples);
+		mpg123_decoder->scan_complete = TRUE;
+		GST_OBJECT_UNLOCK(mpg123_decoder);
+		gst_element_post_message(GST_ELEMENT(dec), gst_message_new_duration_changed(GST_OBJECT(dec)));
+		return GST_FLOW_OK;
+	}
+
+	discard_output = FALSE;
+
+	if (G_UNLIKELY(g_atomic_pointer_get(&(mpg123_decoder->restore_frames)) != NULL))
+		gst_mpg123_replay_restored_frames(mpg123_decoder);
+
+	/* In async mode, this runs in the decoding thread, so queued frames do not enter the history before they are decoded */
+	if (mpg123_decoder->state_history != NULL)
+		gst_mpg123_update_state_history(mpg123_decoder, input_buffer);
+
+	if (G_LIKELY(input_buffer != NULL))
+	{
+		switch (action)
+		{
+			case GST_MPG123_FRAME_ACTION_SKIP:
+				/* mpg123 parses skipped frames, so its state no longer matches the hash chain until the next reset */
+				if (mpg123_decoder->use_pcm_cache)
+				{
+					if (!gst_mpg123_pcm_cache_catch_up(mpg123_decoder))
+						return GST_FLOW_ERROR;
+					mpg123_decoder->pcm_cache_hash_valid = FALSE;
+				}
+				return gst_mpg123_skip_frame(mpg123_decoder, input_buffer);
+
+			case GST_MPG123_FRAME_ACTION_EOS:
+			{
+				GstFlowReturn retval = gst_mpg123_finish_frame(mpg123_decoder, NULL);
+				GST_LOG_OBJECT(dec, "frame is past the segment stop -> EOS");
+				return (retval == GST_FLOW_OK) ? GST_FLOW_EOS : retval;
+			}
+
+			case GST_MPG123_FRAME_ACTION_RESYNC:
+				GST_LOG_OBJECT(dec, "discontinuity in reverse playback -> resetting decoder state");
+				if (!gst_mpg123_reopen_feed(mpg123_decoder))
+					return GST_FLOW_ERROR;
+				discard_output = TRUE;
+				break;
+
+			case GST_MPG123_FRAME_ACTION_PREROLL:
+				discard_output = TRUE;
+				break;
+
+			case GST_MPG123_FRAME_ACTION_DECODE:
+			default:
+				break;
+		}
+
+		/* Skipped frames do not update the synthesis state, so only a run of decoded frames counts */
+		if (mpg123_decoder->use_silence_gaps)
+		{
+			gsize num_frames = (action == GST_MPG123_FRAME_ACTION_DECODE) ? gst_mpg123_get_silent_frame_size(mpg123_decoder, input_buffer) : 0;
+
+			if (num_frames == 0)
+				mpg123_decoder->num_silent_frames = 0;
+			else if (++(mpg123_decoder->num_silent_frames) > GST_MPG123_SILENCE_HISTORY_FRAMES)
+				return gst_mpg123_push_gap_frame(mpg123_decoder, input_buffer, num_frames);
+		}
+
+		if (mpg123_decoder->use_pcm_cache && gst_mpg123_pcm_cache_lookup_input(mpg123_decoder, input_buffer, discard_output, &retval))
+			return retval;
+	}
+	else if (mpg123_decoder->use_pcm_cache)
+	{
+		/* Draining outputs the last frame mpg123 holds back; after cache hits, that is the last skipped frame */
+		if (!gst_mpg123_pcm_cache_catch_up(mpg123_decoder))
+			return GST_FLOW_ERROR;
+	}
+
+	/* The actual decoding */
+	{
+		/* The load is also measured while the budget is off but the quality is still reduced, so the quality can be restored */
+		measure_load = (g_atomic_int_get(&(mpg123_decoder->cpu_budget)) > 0) || (mpg123_decoder->quality_level > 0);
+
+		/* feed input data (if there is any) */
+		if (G_LIKELY(input_buffer != NULL))
+		{
+			if (!gst_mpg123_feed_buffer(mpg123_decoder, input_buffer))
+				return GST_FLOW_ERROR;
+
+			/* Only a quality level change, which requires measuring the load, replays these */
+			if (G_UNLIKELY(measure_load))
+				gst_mpg123_add_catch_up_frame(mpg123_decoder->quality_replay_frames, input_buffer);
+		}
+
+		/* Try to decode a frame */
+		decoded_bytes = NULL;
+		num_decoded_bytes = 0;
+
+		decode_start = measure_load ? g_get_monotonic_time() : 0;
+
+		GST_MPG123_PROBE(decode__start);
+		trace_start = gst_mpg123_trace_start();
+
+		decode_error = gst_mpg123_core_decode_frame(mpg123_decoder->core, &decoded_bytes, &num_decoded_bytes);
+
+		gst_mpg123_trace_stop(GST_MPG123_TRACE_PHASE_DECODE, trace_start);
+		GST_MPG123_PROBE2(decode__done, decode_error, num_decoded_bytes);
+
+		gst_mpg123_update_buffered_input_size(mpg123_decoder);
+	}
+
+	retval = GST_FLOW_OK;
+
 	switch (decode_error)
 	{
 		case MPG123_NEW_FORMAT:
@@ -348,28 +1840,50 @@ static GstFlowReturn gst_mpg123_handle_frame(GstAudioDecoder *dec, GstBuffer *in
 			*/
 
 			GST_LOG_OBJECT(dec, "mpg123 reported a new format -> setting next srccaps");
-			
+
+			/* Any samples decoded along with the format change are not in the format the cache would file them under */
+			mpg123_decoder->pcm_cache_store = FALSE;
 			gst_mpg123_push_decoded_bytes(mpg123_decoder, decoded_bytes, num_decoded_bytes);
 
-			/*
-			If there is a next audioinfo, use it, then set has_next_audioinfo to FALSE, to make sure
-			gst_audio_decoder_set_output_format() isn't called again until set_format is called by the base class
-			*/
-			if (mpg123_decoder->has_next_audioinfo)
-			{
-				if (!gst_audio_decoder_set_output_format(dec, &(mpg123_decoder->next_audioinfo)))
-				{
-					GST_WARNING_OBJECT(dec, "Unable to set output format");
-					retval = GST_FLOW_NOT_NEGOTIATED;
-				}
-				mpg123_decoder->has_next_audioinfo = FALSE;
-			}
+			retval = gst_mpg123_apply_next_audioinfo(mpg123_decoder);
 
 			break;
 
 		case MPG123_NEED_MORE:
 		case MPG123_OK:
+			if (G_UNLIKELY(discard_output) && (num_decoded_bytes > 0))
+			{
+				GST_LOG_OBJECT(dec, "discarding output of pre-roll frame");
+				retval = gst_mpg123_finish_frame(mpg123_decoder, NULL);
+				break;
+			}
+
 			retval = gst_mpg123_push_decoded_bytes(mpg123_decoder, decoded_bytes, num_decoded_bytes);
+
+			if (G_UNLIKELY(measure_load) && (num_decoded_bytes > 0) && (retval == GST_FLOW_OK))
+			{
+				if (!gst_mpg123_update_decode_load(mpg123_decoder, g_get_monotonic_time() - decode_start, num_decoded_bytes))
+					return GST_FLOW_ERROR;
+			}
+
+			if (num_decoded_bytes > 0)
+			{
+				if (G_UNLIKELY(!mpg123_decoder->stream_info_posted))
+					gst_mpg123_post_stream_info(mpg123_decoder);
+
+				/*
+				In fast scan mode, the first decoded frame is enough to preroll downstream; from here on,
+				frames are only parsed. mpg123_tell() counts the samples decoded so far, so the scan starts
+				with these.
+				*/
+				if (mpg123_decoder->fast_scan)
+				{
+					GST_DEBUG_OBJECT(dec, "first frame decoded, switching to fast scan");
+					mpg123_decoder->scanning = TRUE;
+					mpg123_decoder->num_scanned_samples = MAX(mpg123_tell(mpg123_decoder->handle), 0);
+					mpg123_decoder->num_scanned_input_samples = 0;
+				}
+			}
 			break;
 
 		case MPG123_DONE:
@@ -420,18 +1934,569 @@ static GstFlowReturn gst_mpg123_handle_frame(GstAudioDecoder *dec, GstBuffer *in
 }
 
 
-static gboolean gst_mpg123_set_format(GstAudioDecoder *dec, GstCaps *input_caps)
+static GstFlowReturn gst_mpg123_handle_frame(GstAudioDecoder *dec, GstBuffer *input_buffer)
 {
-/*
-	Using the parsed information upstream, and the list of allowed caps downstream, this code
-	tries to find a suitable audio info. It is important to keep in mind that the rate and number of channels
-	should never deviate from the one the bitstream has, otherwise mpg123 has to mix channels and/or
-	resample (and as its docs say, its internal resampler is very crude). The sample format, however,
-	can be chosen freely, because the MPEG specs do not mandate any special format.
-	Therefore, rate and number of channels are taken from upstream (which parsed the MPEG frames, so
-	the incoming_caps contain exactly the rate and number of channels the bitstream actually has), while
-	the sample format is chosen by trying out all caps that are allowed by downstream. This way, the output
-	is adjusted to what the downstream prefers.
+	GstMpg123 *mpg123_decoder;
+	GstMpg123FrameAction action;
+	GstFlowReturn retval;
+
+	mpg123_decoder = GST_MPG123(dec);
+
+	g_assert(mpg123_decoder->handle != NULL);
+
+	/* This has to be determined here, since the output segment is protected by the stream lock */
+	action = (input_buffer != NULL) ? gst_mpg123_get_frame_action(mpg123_decoder, input_buffer) : GST_MPG123_FRAME_ACTION_DECODE;
+
+	if (mpg123_decoder->async_input_queue == NULL)
+		return gst_mpg123_decode_input(mpg123_decoder, input_buffer, action);
+
+	retval = gst_mpg123_async_push_input(mpg123_decoder, input_buffer, action);
+
+	/* When draining, everything queued so far (including the drain itself) has to be done before returning */
+	if ((input_buffer == NULL) && (retval == GST_FLOW_OK))
+		retval = gst_mpg123_async_wait_until_idle(mpg123_decoder, FALSE);
+
+	return retval;
+}
+
+
+/*
+Asynchronous decoding
+
+The streaming thread pushes input buffers (along with their frame action) into a lock-free SPSC queue,
+and the decoding thread pops them and runs gst_mpg123_decode_input(). Everything that needs the stream
+lock (finishing frames, setting the output format) is pushed back through a second SPSC queue and
+executed by the streaming thread in gst_mpg123_async_publish_output(), which is done whenever it pushes
+new input or waits for the decoding thread. This way, the decoding thread never needs the stream lock,
+and the streaming thread can safely wait for it while holding the stream lock.
+
+The mpg123 handle belongs to the decoding thread as long as there are pending inputs. Code in the streaming
+thread which needs the handle (set_format, flush) first waits until the decoding thread is idle.
+
+Waiting uses progress counters: each side increments its counter whenever it changed the state of the
+queues, and the other side sleeps until the counter differs from the value it saw before checking the
+queues. The mutex and condition variable are only used if the other side is actually sleeping.
+*/
+
+
+static void gst_mpg123_async_start(GstMpg123 *mpg123_decoder)
+{
+	gboolean async_decode, shared_thread_pool;
+	guint depth;
+	GstMpg123SpscQueue *input_queue, *output_queue;
+
+	GST_OBJECT_LOCK(mpg123_decoder);
+	async_decode = mpg123_decoder->async_decode;
+	depth = mpg123_decoder->async_queue_depth;
+	shared_thread_pool = mpg123_decoder->shared_thread_pool;
+	GST_OBJECT_UNLOCK(mpg123_decoder);
+
+	if (!async_decode)
+		return;
+
+	input_queue = gst_mpg123_spsc_queue_new(depth);
+	output_queue = gst_mpg123_spsc_queue_new(gst_mpg123_spsc_queue_get_capacity(input_queue) * GST_MPG123_MAX_OUTPUTS_PER_INPUT);
+
+	GST_OBJECT_LOCK(mpg123_decoder);
+	mpg123_decoder->async_input_queue = input_queue;
+	mpg123_decoder->async_output_queue = output_queue;
+	GST_OBJECT_UNLOCK(mpg123_decoder);
+
+	g_atomic_int_set(&(mpg123_decoder->async_worker_progress), 0);
+	g_atomic_int_set(&(mpg123_decoder->async_streaming_progress), 0);
+	g_atomic_int_set(&(mpg123_decoder->async_worker_waiting), 0);
+	g_atomic_int_set(&(mpg123_decoder->async_streaming_waiting), 0);
+	g_atomic_int_set(&(mpg123_decoder->async_num_pending), 0);
+	g_atomic_int_set(&(mpg123_decoder->async_flushing), 0);
+	g_atomic_int_set(&(mpg123_decoder->async_quit), 0);
+	g_atomic_int_set(&(mpg123_decoder->async_pool_scheduled), 0);
+
+	/* Without a dedicated thread, jobs are submitted to the shared pool whenever there is input */
+	if (shared_thread_pool && (gst_mpg123_get_thread_pool() != NULL))
+	{
+		GST_INFO_OBJECT(mpg123_decoder, "using shared decoding thread pool with a queue depth of %u", gst_mpg123_spsc_queue_get_capacity(mpg123_decoder->async_input_queue));
+		return;
+	}
+
+	mpg123_decoder->async_thread = g_thread_new("mpg123dec", gst_mpg123_async_thread_func, mpg123_decoder);
+
+	GST_INFO_OBJECT(mpg123_decoder, "started decoding thread with a queue depth of %u", gst_mpg123_spsc_queue_get_capacity(mpg123_decoder->async_input_queue));
+}
+
+
+static void gst_mpg123_async_stop(GstMpg123 *mpg123_decoder)
+{
+	GstMpg123SpscQueue *input_queue, *output_queue;
+	gpointer item;
+	gint type;
+
+	if (mpg123_decoder->async_input_queue == NULL)
+		return;
+
+	g_mutex_lock(&(mpg123_decoder->async_mutex));
+	g_atomic_int_set(&(mpg123_decoder->async_quit), 1);
+	g_atomic_int_inc(&(mpg123_decoder->async_streaming_progress));
+	g_cond_broadcast(&(mpg123_decoder->async_cond));
+	g_mutex_unlock(&(mpg123_decoder->async_mutex));
+
+	if (mpg123_decoder->async_thread != NULL)
+	{
+		g_thread_join(mpg123_decoder->async_thread);
+		mpg123_decoder->async_thread = NULL;
+	}
+	else
+	{
+		/* A pool job that is already scheduled sees the quit flag and returns early */
+		while (TRUE)
+		{
+			gint progress = g_atomic_int_get(&(mpg123_decoder->async_worker_progress));
+			if (!g_atomic_int_get(&(mpg123_decoder->async_pool_scheduled)))
+				break;
+			gst_mpg123_async_wait_for_worker(mpg123_decoder, progress);
+		}
+	}
+
+	/* Discard whatever is left */
+	while (gst_mpg123_spsc_queue_pop(mpg123_decoder->async_input_queue, &item, &type))
+	{
+		if (item != NULL)
+			gst_buffer_unref(GST_BUFFER_CAST(item));
+	}
+	gst_mpg123_async_publish_output(mpg123_decoder, TRUE);
+
+	GST_OBJECT_LOCK(mpg123_decoder);
+	input_queue = mpg123_decoder->async_input_queue;
+	output_queue = mpg123_decoder->async_output_queue;
+	mpg123_decoder->async_input_queue = NULL;
+	mpg123_decoder->async_output_queue = NULL;
+	GST_OBJECT_UNLOCK(mpg123_decoder);
+
+	gst_mpg123_spsc_queue_free(input_queue);
+	gst_mpg123_spsc_queue_free(output_queue);
+
+	GST_INFO_OBJECT(mpg123_decoder, "stopped decoding thread");
+}
+
+
+static void gst_mpg123_async_wait_for_worker(GstMpg123 *mpg123_decoder, gint progress)
+{
+	g_mutex_lock(&(mpg123_decoder->async_mutex));
+	g_atomic_int_set(&(mpg123_decoder->async_streaming_waiting), 1);
+	while (g_atomic_int_get(&(mpg123_decoder->async_worker_progress)) == progress)
+		g_cond_wait(&(mpg123_decoder->async_cond), &(mpg123_decoder->async_mutex));
+	g_atomic_int_set(&(mpg123_decoder->async_streaming_waiting), 0);
+	g_mutex_unlock(&(mpg123_decoder->async_mutex));
+}
+
+
+static void gst_mpg123_async_wait_for_streaming(GstMpg123 *mpg123_decoder, gint progress)
+{
+	g_mutex_lock(&(mpg123_decoder->async_mutex));
+	g_atomic_int_set(&(mpg123_decoder->async_worker_waiting), 1);
+	while ((g_atomic_int_get(&(mpg123_decoder->async_streaming_progress)) == progress) && !g_atomic_int_get(&(mpg123_decoder->async_quit)))
+		g_cond_wait(&(mpg123_decoder->async_cond), &(mpg123_decoder->async_mutex));
+	g_atomic_int_set(&(mpg123_decoder->async_worker_waiting), 0);
+	g_mutex_unlock(&(mpg123_decoder->async_mutex));
+}
+
+
+static void gst_mpg123_async_signal(GstMpg123 *mpg123_decoder, volatile gint *progress, volatile gint *other_side_waiting)
+{
+	g_atomic_int_inc(progress);
+
+	if (g_atomic_int_get(other_side_waiting))
+	{
+		g_mutex_lock(&(mpg123_decoder->async_mutex));
+		g_cond_broadcast(&(mpg123_decoder->async_cond));
+		g_mutex_unlock(&(mpg123_decoder->async_mutex));
+	}
+}
+
+
+static void gst_mpg123_async_push_output(GstMpg123 *mpg123_decoder, gpointer item, GstMpg123AsyncOutputType type)
+{
+	while (TRUE)
+	{
+		gint progress = g_atomic_int_get(&(mpg123_decoder->async_streaming_progress));
+
+		if (gst_mpg123_spsc_queue_push(mpg123_decoder->async_output_queue, item, type))
+			break;
+
+		if (g_atomic_int_get(&(mpg123_decoder->async_quit)))
+		{
+			/* Shutting down, nobody will publish this anymore */
+			if ((type == GST_MPG123_ASYNC_OUTPUT_FINISH_FRAME) && (item != NULL))
+				gst_buffer_unref(GST_BUFFER_CAST(item));
+			else if (type == GST_MPG123_ASYNC_OUTPUT_FORMAT)
+				g_slice_free(GstAudioInfo, item);
+			else if (type == GST_MPG123_ASYNC_OUTPUT_TAGS)
+				gst_tag_list_unref((GstTagList *)item);
+			return;
+		}
+
+		gst_mpg123_async_wait_for_streaming(mpg123_decoder, progress);
+	}
+
+	gst_mpg123_async_signal(mpg123_decoder, &(mpg123_decoder->async_worker_progress), &(mpg123_decoder->async_streaming_waiting));
+}
+
+
+static GstFlowReturn gst_mpg123_async_publish_output(GstMpg123 *mpg123_decoder, gboolean discard)
+{
+	GstAudioDecoder *dec;
+	GstFlowReturn retval, item_retval;
+	gpointer item;
+	gint type;
+	gboolean published;
+
+	dec = GST_AUDIO_DECODER(mpg123_decoder);
+	retval = GST_FLOW_OK;
+	published = FALSE;
+
+	while (gst_mpg123_spsc_queue_pop(mpg123_decoder->async_output_queue, &item, &type))
+	{
+		item_retval = GST_FLOW_OK;
+		published = TRUE;
+
+		switch (type)
+		{
+			case GST_MPG123_ASYNC_OUTPUT_FINISH_FRAME:
+				if (discard)
+				{
+					if (item != NULL)
+						gst_buffer_unref(GST_BUFFER_CAST(item));
+				}
+				else
+					item_retval = gst_mpg123_traced_finish_frame(mpg123_decoder, GST_BUFFER_CAST(item));
+				break;
+
+			case GST_MPG123_ASYNC_OUTPUT_FORMAT:
+				if (!discard && !gst_audio_decoder_set_output_format(dec, (GstAudioInfo *)item))
+				{
+					GST_WARNING_OBJECT(dec, "Unable to set output format");
+					item_retval = GST_FLOW_NOT_NEGOTIATED;
+				}
+				g_slice_free(GstAudioInfo, item);
+				break;
+
+			case GST_MPG123_ASYNC_OUTPUT_TAGS:
+				if (!discard)
+					gst_audio_decoder_merge_tags(dec, (GstTagList *)item, GST_TAG_MERGE_REPLACE);
+				gst_tag_list_unref((GstTagList *)item);
+				break;
+
+			case GST_MPG123_ASYNC_OUTPUT_FLOW:
+				if (!discard)
+					item_retval = (GstFlowReturn)GPOINTER_TO_INT(item);
+				break;
+
+			default:
+				g_assert_not_reached();
+		}
+
+		/* The first non-OK flow return is the one that counts */
+		if (retval == GST_FLOW_OK)
+			retval = item_retval;
+	}
+
+	/* Let the decoding thread know there is room in the output queue again */
+	if (published)
+	{
+		gst_mpg123_async_signal(mpg123_decoder, &(mpg123_decoder->async_streaming_progress), &(mpg123_decoder->async_worker_waiting));
+		gst_mpg123_thread_pool_schedule(mpg123_decoder);
+	}
+
+	return retval;
+}
+
+
+static GstFlowReturn gst_mpg123_async_push_input(GstMpg123 *mpg123_decoder, GstBuffer *input_buffer, GstMpg123FrameAction action)
+{
+	GstFlowReturn retval, publish_retval;
+
+	retval = GST_FLOW_OK;
+
+	/* The base class keeps its own reference until the frame is finished, but that may happen before the decoding thread is done with it */
+	if (input_buffer != NULL)
+	{
+		gst_buffer_ref(input_buffer);
+		g_atomic_int_add(&(mpg123_decoder->async_queued_input_size), (gint)gst_buffer_get_size(input_buffer));
+	}
+
+	g_atomic_int_inc(&(mpg123_decoder->async_num_pending));
+
+	while (TRUE)
+	{
+		gint progress = g_atomic_int_get(&(mpg123_decoder->async_worker_progress));
+
+		if (gst_mpg123_spsc_queue_push(mpg123_decoder->async_input_queue, input_buffer, action))
+			break;
+
+		/* The queue is full; publishing output allows the decoding thread to make progress if it is blocked */
+		publish_retval = gst_mpg123_async_publish_output(mpg123_decoder, FALSE);
+		if (retval == GST_FLOW_OK)
+			retval = publish_retval;
+
+		gst_mpg123_async_wait_for_worker(mpg123_decoder, progress);
+	}
+
+	gst_mpg123_async_signal(mpg123_decoder, &(mpg123_decoder->async_streaming_progress), &(mpg123_decoder->async_worker_waiting));
+	gst_mpg123_thread_pool_schedule(mpg123_decoder);
+
+	publish_retval = gst_mpg123_async_publish_output(mpg123_decoder, FALSE);
+	if (retval == GST_FLOW_OK)
+		retval = publish_retval;
+
+	return retval;
+}
+
+
+static GstFlowReturn gst_mpg123_async_wait_until_idle(GstMpg123 *mpg123_decoder, gboolean discard)
+{
+	GstFlowReturn retval, publish_retval;
+
+	retval = GST_FLOW_OK;
+
+	while (TRUE)
+	{
+		gint progress = g_atomic_int_get(&(mpg123_decoder->async_worker_progress));
+
+		publish_retval = gst_mpg123_async_publish_output(mpg123_decoder, discard);
+		if (retval == GST_FLOW_OK)
+			retval = publish_retval;
+
+		/* The decoding thread pushes all output of an input before marking it as done */
+		if ((g_atomic_int_get(&(mpg123_decoder->async_num_pending)) == 0) && (gst_mpg123_spsc_queue_get_fill_level(mpg123_decoder->async_output_queue) == 0))
+			break;
+
+		gst_mpg123_async_wait_for_worker(mpg123_decoder, progress);
+	}
+
+	return retval;
+}
+
+
+static gboolean gst_mpg123_async_decode_next_input(GstMpg123 *mpg123_decoder)
+{
+	gpointer item;
+	gint action;
+	GstFlowReturn retval;
+
+	if (!gst_mpg123_spsc_queue_pop(mpg123_decoder->async_input_queue, &item, &action))
+		return FALSE;
+
+	if (item != NULL)
+		g_atomic_int_add(&(mpg123_decoder->async_queued_input_size), -(gint)gst_buffer_get_size(GST_BUFFER_CAST(item)));
+
+	/* While flushing, queued input is dropped without decoding it */
+	if (!g_atomic_int_get(&(mpg123_decoder->async_flushing)))
+	{
+		retval = gst_mpg123_decode_input(mpg123_decoder, GST_BUFFER_CAST(item), (GstMpg123FrameAction)action);
+		if (retval != GST_FLOW_OK)
+			gst_mpg123_async_push_output(mpg123_decoder, GINT_TO_POINTER(retval), GST_MPG123_ASYNC_OUTPUT_FLOW);
+	}
+
+	if (item != NULL)
+		gst_buffer_unref(GST_BUFFER_CAST(item));
+
+	g_atomic_int_add(&(mpg123_decoder->async_num_pending), -1);
+	gst_mpg123_async_signal(mpg123_decoder, &(mpg123_decoder->async_worker_progress), &(mpg123_decoder->async_streaming_waiting));
+
+	return TRUE;
+}
+
+
+static gpointer gst_mpg123_async_thread_func(gpointer user_data)
+{
+	GstMpg123 *mpg123_decoder = GST_MPG123(user_data);
+
+	while (!g_atomic_int_get(&(mpg123_decoder->async_quit)))
+	{
+		gint progress = g_atomic_int_get(&(mpg123_decoder->async_streaming_progress));
+
+		if (!gst_mpg123_async_decode_next_input(mpg123_decoder))
+			gst_mpg123_async_wait_for_streaming(mpg123_decoder, progress);
+	}
+
+	return NULL;
+}
+
+
+/*
+Shared thread pool
+
+Instead of a dedicated thread per decoder, the decoder submits itself as a job to a process-wide
+GThreadPool whenever it has queued input. At most one job per decoder is scheduled at any time
+(tracked by async_pool_scheduled), which keeps the frames of a stream in order. A job decodes a
+limited number of frames and then resubmits itself, so that busy streams cannot starve the others.
+
+Jobs never block: a job only takes the next input frame if the output queue has enough room for
+everything decoding it can produce. Otherwise, it ends, and the streaming thread reschedules the
+decoder once it published the pending output.
+*/
+
+
+static GThreadPool* gst_mpg123_get_thread_pool(void)
+{
+	GThreadPool *pool;
+
+	g_mutex_lock(&gst_mpg123_thread_pool_mutex);
+
+	if (gst_mpg123_thread_pool == NULL)
+	{
+		GError *error = NULL;
+		gint num_threads = (gint)g_get_num_processors();
+
+		gst_mpg123_thread_pool = g_thread_pool_new(gst_mpg123_thread_pool_func, NULL, num_threads, FALSE, &error);
+		if (gst_mpg123_thread_pool == NULL)
+		{
+			GST_ERROR("could not create decoding thread pool: %s", error->message);
+			g_error_free(error);
+		}
+		else
+			GST_INFO("created decoding thread pool with %d threads", num_threads);
+	}
+
+	pool = gst_mpg123_thread_pool;
+
+	g_mutex_unlock(&gst_mpg123_thread_pool_mutex);
+
+	return pool;
+}
+
+
+static void gst_mpg123_thread_pool_schedule(GstMpg123 *mpg123_decoder)
+{
+	guint output_room;
+
+	/* Only applies to decoders without a dedicated thread */
+	if ((mpg123_decoder->async_input_queue == NULL) || (mpg123_decoder->async_thread != NULL))
+		return;
+
+	if (g_atomic_int_get(&(mpg123_decoder->async_quit)) || (gst_mpg123_spsc_queue_get_fill_level(mpg123_decoder->async_input_queue) == 0))
+		return;
+
+	output_room = gst_mpg123_spsc_queue_get_capacity(mpg123_decoder->async_output_queue) - gst_mpg123_spsc_queue_get_fill_level(mpg123_decoder->async_output_queue);
+	if (output_room < GST_MPG123_MAX_OUTPUTS_PER_INPUT)
+		return;
+
+	if (!g_atomic_int_compare_and_exchange(&(mpg123_decoder->async_pool_scheduled), 0, 1))
+		return;
+
+	/* The job keeps the decoder alive until it is done */
+	gst_object_ref(mpg123_decoder);
+	mpg123_decoder->async_pool_submit_time = g_get_monotonic_time();
+	g_thread_pool_push(gst_mpg123_thread_pool, mpg123_decoder, NULL);
+}
+
+
+static void gst_mpg123_thread_pool_func(gpointer data, gpointer user_data)
+{
+	GstMpg123 *mpg123_decoder = GST_MPG123(data);
+	gint64 start_time, end_time;
+	guint64 wait_time;
+	guint num_frames;
+
+	/* The pool is shared by all decoders; each task carries its decoder as data */
+	(void)user_data;
+
+	start_time = g_get_monotonic_time();
+	wait_time = (guint64)(start_time - mpg123_decoder->async_pool_submit_time);
+
+	for (num_frames = gst_mpg123_spsc_queue_get_capacity(mpg123_decoder->async_input_queue); num_frames > 0; --num_frames)
+	{
+		guint output_room;
+
+		if (g_atomic_int_get(&(mpg123_decoder->async_quit)))
+			break;
+
+		output_room = gst_mpg123_spsc_queue_get_capacity(mpg123_decoder->async_output_queue) - gst_mpg123_spsc_queue_get_fill_level(mpg123_decoder->async_output_queue);
+		if (output_room < GST_MPG123_MAX_OUTPUTS_PER_INPUT)
+			break;
+
+		if (!gst_mpg123_async_decode_next_input(mpg123_decoder))
+			break;
+	}
+
+	end_time = g_get_monotonic_time();
+
+	g_mutex_lock(&gst_mpg123_thread_pool_mutex);
+	gst_mpg123_thread_pool_num_jobs++;
+	gst_mpg123_thread_pool_total_wait_time += wait_time;
+	gst_mpg123_thread_pool_max_wait_time = MAX(gst_mpg123_thread_pool_max_wait_time, wait_time);
+	gst_mpg123_thread_pool_total_run_time += (guint64)(end_time - start_time);
+	g_mutex_unlock(&gst_mpg123_thread_pool_mutex);
+
+	/*
+	Input may have been queued after the last check, while the scheduled flag was still set, in which
+	case the streaming thread could not schedule a job. Check again after clearing the flag.
+	*/
+	g_atomic_int_set(&(mpg123_decoder->async_pool_scheduled), 0);
+	gst_mpg123_thread_pool_schedule(mpg123_decoder);
+
+	/* Wake up stop() if it is waiting for the job to finish */
+	gst_mpg123_async_signal(mpg123_decoder, &(mpg123_decoder->async_worker_progress), &(mpg123_decoder->async_streaming_waiting));
+
+	gst_object_unref(mpg123_decoder);
+}
+
+
+static GstStructure* gst_mpg123_get_thread_pool_stats(GstMpg123 *mpg123_decoder)
+{
+	GstStructure *stats;
+	guint num_threads, num_pending_jobs;
+	guint64 num_jobs, avg_wait_time, max_wait_time, avg_run_time;
+
+	g_mutex_lock(&gst_mpg123_thread_pool_mutex);
+	num_threads = (gst_mpg123_thread_pool != NULL) ? g_thread_pool_get_num_threads(gst_mpg123_thread_pool) : 0;
+	num_pending_jobs = (gst_mpg123_thread_pool != NULL) ? g_thread_pool_unprocessed(gst_mpg123_thread_pool) : 0;
+	num_jobs = gst_mpg123_thread_pool_num_jobs;
+	avg_wait_time = (num_jobs > 0) ? (gst_mpg123_thread_pool_total_wait_time / num_jobs) : 0;
+	max_wait_time = gst_mpg123_thread_pool_max_wait_time;
+	avg_run_time = (num_jobs > 0) ? (gst_mpg123_thread_pool_total_run_time / num_jobs) : 0;
+	g_mutex_unlock(&gst_mpg123_thread_pool_mutex);
+
+	/* Times are measured in microseconds, but reported as GstClockTime */
+	stats = gst_structure_new(
+		"application/x-mpg123-thread-pool-stats",
+		"num-threads", G_TYPE_UINT, num_threads,
+		"pending-jobs", G_TYPE_UINT, num_pending_jobs,
+		"completed-jobs", G_TYPE_UINT64, num_jobs,
+		"average-wait-time", G_TYPE_UINT64, (guint64)(avg_wait_time * GST_USECOND),
+		"max-wait-time", G_TYPE_UINT64, (guint64)(max_wait_time * GST_USECOND),
+		"average-run-time", G_TYPE_UINT64, (guint64)(avg_run_time * GST_USECOND),
+		NULL
+	);
+
+	/* The queues only exist while the element is running; the object lock protects them from being freed */
+	GST_OBJECT_LOCK(mpg123_decoder);
+	if (mpg123_decoder->async_input_queue != NULL)
+	{
+		gst_structure_set(
+			stats,
+			"input-queue-level", G_TYPE_UINT, gst_mpg123_spsc_queue_get_fill_level(mpg123_decoder->async_input_queue),
+			"input-queue-capacity", G_TYPE_UINT, gst_mpg123_spsc_queue_get_capacity(mpg123_decoder->async_input_queue),
+			NULL
+		);
+	}
+	GST_OBJECT_UNLOCK(mpg123_decoder);
+
+	return stats;
+}
+
+
+static gboolean gst_mpg123_set_format(GstAudioDecoder *dec, GstCaps *input_caps)
+{
+/*
+	Using the parsed information upstream, and the list of allowed caps downstream, this code
+	tries to find a suitable audio info. It is important to keep in mind that the rate and number of channels
+	should never deviate from the one the bitstream has, otherwise mpg123 has to mix channels and/or
+	resample (and as its docs say, its internal resampler is very crude). The sample format, however,
+	can be chosen freely, because the MPEG specs do not mandate any special format.
+	Therefore, rate and number of channels are taken from upstream (which parsed the MPEG frames, so
+	the incoming_caps contain exactly the rate and number of channels the bitstream actually has), while
+	the sample format is chosen by trying out all caps that are allowed by downstream. This way, the output
+	is adjusted to what the downstream prefers.
 
 	Also, the new output audio info is not set immediately. Instead, it is considered the "next audioinfo".
 	The code waits for mpg123 to notice the new format (= when mpg123_decode_frame() returns MPG123_NEW_FORMAT),
@@ -448,6 +2513,12 @@ static gboolean gst_mpg123_set_format(GstAudioDecoder *dec, GstCaps *input_caps)
 	3.2. if the combination of format with rate and channels is unsupported by mpg123, go to (3),
 	     or exit with error if there are no more structures to try
 	3.3. create next audioinfo out of rate,channels,format, and exit
+
+	There are two exceptions to the rule above. With force-rate, mpg123 resamples if downstream does not
+	accept the bitstream's rate, since its NtoM synthesis is cheaper than a separate resampler. And under
+	overload, the cpu-budget mode deliberately lets mpg123 down-sample and mix to mono (see
+	gst_mpg123_configure_output()). The input rate and channels and the chosen format are therefore kept,
+	so the output can be reconfigured without another set_format call.
 */
 
 
@@ -456,11 +2527,20 @@ static gboolean gst_mpg123_set_format(GstAudioDecoder *dec, GstCaps *input_caps)
 	GstCaps *allowed_srccaps;
 	guint structure_nr;
 	gboolean match_found = FALSE;
+	gboolean force_rate;
 
 	mpg123_decoder = GST_MPG123(dec);
 
+	GST_OBJECT_LOCK(mpg123_decoder);
+	force_rate = mpg123_decoder->force_rate;
+	GST_OBJECT_UNLOCK(mpg123_decoder);
+
 	g_assert (mpg123_decoder->handle != NULL);
 
+	/* The decoding thread must be done with the handle and next_audioinfo before they can be modified */
+	if (mpg123_decoder->async_input_queue != NULL)
+		gst_mpg123_async_wait_until_idle(mpg123_decoder, FALSE);
+
 	mpg123_decoder->has_next_audioinfo = FALSE;
 
 	/* Get rate and channels from input_caps */
@@ -484,6 +2564,9 @@ static gboolean gst_mpg123_set_format(GstAudioDecoder *dec, GstCaps *input_caps)
 
 		if (err)
 			return FALSE;
+
+		mpg123_decoder->input_rate = rate;
+		mpg123_decoder->input_channels = channels;
 	}
 
 	/* Get the caps that are allowed by downstream */
@@ -530,12 +2613,32 @@ static gboolean gst_mpg123_set_format(GstAudioDecoder *dec, GstCaps *input_caps)
 				continue;
 		}
 
+		mpg123_decoder->output_format = format;
+		mpg123_decoder->output_encoding = encoding;
+		/* The caps are normalized, so if downstream accepts both layouts, there are separate structures for each, in downstream's order of preference */
+		mpg123_decoder->output_non_interleaved = (g_strcmp0(gst_structure_get_string(structure, "layout"), "non-interleaved") == 0);
+
+		/* With force-rate, the rate is taken from downstream if it does not accept the bitstream's rate */
+		mpg123_decoder->forced_rate = 0;
+		if (force_rate)
+		{
+			GstStructure *fixated = gst_structure_copy(structure);
+			gint downstream_rate;
+
+			/* Keeps the bitstream's rate if downstream accepts it, and picks the closest one otherwise */
+			gst_structure_fixate_field_nearest_int(fixated, "rate", rate);
+			if (gst_structure_get_int(fixated, "rate", &downstream_rate) && (downstream_rate != rate))
+			{
+				GST_DEBUG_OBJECT(dec, "downstream does not accept %d Hz, resampling to %d Hz", rate, downstream_rate);
+				mpg123_decoder->forced_rate = downstream_rate;
+			}
+			gst_structure_free(fixated);
+		}
+
 		{
 			int err;
 
-			/* Cleanup old formats & set new one */
-			mpg123_format_none(mpg123_decoder->handle);
-			err = mpg123_format(mpg123_decoder->handle, rate, channels, encoding);
+			err = gst_mpg123_configure_output(mpg123_decoder);
 			if (err != MPG123_OK)
 			{
 				GST_DEBUG_OBJECT(
@@ -548,10 +2651,15 @@ static gboolean gst_mpg123_set_format(GstAudioDecoder *dec, GstCaps *input_caps)
 			}
 		}
 
-		gst_audio_info_init(&(mpg123_decoder->next_audioinfo));
-		gst_audio_info_set_format(&(mpg123_decoder->next_audioinfo), format, rate, channels, NULL);
-		GST_LOG_OBJECT(dec, "The next audio format is: %s, %u Hz, %u channels", format_str, rate, channels);
-		mpg123_decoder->has_next_audioinfo = TRUE;
+		/*
+		If the output format does not actually change (typically the next track of a playlist), there is
+		nothing to renegotiate; the current output simply continues.
+		*/
+		if (gst_audio_info_is_equal(&(mpg123_decoder->next_audioinfo), &(mpg123_decoder->output_audioinfo)) && (mpg123_decoder->next_conversion == mpg123_decoder->conversion))
+		{
+			GST_DEBUG_OBJECT(dec, "output format is unchanged, keeping it");
+			mpg123_decoder->has_next_audioinfo = FALSE;
+		}
 
 		match_found = TRUE;
 		
@@ -564,36 +2672,290 @@ static gboolean gst_mpg123_set_format(GstAudioDecoder *dec, GstCaps *input_caps)
 }
 
 
-static void gst_mpg123_flush(GstAudioDecoder *dec, gboolean hard)
+static GstCaps* gst_mpg123_sink_getcaps(GstAudioDecoder *dec, GstCaps *filter)
 {
-	int error;
-	GstMpg123 *mpg123_decoder;
+	GstMpg123 *mpg123_decoder = GST_MPG123(dec);
+	gboolean force_rate;
+	GstCaps *caps, *template_caps, *result;
+	guint i;
 
-	hard = hard;
+	GST_OBJECT_LOCK(mpg123_decoder);
+	force_rate = mpg123_decoder->force_rate;
+	GST_OBJECT_UNLOCK(mpg123_decoder);
 
-	GST_LOG_OBJECT(dec, "Flushing decoder");
+	/* This is what the base class does by default */
+	if (!force_rate)
+		return gst_audio_decoder_proxy_getcaps(dec, NULL, filter);
 
-	mpg123_decoder = GST_MPG123(dec);
+	/*
+	The default proxies the rates downstream accepts to upstream, so a stream with any other rate would be
+	refused before set_format gets a chance to resample. With force-rate, all rates in the sink template
+	are fine, so the rate restriction is removed again.
+	*/
+	caps = gst_caps_make_writable(gst_audio_decoder_proxy_getcaps(dec, NULL, NULL));
+	for (i = 0; i < gst_caps_get_size(caps); ++i)
+		gst_structure_remove_field(gst_caps_get_structure(caps, i), "rate");
 
-	g_assert (mpg123_decoder->handle != NULL);
+	template_caps = gst_pad_get_pad_template_caps(GST_AUDIO_DECODER_SINK_PAD(dec));
+	result = gst_caps_intersect_full(caps, template_caps, GST_CAPS_INTERSECT_FIRST);
+	gst_caps_unref(template_caps);
+	gst_caps_unref(caps);
+
+	if (filter != NULL)
+	{
+		caps = result;
+		result = gst_caps_intersect_full(filter, caps, GST_CAPS_INTERSECT_FIRST);
+		gst_caps_unref(caps);
+	}
+
+	return result;
+}
 
-	/* Flush by reopening the feed */
-	mpg123_close(mpg123_decoder->handle);
-	error = mpg123_open_feed(mpg123_decoder->handle);
+
+static gboolean gst_mpg123_reopen_feed(GstMpg123 *mpg123_decoder)
+{
+	int error;
+
+	error = gst_mpg123_core_reset(mpg123_decoder->core);
+	g_atomic_int_set(&(mpg123_decoder->buffered_input_size), 0);
 
 	if (G_UNLIKELY(error != MPG123_OK))
 	{
-		GST_ELEMENT_ERROR(dec, LIBRARY, INIT, (NULL),
+		GST_ELEMENT_ERROR(mpg123_decoder, LIBRARY, INIT, (NULL),
 			("Error while reopening mpg123 feed: %s",
 			 mpg123_plain_strerror(error)
 			)
 		);
-		mpg123_close(mpg123_decoder->handle);
-		mpg123_delete(mpg123_decoder->handle);
+		gst_mpg123_core_free(mpg123_decoder->core);
+		mpg123_decoder->core = NULL;
 		mpg123_decoder->handle = NULL;
+		return FALSE;
+	}
+
+	/* The decoder state starts over, and so does the hash chain of the PCM cache */
+	mpg123_decoder->num_silent_frames = 0;
+	mpg123_decoder->pcm_cache_hash = GST_MPG123_PCM_CACHE_INITIAL_HASH;
+	mpg123_decoder->pcm_cache_hash_valid = TRUE;
+	if (mpg123_decoder->pcm_cache_skipped_frames != NULL)
+		g_ptr_array_set_size(mpg123_decoder->pcm_cache_skipped_frames, 0);
+	if (mpg123_decoder->quality_replay_frames != NULL)
+		g_ptr_array_set_size(mpg123_decoder->quality_replay_frames, 0);
+
+	return TRUE;
+}
+
+
+static int gst_mpg123_configure_output(GstMpg123 *mpg123_decoder)
+{
+	int err, rate, channels, decode_encoding;
+	guint quality_level = mpg123_decoder->quality_level;
+	GstMpg123Conversion conversion;
+
+	/* Level 1 halves the rate (which roughly halves the synthesis work), level 2 additionally mixes to mono */
+	gst_mpg123_core_set_quality(mpg123_decoder->core, (quality_level >= 1) ? 1 : 0, quality_level >= 2);
+
+	/*
+	For 24 bit and unsigned formats, mpg123 synthesizes signed 32 or 16 bit samples and converts them with
+	generic scalar code, which the output then copies once more. Instead, mpg123 outputs the native format,
+	and the vectorized conversion writes straight into the output buffer.
+	*/
+	switch (mpg123_decoder->output_encoding)
+	{
+		case MPG123_ENC_SIGNED_24:   conversion = GST_MPG123_CONVERSION_S32_TO_S24; decode_encoding = MPG123_ENC_SIGNED_32; break;
+		case MPG123_ENC_UNSIGNED_24: conversion = GST_MPG123_CONVERSION_S32_TO_U24; decode_encoding = MPG123_ENC_SIGNED_32; break;
+		case MPG123_ENC_UNSIGNED_32: conversion = GST_MPG123_CONVERSION_S32_TO_U32; decode_encoding = MPG123_ENC_SIGNED_32; break;
+		case MPG123_ENC_UNSIGNED_16: conversion = GST_MPG123_CONVERSION_S16_TO_U16; decode_encoding = MPG123_ENC_SIGNED_16; break;
+		default:                     conversion = GST_MPG123_CONVERSION_NONE; decode_encoding = mpg123_decoder->output_encoding; break;
+	}
+
+	gst_mpg123_core_set_forced_rate(mpg123_decoder->core, mpg123_decoder->forced_rate);
+
+	err = gst_mpg123_core_set_output_format(mpg123_decoder->core, mpg123_decoder->input_rate, mpg123_decoder->input_channels, decode_encoding);
+
+	/* mpg123 can be built without 32 bit output; in that case, let it do the conversion itself (if it can) */
+	if ((err != MPG123_OK) && (conversion != GST_MPG123_CONVERSION_NONE))
+	{
+		GST_DEBUG_OBJECT(mpg123_decoder, "mpg123 cannot output the native format for the conversion, using its own conversion");
+		conversion = GST_MPG123_CONVERSION_NONE;
+		err = gst_mpg123_core_set_output_format(mpg123_decoder->core, mpg123_decoder->input_rate, mpg123_decoder->input_channels, mpg123_decoder->output_encoding);
+	}
+
+	if (err != MPG123_OK)
+		return err;
+
+	mpg123_decoder->next_conversion = conversion;
+
+	/* With down-sampling or NtoM resampling, mpg123 outputs a different rate than the bitstream has */
+	rate = gst_mpg123_core_get_output_rate(mpg123_decoder->core);
+	channels = (quality_level >= 2) ? 1 : mpg123_decoder->input_channels;
+
+	gst_audio_info_init(&(mpg123_decoder->next_audioinfo));
+	gst_audio_info_set_format(&(mpg123_decoder->next_audioinfo), mpg123_decoder->output_format, rate, channels, NULL);
+
+#if GST_CHECK_VERSION(1, 16, 0)
+	if (mpg123_decoder->output_non_interleaved)
+		mpg123_decoder->next_audioinfo.layout = GST_AUDIO_LAYOUT_NON_INTERLEAVED;
+#endif
+
+	GST_LOG_OBJECT(mpg123_decoder, "The next audio format is: %s, %d Hz, %d channels, %s", gst_audio_format_to_string(mpg123_decoder->output_format), rate, channels, mpg123_decoder->output_non_interleaved ? "non-interleaved" : "interleaved");
+	mpg123_decoder->has_next_audioinfo = TRUE;
+
+	return MPG123_OK;
+}
+
+
+static gboolean gst_mpg123_set_quality_level(GstMpg123 *mpg123_decoder, guint quality_level)
+{
+	guint old_quality_level = mpg123_decoder->quality_level;
+	gdouble load = mpg123_decoder->decode_load;
+	GPtrArray *replay_frames;
+
+	mpg123_decoder->quality_level = quality_level;
+	if (gst_mpg123_configure_output(mpg123_decoder) != MPG123_OK)
+	{
+		/* Should not happen, since the reduced rates are checked by the core; keep decoding with the old format */
+		GST_WARNING_OBJECT(mpg123_decoder, "could not switch to quality level %u: %s", quality_level, mpg123_strerror(mpg123_decoder->handle));
+		mpg123_decoder->quality_level = old_quality_level;
+		if (gst_mpg123_configure_output(mpg123_decoder) != MPG123_OK)
+			return FALSE;
 	}
 
+	/*
+	mpg123 only picks up a new output format when it (re)starts a stream, so the feed is reopened, which
+	also drops the frame mpg123 holds back (see gst_mpg123_replay_frames()). Replaying the most recent
+	frames keeps that frame pending and restores the bit reservoir, just like catching up after PCM cache
+	hits; the first replayed frame reports MPG123_NEW_FORMAT, and the next audioinfo is applied there.
+	Reopening the feed clears the array, so a new one takes its place meanwhile.
+	*/
+	replay_frames = mpg123_decoder->quality_replay_frames;
+	mpg123_decoder->quality_replay_frames = g_ptr_array_new_with_free_func((GDestroyNotify)gst_buffer_unref);
+
+	if (!gst_mpg123_reopen_feed(mpg123_decoder))
+	{
+		g_ptr_array_unref(replay_frames);
+		return FALSE;
+	}
+
+	gst_mpg123_replay_frames(mpg123_decoder, replay_frames, FALSE);
+
+	/* The replayed frames are still the most recent ones for the next change */
+	g_ptr_array_unref(mpg123_decoder->quality_replay_frames);
+	mpg123_decoder->quality_replay_frames = replay_frames;
+
+	GST_INFO_OBJECT(mpg123_decoder, "switched from quality level %u to %u (load %.2f): %d Hz, %d channels", old_quality_level, mpg123_decoder->quality_level, load, GST_AUDIO_INFO_RATE(&(mpg123_decoder->next_audioinfo)), GST_AUDIO_INFO_CHANNELS(&(mpg123_decoder->next_audioinfo)));
+
+	gst_element_post_message(
+		GST_ELEMENT(mpg123_decoder),
+		gst_message_new_element(
+			GST_OBJECT(mpg123_decoder),
+			gst_structure_new(
+				"mpg123-quality",
+				"level", G_TYPE_UINT, mpg123_decoder->quality_level,
+				"rate", G_TYPE_INT, GST_AUDIO_INFO_RATE(&(mpg123_decoder->next_audioinfo)),
+				"channels", G_TYPE_INT, GST_AUDIO_INFO_CHANNELS(&(mpg123_decoder->next_audioinfo)),
+				"load", G_TYPE_DOUBLE, load,
+				NULL
+			)
+		)
+	);
+
+	/* Start over with the estimate, and wait for fresh QoS information */
+	mpg123_decoder->decode_load = 0.0;
+	mpg123_decoder->frames_since_quality_change = 0;
+	g_atomic_int_set(&(mpg123_decoder->qos_late), 0);
+
+	return TRUE;
+}
+
+
+static gboolean gst_mpg123_update_decode_load(GstMpg123 *mpg123_decoder, gint64 elapsed, size_t num_decoded_bytes)
+{
+	gint cpu_budget;
+	gint bpf, rate;
+	gdouble frame_duration, load;
+	GstMpg123Conversion conversion;
+	gboolean late;
+
+	cpu_budget = g_atomic_int_get(&(mpg123_decoder->cpu_budget));
+
+	/* The budget was switched off while the quality was reduced */
+	if (cpu_budget == 0)
+		return (mpg123_decoder->quality_level == 0) || gst_mpg123_set_quality_level(mpg123_decoder, 0);
+
+	/* num_decoded_bytes is in mpg123's native format, which is not the output format if there is a conversion */
+	conversion = mpg123_decoder->conversion;
+	if (conversion != GST_MPG123_CONVERSION_NONE)
+		bpf = gst_mpg123_conversion_get_source_size(conversion) * GST_AUDIO_INFO_CHANNELS(&(mpg123_decoder->output_audioinfo));
+	else
+		bpf = GST_AUDIO_INFO_BPF(&(mpg123_decoder->output_audioinfo));
+	rate = GST_AUDIO_INFO_RATE(&(mpg123_decoder->output_audioinfo));
+	if (G_UNLIKELY((bpf == 0) || (rate == 0)))
+		return TRUE;
+
+	/*
+	The load is the time spent decoding a frame relative to its playback duration; 1.0 means decoding
+	just keeps up with realtime. It is smoothed with an exponential moving average, since single frames
+	can take much longer, for example when the thread gets preempted.
+	*/
+	frame_duration = (gdouble)(num_decoded_bytes / bpf) * G_USEC_PER_SEC / rate;
+	load = (gdouble)elapsed / frame_duration;
+
+	if (mpg123_decoder->frames_since_quality_change == 0)
+		mpg123_decoder->decode_load = load;
+	else
+		mpg123_decoder->decode_load = mpg123_decoder->decode_load * 0.9 + load * 0.1;
+	mpg123_decoder->frames_since_quality_change++;
+
+	if (mpg123_decoder->frames_since_quality_change < GST_MPG123_QUALITY_HOLDOFF_FRAMES)
+		return TRUE;
+
+	late = g_atomic_int_get(&(mpg123_decoder->qos_late));
+
+	/* Only go back up once there is plenty of headroom, since a higher level needs considerably more time per frame */
+	if (((mpg123_decoder->decode_load * 100.0 > cpu_budget) || late) && (mpg123_decoder->quality_level < GST_MPG123_MAX_QUALITY_LEVEL))
+		return gst_mpg123_set_quality_level(mpg123_decoder, mpg123_decoder->quality_level + 1);
+	else if ((mpg123_decoder->decode_load * 100.0 < cpu_budget / 3.0) && !late && (mpg123_decoder->quality_level > 0))
+		return gst_mpg123_set_quality_level(mpg123_decoder, mpg123_decoder->quality_level - 1);
+
+	return TRUE;
+}
+
+
+static void gst_mpg123_flush(GstAudioDecoder *dec, gboolean hard)
+{
+	GstMpg123 *mpg123_decoder;
+
+	hard = hard;
+
+	GST_LOG_OBJECT(dec, "Flushing decoder");
+
+	mpg123_decoder = GST_MPG123(dec);
+
+	g_assert (mpg123_decoder->handle != NULL);
+
+	/* Let the decoding thread drop all queued input, and throw away what it produced so far */
+	if (mpg123_decoder->async_input_queue != NULL)
+	{
+		g_atomic_int_set(&(mpg123_decoder->async_flushing), 1);
+		gst_mpg123_async_wait_until_idle(mpg123_decoder, TRUE);
+		g_atomic_int_set(&(mpg123_decoder->async_flushing), 0);
+	}
+
+	/* Flush by reopening the feed */
+	gst_mpg123_reopen_feed(mpg123_decoder);
+
 	mpg123_decoder->has_next_audioinfo = FALSE;
+	mpg123_decoder->trick_frame_counter = 0;
+
+	/* The scanned length is only meaningful if the scan started at the beginning of the stream */
+	mpg123_decoder->scanning = FALSE;
+	mpg123_decoder->num_scanned_samples = 0;
+	mpg123_decoder->num_scanned_input_samples = 0;
+	GST_OBJECT_LOCK(mpg123_decoder);
+	mpg123_decoder->scan_complete = FALSE;
+	/* The history must consist of consecutive frames */
+	gst_mpg123_clear_state_history(mpg123_decoder);
+	GST_OBJECT_UNLOCK(mpg123_decoder);
 
 	/*
 	opening/closing feeds do not affect the format defined by the mpg123_format() call that was made in
@@ -603,11 +2965,657 @@ static void gst_mpg123_flush(GstAudioDecoder *dec, gboolean hard)
 }
 
 
+static gboolean gst_mpg123_sink_event(GstAudioDecoder *dec, GstEvent *event)
+{
+	GstMpg123 *mpg123_decoder = GST_MPG123(dec);
+	gboolean is_stream_start;
+	gboolean ret;
+
+	is_stream_start = (GST_EVENT_TYPE(event) == GST_EVENT_STREAM_START);
+
+	/* The base class drains the frames of the previous stream when it gets stream-start, so the reset comes afterwards */
+	ret = GST_AUDIO_DECODER_CLASS(gst_mpg123_parent_class)->sink_event(dec, event);
+
+	if (is_stream_start)
+	{
+		GST_AUDIO_DECODER_STREAM_LOCK(dec);
+		gst_mpg123_begin_stream(mpg123_decoder);
+		GST_AUDIO_DECODER_STREAM_UNLOCK(dec);
+	}
+
+	return ret;
+}
+
+
+static void gst_mpg123_begin_stream(GstMpg123 *mpg123_decoder)
+{
+	/*
+	Playlists often follow one track with the next by just sending stream-start (and maybe new caps), without
+	a flush or a state change. The previous stream may have ended in the middle of a frame though, and its
+	bit reservoir, tags and length are not valid for the new stream. So only the bitstream state is reset;
+	the handle with all of its parameters stays, as does the output format. If the new stream has the same
+	format, set_format keeps it as well, and the output continues without renegotiation.
+	*/
+
+	if (mpg123_decoder->core == NULL)
+		return;
+
+	if (mpg123_decoder->async_input_queue != NULL)
+		gst_mpg123_async_wait_until_idle(mpg123_decoder, FALSE);
+
+	GST_DEBUG_OBJECT(mpg123_decoder, "new stream; resetting bitstream state");
+
+	if (!gst_mpg123_reopen_feed(mpg123_decoder))
+		return;
+
+	mpg123_decoder->stream_info_posted = FALSE;
+	mpg123_decoder->trick_frame_counter = 0;
+	mpg123_decoder->scanning = FALSE;
+	mpg123_decoder->num_scanned_samples = 0;
+	mpg123_decoder->num_scanned_input_samples = 0;
+	GST_OBJECT_LOCK(mpg123_decoder);
+	mpg123_decoder->stream_length = 0;
+	mpg123_decoder->stream_rate = 0;
+	mpg123_decoder->scan_complete = FALSE;
+	gst_mpg123_clear_state_history(mpg123_decoder);
+	GST_OBJECT_UNLOCK(mpg123_decoder);
+}
+
+
+
+
+
+static gboolean gst_mpg123_query_duration(GstMpg123 *mpg123_decoder, gint64 *duration)
+{
+	guint64 num_samples;
+	long rate;
+
+	/* This only uses values determined by the decoding code, since the mpg123 handle may be in use in another thread */
+	GST_OBJECT_LOCK(mpg123_decoder);
+	num_samples = mpg123_decoder->scan_complete ? mpg123_decoder->num_scanned_samples : mpg123_decoder->stream_length;
+	rate = mpg123_decoder->stream_rate;
+	GST_OBJECT_UNLOCK(mpg123_decoder);
+
+	if ((num_samples == 0) || (rate <= 0))
+		return FALSE;
+
+	*duration = gst_util_uint64_scale_int(num_samples, GST_SECOND, rate);
+
+	GST_LOG_OBJECT(mpg123_decoder, "duration: %" G_GUINT64_FORMAT " samples, %" GST_TIME_FORMAT, num_samples, GST_TIME_ARGS(*duration));
+
+	return TRUE;
+}
+
+
+static void gst_mpg123_set_output_pool(GstMpg123 *mpg123_decoder, GstBufferPool *pool)
+{
+	GstBufferPool *old_pool;
+
+	GST_OBJECT_LOCK(mpg123_decoder);
+	old_pool = mpg123_decoder->output_pool;
+	mpg123_decoder->output_pool = pool;
+	GST_OBJECT_UNLOCK(mpg123_decoder);
+
+	/* Buffers which are still in use are freed when they are released */
+	if (old_pool != NULL)
+	{
+		gst_buffer_pool_set_active(old_pool, FALSE);
+		gst_object_unref(old_pool);
+	}
+}
+
+
+static gboolean gst_mpg123_decide_allocation(GstAudioDecoder *dec, GstQuery *query)
+{
+	GstMpg123 *mpg123_decoder;
+	GstAllocator *allocator;
+	GstAllocationParams params;
+	GstBufferPool *pool;
+	GstStructure *config;
+	GstCaps *caps;
+
+	mpg123_decoder = GST_MPG123(dec);
+
+	if (!GST_AUDIO_DECODER_CLASS(gst_mpg123_parent_class)->decide_allocation(dec, query))
+		return FALSE;
+
+	if (mpg123_decoder->handle == NULL)
+		return TRUE;
+
+	/*
+	Set up a pool for the output buffers, using the allocator the base class picked. The buffers are
+	large enough for any frame mpg123 can decode (mpg123_outblock()), and are shrunk to the actual size
+	of the decoded frame.
+	*/
+	allocator = NULL;
+	gst_allocation_params_init(&params);
+	if (gst_query_get_n_allocation_params(query) > 0)
+		gst_query_parse_nth_allocation_param(query, 0, &allocator, &params);
+	gst_query_parse_allocation(query, &caps, NULL);
+
+#ifdef HAVE_GST_SHM_ALLOCATOR
+	/*
+	If downstream already proposed an fd allocator (unixfdsink does), its memory can be shared anyway.
+	Otherwise, the decoded samples would have to be copied into shareable memory downstream.
+	*/
+	{
+		gboolean shm_output;
+
+		GST_OBJECT_LOCK(mpg123_decoder);
+		shm_output = mpg123_decoder->shm_output;
+		GST_OBJECT_UNLOCK(mpg123_decoder);
+
+		if (shm_output && ((allocator == NULL) || !GST_IS_FD_ALLOCATOR(allocator)))
+		{
+			if (allocator != NULL)
+				gst_object_unref(allocator);
+			allocator = gst_shm_allocator_get();
+			GST_DEBUG_OBJECT(dec, "using shared memory allocator for output buffers");
+		}
+	}
+#endif
+
+	pool = gst_buffer_pool_new();
+	config = gst_buffer_pool_get_config(pool);
+	gst_buffer_pool_config_set_params(config, caps, mpg123_outblock(mpg123_decoder->handle), 0, 0);
+	gst_buffer_pool_config_set_allocator(config, allocator, &params);
+
+	if (!gst_buffer_pool_set_config(pool, config) || !gst_buffer_pool_set_active(pool, TRUE))
+	{
+		GST_WARNING_OBJECT(dec, "could not set up output buffer pool; allocating output buffers individually");
+		gst_object_unref(pool);
+		pool = NULL;
+	}
+
+	if (allocator != NULL)
+		gst_object_unref(allocator);
+
+	gst_mpg123_set_output_pool(mpg123_decoder, pool);
+
+	return TRUE;
+}
+
+
+static gboolean gst_mpg123_src_query(GstAudioDecoder *dec, GstQuery *query)
+{
+	GstMpg123 *mpg123_decoder = GST_MPG123(dec);
+
+	switch (GST_QUERY_TYPE(query))
+	{
+		case GST_QUERY_DURATION:
+		{
+			GstFormat format;
+			gint64 duration;
+			gboolean scan_complete;
+
+			gst_query_parse_duration(query, &format, NULL);
+			if (format != GST_FORMAT_TIME)
+				break;
+
+			/* An exact scan result beats anything upstream can estimate */
+			GST_OBJECT_LOCK(mpg123_decoder);
+			scan_complete = mpg123_decoder->scan_complete;
+			GST_OBJECT_UNLOCK(mpg123_decoder);
+
+			if (scan_complete && gst_mpg123_query_duration(mpg123_decoder, &duration))
+			{
+				gst_query_set_duration(query, GST_FORMAT_TIME, duration);
+				return TRUE;
+			}
+
+			/* Otherwise, prefer upstream (the parser), and fall back to mpg123's own estimate */
+			if (GST_AUDIO_DECODER_CLASS(gst_mpg123_parent_class)->src_query(dec, query))
+				return TRUE;
+
+			if (gst_mpg123_query_duration(mpg123_decoder, &duration))
+			{
+				gst_query_set_duration(query, GST_FORMAT_TIME, duration);
+				return TRUE;
+			}
+
+			return FALSE;
+		}
+
+		default:
+			break;
+	}
+
+	return GST_AUDIO_DECODER_CLASS(gst_mpg123_parent_class)->src_query(dec, query);
+}
+
+
+static gboolean gst_mpg123_src_event(GstAudioDecoder *dec, GstEvent *event)
+{
+	GstMpg123 *mpg123_decoder = GST_MPG123(dec);
+
+	/*
+	QoS events tell whether the buffers arrive at the sink too late. This catches overload the decode time
+	measurement cannot see, for example when other elements in the pipeline compete for the same CPU.
+	*/
+	if (GST_EVENT_TYPE(event) == GST_EVENT_QOS)
+	{
+		GstClockTimeDiff diff;
+
+		gst_event_parse_qos(event, NULL, NULL, &diff, NULL);
+		g_atomic_int_set(&(mpg123_decoder->qos_late), (diff > 0) ? 1 : 0);
+	}
+
+	return GST_AUDIO_DECODER_CLASS(gst_mpg123_parent_class)->src_event(dec, event);
+}
+
+
+
+
+
+/*
+State snapshots
+
+mpg123 offers no way to serialize its internal state (bit reservoir, synthesis history, stream position).
+However, that state is entirely determined by the last few frames: the bit reservoir of a layer III frame
+refers to at most 511 bytes of the preceding frames, and the synthesis history only spans one frame.
+So instead of the state itself, the most recent input frames are kept. A decoder which gets them via
+restore-state decodes them (discarding the output) before its first regular frame, which brings it
+into the same state as the decoder the snapshot was taken from. Only frames whose output is done are
+kept, so that the new decoder continues exactly where the output of the old one ends: with the frame
+the old decoder still held back, which is the frame at the saved position.
+*/
+
+
+static void gst_mpg123_clear_state_history(GstMpg123 *mpg123_decoder)
+{
+	guint i;
+
+	/* Must be called with the object lock held */
+
+	if (mpg123_decoder->state_history != NULL)
+	{
+		for (i = 0; i < mpg123_decoder->state_history_size; ++i)
+		{
+			if (mpg123_decoder->state_history[i] != NULL)
+			{
+				gst_buffer_unref(mpg123_decoder->state_history[i]);
+				mpg123_decoder->state_history[i] = NULL;
+			}
+		}
+	}
+
+	if (mpg123_decoder->state_pending_frame != NULL)
+	{
+		gst_buffer_unref(mpg123_decoder->state_pending_frame);
+		mpg123_decoder->state_pending_frame = NULL;
+	}
+
+	mpg123_decoder->state_history_pos = 0;
+	mpg123_decoder->state_history_fill = 0;
+	mpg123_decoder->state_position = GST_CLOCK_TIME_NONE;
+}
+
+
+static void gst_mpg123_update_state_history(GstMpg123 *mpg123_decoder, GstBuffer *input_buffer)
+{
+	GstBuffer *done_buffer, *old_buffer;
+
+	/*
+	Decoding lags one frame behind the input (see gst_mpg123_replay_frames()), so each new input frame (or
+	draining) completes the output of the frame before it. Only that frame enters the history, and the
+	position is the end of its output; the new frame stays pending until the next call. Input buffers are
+	not modified, so keeping references is enough.
+	*/
+	GST_OBJECT_LOCK(mpg123_decoder);
+
+	done_buffer = mpg123_decoder->state_pending_frame;
+	mpg123_decoder->state_pending_frame = (input_buffer != NULL) ? gst_buffer_ref(input_buffer) : NULL;
+
+	if (done_buffer == NULL)
+	{
+		GST_OBJECT_UNLOCK(mpg123_decoder);
+		return;
+	}
+
+	old_buffer = mpg123_decoder->state_history[mpg123_decoder->state_history_pos];
+	mpg123_decoder->state_history[mpg123_decoder->state_history_pos] = done_buffer;
+	mpg123_decoder->state_history_pos = (mpg123_decoder->state_history_pos + 1) % mpg123_decoder->state_history_size;
+	mpg123_decoder->state_history_fill = MIN(mpg123_decoder->state_history_fill + 1, mpg123_decoder->state_history_size);
+
+	if (GST_BUFFER_PTS_IS_VALID(done_buffer) && GST_BUFFER_DURATION_IS_VALID(done_buffer))
+		mpg123_decoder->state_position = GST_BUFFER_PTS(done_buffer) + GST_BUFFER_DURATION(done_buffer);
+	else
+		mpg123_decoder->state_position = GST_CLOCK_TIME_NONE;
+
+	GST_OBJECT_UNLOCK(mpg123_decoder);
+
+	if (old_buffer != NULL)
+		gst_buffer_unref(old_buffer);
+}
+
+
+static GstStructure* gst_mpg123_save_state(GstMpg123 *mpg123_decoder)
+{
+	GstStructure *state;
+	GValue frames = G_VALUE_INIT;
+	guint i, first;
+
+	GST_OBJECT_LOCK(mpg123_decoder);
+
+	if (mpg123_decoder->state_history_fill == 0)
+	{
+		GST_OBJECT_UNLOCK(mpg123_decoder);
+		GST_DEBUG_OBJECT(mpg123_decoder, "no state history available");
+		return NULL;
+	}
+
+	g_value_init(&frames, GST_TYPE_ARRAY);
+
+	/* Oldest frame first */
+	first = (mpg123_decoder->state_history_pos + mpg123_decoder->state_history_size - mpg123_decoder->state_history_fill) % mpg123_decoder->state_history_size;
+	for (i = 0; i < mpg123_decoder->state_history_fill; ++i)
+	{
+		GValue frame = G_VALUE_INIT;
+
+		g_value_init(&frame, GST_TYPE_BUFFER);
+		gst_value_set_buffer(&frame, mpg123_decoder->state_history[(first + i) % mpg123_decoder->state_history_size]);
+		gst_value_array_append_and_take_value(&frames, &frame);
+	}
+
+	state = gst_structure_new(
+		"mpg123-state",
+		"position", G_TYPE_UINT64, (guint64)(mpg123_decoder->state_position),
+		NULL
+	);
+
+	GST_OBJECT_UNLOCK(mpg123_decoder);
+
+	gst_structure_take_value(state, "frames", &frames);
+
+	GST_DEBUG_OBJECT(mpg123_decoder, "saved state: %" GST_PTR_FORMAT, (gpointer)state);
+
+	return state;
+}
+
+
+static gboolean gst_mpg123_restore_state(GstMpg123 *mpg123_decoder, GstStructure *state)
+{
+	GValue const *frames;
+	GPtrArray *restore_frames, *old_restore_frames;
+	guint i, num_frames;
+
+	if ((state == NULL) || !gst_structure_has_name(state, "mpg123-state"))
+	{
+		GST_WARNING_OBJECT(mpg123_decoder, "restore-state called without a valid state structure");
+		return FALSE;
+	}
+
+	frames = gst_structure_get_value(state, "frames");
+	if ((frames == NULL) || !GST_VALUE_HOLDS_ARRAY(frames))
+	{
+		GST_WARNING_OBJECT(mpg123_decoder, "state structure has no frames");
+		return FALSE;
+	}
+
+	num_frames = gst_value_array_get_size(frames);
+	restore_frames = g_ptr_array_new_full(num_frames, (GDestroyNotify)gst_buffer_unref);
+
+	for (i = 0; i < num_frames; ++i)
+	{
+		GValue const *frame = gst_value_array_get_value(frames, i);
+
+		if (!GST_VALUE_HOLDS_BUFFER(frame) || (gst_value_get_buffer(frame) == NULL))
+		{
+			GST_WARNING_OBJECT(mpg123_decoder, "state structure contains an invalid frame");
+			g_ptr_array_unref(restore_frames);
+			return FALSE;
+		}
+
+		g_ptr_array_add(restore_frames, gst_buffer_ref(gst_value_get_buffer(frame)));
+	}
+
+	GST_DEBUG_OBJECT(mpg123_decoder, "restoring state: %" GST_PTR_FORMAT, (gpointer)state);
+
+	/* The frames are replayed by the decoding code, since only it may use the mpg123 handle */
+	GST_OBJECT_LOCK(mpg123_decoder);
+	old_restore_frames = mpg123_decoder->restore_frames;
+	mpg123_decoder->restore_frames = restore_frames;
+	GST_OBJECT_UNLOCK(mpg123_decoder);
+
+	if (old_restore_frames != NULL)
+		g_ptr_array_unref(old_restore_frames);
+
+	return TRUE;
+}
+
+
+static void gst_mpg123_replay_frames(GstMpg123 *mpg123_decoder, GPtrArray *frames, gboolean decode_last_frame)
+{
+	guint i;
+
+	/*
+	The frames only serve to bring mpg123 into the right state, so they are decoded directly, without finishing
+	any frames; the decoded samples are simply dropped. If something goes wrong, the regular input still gets
+	decoded, just with the glitch the replay was meant to avoid.
+
+	Regular decoding lags one frame behind the input: mpg123 reports a new format for the first frame instead
+	of decoding it, so each later call decodes the frame fed one call earlier. If decode_last_frame is FALSE,
+	the replay keeps this lag, and the last frame is left for the next regular decoding call, which then
+	outputs exactly what it would have output without the replay. Otherwise, all frames are decoded, and the
+	next regular call outputs the samples of its own input frame.
+	*/
+	for (i = 0; i < frames->len; ++i)
+	{
+		unsigned char *decoded_bytes;
+		size_t num_decoded_bytes;
+		int error;
+
+		if (!gst_mpg123_feed_buffer(mpg123_decoder, g_ptr_array_index(frames, i)))
+			break;
+
+		error = gst_mpg123_core_decode_frame(mpg123_decoder->core, &decoded_bytes, &num_decoded_bytes);
+
+		/* mpg123 reports a new format before decoding the first frame in that format */
+		if (error == MPG123_NEW_FORMAT)
+		{
+			if (gst_mpg123_apply_next_audioinfo(mpg123_decoder) != GST_FLOW_OK)
+				break;
+			if (decode_last_frame)
+				error = gst_mpg123_core_decode_frame(mpg123_decoder->core, &decoded_bytes, &num_decoded_bytes);
+			else
+				error = MPG123_OK;
+		}
+
+		if ((error != MPG123_OK) && (error != MPG123_NEED_MORE))
+		{
+			GST_WARNING_OBJECT(mpg123_decoder, "could not replay frame %u: %s", i, mpg123_strerror(mpg123_decoder->handle));
+			break;
+		}
+	}
+
+	gst_mpg123_update_buffered_input_size(mpg123_decoder);
+}
+
+
+static void gst_mpg123_replay_restored_frames(GstMpg123 *mpg123_decoder)
+{
+	GPtrArray *restore_frames;
+
+	GST_OBJECT_LOCK(mpg123_decoder);
+	restore_frames = mpg123_decoder->restore_frames;
+	mpg123_decoder->restore_frames = NULL;
+	GST_OBJECT_UNLOCK(mpg123_decoder);
+
+	if (restore_frames == NULL)
+		return;
+
+	GST_DEBUG_OBJECT(mpg123_decoder, "replaying %u frames from restored state", restore_frames->len);
+
+	/*
+	The frames do not belong to the current stream as far as the base class is concerned, so none of them may
+	be output later. Their output was done by the decoder the state came from, so all of them are decoded.
+	*/
+	gst_mpg123_replay_frames(mpg123_decoder, restore_frames, TRUE);
+	g_ptr_array_unref(restore_frames);
+
+	/* The hash chain of the PCM cache does not cover the restored frames */
+	mpg123_decoder->pcm_cache_hash_valid = FALSE;
+}
+
+
+
+
+
+/*
+Decoded PCM cache
+
+The cache itself is in gstmpg123pcmcache.c. The decoder chains every input frame into a hash, which
+identifies the decoder state after that frame, and looks it up before decoding. On a hit, the cached
+buffer is finished instead, and the frame is not fed to mpg123 at all. Once a frame misses, mpg123
+has to catch up: it starts over with the last few skipped frames, like after a seek.
+
+Since decoding lags one frame behind the input (see gst_mpg123_replay_frames()), the buffer filed under
+the hash of frame N contains the samples of frame N-1. Catching up keeps the lag, so that the first
+frame after the hits outputs frame N-1 as well.
+*/
+
+
+static gboolean gst_mpg123_pcm_cache_catch_up(GstMpg123 *mpg123_decoder)
+{
+	GPtrArray *skipped_frames = mpg123_decoder->pcm_cache_skipped_frames;
+
+	if (skipped_frames->len == 0)
+		return TRUE;
+
+	GST_LOG_OBJECT(mpg123_decoder, "replaying %u frames to catch up after PCM cache hits", skipped_frames->len);
+
+	/* Reopening the feed clears the array, so a new one takes its place */
+	mpg123_decoder->pcm_cache_skipped_frames = g_ptr_array_new_with_free_func((GDestroyNotify)gst_buffer_unref);
+
+	if (!gst_mpg123_reopen_feed(mpg123_decoder))
+	{
+		g_ptr_array_unref(skipped_frames);
+		return FALSE;
+	}
+
+	gst_mpg123_replay_frames(mpg123_decoder, skipped_frames, FALSE);
+	g_ptr_array_unref(skipped_frames);
+
+	return TRUE;
+}
+
+
+static void gst_mpg123_add_catch_up_frame(GPtrArray *frames, GstBuffer *input_buffer)
+{
+	g_ptr_array_add(frames, gst_buffer_ref(input_buffer));
+
+	/*
+	Catching up only needs the most recent frames. The last frame stays pending after catching up, and
+	the one before it supplies the synthesis history; for that, it must be decoded correctly, which needs
+	all of its bit reservoir data in the frames before it. The oldest frame is dropped as long as the
+	remaining older frames still hold the largest possible reservoir.
+	*/
+	while (frames->len > GST_MPG123_SEGMENT_PREROLL_FRAMES)
+	{
+		gsize reservoir_size = 0;
+		guint i;
+
+		if (frames->len <= GST_MPG123_MAX_CATCH_UP_FRAMES)
+		{
+			for (i = 1; i < frames->len - GST_MPG123_SEGMENT_PREROLL_FRAMES; ++i)
+			{
+				gsize frame_size = gst_buffer_get_size(g_ptr_array_index(frames, i));
+				reservoir_size += (frame_size > GST_MPG123_MAX_FRAME_OVERHEAD) ? (frame_size - GST_MPG123_MAX_FRAME_OVERHEAD) : 0;
+			}
+
+			if (reservoir_size < GST_MPG123_MAX_RESERVOIR_SIZE)
+				break;
+		}
+
+		g_ptr_array_remove_index(frames, 0);
+	}
+}
+
+
+static void gst_mpg123_pcm_cache_add_skipped_frame(GstMpg123 *mpg123_decoder, GstBuffer *input_buffer)
+{
+	gst_mpg123_add_catch_up_frame(mpg123_decoder->pcm_cache_skipped_frames, input_buffer);
+}
+
+
+static gboolean gst_mpg123_pcm_cache_lookup_input(GstMpg123 *mpg123_decoder, GstBuffer *input_buffer, gboolean discard_output, GstFlowReturn *retval)
+{
+	GstMapInfo info;
+	guint64 hash = 0;
+	gboolean hash_valid;
+
+	mpg123_decoder->pcm_cache_store = FALSE;
+
+	hash_valid = mpg123_decoder->pcm_cache_hash_valid && gst_buffer_map(input_buffer, &info, GST_MAP_READ);
+	if (hash_valid)
+	{
+		hash = gst_mpg123_pcm_cache_hash_frame(mpg123_decoder->pcm_cache_hash, info.data, info.size);
+		gst_buffer_unmap(input_buffer, &info);
+	}
+
+	/* Frames decoded for their side effects must reach mpg123, and a hit cannot tell mpg123 about a new output format */
+	if (hash_valid && !discard_output && !mpg123_decoder->has_next_audioinfo)
+	{
+		GstBuffer *cached_buffer = gst_mpg123_pcm_cache_lookup(hash, &(mpg123_decoder->output_audioinfo), &(mpg123_decoder->pcm_cache_decoder_info));
+
+		if (cached_buffer != NULL)
+		{
+			gst_mpg123_pcm_cache_add_skipped_frame(mpg123_decoder, input_buffer);
+			mpg123_decoder->pcm_cache_hash = hash;
+			*retval = gst_mpg123_finish_frame(mpg123_decoder, cached_buffer);
+			return TRUE;
+		}
+	}
+
+	if (!gst_mpg123_pcm_cache_catch_up(mpg123_decoder))
+	{
+		*retval = GST_FLOW_ERROR;
+		return TRUE;
+	}
+
+	/* Catching up resets the hash chain, but the state after it is equivalent to having decoded all frames */
+	mpg123_decoder->pcm_cache_hash = hash;
+	mpg123_decoder->pcm_cache_hash_valid = hash_valid;
+	mpg123_decoder->pcm_cache_store = hash_valid && !discard_output && !mpg123_decoder->has_next_audioinfo;
+
+	return FALSE;
+}
+
+
 
 
 
 static gboolean plugin_init(GstPlugin *plugin)
 {
+	int error;
+
+	GST_DEBUG_CATEGORY_INIT(mpg123_debug, "mpg123", 0, "mpg123 mp3 decoder");
+
+#ifdef HAVE_GST_SHM_ALLOCATOR
+	gst_shm_allocator_init_once();
+#endif
+
+	/* Done once here instead of in class_init, so that a failure can be reported, and no element is registered */
+	error = gst_mpg123_core_global_init();
+	if (G_UNLIKELY(error != MPG123_OK))
+	{
+		GST_ERROR("Could not initialize mpg123 library: %s", mpg123_plain_strerror(error));
+		return FALSE;
+	}
+
+	gst_tag_register(GST_MPG123_TAG_BITRATE_MODE, GST_TAG_FLAG_META, G_TYPE_STRING, "bitrate mode", "bitrate mode of the MPEG audio stream (cbr, vbr, abr)", NULL);
+	gst_tag_register(GST_MPG123_TAG_ENCODER_DELAY, GST_TAG_FLAG_META, G_TYPE_UINT, "encoder delay", "number of samples the encoder prepended to the stream", NULL);
+	gst_tag_register(GST_MPG123_TAG_ENCODER_PADDING, GST_TAG_FLAG_META, G_TYPE_UINT, "encoder padding", "number of samples the encoder appended to the stream", NULL);
+
+#if GST_CHECK_VERSION(1, 8, 0)
+	if (!gst_tracer_register(plugin, "mpg123stats", gst_mpg123_tracer_get_type()))
+		return FALSE;
+#endif
+
+	/* Not autoplugged; it is only useful in pipelines built for it, since it has request pads */
+	if (!gst_element_register(plugin, "mpg123multidec", GST_RANK_NONE, gst_mpg123_multidec_get_type()))
+		return FALSE;
+
 	return gst_element_register(plugin, "mpg123", GST_RANK_SECONDARY + 1, gst_mpg123_get_type());
 }
 
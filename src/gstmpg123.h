@@ -25,6 +25,10 @@
 #include <gst/gst.h>
 #include <gst/audio/gstaudiodecoder.h>
 #include <mpg123.h>
+#include "gstmpg123core.h"
+#include "gstmpg123spscqueue.h"
+#include "gstmpg123simd.h"
+#include "gstmpg123pcmcache.h"
 
 
 G_BEGIN_DECLS
@@ -45,23 +49,114 @@ typedef struct _GstMpg123Class GstMpg123Class;
 #endif
 
 
+#ifdef GST_MPG123_USING_GSTREAMER_1_0
+/* Custom tags posted by the decoder in addition to the standard bitrate tags */
+#define GST_MPG123_TAG_BITRATE_MODE     "mpg123-bitrate-mode"
+#define GST_MPG123_TAG_ENCODER_DELAY    "mpg123-encoder-delay"
+#define GST_MPG123_TAG_ENCODER_PADDING  "mpg123-encoder-padding"
+#endif
+
+
 struct _GstMpg123
 {
 	GstAudioDecoder parent;
+	GstMpg123Core *core;
+	/* owned by core; kept here for the mpg123 queries */
 	mpg123_handle *handle;
 #ifdef GST_MPG123_USING_GSTREAMER_1_0
 	GstAudioInfo next_audioinfo;
 	gboolean has_next_audioinfo;
+	/* the format mpg123 currently decodes to; only accessed by the decoding code */
+	GstAudioInfo output_audioinfo;
 #else
 	GstCaps *next_srccaps;
 #endif
-	off_t frame_offset;
+#ifdef GST_MPG123_USING_GSTREAMER_1_0
+	gboolean fast_scan, scanning;
+	gboolean stream_info_posted;
+	/* num_scanned_samples is at the output rate; num_scanned_input_samples counts the skipped frames at the bitstream rate */
+	guint64 num_scanned_samples, num_scanned_input_samples;
+	gboolean scan_complete;
+	guint64 stream_length;
+	long stream_rate;
+	guint trick_frame_counter;
+
+	gboolean async_decode;
+	guint async_queue_depth;
+	GstMpg123SpscQueue *async_input_queue, *async_output_queue;
+	GThread *async_thread;
+	GMutex async_mutex;
+	GCond async_cond;
+	volatile gint async_worker_progress, async_streaming_progress;
+	volatile gint async_worker_waiting, async_streaming_waiting;
+	volatile gint async_num_pending;
+	volatile gint async_flushing, async_quit;
+	gboolean shared_thread_pool;
+	volatile gint async_pool_scheduled;
+	gint64 async_pool_submit_time;
+	gint feed_pool_size, feed_buffer_size;
+	gboolean seek_buffer;
+	guint down_sample;
+	gboolean shm_output;
+	gboolean force_rate;
+	guint64 pcm_cache_size;
+	gchar *decoder;
+	gboolean silence_gaps;
+	/* in percent of realtime; accessed atomically, since the decoding code reads it for every frame */
+	volatile gint cpu_budget;
+	/* adaptive quality state; only accessed by the decoding code */
+	guint quality_level;
+	gdouble decode_load;
+	guint frames_since_quality_change;
+	volatile gint qos_late;
+	/* the most recent decoded frames, which are replayed after a quality level change reopens the feed */
+	GPtrArray *quality_replay_frames;
+	/* the input format and the sample format chosen in set_format, for reconfiguring the output when the quality level changes */
+	gint input_rate, input_channels;
+	GstAudioFormat output_format;
+	int output_encoding;
+	gboolean output_non_interleaved;
+	/* rate mpg123 resamples to if downstream does not accept the input rate (force-rate); 0 = none */
+	gint forced_rate;
+	/* conversion from mpg123's native output to the output format; next_conversion is applied along with next_audioinfo */
+	GstMpg123Conversion conversion, next_conversion;
+	/* decoded PCM cache state; only accessed by the decoding code */
+	gboolean use_pcm_cache, pcm_cache_hash_valid, pcm_cache_store;
+	guint64 pcm_cache_hash;
+	/* the decoder settings the current output format was produced with, which are part of the cache keys */
+	GstMpg123PcmCacheDecoderInfo pcm_cache_decoder_info;
+	/* the most recent frames whose output came from the cache, which mpg123 has not seen */
+	GPtrArray *pcm_cache_skipped_frames;
+	/* silence detection state; only accessed by the decoding code */
+	gboolean use_silence_gaps;
+	guint num_silent_frames;
+	/* number of frames output as GAP buffers; protected by the object lock */
+	guint64 num_gap_frames;
+	gsize fixed_memory_usage;
+	volatile gint buffered_input_size, async_queued_input_size;
+	/* protected by the object lock, since the decoding thread acquires buffers while the streaming thread may renegotiate */
+	GstBufferPool *output_pool;
+	/* ring of references to the last input frames whose output is done, for save-state; protected by the object lock */
+	guint state_history_size;
+	GstBuffer **state_history;
+	guint state_history_pos, state_history_fill;
+	GstClockTime state_position;
+	/* the input frame mpg123 holds back, which enters the history once the next frame is decoded */
+	GstBuffer *state_pending_frame;
+	/* frames handed over by restore-state, replayed before the next input; protected by the object lock */
+	GPtrArray *restore_frames;
+#endif
 };
 
 
 struct _GstMpg123Class
 {
 	GstAudioDecoderClass parent_class;
+#ifdef GST_MPG123_USING_GSTREAMER_1_0
+	/* action signals */
+	GstStructure* (*save_state)(GstMpg123 *mpg123_decoder);
+	gboolean (*restore_state)(GstMpg123 *mpg123_decoder, GstStructure *state);
+#endif
 };
 
 
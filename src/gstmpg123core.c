@@ -0,0 +1,558 @@
+/*
+*   MP3 decoding plugin for GStreamer using the mpg123 library
+*   Copyright (C) 2012 Carlos Rafael Giani
+*
+*   This library is free software; you can redistribute it and/or
+*   modify it under the terms of the GNU Lesser General Public
+*   License as published by the Free Software Foundation; either
+*   version 2.1 of the License, or (at your option) any later version.
+*
+*   This library is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+*   Lesser General Public License for more details.
+*
+*   You should have received a copy of the GNU Lesser General Public
+*   License along with this library; if not, write to the Free Software
+*   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+
+
+#include <stdlib.h>
+#include <string.h>
+#include "gstmpg123core.h"
+
+
+/* Size of an ID3v2 header, and of the optional footer */
+#define ID3V2_HEADER_SIZE 10
+
+
+typedef enum
+{
+	/* Looking for an ID3v2 header; the first bytes are held back until it is clear whether they are one */
+	ID3V2_SKIP_CHECK_HEADER,
+	/* Inside a tag, dropping its bytes */
+	ID3V2_SKIP_DROPPING,
+	/* The audio data started */
+	ID3V2_SKIP_DONE
+}
+Id3v2SkipState;
+
+
+struct _GstMpg123Core
+{
+	mpg123_handle *handle;
+	off_t frame_offset;
+	/* set if a frame was read by gst_mpg123_core_skip_frame() but not decoded */
+	int frame_pending;
+	int frame_by_frame;
+	/* set in frame-by-frame mode if a frame was read, but mpg123 reported a new format instead of decoding it */
+	int frame_ready;
+
+	int skip_id3v2;
+	Id3v2SkipState id3v2_skip_state;
+	unsigned char id3v2_header[ID3V2_HEADER_SIZE];
+	size_t id3v2_header_fill;
+	size_t id3v2_bytes_to_drop;
+	size_t num_skipped_tag_bytes;
+
+	int config_down_sample, requested_down_sample, down_sample;
+	int mono_mix;
+	long forced_rate, output_rate;
+};
+
+
+int gst_mpg123_core_global_init(void)
+{
+	return mpg123_init();
+}
+
+
+void gst_mpg123_core_config_init(GstMpg123CoreConfig *config)
+{
+	config->feed_pool_size = -1;
+	config->feed_buffer_size = -1;
+	config->seek_buffer = 1;
+	config->skip_id3v2 = 0;
+	config->down_sample = 0;
+	config->frame_by_frame = 0;
+	config->decoder = NULL;
+}
+
+
+GstMpg123Core* gst_mpg123_core_new(GstMpg123CoreConfig const *config, int *error)
+{
+	GstMpg123Core *core;
+	int err;
+
+	err = MPG123_OK;
+
+	core = calloc(1, sizeof(GstMpg123Core));
+	if (core == NULL)
+	{
+		if (error != NULL)
+			*error = MPG123_OUT_OF_MEM;
+		return NULL;
+	}
+
+	/* An unknown or unsupported decoder name makes this fail with MPG123_BAD_DECODER */
+	core->handle = mpg123_new(config->decoder, &err);
+	if (core->handle == NULL)
+	{
+		free(core);
+		if (error != NULL)
+			*error = err;
+		return NULL;
+	}
+
+	/*
+	Initially, the mpg123 handle comes with a set of default formats supported. This clears this set. 
+	This is necessary, since only one format shall be supported (see gst_mpg123_core_set_output_format()).
+	*/
+	mpg123_format_none(core->handle);
+
+	/* Built-in mpg123 support for gapless decoding is disabled for now, since it does not work well with seeking */
+	mpg123_param(core->handle, MPG123_REMOVE_FLAGS,  MPG123_GAPLESS,       0);
+	/* Tells mpg123 to use a small read-ahead buffer for better MPEG sync; essential for MP3 radio streams */
+	mpg123_param(core->handle, config->seek_buffer ? MPG123_ADD_FLAGS : MPG123_REMOVE_FLAGS, MPG123_SEEKBUFFER, 0);
+	/* Sets the resync limit to the end of the stream (e.g. don't give up prematurely) */
+	mpg123_param(core->handle, MPG123_RESYNC_LIMIT,  -1,                   0);
+	/* Don't let mpg123 resample output */
+	mpg123_param(core->handle, MPG123_REMOVE_FLAGS,  MPG123_AUTO_RESAMPLE, 0);
+	/* Don't let mpg123 print messages to stdout/stderr */
+	mpg123_param(core->handle, MPG123_ADD_FLAGS,     MPG123_QUIET,         0);
+	/* Limits for the buffers that hold fed input data; with many decoder instances, the defaults add up */
+	if (config->feed_pool_size >= 0)
+		mpg123_param(core->handle, MPG123_FEEDPOOL,   config->feed_pool_size,   0);
+	if (config->feed_buffer_size >= 0)
+		mpg123_param(core->handle, MPG123_FEEDBUFFER, config->feed_buffer_size, 0);
+	/*
+	In feed mode, mpg123 has to buffer an entire tag before it can parse or even skip it. Tags are therefore
+	dropped in gst_mpg123_core_feed(); the flag only covers tags mpg123 encounters elsewhere in the stream.
+	*/
+	core->skip_id3v2 = config->skip_id3v2;
+	core->id3v2_skip_state = core->skip_id3v2 ? ID3V2_SKIP_CHECK_HEADER : ID3V2_SKIP_DONE;
+	if (core->skip_id3v2)
+		mpg123_param(core->handle, MPG123_ADD_FLAGS, MPG123_SKIP_ID3V2, 0);
+	/* mpg123 supports 2:1 and 4:1 down-sampling in the synthesis; the parameter is set along with the output format */
+	core->config_down_sample = (config->down_sample < 0) ? 0 : ((config->down_sample > 2) ? 2 : config->down_sample);
+	core->requested_down_sample = core->config_down_sample;
+	core->mono_mix = 0;
+	core->forced_rate = 0;
+	core->output_rate = 0;
+	core->frame_by_frame = config->frame_by_frame;
+
+	/* Open in feed mode (= encoded data is fed manually into the handle). */
+	err = mpg123_open_feed(core->handle);
+	if (err != MPG123_OK)
+	{
+		mpg123_delete(core->handle);
+		free(core);
+		if (error != NULL)
+			*error = err;
+		return NULL;
+	}
+
+	if (error != NULL)
+		*error = MPG123_OK;
+
+	return core;
+}
+
+
+void gst_mpg123_core_free(GstMpg123Core *core)
+{
+	if (core == NULL)
+		return;
+
+	mpg123_close(core->handle);
+	mpg123_delete(core->handle);
+	free(core);
+}
+
+
+mpg123_handle* gst_mpg123_core_get_handle(GstMpg123Core *core)
+{
+	return core->handle;
+}
+
+
+int gst_mpg123_core_reset(GstMpg123Core *core)
+{
+	/* Reset all bitstream state by reopening the feed */
+	mpg123_close(core->handle);
+	core->frame_pending = 0;
+	core->frame_ready = 0;
+	core->id3v2_skip_state = core->skip_id3v2 ? ID3V2_SKIP_CHECK_HEADER : ID3V2_SKIP_DONE;
+	core->id3v2_header_fill = 0;
+	core->id3v2_bytes_to_drop = 0;
+	return mpg123_open_feed(core->handle);
+}
+
+
+static int gst_mpg123_core_is_supported_rate(long rate)
+{
+	long const *rates;
+	size_t num_rates, i;
+
+	mpg123_rates(&rates, &num_rates);
+	for (i = 0; i < num_rates; ++i)
+	{
+		if (rates[i] == rate)
+			return 1;
+	}
+
+	return 0;
+}
+
+
+int gst_mpg123_core_set_output_format(GstMpg123Core *core, long rate, int channels, int encoding)
+{
+	int err;
+	long ntom_rate = 0;
+
+	if ((core->forced_rate > 0) && (core->forced_rate != rate))
+	{
+		/*
+		mpg123 switches to its NtoM synthesis when the output rate differs from the bitstream rate; it resamples
+		while synthesizing, so there is no separate resampling pass. It replaces the 2:1 and 4:1 down-sampling.
+		*/
+		core->down_sample = 0;
+		core->output_rate = core->forced_rate;
+		ntom_rate = core->forced_rate;
+	}
+	else
+	{
+		/* mpg123 only outputs the rates in its rate list, so for example 16 kHz can be halved, but not quartered */
+		core->down_sample = core->requested_down_sample;
+		while ((core->down_sample > 0) && !gst_mpg123_core_is_supported_rate(rate >> core->down_sample))
+			core->down_sample--;
+		core->output_rate = rate >> core->down_sample;
+	}
+
+	err = mpg123_param(core->handle, MPG123_DOWN_SAMPLE, core->down_sample, 0);
+	if (err != MPG123_OK)
+		return err;
+
+	/* This fails if mpg123 was built without NtoM support */
+	err = mpg123_param(core->handle, MPG123_FORCE_RATE, ntom_rate, 0);
+	if (err != MPG123_OK)
+		return err;
+
+	/* Mixing to mono only makes sense if there is more than one channel to begin with */
+	if (core->mono_mix && (channels > 1))
+	{
+		err = mpg123_param(core->handle, MPG123_ADD_FLAGS, MPG123_MONO_MIX, 0);
+		channels = 1;
+	}
+	else
+		err = mpg123_param(core->handle, MPG123_REMOVE_FLAGS, MPG123_FORCE_MONO, 0);
+	if (err != MPG123_OK)
+		return err;
+
+	/* Cleanup old formats & set new one */
+	mpg123_format_none(core->handle);
+	return mpg123_format(core->handle, core->output_rate, (channels > 1) ? MPG123_STEREO : MPG123_MONO, encoding);
+}
+
+
+void gst_mpg123_core_set_forced_rate(GstMpg123Core *core, long rate)
+{
+	core->forced_rate = (rate < 0) ? 0 : rate;
+}
+
+
+long gst_mpg123_core_get_output_rate(GstMpg123Core *core)
+{
+	return core->output_rate;
+}
+
+
+void gst_mpg123_core_set_quality(GstMpg123Core *core, int min_down_sample, int mono_mix)
+{
+	min_down_sample = (min_down_sample > 2) ? 2 : min_down_sample;
+	core->requested_down_sample = (min_down_sample > core->config_down_sample) ? min_down_sample : core->config_down_sample;
+	core->mono_mix = mono_mix;
+}
+
+
+int gst_mpg123_core_get_down_sample(GstMpg123Core *core)
+{
+	return core->down_sample;
+}
+
+
+/* Returns the total size of the tag if the header is a valid ID3v2 header, otherwise 0 */
+static size_t gst_mpg123_core_get_id3v2_tag_size(unsigned char const *header)
+{
+	size_t size;
+
+	/* "ID3", major version, revision, flags, and the tag size as a 28-bit "syncsafe" integer (7 bits per byte) */
+	if ((header[0] != 'I') || (header[1] != 'D') || (header[2] != '3'))
+		return 0;
+	if ((header[3] == 0xFF) || (header[4] == 0xFF))
+		return 0;
+	if ((header[6] | header[7] | header[8] | header[9]) & 0x80)
+		return 0;
+
+	size = ((size_t)header[6] << 21) | ((size_t)header[7] << 14) | ((size_t)header[8] << 7) | (size_t)header[9];
+	size += ID3V2_HEADER_SIZE;
+	/* flag bit 4 indicates a footer, which has the same size as the header */
+	if (header[5] & 0x10)
+		size += ID3V2_HEADER_SIZE;
+
+	return size;
+}
+
+
+int gst_mpg123_core_feed(GstMpg123Core *core, void const *data, size_t size)
+{
+	unsigned char const *bytes = (unsigned char const *)data;
+
+	/*
+	Drops ID3v2 tags as they stream through. Only the header is held back, so with multi-megabyte tags
+	(for example, embedded cover art), neither the memory usage nor the time until the first frame can
+	be decoded depend on the tag size.
+	*/
+	while ((core->id3v2_skip_state != ID3V2_SKIP_DONE) && (size > 0))
+	{
+		if (core->id3v2_skip_state == ID3V2_SKIP_DROPPING)
+		{
+			size_t num_dropped = (size < core->id3v2_bytes_to_drop) ? size : core->id3v2_bytes_to_drop;
+
+			bytes += num_dropped;
+			size -= num_dropped;
+			core->id3v2_bytes_to_drop -= num_dropped;
+			core->num_skipped_tag_bytes += num_dropped;
+
+			/* Several tags can follow each other, so look for another header afterwards */
+			if (core->id3v2_bytes_to_drop == 0)
+				core->id3v2_skip_state = ID3V2_SKIP_CHECK_HEADER;
+		}
+		else
+		{
+			size_t num_copied = ID3V2_HEADER_SIZE - core->id3v2_header_fill;
+			size_t tag_size;
+
+			if (num_copied > size)
+				num_copied = size;
+
+			memcpy(core->id3v2_header + core->id3v2_header_fill, bytes, num_copied);
+			core->id3v2_header_fill += num_copied;
+			bytes += num_copied;
+			size -= num_copied;
+
+			if (core->id3v2_header_fill < ID3V2_HEADER_SIZE)
+			{
+				/* Stop holding back data as soon as it cannot be a tag */
+				if (memcmp(core->id3v2_header, "ID3", (core->id3v2_header_fill < 3) ? core->id3v2_header_fill : 3) == 0)
+					continue;
+				tag_size = 0;
+			}
+			else
+				tag_size = gst_mpg123_core_get_id3v2_tag_size(core->id3v2_header);
+
+			if (tag_size > 0)
+			{
+				core->id3v2_skip_state = ID3V2_SKIP_DROPPING;
+				core->id3v2_bytes_to_drop = tag_size - ID3V2_HEADER_SIZE;
+				core->num_skipped_tag_bytes += ID3V2_HEADER_SIZE;
+				core->id3v2_header_fill = 0;
+			}
+			else
+			{
+				/* Not a tag; the held back bytes are the beginning of the audio data */
+				int error;
+
+				core->id3v2_skip_state = ID3V2_SKIP_DONE;
+				error = mpg123_feed(core->handle, core->id3v2_header, core->id3v2_header_fill);
+				core->id3v2_header_fill = 0;
+				if (error != MPG123_OK)
+					return error;
+			}
+		}
+	}
+
+	if (size == 0)
+		return MPG123_OK;
+
+	return mpg123_feed(core->handle, bytes, size);
+}
+
+
+int gst_mpg123_core_decode_frame(GstMpg123Core *core, unsigned char **decoded_bytes, size_t *num_decoded_bytes)
+{
+	int error;
+
+	if (core->frame_by_frame)
+	{
+		/* The frame read by the previous call is decoded now that the new format has been dealt with */
+		if (core->frame_ready)
+		{
+			core->frame_ready = 0;
+			return mpg123_framebyframe_decode(core->handle, &(core->frame_offset), decoded_bytes, num_decoded_bytes);
+		}
+
+		/* Reading the next frame also drops a frame left pending by gst_mpg123_core_skip_frame() */
+		core->frame_pending = 0;
+		error = mpg123_framebyframe_next(core->handle);
+		if (error == MPG123_NEW_FORMAT)
+			core->frame_ready = 1;
+		if (error != MPG123_OK)
+			return error;
+
+		return mpg123_framebyframe_decode(core->handle, &(core->frame_offset), decoded_bytes, num_decoded_bytes);
+	}
+
+	if (!core->frame_pending)
+		return mpg123_decode_frame(core->handle, &(core->frame_offset), decoded_bytes, num_decoded_bytes);
+
+	/*
+	A skipped frame is still pending inside mpg123, and mpg123_decode_frame() would decode it instead of the
+	frame that was just fed. mpg123_framebyframe_next() drops the pending frame and reads the next one.
+	*/
+	core->frame_pending = 0;
+	error = mpg123_framebyframe_next(core->handle);
+
+	/*
+	Just like mpg123_decode_frame(), report a new format without decoding; the frame stays pending and is
+	decoded by the next mpg123_decode_frame() call
+	*/
+	if (error != MPG123_OK)
+		return error;
+
+	return mpg123_framebyframe_decode(core->handle, &(core->frame_offset), decoded_bytes, num_decoded_bytes);
+}
+
+
+int gst_mpg123_core_skip_frame(GstMpg123Core *core)
+{
+	int error;
+
+	/*
+	Only read the frame (header, side info, main data) without running the synthesis. The frame is left
+	undecoded; see gst_mpg123_core_decode_frame() for how it is discarded.
+	*/
+	core->frame_ready = 0;
+	error = mpg123_framebyframe_next(core->handle);
+	if ((error == MPG123_OK) || (error == MPG123_NEW_FORMAT))
+		core->frame_pending = 1;
+
+	return error;
+}
+
+
+int gst_mpg123_core_decode(GstMpg123Core *core, void const *input, size_t input_size, void *output, size_t output_size, size_t *num_output_bytes)
+{
+	unsigned char *decoded_bytes;
+	size_t num_decoded_bytes;
+	int error;
+
+	*num_output_bytes = 0;
+
+	/* Checked upfront, since a decoded frame that does not fit would be lost */
+	if ((output == NULL) || (output_size < mpg123_outblock(core->handle)))
+		return MPG123_BAD_BUFFER;
+
+	if ((input != NULL) && (input_size > 0))
+	{
+		error = gst_mpg123_core_feed(core, input, input_size);
+		if (error != MPG123_OK)
+			return error;
+	}
+
+	decoded_bytes = NULL;
+	num_decoded_bytes = 0;
+	error = gst_mpg123_core_decode_frame(core, &decoded_bytes, &num_decoded_bytes);
+
+	if ((decoded_bytes != NULL) && (num_decoded_bytes > 0))
+	{
+		memcpy(output, decoded_bytes, num_decoded_bytes);
+		*num_output_bytes = num_decoded_bytes;
+	}
+
+	return error;
+}
+
+
+static unsigned int gst_mpg123_core_read_bits(unsigned char const *bytes, size_t bit_pos, unsigned int num_bits)
+{
+	unsigned int value = 0;
+
+	for (; num_bits > 0; --num_bits, ++bit_pos)
+		value = (value << 1) | ((bytes[bit_pos >> 3] >> (7 - (bit_pos & 7))) & 1);
+
+	return value;
+}
+
+
+size_t gst_mpg123_core_check_silent_frame(void const *data, size_t size)
+{
+	unsigned char const *bytes = data;
+	int version, lsf, num_channels, num_granules, i;
+	size_t bit_pos, granule_channel_bits;
+
+	if (size < 4)
+		return 0;
+
+	/* Frame sync and layer III */
+	if ((bytes[0] != 0xFF) || ((bytes[1] & 0xE0) != 0xE0) || (((bytes[1] >> 1) & 0x03) != 0x01))
+		return 0;
+
+	version = (bytes[1] >> 3) & 0x03;
+	if (version == 0x01)
+		return 0;
+	/* MPEG 2 and 2.5 have one granule per frame, and a slightly different side info layout */
+	lsf = (version != 0x03);
+	num_channels = (((bytes[3] >> 6) & 0x03) == 0x03) ? 1 : 2;
+	num_granules = lsf ? 1 : 2;
+
+	/* Header, and the CRC if the protection bit is not set */
+	bit_pos = 32;
+	if (!(bytes[1] & 0x01))
+		bit_pos += 16;
+
+	/* main_data_begin and private bits (and scfsi with MPEG 1), followed by the granule/channel blocks */
+	if (lsf)
+	{
+		bit_pos += 8 + num_channels;
+		granule_channel_bits = 63;
+	}
+	else
+	{
+		bit_pos += 9 + ((num_channels == 1) ? 5 : 3) + 4 * num_channels;
+		granule_channel_bits = 59;
+	}
+
+	if (((bit_pos + num_granules * num_channels * granule_channel_bits + 7) / 8) > size)
+		return 0;
+
+	/* part2_3_length is the first field of each block */
+	for (i = 0; i < num_granules * num_channels; ++i)
+	{
+		if (gst_mpg123_core_read_bits(bytes, bit_pos + i * granule_channel_bits, 12) != 0)
+			return 0;
+	}
+
+	return lsf ? 576 : 1152;
+}
+
+
+size_t gst_mpg123_core_get_num_skipped_tag_bytes(GstMpg123Core *core)
+{
+	return core->num_skipped_tag_bytes;
+}
+
+
+size_t gst_mpg123_core_get_max_output_size(GstMpg123Core *core)
+{
+	return mpg123_outblock(core->handle);
+}
+
+
+char const * gst_mpg123_core_get_error_string(GstMpg123Core *core)
+{
+	return mpg123_strerror(core->handle);
+}
@@ -0,0 +1,203 @@
+/*
+*   MP3 decoding plugin for GStreamer using the mpg123 library
+*   Copyright (C) 2012 Carlos Rafael Giani
+*
+*   This library is free software; you can redistribute it and/or
+*   modify it under the terms of the GNU Lesser General Public
+*   License as published by the Free Software Foundation; either
+*   version 2.1 of the License, or (at your option) any later version.
+*
+*   This library is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+*   Lesser General Public License for more details.
+*
+*   You should have received a copy of the GNU Lesser General Public
+*   License along with this library; if not, write to the Free Software
+*   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+
+
+#ifndef GSTMPG123CORE_H
+#define GSTMPG123CORE_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <mpg123.h>
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/*
+Decoding core shared by the GStreamer 0.10 and 1.0 elements. It owns an mpg123 handle in feed mode,
+and takes care of the handle setup, output format selection, and the frame decoding loop. It does not
+depend on GStreamer or GLib, so it can also be used directly by applications which just need to turn
+MP3 data into PCM, without the overhead of a pipeline.
+
+Typical direct use:
+
+  GstMpg123CoreConfig config;
+  GstMpg123Core *core;
+  int error;
+
+  gst_mpg123_core_global_init();
+  gst_mpg123_core_config_init(&config);
+  core = gst_mpg123_core_new(&config, &error);
+  gst_mpg123_core_set_output_format(core, 44100, 2, MPG123_ENC_SIGNED_16);
+
+  for each chunk of input data:
+    error = gst_mpg123_core_decode(core, chunk, chunk_size, pcm, pcm_size, &num_pcm_bytes);
+    while (error != MPG123_NEED_MORE)  (and error is not an actual error)
+      consume num_pcm_bytes bytes of pcm, then call gst_mpg123_core_decode(core, NULL, 0, pcm, pcm_size, &num_pcm_bytes)
+
+  gst_mpg123_core_free(core);
+
+All functions return mpg123 error codes (MPG123_OK, MPG123_NEED_MORE, MPG123_NEW_FORMAT, MPG123_DONE,
+or an error). A core must only be used by one thread at a time.
+*/
+typedef struct _GstMpg123Core GstMpg123Core;
+
+
+typedef struct
+{
+	/* Number of input buffers mpg123 keeps around for reuse; -1 = mpg123 default */
+	long feed_pool_size;
+	/* Minimum size of the input buffers mpg123 allocates, in bytes; -1 = mpg123 default */
+	long feed_buffer_size;
+	/* If nonzero, mpg123 keeps a small read-ahead buffer for better resynchronization */
+	int seek_buffer;
+	/*
+	If nonzero, ID3v2 tags at the beginning of the stream (and after a reset) are dropped while they are fed,
+	instead of being buffered and parsed by mpg123. Tag metadata is then not available through mpg123_id3().
+	This is only useful for unparsed input, that is, a raw byte stream fed in arbitrary chunks (for example,
+	straight from a network socket), which is why the mpg123 element does not expose it: its sink caps
+	require parsed input, and parsers such as mpegaudioparse strip ID3v2 tags before they reach the decoder.
+	*/
+	int skip_id3v2;
+	/*
+	Reduces the output rate by a factor of 2^down_sample (0 = full rate, 1 = half, 2 = quarter). mpg123 then
+	only synthesizes the lower part of the spectrum, which is considerably cheaper; this is useful for
+	analysis that does not need the full bandwidth. The factor is lowered where mpg123 does not support
+	the resulting rate.
+	*/
+	int down_sample;
+	/*
+	If nonzero, frames are decoded with mpg123's frame-by-frame API instead of mpg123_decode_frame(). This skips
+	the sample-accurate output bookkeeping (gapless trimming, frames to ignore after seeking), which is not
+	used here, and is meant for input that is already split into MPEG frames, for example by a parser.
+	*/
+	int frame_by_frame;
+	/*
+	Name of the mpg123 decoder core (synthesis implementation) to use, one of mpg123_supported_decoders();
+	NULL = let mpg123 pick the fastest one for the CPU. The string is only used while the core is created.
+	*/
+	char const *decoder;
+}
+GstMpg123CoreConfig;
+
+
+/* Initializes the mpg123 library; must be called once before any core is created */
+int gst_mpg123_core_global_init(void);
+
+/* Fills the config with the default values */
+void gst_mpg123_core_config_init(GstMpg123CoreConfig *config);
+
+/* Creates a core with an mpg123 handle opened in feed mode; returns NULL and sets *error if this fails */
+GstMpg123Core* gst_mpg123_core_new(GstMpg123CoreConfig const *config, int *error);
+void gst_mpg123_core_free(GstMpg123Core *core);
+
+/* The handle stays owned by the core; it can be used for queries (mpg123_info(), mpg123_getstate() ...) */
+mpg123_handle* gst_mpg123_core_get_handle(GstMpg123Core *core);
+
+/*
+Discards all buffered input and bitstream state, for example after a seek. The output format is kept.
+If this fails, the core is unusable and must be freed.
+*/
+int gst_mpg123_core_reset(GstMpg123Core *core);
+
+/*
+Sets the one output format mpg123 shall decode to. rate and channels should be the ones of the
+bitstream, since mpg123 would otherwise resample and/or mix channels. The format takes effect with
+the next frame; decoding reports this with MPG123_NEW_FORMAT. If down_sample is set in the config,
+the output rate is rate >> gst_mpg123_core_get_down_sample(), unless a rate was forced with
+gst_mpg123_core_set_forced_rate(); gst_mpg123_core_get_output_rate() returns the resulting rate.
+If mono mixing was enabled with gst_mpg123_core_set_quality(), the output has one channel.
+*/
+int gst_mpg123_core_set_output_format(GstMpg123Core *core, long rate, int channels, int encoding);
+
+/*
+Trades output quality for decoding speed: raises the down-sampling factor to at least min_down_sample
+(a higher factor from the config is kept), and optionally lets mpg123 mix all channels into one, which
+halves the synthesis work for stereo streams. Pass 0, 0 to go back to the config settings. This only
+takes effect with the next gst_mpg123_core_set_output_format() call.
+*/
+void gst_mpg123_core_set_quality(GstMpg123Core *core, int min_down_sample, int mono_mix);
+
+/* The down-sampling factor (as a power of two) used for the current output format */
+int gst_mpg123_core_get_down_sample(GstMpg123Core *core);
+
+/*
+Makes mpg123 resample to the given rate with its NtoM synthesis if the bitstream has a different rate
+(0 = off). Down-sampling does not apply then. Only rates mpg123 supports (up to 96 kHz) can be forced.
+Like the quality settings, this takes effect with the next gst_mpg123_core_set_output_format() call.
+*/
+void gst_mpg123_core_set_forced_rate(GstMpg123Core *core, long rate);
+
+/* The output rate of the current output format */
+long gst_mpg123_core_get_output_rate(GstMpg123Core *core);
+
+/* Feeds input data into mpg123; the data is copied, and can be freed afterwards */
+int gst_mpg123_core_feed(GstMpg123Core *core, void const *data, size_t size);
+
+/*
+Decodes the next frame from the data fed so far. *decoded_bytes points to mpg123's internal buffer, and
+stays valid until the next call. MPG123_NEW_FORMAT is returned once before the first frame in a new
+format is decoded; in that case, no data is output, and the frame is decoded by the next call.
+*/
+int gst_mpg123_core_decode_frame(GstMpg123Core *core, unsigned char **decoded_bytes, size_t *num_decoded_bytes);
+
+/*
+Reads the next frame from the data fed so far without decoding it. This is much cheaper than decoding,
+and still keeps mpg123's frame counter and bit reservoir up to date. The next decode call drops the
+skipped frame.
+*/
+int gst_mpg123_core_skip_frame(GstMpg123Core *core);
+
+/*
+Convenience function combining gst_mpg123_core_feed() and gst_mpg123_core_decode_frame(), which copies
+the decoded frame to caller-provided memory. input may be NULL to decode already fed data. output_size
+must be at least gst_mpg123_core_get_max_output_size(), otherwise MPG123_BAD_BUFFER is returned.
+*/
+int gst_mpg123_core_decode(GstMpg123Core *core, void const *input, size_t input_size, void *output, size_t output_size, size_t *num_output_bytes);
+
+/*
+Checks whether data holds a layer III frame that decodes to digital silence, which is the case if none of
+its granules carries scalefactors or spectral data (part2_3_length is 0 in the side info). Only the header
+and the side info are looked at, so this is very cheap. Returns the number of samples per channel the frame
+decodes to at the bitstream rate (1152 or 576), or 0 if the frame is not silent or not a layer III frame.
+Note that the output of such a frame is only silent if the one or two frames before it were silent as well,
+since the synthesis carries over parts of earlier frames.
+*/
+size_t gst_mpg123_core_check_silent_frame(void const *data, size_t size);
+
+/* Number of ID3v2 tag bytes dropped so far if skip_id3v2 is set in the config */
+size_t gst_mpg123_core_get_num_skipped_tag_bytes(GstMpg123Core *core);
+
+/* Maximum number of bytes a single decoded frame can have with the current output format */
+size_t gst_mpg123_core_get_max_output_size(GstMpg123Core *core);
+
+/* Human-readable description of the last error */
+char const * gst_mpg123_core_get_error_string(GstMpg123Core *core);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif
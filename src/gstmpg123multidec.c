@@ -0,0 +1,979 @@
+/*
+*   MP3 decoding plugin for GStreamer using the mpg123 library
+*   Copyright (C) 2012 Carlos Rafael Giani
+*
+*   This library is free software; you can redistribute it and/or
+*   modify it under the terms of the GNU Lesser General Public
+*   License as published by the Free Software Foundation; either
+*   version 2.1 of the License, or (at your option) any later version.
+*
+*   This library is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+*   Lesser General Public License for more details.
+*
+*   You should have received a copy of the GNU Lesser General Public
+*   License along with this library; if not, write to the Free Software
+*   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+
+
+
+#include <stdio.h>
+#include <string.h>
+#include <config.h>
+#include <gst/audio/audio.h>
+#include "gstmpg123multidec.h"
+
+
+GST_DEBUG_CATEGORY_STATIC(mpg123_multidec_debug);
+#define GST_CAT_DEFAULT mpg123_multidec_debug
+
+
+enum
+{
+	PROP_0,
+	PROP_BATCH_SIZE,
+	PROP_QUEUE_SIZE,
+	PROP_DOWN_SAMPLE
+};
+
+
+#define DEFAULT_BATCH_SIZE   8
+#define DEFAULT_QUEUE_SIZE   16
+#define DEFAULT_DOWN_SAMPLE  0
+
+
+struct _GstMpg123MultiDecStream
+{
+	GstPad *sinkpad, *srcpad;
+	GstMpg123Core *core;
+
+	/* Protected by the element mutex */
+	/* input buffers and serialized events, in stream order */
+	GQueue queue;
+	/* only buffers count towards queue-size; events are always queued */
+	guint num_queued_buffers;
+	gboolean flushing;
+	/* result of the last downstream push, returned to upstream by the next chain call */
+	GstFlowReturn flow_return;
+
+	/*
+	Only used by the task, and by flush-stop and stop while the task is not active on this stream
+	*/
+	long rate;
+	int channels;
+	GstClockTime next_pts;
+	gboolean discont;
+};
+
+
+static GstStaticPadTemplate static_sink_template = GST_STATIC_PAD_TEMPLATE(
+	"sink_%u",
+	GST_PAD_SINK,
+	GST_PAD_REQUEST,
+	GST_STATIC_CAPS(
+		"audio/mpeg, "
+		"mpegversion = (int) { 1 }, "
+		"layer = (int) [ 1, 3 ], "
+		"rate = (int) { 8000, 11025, 12000, 16000, 22050, 24000, 32000, 44100, 48000 }, "
+		"channels = (int) [ 1, 2 ], "
+		"parsed = (boolean) true "
+	)
+);
+
+static GstStaticPadTemplate static_src_template = GST_STATIC_PAD_TEMPLATE(
+	"src_%u",
+	GST_PAD_SRC,
+	GST_PAD_SOMETIMES,
+	GST_STATIC_CAPS(
+		"audio/x-raw, "
+		"format = (string) " GST_AUDIO_NE(S16) ", "
+		"rate = (int) [ 1, MAX ], "
+		"channels = (int) [ 1, 2 ], "
+		"layout = (string) interleaved"
+	)
+);
+
+
+static void gst_mpg123_multidec_set_property(GObject *object, guint prop_id, GValue const *value, GParamSpec *pspec);
+static void gst_mpg123_multidec_get_property(GObject *object, guint prop_id, GValue *value, GParamSpec *pspec);
+static void gst_mpg123_multidec_finalize(GObject *object);
+static GstPad* gst_mpg123_multidec_request_new_pad(GstElement *element, GstPadTemplate *templ, gchar const *name, GstCaps const *caps);
+static void gst_mpg123_multidec_release_pad(GstElement *element, GstPad *pad);
+static GstStateChangeReturn gst_mpg123_multidec_change_state(GstElement *element, GstStateChange transition);
+static gboolean gst_mpg123_multidec_start(GstMpg123MultiDec *multidec);
+static void gst_mpg123_multidec_stop(GstMpg123MultiDec *multidec);
+static void gst_mpg123_multidec_stream_clear_queue(GstMpg123MultiDecStream *stream);
+static void gst_mpg123_multidec_stream_free(GstMpg123MultiDecStream *stream);
+static GstFlowReturn gst_mpg123_multidec_sink_chain(GstPad *pad, GstObject *parent, GstBuffer *buffer);
+static gboolean gst_mpg123_multidec_sink_event(GstPad *pad, GstObject *parent, GstEvent *event);
+static gboolean gst_mpg123_multidec_sink_query(GstPad *pad, GstObject *parent, GstQuery *query);
+static gboolean gst_mpg123_multidec_src_event(GstPad *pad, GstObject *parent, GstEvent *event);
+static gboolean gst_mpg123_multidec_src_query(GstPad *pad, GstObject *parent, GstQuery *query);
+static GstMpg123MultiDecStream* gst_mpg123_multidec_find_next_stream(GstMpg123MultiDec *multidec);
+static void gst_mpg123_multidec_loop(gpointer user_data);
+static GstFlowReturn gst_mpg123_multidec_decode_batch(GstMpg123MultiDecStream *stream, GQueue *batch);
+static GstFlowReturn gst_mpg123_multidec_decode_buffer(GstMpg123MultiDecStream *stream, GstBuffer *input_buffer, GstBufferList **output);
+static GstFlowReturn gst_mpg123_multidec_push_output(GstMpg123MultiDecStream *stream, GstBufferList **output, GstFlowReturn flow);
+static void gst_mpg123_multidec_handle_event(GstMpg123MultiDecStream *stream, GstEvent *event);
+static void gst_mpg123_multidec_update_caps(GstMpg123MultiDecStream *stream);
+static void gst_mpg123_multidec_push_caps(GstMpg123MultiDecStream *stream, long rate, int channels);
+
+
+G_DEFINE_TYPE(GstMpg123MultiDec, gst_mpg123_multidec, GST_TYPE_ELEMENT)
+
+
+
+static void gst_mpg123_multidec_class_init(GstMpg123MultiDecClass *klass)
+{
+	GObjectClass *object_class;
+	GstElementClass *element_class;
+
+	GST_DEBUG_CATEGORY_INIT(mpg123_multidec_debug, "mpg123multidec", 0, "mpg123 multi-stream mp3 decoder");
+
+	object_class = G_OBJECT_CLASS(klass);
+	element_class = GST_ELEMENT_CLASS(klass);
+
+	object_class->set_property = GST_DEBUG_FUNCPTR(gst_mpg123_multidec_set_property);
+	object_class->get_property = GST_DEBUG_FUNCPTR(gst_mpg123_multidec_get_property);
+	object_class->finalize     = GST_DEBUG_FUNCPTR(gst_mpg123_multidec_finalize);
+
+	g_object_class_install_property(
+		object_class,
+		PROP_BATCH_SIZE,
+		g_param_spec_uint(
+			"batch-size",
+			"Batch size",
+			"Maximum number of queued frames decoded from one stream before the decoding thread moves on to the next "
+			"stream; larger batches make better use of the CPU caches, smaller ones spread the latency more evenly",
+			1, 1024,
+			DEFAULT_BATCH_SIZE,
+			G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS
+		)
+	);
+	g_object_class_install_property(
+		object_class,
+		PROP_QUEUE_SIZE,
+		g_param_spec_uint(
+			"queue-size",
+			"Queue size",
+			"Maximum number of input frames queued per stream; upstream blocks while the queue of its stream is full",
+			1, 1024,
+			DEFAULT_QUEUE_SIZE,
+			G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS
+		)
+	);
+	g_object_class_install_property(
+		object_class,
+		PROP_DOWN_SAMPLE,
+		g_param_spec_uint(
+			"down-sample",
+			"Down-sample",
+			"Output at a reduced rate, decoding only the lower part of the spectrum, which saves a large part "
+			"of the synthesis work (0 = full rate, 1 = half rate, 2 = quarter rate; lowered where the reduced rate "
+			"is not supported; only applies to pads requested afterwards)",
+			0, 2,
+			DEFAULT_DOWN_SAMPLE,
+			G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS
+		)
+	);
+
+	gst_element_class_set_static_metadata(
+		element_class,
+		"mpg123 multi-stream mp3 decoder",
+		"Codec/Decoder/Audio",
+		"Decodes many mp3 streams on one thread using the mpg123 library",
+		"Carlos Rafael Giani <dv@pseudoterminal.org>"
+	);
+
+	gst_element_class_add_pad_template(element_class, gst_static_pad_template_get(&static_sink_template));
+	gst_element_class_add_pad_template(element_class, gst_static_pad_template_get(&static_src_template));
+
+	element_class->request_new_pad = GST_DEBUG_FUNCPTR(gst_mpg123_multidec_request_new_pad);
+	element_class->release_pad     = GST_DEBUG_FUNCPTR(gst_mpg123_multidec_release_pad);
+	element_class->change_state    = GST_DEBUG_FUNCPTR(gst_mpg123_multidec_change_state);
+}
+
+
+static void gst_mpg123_multidec_init(GstMpg123MultiDec *multidec)
+{
+	multidec->task = NULL;
+	g_rec_mutex_init(&(multidec->task_lock));
+	g_mutex_init(&(multidec->mutex));
+	g_cond_init(&(multidec->cond));
+	multidec->streams = g_ptr_array_new();
+	multidec->next_stream = 0;
+	multidec->active_stream = NULL;
+	multidec->running = FALSE;
+	multidec->next_pad_index = 0;
+
+	multidec->batch_size = DEFAULT_BATCH_SIZE;
+	multidec->queue_size = DEFAULT_QUEUE_SIZE;
+	multidec->down_sample = DEFAULT_DOWN_SAMPLE;
+}
+
+
+static void gst_mpg123_multidec_set_property(GObject *object, guint prop_id, GValue const *value, GParamSpec *pspec)
+{
+	GstMpg123MultiDec *multidec = GST_MPG123_MULTIDEC(object);
+
+	switch (prop_id)
+	{
+		case PROP_BATCH_SIZE:
+			GST_OBJECT_LOCK(object);
+			multidec->batch_size = g_value_get_uint(value);
+			GST_OBJECT_UNLOCK(object);
+			break;
+		case PROP_QUEUE_SIZE:
+			GST_OBJECT_LOCK(object);
+			multidec->queue_size = g_value_get_uint(value);
+			GST_OBJECT_UNLOCK(object);
+			break;
+		case PROP_DOWN_SAMPLE:
+			GST_OBJECT_LOCK(object);
+			multidec->down_sample = g_value_get_uint(value);
+			GST_OBJECT_UNLOCK(object);
+			break;
+		default:
+			G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+			break;
+	}
+}
+
+
+static void gst_mpg123_multidec_get_property(GObject *object, guint prop_id, GValue *value, GParamSpec *pspec)
+{
+	GstMpg123MultiDec *multidec = GST_MPG123_MULTIDEC(object);
+
+	switch (prop_id)
+	{
+		case PROP_BATCH_SIZE:
+			GST_OBJECT_LOCK(object);
+			g_value_set_uint(value, multidec->batch_size);
+			GST_OBJECT_UNLOCK(object);
+			break;
+		case PROP_QUEUE_SIZE:
+			GST_OBJECT_LOCK(object);
+			g_value_set_uint(value, multidec->queue_size);
+			GST_OBJECT_UNLOCK(object);
+			break;
+		case PROP_DOWN_SAMPLE:
+			GST_OBJECT_LOCK(object);
+			g_value_set_uint(value, multidec->down_sample);
+			GST_OBJECT_UNLOCK(object);
+			break;
+		default:
+			G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+			break;
+	}
+}
+
+
+static void gst_mpg123_multidec_finalize(GObject *object)
+{
+	GstMpg123MultiDec *multidec = GST_MPG123_MULTIDEC(object);
+	guint i;
+
+	/*
+	Pads that were not released are removed by the GstElement dispose function without calling
+	release_pad, so their streams are freed here; the pads themselves are gone at this point
+	*/
+	for (i = 0; i < multidec->streams->len; ++i)
+		gst_mpg123_multidec_stream_free(g_ptr_array_index(multidec->streams, i));
+	g_ptr_array_free(multidec->streams, TRUE);
+
+	g_cond_clear(&(multidec->cond));
+	g_mutex_clear(&(multidec->mutex));
+	g_rec_mutex_clear(&(multidec->task_lock));
+
+	G_OBJECT_CLASS(gst_mpg123_multidec_parent_class)->finalize(object);
+}
+
+
+static GstPad* gst_mpg123_multidec_request_new_pad(GstElement *element, GstPadTemplate *templ, gchar const *name, GstCaps const *caps)
+{
+	GstMpg123MultiDec *multidec = GST_MPG123_MULTIDEC(element);
+	GstMpg123MultiDecStream *stream;
+	GstMpg123CoreConfig config;
+	guint index;
+	gchar *pad_name;
+	int error;
+
+	(void)caps;
+
+	if (GST_PAD_TEMPLATE_DIRECTION(templ) != GST_PAD_SINK)
+		return NULL;
+
+	gst_mpg123_core_config_init(&config);
+	GST_OBJECT_LOCK(multidec);
+	if ((name != NULL) && (sscanf(name, "sink_%u", &index) == 1))
+		multidec->next_pad_index = MAX(multidec->next_pad_index, index + 1);
+	else
+		index = multidec->next_pad_index++;
+	config.down_sample = multidec->down_sample;
+	/* Like the mpg123 element, this requires parsed input, so each input buffer is exactly one frame */
+	config.frame_by_frame = TRUE;
+	GST_OBJECT_UNLOCK(multidec);
+
+	stream = g_slice_new0(GstMpg123MultiDecStream);
+	stream->core = gst_mpg123_core_new(&config, &error);
+	if (G_UNLIKELY(stream->core == NULL))
+	{
+		GST_ERROR_OBJECT(multidec, "could not create mpg123 decoder for stream %u: %s", index, mpg123_plain_strerror(error));
+		g_slice_free(GstMpg123MultiDecStream, stream);
+		return NULL;
+	}
+	g_queue_init(&(stream->queue));
+	stream->flow_return = GST_FLOW_OK;
+	stream->next_pts = GST_CLOCK_TIME_NONE;
+	stream->discont = TRUE;
+
+	pad_name = g_strdup_printf("sink_%u", index);
+	stream->sinkpad = gst_pad_new_from_template(templ, pad_name);
+	g_free(pad_name);
+	gst_pad_set_element_private(stream->sinkpad, stream);
+	gst_pad_set_chain_function(stream->sinkpad, GST_DEBUG_FUNCPTR(gst_mpg123_multidec_sink_chain));
+	gst_pad_set_event_function(stream->sinkpad, GST_DEBUG_FUNCPTR(gst_mpg123_multidec_sink_event));
+	gst_pad_set_query_function(stream->sinkpad, GST_DEBUG_FUNCPTR(gst_mpg123_multidec_sink_query));
+
+	pad_name = g_strdup_printf("src_%u", index);
+	stream->srcpad = gst_pad_new_from_static_template(&static_src_template, pad_name);
+	g_free(pad_name);
+	gst_pad_set_element_private(stream->srcpad, stream);
+	gst_pad_set_event_function(stream->srcpad, GST_DEBUG_FUNCPTR(gst_mpg123_multidec_src_event));
+	gst_pad_set_query_function(stream->srcpad, GST_DEBUG_FUNCPTR(gst_mpg123_multidec_src_query));
+	gst_pad_use_fixed_caps(stream->srcpad);
+
+	/* The pads are named after the index, so adding fails if a pad with the requested name already exists */
+	if (!gst_element_add_pad(element, stream->srcpad))
+	{
+		gst_object_unref(GST_OBJECT(stream->sinkpad));
+		gst_object_unref(GST_OBJECT(stream->srcpad));
+		gst_mpg123_core_free(stream->core);
+		g_slice_free(GstMpg123MultiDecStream, stream);
+		return NULL;
+	}
+	if (!gst_element_add_pad(element, stream->sinkpad))
+	{
+		gst_element_remove_pad(element, stream->srcpad);
+		gst_object_unref(GST_OBJECT(stream->sinkpad));
+		gst_mpg123_core_free(stream->core);
+		g_slice_free(GstMpg123MultiDecStream, stream);
+		return NULL;
+	}
+
+	g_mutex_lock(&(multidec->mutex));
+	stream->flushing = !(multidec->running);
+	g_ptr_array_add(multidec->streams, stream);
+	g_mutex_unlock(&(multidec->mutex));
+
+	GST_DEBUG_OBJECT(multidec, "added stream %u", index);
+
+	return stream->sinkpad;
+}
+
+
+static void gst_mpg123_multidec_release_pad(GstElement *element, GstPad *pad)
+{
+	GstMpg123MultiDec *multidec = GST_MPG123_MULTIDEC(element);
+	GstMpg123MultiDecStream *stream;
+
+	if (GST_PAD_DIRECTION(pad) != GST_PAD_SINK)
+		return;
+
+	stream = gst_pad_get_element_private(pad);
+
+	g_mutex_lock(&(multidec->mutex));
+	/* Taking the stream out of the list keeps the task from picking it again */
+	g_ptr_array_remove(multidec->streams, stream);
+	/* Wakes up a chain function waiting for queue space; the pad deactivation below waits for it to return */
+	stream->flushing = TRUE;
+	g_cond_broadcast(&(multidec->cond));
+	while (multidec->active_stream == stream)
+		g_cond_wait(&(multidec->cond), &(multidec->mutex));
+	g_mutex_unlock(&(multidec->mutex));
+
+	GST_DEBUG_OBJECT(multidec, "releasing pad %s", GST_PAD_NAME(pad));
+
+	gst_element_remove_pad(element, stream->srcpad);
+	gst_element_remove_pad(element, stream->sinkpad);
+	gst_mpg123_multidec_stream_free(stream);
+}
+
+
+static GstStateChangeReturn gst_mpg123_multidec_change_state(GstElement *element, GstStateChange transition)
+{
+	GstMpg123MultiDec *multidec = GST_MPG123_MULTIDEC(element);
+	GstStateChangeReturn ret;
+	guint i;
+
+	switch (transition)
+	{
+		case GST_STATE_CHANGE_READY_TO_PAUSED:
+			if (!gst_mpg123_multidec_start(multidec))
+				return GST_STATE_CHANGE_FAILURE;
+			break;
+
+		case GST_STATE_CHANGE_PAUSED_TO_READY:
+			/*
+			Wake up the task and any chain function waiting for queue space before the base class
+			deactivates the pads, which waits for the chain functions to return
+			*/
+			if (multidec->task != NULL)
+				gst_task_stop(multidec->task);
+			g_mutex_lock(&(multidec->mutex));
+			multidec->running = FALSE;
+			for (i = 0; i < multidec->streams->len; ++i)
+				((GstMpg123MultiDecStream *)g_ptr_array_index(multidec->streams, i))->flushing = TRUE;
+			g_cond_broadcast(&(multidec->cond));
+			g_mutex_unlock(&(multidec->mutex));
+			break;
+
+		default:
+			break;
+	}
+
+	ret = GST_ELEMENT_CLASS(gst_mpg123_multidec_parent_class)->change_state(element, transition);
+
+	switch (transition)
+	{
+		case GST_STATE_CHANGE_PAUSED_TO_READY:
+			gst_mpg123_multidec_stop(multidec);
+			break;
+
+		default:
+			break;
+	}
+
+	return ret;
+}
+
+
+static gboolean gst_mpg123_multidec_start(GstMpg123MultiDec *multidec)
+{
+	guint i;
+
+	g_mutex_lock(&(multidec->mutex));
+	multidec->running = TRUE;
+	for (i = 0; i < multidec->streams->len; ++i)
+	{
+		GstMpg123MultiDecStream *stream = g_ptr_array_index(multidec->streams, i);
+		stream->flushing = FALSE;
+		stream->flow_return = GST_FLOW_OK;
+	}
+	g_mutex_unlock(&(multidec->mutex));
+
+	multidec->task = gst_task_new(gst_mpg123_multidec_loop, multidec, NULL);
+	gst_task_set_lock(multidec->task, &(multidec->task_lock));
+	if (!gst_task_start(multidec->task))
+	{
+		GST_ERROR_OBJECT(multidec, "could not start decoding task");
+		g_mutex_lock(&(multidec->mutex));
+		multidec->running = FALSE;
+		g_mutex_unlock(&(multidec->mutex));
+		gst_object_unref(GST_OBJECT(multidec->task));
+		multidec->task = NULL;
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+
+static void gst_mpg123_multidec_stop(GstMpg123MultiDec *multidec)
+{
+	guint i;
+
+	/* The task was already told to stop in change_state, and is woken up at this point */
+	if (multidec->task != NULL)
+	{
+		gst_task_join(multidec->task);
+		gst_object_unref(GST_OBJECT(multidec->task));
+		multidec->task = NULL;
+	}
+
+	/* The task is gone and the pads are inactive, so nothing else touches the streams now */
+	for (i = 0; i < multidec->streams->len; ++i)
+	{
+		GstMpg123MultiDecStream *stream = g_ptr_array_index(multidec->streams, i);
+
+		gst_mpg123_multidec_stream_clear_queue(stream);
+		if (gst_mpg123_core_reset(stream->core) != MPG123_OK)
+			GST_ERROR_OBJECT(multidec, "could not reset mpg123 decoder of %s: %s", GST_PAD_NAME(stream->sinkpad), gst_mpg123_core_get_error_string(stream->core));
+		stream->rate = 0;
+		stream->channels = 0;
+		stream->next_pts = GST_CLOCK_TIME_NONE;
+		stream->discont = TRUE;
+	}
+	multidec->next_stream = 0;
+}
+
+
+static void gst_mpg123_multidec_stream_clear_queue(GstMpg123MultiDecStream *stream)
+{
+	GstMiniObject *item;
+
+	while ((item = g_queue_pop_head(&(stream->queue))) != NULL)
+		gst_mini_object_unref(item);
+	stream->num_queued_buffers = 0;
+}
+
+
+static void gst_mpg123_multidec_stream_free(GstMpg123MultiDecStream *stream)
+{
+	gst_mpg123_multidec_stream_clear_queue(stream);
+	gst_mpg123_core_free(stream->core);
+	g_slice_free(GstMpg123MultiDecStream, stream);
+}
+
+
+static GstFlowReturn gst_mpg123_multidec_sink_chain(GstPad *pad, GstObject *parent, GstBuffer *buffer)
+{
+	GstMpg123MultiDec *multidec = GST_MPG123_MULTIDEC(parent);
+	GstMpg123MultiDecStream *stream = gst_pad_get_element_private(pad);
+	GstFlowReturn ret;
+	guint queue_size;
+
+	GST_OBJECT_LOCK(multidec);
+	queue_size = multidec->queue_size;
+	GST_OBJECT_UNLOCK(multidec);
+
+	g_mutex_lock(&(multidec->mutex));
+
+	while (!(stream->flushing) && (stream->flow_return == GST_FLOW_OK) && (stream->num_queued_buffers >= queue_size))
+		g_cond_wait(&(multidec->cond), &(multidec->mutex));
+
+	ret = stream->flushing ? GST_FLOW_FLUSHING : stream->flow_return;
+	if (ret == GST_FLOW_OK)
+	{
+		g_queue_push_tail(&(stream->queue), buffer);
+		stream->num_queued_buffers++;
+		g_cond_broadcast(&(multidec->cond));
+	}
+	else
+		gst_buffer_unref(buffer);
+
+	g_mutex_unlock(&(multidec->mutex));
+
+	return ret;
+}
+
+
+static gboolean gst_mpg123_multidec_sink_event(GstPad *pad, GstObject *parent, GstEvent *event)
+{
+	GstMpg123MultiDec *multidec = GST_MPG123_MULTIDEC(parent);
+	GstMpg123MultiDecStream *stream = gst_pad_get_element_private(pad);
+
+	switch (GST_EVENT_TYPE(event))
+	{
+		case GST_EVENT_FLUSH_START:
+			g_mutex_lock(&(multidec->mutex));
+			stream->flushing = TRUE;
+			g_cond_broadcast(&(multidec->cond));
+			g_mutex_unlock(&(multidec->mutex));
+			return gst_pad_push_event(stream->srcpad, event);
+
+		case GST_EVENT_FLUSH_STOP:
+			g_mutex_lock(&(multidec->mutex));
+			while (multidec->active_stream == stream)
+				g_cond_wait(&(multidec->cond), &(multidec->mutex));
+			gst_mpg123_multidec_stream_clear_queue(stream);
+			stream->flushing = !(multidec->running);
+			stream->flow_return = GST_FLOW_OK;
+			/* Safe, since the queue is empty, and the task therefore does not pick this stream */
+			if (gst_mpg123_core_reset(stream->core) != MPG123_OK)
+			{
+				GST_ERROR_OBJECT(pad, "could not reset mpg123 decoder: %s", gst_mpg123_core_get_error_string(stream->core));
+				stream->flow_return = GST_FLOW_ERROR;
+			}
+			stream->next_pts = GST_CLOCK_TIME_NONE;
+			stream->discont = TRUE;
+			g_mutex_unlock(&(multidec->mutex));
+			return gst_pad_push_event(stream->srcpad, event);
+
+		case GST_EVENT_CAPS:
+		{
+			GstCaps *caps;
+			GstStructure *structure;
+			gint rate, channels;
+
+			/* Checked here, since the task cannot reject the caps anymore */
+			gst_event_parse_caps(event, &caps);
+			structure = gst_caps_get_structure(caps, 0);
+			if (!gst_structure_get_int(structure, "rate", &rate) || !gst_structure_get_int(structure, "channels", &channels))
+			{
+				GST_ERROR_OBJECT(pad, "caps %" GST_PTR_FORMAT " have no rate or channels", (gpointer)caps);
+				gst_event_unref(event);
+				return FALSE;
+			}
+			break;
+		}
+
+		default:
+			break;
+	}
+
+	if (!GST_EVENT_IS_SERIALIZED(event))
+		return gst_pad_push_event(stream->srcpad, event);
+
+	/* Serialized events go through the queue, so that they stay in order with the decoded audio */
+	g_mutex_lock(&(multidec->mutex));
+	if (stream->flushing)
+	{
+		g_mutex_unlock(&(multidec->mutex));
+		gst_event_unref(event);
+		return FALSE;
+	}
+	g_queue_push_tail(&(stream->queue), event);
+	g_cond_broadcast(&(multidec->cond));
+	g_mutex_unlock(&(multidec->mutex));
+
+	return TRUE;
+}
+
+
+static gboolean gst_mpg123_multidec_sink_query(GstPad *pad, GstObject *parent, GstQuery *query)
+{
+	switch (GST_QUERY_TYPE(query))
+	{
+		case GST_QUERY_CAPS:
+		{
+			GstCaps *filter, *caps;
+
+			gst_query_parse_caps(query, &filter);
+			caps = gst_pad_get_pad_template_caps(pad);
+			if (filter != NULL)
+			{
+				GstCaps *intersection = gst_caps_intersect_full(filter, caps, GST_CAPS_INTERSECT_FIRST);
+				gst_caps_unref(caps);
+				caps = intersection;
+			}
+			gst_query_set_caps_result(query, caps);
+			gst_caps_unref(caps);
+			return TRUE;
+		}
+
+		default:
+			return gst_pad_query_default(pad, parent, query);
+	}
+}
+
+
+static gboolean gst_mpg123_multidec_src_event(GstPad *pad, GstObject *parent, GstEvent *event)
+{
+	GstMpg123MultiDecStream *stream = gst_pad_get_element_private(pad);
+
+	(void)parent;
+
+	/* Seeks, QoS etc. go to the upstream element of this stream only */
+	return gst_pad_push_event(stream->sinkpad, event);
+}
+
+
+static gboolean gst_mpg123_multidec_src_query(GstPad *pad, GstObject *parent, GstQuery *query)
+{
+	GstMpg123MultiDecStream *stream = gst_pad_get_element_private(pad);
+
+	switch (GST_QUERY_TYPE(query))
+	{
+		case GST_QUERY_CAPS:
+		case GST_QUERY_ACCEPT_CAPS:
+			/* The output caps are fixed once known (see gst_pad_use_fixed_caps()) */
+			return gst_pad_query_default(pad, parent, query);
+
+		default:
+			/* Position, duration, seeking etc. are answered by upstream, since the timestamps are passed through */
+			return gst_pad_peer_query(stream->sinkpad, query);
+	}
+}
+
+
+static GstMpg123MultiDecStream* gst_mpg123_multidec_find_next_stream(GstMpg123MultiDec *multidec)
+{
+	guint i, num_streams;
+
+	num_streams = multidec->streams->len;
+	for (i = 0; i < num_streams; ++i)
+	{
+		guint index = (multidec->next_stream + i) % num_streams;
+		GstMpg123MultiDecStream *stream = g_ptr_array_index(multidec->streams, index);
+
+		if (!(stream->flushing) && !g_queue_is_empty(&(stream->queue)))
+		{
+			multidec->next_stream = (index + 1) % num_streams;
+			return stream;
+		}
+	}
+
+	return NULL;
+}
+
+
+static void gst_mpg123_multidec_loop(gpointer user_data)
+{
+	GstMpg123MultiDec *multidec = GST_MPG123_MULTIDEC(user_data);
+	GstMpg123MultiDecStream *stream;
+	GQueue batch = G_QUEUE_INIT;
+	GstMiniObject *item;
+	GstFlowReturn flow;
+	guint batch_size, num_buffers;
+
+	GST_OBJECT_LOCK(multidec);
+	batch_size = multidec->batch_size;
+	GST_OBJECT_UNLOCK(multidec);
+
+	g_mutex_lock(&(multidec->mutex));
+
+	stream = NULL;
+	while (multidec->running && ((stream = gst_mpg123_multidec_find_next_stream(multidec)) == NULL))
+		g_cond_wait(&(multidec->cond), &(multidec->mutex));
+
+	if (!(multidec->running))
+	{
+		/* The task was stopped in change_state; returning here ends it */
+		g_mutex_unlock(&(multidec->mutex));
+		return;
+	}
+
+	/* Events do not count towards the batch size; they are cheap to handle */
+	num_buffers = 0;
+	while ((num_buffers < batch_size) && ((item = g_queue_pop_head(&(stream->queue))) != NULL))
+	{
+		g_queue_push_tail(&batch, item);
+		if (GST_IS_BUFFER(item))
+		{
+			num_buffers++;
+			stream->num_queued_buffers--;
+		}
+	}
+	multidec->active_stream = stream;
+	/* Upstream can refill the queue while the batch is decoded */
+	g_cond_broadcast(&(multidec->cond));
+
+	g_mutex_unlock(&(multidec->mutex));
+
+	GST_LOG_OBJECT(stream->sinkpad, "decoding batch of %u frames", num_buffers);
+	flow = gst_mpg123_multidec_decode_batch(stream, &batch);
+
+	g_mutex_lock(&(multidec->mutex));
+	/* Reset to GST_FLOW_OK by flush-stop and start */
+	if (flow != GST_FLOW_OK)
+		stream->flow_return = flow;
+	multidec->active_stream = NULL;
+	g_cond_broadcast(&(multidec->cond));
+	g_mutex_unlock(&(multidec->mutex));
+}
+
+
+static GstFlowReturn gst_mpg123_multidec_decode_batch(GstMpg123MultiDecStream *stream, GQueue *batch)
+{
+	GstMiniObject *item;
+	GstBufferList *output;
+	GstFlowReturn flow;
+
+	/*
+	All frames of the batch are decoded before anything is pushed, so the decoding runs back to back
+	with warm caches; the output goes downstream as one buffer list
+	*/
+	output = NULL;
+	flow = GST_FLOW_OK;
+	while ((item = g_queue_pop_head(batch)) != NULL)
+	{
+		if (GST_IS_BUFFER(item))
+		{
+			/* After an error, the remaining input is dropped, but events are still forwarded */
+			if (flow == GST_FLOW_OK)
+				flow = gst_mpg123_multidec_decode_buffer(stream, GST_BUFFER_CAST(item), &output);
+			gst_buffer_unref(GST_BUFFER_CAST(item));
+		}
+		else
+		{
+			/* Serialized events must not overtake the audio decoded before them */
+			flow = gst_mpg123_multidec_push_output(stream, &output, flow);
+			gst_mpg123_multidec_handle_event(stream, GST_EVENT_CAST(item));
+		}
+	}
+
+	return gst_mpg123_multidec_push_output(stream, &output, flow);
+}
+
+
+static GstFlowReturn gst_mpg123_multidec_decode_buffer(GstMpg123MultiDecStream *stream, GstBuffer *input_buffer, GstBufferList **output)
+{
+	GstMapInfo map;
+	unsigned char *decoded_bytes;
+	size_t num_decoded_bytes;
+	int error;
+
+	if (!gst_buffer_map(input_buffer, &map, GST_MAP_READ))
+	{
+		GST_ERROR_OBJECT(stream->sinkpad, "could not map input buffer");
+		return GST_FLOW_ERROR;
+	}
+	error = gst_mpg123_core_feed(stream->core, map.data, map.size);
+	gst_buffer_unmap(input_buffer, &map);
+
+	if (G_UNLIKELY(error != MPG123_OK))
+	{
+		GST_WARNING_OBJECT(stream->sinkpad, "could not feed input: %s", gst_mpg123_core_get_error_string(stream->core));
+		return GST_FLOW_OK;
+	}
+
+	if (GST_BUFFER_PTS_IS_VALID(input_buffer))
+		stream->next_pts = GST_BUFFER_PTS(input_buffer);
+	if (GST_BUFFER_FLAG_IS_SET(input_buffer, GST_BUFFER_FLAG_DISCONT))
+		stream->discont = TRUE;
+
+	while (TRUE)
+	{
+		GstBuffer *output_buffer;
+		GstClockTime duration;
+		size_t num_samples;
+
+		error = gst_mpg123_core_decode_frame(stream->core, &decoded_bytes, &num_decoded_bytes);
+
+		if (error == MPG123_NEW_FORMAT)
+		{
+			gst_mpg123_multidec_update_caps(stream);
+			continue;
+		}
+		else if ((error == MPG123_NEED_MORE) || (error == MPG123_DONE))
+			break;
+		else if (G_UNLIKELY(error != MPG123_OK))
+		{
+			/* Like the mpg123 element, keep going; mpg123 resynchronizes at the next frame */
+			GST_WARNING_OBJECT(stream->sinkpad, "decoding error: %s", gst_mpg123_core_get_error_string(stream->core));
+			break;
+		}
+
+		if (num_decoded_bytes == 0)
+			continue;
+
+		if (G_UNLIKELY(stream->rate == 0))
+		{
+			GST_ERROR_OBJECT(stream->sinkpad, "decoded audio before the output format is known");
+			return GST_FLOW_NOT_NEGOTIATED;
+		}
+
+		output_buffer = gst_buffer_new_allocate(NULL, num_decoded_bytes, NULL);
+		gst_buffer_fill(output_buffer, 0, decoded_bytes, num_decoded_bytes);
+
+		num_samples = num_decoded_bytes / (sizeof(gint16) * stream->channels);
+		duration = gst_util_uint64_scale_int(num_samples, GST_SECOND, stream->rate);
+		GST_BUFFER_PTS(output_buffer) = stream->next_pts;
+		GST_BUFFER_DURATION(output_buffer) = duration;
+		if (GST_CLOCK_TIME_IS_VALID(stream->next_pts))
+			stream->next_pts += duration;
+		if (stream->discont)
+		{
+			GST_BUFFER_FLAG_SET(output_buffer, GST_BUFFER_FLAG_DISCONT);
+			stream->discont = FALSE;
+		}
+
+		if (*output == NULL)
+			*output = gst_buffer_list_new();
+		gst_buffer_list_add(*output, output_buffer);
+	}
+
+	return GST_FLOW_OK;
+}
+
+
+static GstFlowReturn gst_mpg123_multidec_push_output(GstMpg123MultiDecStream *stream, GstBufferList **output, GstFlowReturn flow)
+{
+	if (*output == NULL)
+		return flow;
+
+	if (flow == GST_FLOW_OK)
+		flow = gst_pad_push_list(stream->srcpad, *output);
+	else
+		gst_buffer_list_unref(*output);
+	*output = NULL;
+
+	return flow;
+}
+
+
+static void gst_mpg123_multidec_handle_event(GstMpg123MultiDecStream *stream, GstEvent *event)
+{
+	switch (GST_EVENT_TYPE(event))
+	{
+		case GST_EVENT_CAPS:
+		{
+			GstCaps *caps;
+			GstStructure *structure;
+			gint rate, channels;
+			int error;
+
+			gst_event_parse_caps(event, &caps);
+			structure = gst_caps_get_structure(caps, 0);
+			gst_structure_get_int(structure, "rate", &rate);
+			gst_structure_get_int(structure, "channels", &channels);
+
+			error = gst_mpg123_core_set_output_format(stream->core, rate, channels, MPG123_ENC_SIGNED_16);
+			if (G_UNLIKELY(error != MPG123_OK))
+			{
+				GST_ERROR_OBJECT(stream->sinkpad, "could not set output format: %s", gst_mpg123_core_get_error_string(stream->core));
+			}
+			else
+			{
+				/*
+				The output caps have to be sent right here, since the sticky events that follow (segment,
+				tags) are forwarded directly, and caps after segment would be misordered. The output
+				format is fully determined by the input caps; gst_mpg123_multidec_update_caps() only
+				sends new caps if mpg123 reports something different once it decodes.
+				*/
+				gst_mpg123_multidec_push_caps(stream, gst_mpg123_core_get_output_rate(stream->core), channels);
+			}
+
+			gst_event_unref(event);
+			break;
+		}
+
+		default:
+			gst_pad_push_event(stream->srcpad, event);
+			break;
+	}
+}
+
+
+static void gst_mpg123_multidec_update_caps(GstMpg123MultiDecStream *stream)
+{
+	long rate;
+	int channels, encoding;
+
+	if (mpg123_getformat(gst_mpg123_core_get_handle(stream->core), &rate, &channels, &encoding) != MPG123_OK)
+	{
+		GST_ERROR_OBJECT(stream->sinkpad, "could not get output format: %s", gst_mpg123_core_get_error_string(stream->core));
+		return;
+	}
+
+	gst_mpg123_multidec_push_caps(stream, rate, channels);
+}
+
+
+static void gst_mpg123_multidec_push_caps(GstMpg123MultiDecStream *stream, long rate, int channels)
+{
+	GstCaps *caps;
+
+	if ((rate == stream->rate) && (channels == stream->channels))
+		return;
+
+	stream->rate = rate;
+	stream->channels = channels;
+
+	caps = gst_caps_new_simple(
+		"audio/x-raw",
+		"format", G_TYPE_STRING, GST_AUDIO_NE(S16),
+		"rate", G_TYPE_INT, (gint)rate,
+		"channels", G_TYPE_INT, channels,
+		"layout", G_TYPE_STRING, "interleaved",
+		NULL
+	);
+	GST_DEBUG_OBJECT(stream->srcpad, "new output caps %" GST_PTR_FORMAT, (gpointer)caps);
+	gst_pad_push_event(stream->srcpad, gst_event_new_caps(caps));
+	gst_caps_unref(caps);
+}
@@ -0,0 +1,101 @@
+/*
+*   MP3 decoding plugin for GStreamer using the mpg123 library
+*   Copyright (C) 2012 Carlos Rafael Giani
+*
+*   This library is free software; you can redistribute it and/or
+*   modify it under the terms of the GNU Lesser General Public
+*   License as published by the Free Software Foundation; either
+*   version 2.1 of the License, or (at your option) any later version.
+*
+*   This library is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+*   Lesser General Public License for more details.
+*
+*   You should have received a copy of the GNU Lesser General Public
+*   License along with this library; if not, write to the Free Software
+*   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+
+
+
+#ifndef GSTMPG123MULTIDEC_H
+#define GSTMPG123MULTIDEC_H
+
+#include <gst/gst.h>
+#include "gstmpg123core.h"
+
+
+G_BEGIN_DECLS
+
+
+/*
+mpg123multidec decodes many independent MP3 streams in one element. Each request sink pad "sink_%u"
+gets a matching src pad "src_%u" and its own mpg123 core, but all cores are driven by one task thread,
+which visits the streams round-robin and decodes up to batch-size queued frames of a stream per turn.
+This avoids one thread (and one GstAudioDecoder) per stream when hundreds of low-bitrate streams are
+decoded just for analysis, and keeps mpg123's synthesis code and tables hot in the CPU caches.
+
+Input must be parsed (one frame per buffer), as with the mpg123 element. Output is always interleaved
+native-endian S16 at the rate and channel count of the bitstream (reduced by down-sample).
+Since one thread pushes for all streams, a downstream element that blocks (for example, a sink that
+synchronizes to the clock) stalls all streams; the element is meant for non-blocking consumers.
+*/
+
+
+typedef struct _GstMpg123MultiDec GstMpg123MultiDec;
+typedef struct _GstMpg123MultiDecClass GstMpg123MultiDecClass;
+typedef struct _GstMpg123MultiDecStream GstMpg123MultiDecStream;
+
+
+#define GST_TYPE_MPG123_MULTIDEC             (gst_mpg123_multidec_get_type())
+#define GST_MPG123_MULTIDEC(obj)             (G_TYPE_CHECK_INSTANCE_CAST((obj), GST_TYPE_MPG123_MULTIDEC, GstMpg123MultiDec))
+#define GST_MPG123_MULTIDEC_CLASS(klass)     (G_TYPE_CHECK_CLASS_CAST((klass), GST_TYPE_MPG123_MULTIDEC, GstMpg123MultiDecClass))
+#define GST_IS_MPG123_MULTIDEC(obj)          (G_TYPE_CHECK_INSTANCE_TYPE((obj), GST_TYPE_MPG123_MULTIDEC))
+#define GST_IS_MPG123_MULTIDEC_CLASS(klass)  (G_TYPE_CHECK_CLASS_TYPE((klass), GST_TYPE_MPG123_MULTIDEC))
+
+
+struct _GstMpg123MultiDec
+{
+	GstElement parent;
+
+	GstTask *task;
+	GRecMutex task_lock;
+
+	/*
+	Protects the stream list, the queues and the flags of the streams; the task waits on the cond for
+	queued input, chain functions wait on it for free queue space, and flush-stop and pad release
+	wait on it until the task is done with their stream
+	*/
+	GMutex mutex;
+	GCond cond;
+	GPtrArray *streams;
+	/* index of the stream the next round-robin search starts at */
+	guint next_stream;
+	/* the stream the task is decoding outside of the mutex, or NULL */
+	GstMpg123MultiDecStream *active_stream;
+	gboolean running;
+	guint next_pad_index;
+
+	/* properties; protected by the object lock */
+	guint batch_size;
+	guint queue_size;
+	guint down_sample;
+};
+
+
+struct _GstMpg123MultiDecClass
+{
+	GstElementClass parent_class;
+};
+
+
+GType gst_mpg123_multidec_get_type(void);
+
+
+G_END_DECLS
+
+
+#endif
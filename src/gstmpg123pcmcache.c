@@ -0,0 +1,279 @@
+/*
+*   MP3 decoding plugin for GStreamer using the mpg123 library
+*   Copyright (C) 2012 Carlos Rafael Giani
+*
+*   This library is free software; you can redistribute it and/or
+*   modify it under the terms of the GNU Lesser General Public
+*   License as published by the Free Software Foundation; either
+*   version 2.1 of the License, or (at your option) any later version.
+*
+*   This library is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+*   Lesser General Public License for more details.
+*
+*   You should have received a copy of the GNU Lesser General Public
+*   License along with this library; if not, write to the Free Software
+*   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+
+
+
+#include "gstmpg123pcmcache.h"
+
+
+GST_DEBUG_CATEGORY_STATIC(mpg123_pcm_cache_debug);
+#define GST_CAT_DEFAULT mpg123_pcm_cache_debug
+
+
+typedef struct
+{
+	guint64 hash;
+	GstAudioFormat format;
+	gint rate, channels;
+	GstAudioLayout layout;
+	/* interned, so comparing the pointers is enough */
+	gchar const *decoder;
+	gint down_sample;
+	glong forced_rate;
+}
+GstMpg123PcmCacheKey;
+
+
+typedef struct
+{
+	GstMpg123PcmCacheKey key;
+	GstBuffer *buffer;
+	gsize size;
+	/* position in the LRU queue; the data pointer points back to the entry */
+	GList lru_link;
+}
+GstMpg123PcmCacheEntry;
+
+
+/*
+The cache is created on first use and lives until the process ends, like the shared decoding thread pool.
+Everything below is protected by gst_mpg123_pcm_cache_mutex.
+*/
+static GMutex gst_mpg123_pcm_cache_mutex;
+static GHashTable *gst_mpg123_pcm_cache_entries = NULL;
+/* most recently used entry at the head */
+static GQueue gst_mpg123_pcm_cache_lru = G_QUEUE_INIT;
+static guint64 gst_mpg123_pcm_cache_size = 0;
+static guint64 gst_mpg123_pcm_cache_max_size = 0;
+static guint64 gst_mpg123_pcm_cache_num_hits = 0;
+static guint64 gst_mpg123_pcm_cache_num_misses = 0;
+static guint64 gst_mpg123_pcm_cache_num_insertions = 0;
+static guint64 gst_mpg123_pcm_cache_num_evictions = 0;
+
+
+static guint gst_mpg123_pcm_cache_key_hash(gconstpointer key)
+{
+	GstMpg123PcmCacheKey const *k = key;
+	/* The chained hash is already well mixed; the format and the decoder settings rarely differ between entries */
+	guint settings = (guint)k->rate * 31u + (guint)k->format;
+	settings = settings * 31u + g_direct_hash(k->decoder);
+	settings = settings * 31u + (guint)k->down_sample;
+	settings = settings * 31u + (guint)k->forced_rate;
+	return (guint)(k->hash ^ (k->hash >> 32)) ^ settings;
+}
+
+
+static gboolean gst_mpg123_pcm_cache_key_equal(gconstpointer a, gconstpointer b)
+{
+	GstMpg123PcmCacheKey const *ka = a;
+	GstMpg123PcmCacheKey const *kb = b;
+	return (ka->hash == kb->hash) && (ka->format == kb->format) && (ka->rate == kb->rate) && (ka->channels == kb->channels) && (ka->layout == kb->layout)
+		 && (ka->decoder == kb->decoder) && (ka->down_sample == kb->down_sample) && (ka->forced_rate == kb->forced_rate);
+}
+
+
+static void gst_mpg123_pcm_cache_make_key(GstMpg123PcmCacheKey *key, guint64 hash, GstAudioInfo const *audioinfo, GstMpg123PcmCacheDecoderInfo const *decoder_info)
+{
+	key->hash = hash;
+	key->format = GST_AUDIO_INFO_FORMAT(audioinfo);
+	key->rate = GST_AUDIO_INFO_RATE(audioinfo);
+	key->channels = GST_AUDIO_INFO_CHANNELS(audioinfo);
+	key->layout = GST_AUDIO_INFO_LAYOUT(audioinfo);
+	key->decoder = decoder_info->decoder;
+	key->down_sample = decoder_info->down_sample;
+	key->forced_rate = decoder_info->forced_rate;
+}
+
+
+static void gst_mpg123_pcm_cache_free_entry(GstMpg123PcmCacheEntry *entry)
+{
+	gst_buffer_unref(entry->buffer);
+	g_slice_free(GstMpg123PcmCacheEntry, entry);
+}
+
+
+static void gst_mpg123_pcm_cache_evict(void)
+{
+	/* Must be called with the mutex held */
+	while ((gst_mpg123_pcm_cache_size > gst_mpg123_pcm_cache_max_size) && !g_queue_is_empty(&gst_mpg123_pcm_cache_lru))
+	{
+		GList *link = g_queue_pop_tail_link(&gst_mpg123_pcm_cache_lru);
+		GstMpg123PcmCacheEntry *entry = link->data;
+
+		g_hash_table_remove(gst_mpg123_pcm_cache_entries, &(entry->key));
+		gst_mpg123_pcm_cache_size -= entry->size;
+		gst_mpg123_pcm_cache_num_evictions++;
+		gst_mpg123_pcm_cache_free_entry(entry);
+	}
+}
+
+
+guint64 gst_mpg123_pcm_cache_hash_frame(guint64 hash, gconstpointer data, gsize size)
+{
+	guint8 const *bytes = data;
+	gsize i;
+
+	/* 64-bit FNV-1a; MPEG frames are at most a few kB, so this is cheap compared to decoding them */
+	for (i = 0; i < size; ++i)
+	{
+		hash ^= bytes[i];
+		hash *= G_GUINT64_CONSTANT(0x100000001b3);
+	}
+
+	return hash;
+}
+
+
+void gst_mpg123_pcm_cache_request_max_size(guint64 max_size)
+{
+	g_mutex_lock(&gst_mpg123_pcm_cache_mutex);
+
+	if (gst_mpg123_pcm_cache_entries == NULL)
+	{
+		GST_DEBUG_CATEGORY_INIT(mpg123_pcm_cache_debug, "mpg123pcmcache", 0, "mpg123 decoded PCM cache");
+		gst_mpg123_pcm_cache_entries = g_hash_table_new(gst_mpg123_pcm_cache_key_hash, gst_mpg123_pcm_cache_key_equal);
+	}
+
+	if (max_size > gst_mpg123_pcm_cache_max_size)
+	{
+		GST_INFO("raising PCM cache size limit from %" G_GUINT64_FORMAT " to %" G_GUINT64_FORMAT " bytes", gst_mpg123_pcm_cache_max_size, max_size);
+		gst_mpg123_pcm_cache_max_size = max_size;
+	}
+
+	g_mutex_unlock(&gst_mpg123_pcm_cache_mutex);
+}
+
+
+GstBuffer* gst_mpg123_pcm_cache_lookup(guint64 hash, GstAudioInfo const *audioinfo, GstMpg123PcmCacheDecoderInfo const *decoder_info)
+{
+	GstMpg123PcmCacheKey key;
+	GstMpg123PcmCacheEntry *entry;
+	GstBuffer *buffer = NULL;
+
+	gst_mpg123_pcm_cache_make_key(&key, hash, audioinfo, decoder_info);
+
+	g_mutex_lock(&gst_mpg123_pcm_cache_mutex);
+
+	entry = (gst_mpg123_pcm_cache_entries != NULL) ? g_hash_table_lookup(gst_mpg123_pcm_cache_entries, &key) : NULL;
+	if (entry != NULL)
+	{
+		/* Move to the front of the LRU queue */
+		g_queue_unlink(&gst_mpg123_pcm_cache_lru, &(entry->lru_link));
+		g_queue_push_head_link(&gst_mpg123_pcm_cache_lru, &(entry->lru_link));
+		gst_mpg123_pcm_cache_num_hits++;
+
+		/* A shallow copy only references the memory, and gives the caller a buffer it can timestamp */
+		buffer = gst_buffer_copy(entry->buffer);
+	}
+	else
+		gst_mpg123_pcm_cache_num_misses++;
+
+	g_mutex_unlock(&gst_mpg123_pcm_cache_mutex);
+
+	return buffer;
+}
+
+
+void gst_mpg123_pcm_cache_insert(guint64 hash, GstAudioInfo const *audioinfo, GstMpg123PcmCacheDecoderInfo const *decoder_info, GstBuffer *buffer)
+{
+	GstMpg123PcmCacheKey key;
+	GstMpg123PcmCacheEntry *entry;
+	GstBuffer *copy;
+	gsize size;
+	gboolean skip;
+
+	size = gst_buffer_get_size(buffer);
+	gst_mpg123_pcm_cache_make_key(&key, hash, audioinfo, decoder_info);
+
+	/* Another decoder may have inserted the same samples already */
+	g_mutex_lock(&gst_mpg123_pcm_cache_mutex);
+	skip = (gst_mpg123_pcm_cache_entries == NULL) || (size + sizeof(GstMpg123PcmCacheEntry) > gst_mpg123_pcm_cache_max_size) || g_hash_table_contains(gst_mpg123_pcm_cache_entries, &key);
+	g_mutex_unlock(&gst_mpg123_pcm_cache_mutex);
+
+	if (skip)
+		return;
+
+	/*
+	The buffer itself may come from a downstream pool or shared memory, which must not be held on to
+	indefinitely, so the samples are copied into plain memory. This is done without holding the mutex;
+	if another decoder inserts the same entry meanwhile, the copy is simply dropped below.
+	*/
+	copy = gst_buffer_new_allocate(NULL, size, NULL);
+	gst_buffer_copy_into(copy, buffer, GST_BUFFER_COPY_META, 0, -1);
+	{
+		GstMapInfo info;
+		if (gst_buffer_map(copy, &info, GST_MAP_WRITE))
+		{
+			gst_buffer_extract(buffer, 0, info.data, size);
+			gst_buffer_unmap(copy, &info);
+		}
+		else
+		{
+			gst_buffer_unref(copy);
+			return;
+		}
+	}
+
+	entry = g_slice_new0(GstMpg123PcmCacheEntry);
+	entry->key = key;
+	entry->buffer = copy;
+	entry->size = size + sizeof(GstMpg123PcmCacheEntry);
+	entry->lru_link.data = entry;
+
+	g_mutex_lock(&gst_mpg123_pcm_cache_mutex);
+
+	if (g_hash_table_contains(gst_mpg123_pcm_cache_entries, &(entry->key)))
+	{
+		g_mutex_unlock(&gst_mpg123_pcm_cache_mutex);
+		gst_mpg123_pcm_cache_free_entry(entry);
+		return;
+	}
+
+	g_hash_table_insert(gst_mpg123_pcm_cache_entries, &(entry->key), entry);
+	g_queue_push_head_link(&gst_mpg123_pcm_cache_lru, &(entry->lru_link));
+	gst_mpg123_pcm_cache_size += entry->size;
+	gst_mpg123_pcm_cache_num_insertions++;
+	gst_mpg123_pcm_cache_evict();
+
+	g_mutex_unlock(&gst_mpg123_pcm_cache_mutex);
+}
+
+
+GstStructure* gst_mpg123_pcm_cache_get_stats(void)
+{
+	GstStructure *stats;
+
+	g_mutex_lock(&gst_mpg123_pcm_cache_mutex);
+	stats = gst_structure_new(
+		"application/x-mpg123-pcm-cache-stats",
+		"hits", G_TYPE_UINT64, gst_mpg123_pcm_cache_num_hits,
+		"misses", G_TYPE_UINT64, gst_mpg123_pcm_cache_num_misses,
+		"insertions", G_TYPE_UINT64, gst_mpg123_pcm_cache_num_insertions,
+		"evictions", G_TYPE_UINT64, gst_mpg123_pcm_cache_num_evictions,
+		"num-entries", G_TYPE_UINT, g_queue_get_length(&gst_mpg123_pcm_cache_lru),
+		"size", G_TYPE_UINT64, gst_mpg123_pcm_cache_size,
+		"max-size", G_TYPE_UINT64, gst_mpg123_pcm_cache_max_size,
+		NULL
+	);
+	g_mutex_unlock(&gst_mpg123_pcm_cache_mutex);
+
+	return stats;
+}
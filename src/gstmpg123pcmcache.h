@@ -0,0 +1,81 @@
+/*
+*   MP3 decoding plugin for GStreamer using the mpg123 library
+*   Copyright (C) 2012 Carlos Rafael Giani
+*
+*   This library is free software; you can redistribute it and/or
+*   modify it under the terms of the GNU Lesser General Public
+*   License as published by the Free Software Foundation; either
+*   version 2.1 of the License, or (at your option) any later version.
+*
+*   This library is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+*   Lesser General Public License for more details.
+*
+*   You should have received a copy of the GNU Lesser General Public
+*   License along with this library; if not, write to the Free Software
+*   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+
+
+
+#ifndef GSTMPG123PCMCACHE_H
+#define GSTMPG123PCMCACHE_H
+
+#include <gst/gst.h>
+#include <gst/audio/audio.h>
+
+
+G_BEGIN_DECLS
+
+
+/*
+Process-wide cache of decoded PCM buffers, for content that is decoded over and over again (jingles,
+prompts, ads). The decoded samples of a frame depend on the frames before it (bit reservoir, synthesis
+history), so an entry is not keyed by the frame alone, but by a hash chained over all input frames
+since the decoder was last reset, plus the output format and the decoder settings. Two decoders that
+were fed the same frames since their last reset therefore produce the same keys, and the same samples.
+
+Entries are evicted in least recently used order once the total size exceeds the limit. The cache
+keeps its own copy of inserted buffers; lookups return buffers sharing that copy's memory, so hits do
+not copy any samples. All functions are thread safe.
+*/
+
+
+/* Decoder settings which change the decoded samples without showing up in the output format */
+typedef struct
+{
+	/* name of the mpg123 decoder core (mpg123_current_decoder()), interned with g_intern_string(); the cores round differently */
+	gchar const *decoder;
+	/* down-sampling factor, and the rate mpg123 resamples to with NtoM (0 = none) */
+	gint down_sample;
+	glong forced_rate;
+}
+GstMpg123PcmCacheDecoderInfo;
+
+
+/* Start value for the hash chain; used after every decoder reset */
+#define GST_MPG123_PCM_CACHE_INITIAL_HASH G_GUINT64_CONSTANT(0xcbf29ce484222325)
+
+/* Chains the contents of a frame into the hash; returns the new hash */
+guint64 gst_mpg123_pcm_cache_hash_frame(guint64 hash, gconstpointer data, gsize size);
+
+/* Raises the size limit (in bytes) to max_size if it is currently lower; the limit is never lowered */
+void gst_mpg123_pcm_cache_request_max_size(guint64 max_size);
+
+/* Returns a new buffer with the cached samples, or NULL if there is no entry; counts as hit or miss */
+GstBuffer* gst_mpg123_pcm_cache_lookup(guint64 hash, GstAudioInfo const *audioinfo, GstMpg123PcmCacheDecoderInfo const *decoder_info);
+
+/* Inserts a copy of the buffer (including its metas, but not its timestamps) unless it is already cached */
+void gst_mpg123_pcm_cache_insert(guint64 hash, GstAudioInfo const *audioinfo, GstMpg123PcmCacheDecoderInfo const *decoder_info, GstBuffer *buffer);
+
+/* Hit/miss counters and fill level, as an application/x-mpg123-pcm-cache-stats structure */
+GstStructure* gst_mpg123_pcm_cache_get_stats(void);
+
+
+G_END_DECLS
+
+
+#endif
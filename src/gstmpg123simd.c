@@ -0,0 +1,304 @@
+/*
+*   MP3 decoding plugin for GStreamer using the mpg123 library
+*   Copyright (C) 2012 Carlos Rafael Giani
+*
+*   This library is free software; you can redistribute it and/or
+*   modify it under the terms of the GNU Lesser General Public
+*   License as published by the Free Software Foundation; either
+*   version 2.1 of the License, or (at your option) any later version.
+*
+*   This library is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+*   Lesser General Public License for more details.
+*
+*   You should have received a copy of the GNU Lesser General Public
+*   License along with this library; if not, write to the Free Software
+*   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+
+
+#include <string.h>
+#include "gstmpg123simd.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define GST_MPG123_SIMD_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define GST_MPG123_SIMD_NEON
+#endif
+
+
+static void gst_mpg123_deinterleave_stereo_16(guint8 *dest, guint8 const *src, gsize num_frames)
+{
+	guint16 *left = (guint16 *)dest;
+	guint16 *right = left + num_frames;
+	guint16 const *in = (guint16 const *)src;
+	gsize i = 0;
+
+#if defined(GST_MPG123_SIMD_SSE2)
+	/*
+	Each 32-bit lane holds one frame (left in the low half, right in the high half). Shifting
+	sign-extends the halves to 32 bit, so the saturating pack reproduces the original 16 bits
+	exactly, regardless of whether the samples are signed or unsigned.
+	*/
+	for (; (i + 8) <= num_frames; i += 8)
+	{
+		__m128i a = _mm_loadu_si128((__m128i const *)(in + i * 2));
+		__m128i b = _mm_loadu_si128((__m128i const *)(in + i * 2 + 8));
+		__m128i l = _mm_packs_epi32(_mm_srai_epi32(_mm_slli_epi32(a, 16), 16), _mm_srai_epi32(_mm_slli_epi32(b, 16), 16));
+		__m128i r = _mm_packs_epi32(_mm_srai_epi32(a, 16), _mm_srai_epi32(b, 16));
+		_mm_storeu_si128((__m128i *)(left + i), l);
+		_mm_storeu_si128((__m128i *)(right + i), r);
+	}
+#elif defined(GST_MPG123_SIMD_NEON)
+	for (; (i + 8) <= num_frames; i += 8)
+	{
+		uint16x8x2_t v = vld2q_u16(in + i * 2);
+		vst1q_u16(left + i, v.val[0]);
+		vst1q_u16(right + i, v.val[1]);
+	}
+#endif
+
+	for (; i < num_frames; ++i)
+	{
+		left[i] = in[i * 2 + 0];
+		right[i] = in[i * 2 + 1];
+	}
+}
+
+
+static void gst_mpg123_deinterleave_stereo_32(guint8 *dest, guint8 const *src, gsize num_frames)
+{
+	guint32 *left = (guint32 *)dest;
+	guint32 *right = left + num_frames;
+	guint32 const *in = (guint32 const *)src;
+	gsize i = 0;
+
+#if defined(GST_MPG123_SIMD_SSE2)
+	/* Float shuffles just move bits around, so they work for integer samples as well */
+	for (; (i + 4) <= num_frames; i += 4)
+	{
+		__m128 a = _mm_loadu_ps((float const *)(in + i * 2));
+		__m128 b = _mm_loadu_ps((float const *)(in + i * 2 + 4));
+		_mm_storeu_ps((float *)(left + i), _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+		_mm_storeu_ps((float *)(right + i), _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+	}
+#elif defined(GST_MPG123_SIMD_NEON)
+	for (; (i + 4) <= num_frames; i += 4)
+	{
+		uint32x4x2_t v = vld2q_u32(in + i * 2);
+		vst1q_u32(left + i, v.val[0]);
+		vst1q_u32(right + i, v.val[1]);
+	}
+#endif
+
+	for (; i < num_frames; ++i)
+	{
+		left[i] = in[i * 2 + 0];
+		right[i] = in[i * 2 + 1];
+	}
+}
+
+
+static void gst_mpg123_deinterleave_generic(guint8 *dest, guint8 const *src, gsize num_frames, guint num_channels, guint sample_size)
+{
+	gsize i;
+	guint ch;
+	gsize frame_size = (gsize)num_channels * sample_size;
+
+	for (ch = 0; ch < num_channels; ++ch)
+	{
+		guint8 *plane = dest + ch * num_frames * sample_size;
+		guint8 const *in = src + ch * sample_size;
+
+		for (i = 0; i < num_frames; ++i)
+			memcpy(plane + i * sample_size, in + i * frame_size, sample_size);
+	}
+}
+
+
+void gst_mpg123_deinterleave(gpointer dest, gconstpointer src, gsize num_frames, guint num_channels, guint sample_size)
+{
+	/* With one channel, interleaved and planar are the same */
+	if (num_channels == 1)
+	{
+		memcpy(dest, src, num_frames * sample_size);
+		return;
+	}
+
+	if (num_channels == 2)
+	{
+		switch (sample_size)
+		{
+			case 2:
+				gst_mpg123_deinterleave_stereo_16(dest, src, num_frames);
+				return;
+			case 4:
+				gst_mpg123_deinterleave_stereo_32(dest, src, num_frames);
+				return;
+			default:
+				/* 24 bit samples are not worth vectorizing, since mpg123 converts them from 32 bit anyway */
+				break;
+		}
+	}
+
+	gst_mpg123_deinterleave_generic(dest, src, num_frames, num_channels, sample_size);
+}
+
+
+guint gst_mpg123_conversion_get_source_size(GstMpg123Conversion conversion)
+{
+	switch (conversion)
+	{
+		case GST_MPG123_CONVERSION_S32_TO_S24:
+		case GST_MPG123_CONVERSION_S32_TO_U24:
+		case GST_MPG123_CONVERSION_S32_TO_U32:
+			return 4;
+		case GST_MPG123_CONVERSION_S16_TO_U16:
+			return 2;
+		default:
+			return 0;
+	}
+}
+
+
+guint gst_mpg123_conversion_get_dest_size(GstMpg123Conversion conversion)
+{
+	switch (conversion)
+	{
+		case GST_MPG123_CONVERSION_S32_TO_S24:
+		case GST_MPG123_CONVERSION_S32_TO_U24:
+			return 3;
+		case GST_MPG123_CONVERSION_S32_TO_U32:
+			return 4;
+		case GST_MPG123_CONVERSION_S16_TO_U16:
+			return 2;
+		default:
+			return 0;
+	}
+}
+
+
+static void gst_mpg123_flip_sign_16(guint8 *dest, guint8 const *src, gsize num_samples)
+{
+	guint16 *out = (guint16 *)dest;
+	guint16 const *in = (guint16 const *)src;
+	gsize i = 0;
+
+#if defined(GST_MPG123_SIMD_SSE2)
+	__m128i const sign = _mm_set1_epi16((short)0x8000);
+	for (; (i + 8) <= num_samples; i += 8)
+		_mm_storeu_si128((__m128i *)(out + i), _mm_xor_si128(_mm_loadu_si128((__m128i const *)(in + i)), sign));
+#elif defined(GST_MPG123_SIMD_NEON)
+	uint16x8_t const sign = vdupq_n_u16(0x8000);
+	for (; (i + 8) <= num_samples; i += 8)
+		vst1q_u16(out + i, veorq_u16(vld1q_u16(in + i), sign));
+#endif
+
+	for (; i < num_samples; ++i)
+		out[i] = in[i] ^ 0x8000;
+}
+
+
+static void gst_mpg123_flip_sign_32(guint8 *dest, guint8 const *src, gsize num_samples)
+{
+	guint32 *out = (guint32 *)dest;
+	guint32 const *in = (guint32 const *)src;
+	gsize i = 0;
+
+#if defined(GST_MPG123_SIMD_SSE2)
+	__m128i const sign = _mm_set1_epi32((int)0x80000000u);
+	for (; (i + 4) <= num_samples; i += 4)
+		_mm_storeu_si128((__m128i *)(out + i), _mm_xor_si128(_mm_loadu_si128((__m128i const *)(in + i)), sign));
+#elif defined(GST_MPG123_SIMD_NEON)
+	uint32x4_t const sign = vdupq_n_u32(0x80000000u);
+	for (; (i + 4) <= num_samples; i += 4)
+		vst1q_u32(out + i, veorq_u32(vld1q_u32(in + i), sign));
+#endif
+
+	for (; i < num_samples; ++i)
+		out[i] = in[i] ^ 0x80000000u;
+}
+
+
+static void gst_mpg123_pack_32_to_24(guint8 *dest, guint8 const *src, gsize num_samples, guint32 sign_flip)
+{
+	guint32 const *in = (guint32 const *)src;
+	gsize i = 0;
+
+	/*
+	The vector paths rely on the upper three bytes of a sample being its last three bytes in memory,
+	so they are little endian only. Each iteration loads all of its input before storing, and stores
+	less than it loads, so in-place conversion is safe.
+	*/
+#if defined(GST_MPG123_SIMD_SSE2) && (G_BYTE_ORDER == G_LITTLE_ENDIAN)
+	__m128i const sign = _mm_set1_epi32((int)sign_flip);
+	for (; (i + 4) <= num_samples; i += 4)
+	{
+		guint32 tail;
+		__m128i v = _mm_xor_si128(_mm_loadu_si128((__m128i const *)(in + i)), sign);
+		/* Per 64-bit lane: upper 24 bits of the first sample into bits 0-23, of the second into bits 24-47 */
+		__m128i lo = _mm_srli_epi64(_mm_slli_epi64(v, 32), 40);
+		__m128i hi = _mm_slli_epi64(_mm_srli_epi64(v, 40), 24);
+		__m128i packed = _mm_or_si128(lo, hi);
+		/* Close the 2 byte gap between the 6 valid bytes of each lane */
+		packed = _mm_or_si128(_mm_move_epi64(packed), _mm_slli_si128(_mm_srli_si128(packed, 8), 6));
+		_mm_storel_epi64((__m128i *)(dest + i * 3), packed);
+		tail = (guint32)_mm_cvtsi128_si32(_mm_srli_si128(packed, 8));
+		memcpy(dest + i * 3 + 8, &tail, 4);
+	}
+#elif defined(GST_MPG123_SIMD_NEON) && (G_BYTE_ORDER == G_LITTLE_ENDIAN)
+	/* vld4 splits the samples into their bytes, so dropping the lowest byte is just a matter of not storing it */
+	uint8x16_t const sign = vdupq_n_u8((guint8)(sign_flip >> 24));
+	for (; (i + 16) <= num_samples; i += 16)
+	{
+		uint8x16x4_t v = vld4q_u8(src + i * 4);
+		uint8x16x3_t packed;
+		packed.val[0] = v.val[1];
+		packed.val[1] = v.val[2];
+		packed.val[2] = veorq_u8(v.val[3], sign);
+		vst3q_u8(dest + i * 3, packed);
+	}
+#endif
+
+	for (; i < num_samples; ++i)
+	{
+		guint32 sample = in[i] ^ sign_flip;
+		guint8 *out = dest + i * 3;
+#if G_BYTE_ORDER == G_LITTLE_ENDIAN
+		out[0] = (guint8)(sample >> 8);
+		out[1] = (guint8)(sample >> 16);
+		out[2] = (guint8)(sample >> 24);
+#else
+		out[0] = (guint8)(sample >> 24);
+		out[1] = (guint8)(sample >> 16);
+		out[2] = (guint8)(sample >> 8);
+#endif
+	}
+}
+
+
+void gst_mpg123_convert(gpointer dest, gconstpointer src, gsize num_samples, GstMpg123Conversion conversion)
+{
+	switch (conversion)
+	{
+		case GST_MPG123_CONVERSION_S32_TO_S24:
+			gst_mpg123_pack_32_to_24(dest, src, num_samples, 0);
+			break;
+		case GST_MPG123_CONVERSION_S32_TO_U24:
+			gst_mpg123_pack_32_to_24(dest, src, num_samples, 0x80000000u);
+			break;
+		case GST_MPG123_CONVERSION_S32_TO_U32:
+			gst_mpg123_flip_sign_32(dest, src, num_samples);
+			break;
+		case GST_MPG123_CONVERSION_S16_TO_U16:
+			gst_mpg123_flip_sign_16(dest, src, num_samples);
+			break;
+		default:
+			break;
+	}
+}
@@ -0,0 +1,79 @@
+/*
+*   MP3 decoding plugin for GStreamer using the mpg123 library
+*   Copyright (C) 2012 Carlos Rafael Giani
+*
+*   This library is free software; you can redistribute it and/or
+*   modify it under the terms of the GNU Lesser General Public
+*   License as published by the Free Software Foundation; either
+*   version 2.1 of the License, or (at your option) any later version.
+*
+*   This library is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+*   Lesser General Public License for more details.
+*
+*   You should have received a copy of the GNU Lesser General Public
+*   License along with this library; if not, write to the Free Software
+*   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+
+
+#ifndef GSTMPG123SIMD_H
+#define GSTMPG123SIMD_H
+
+#include <glib.h>
+
+
+G_BEGIN_DECLS
+
+
+/*
+Sample layout and format conversions for the decoded output. These use SSE2 or NEON where the compiler
+targets them (SSE2 is always available on x86-64, NEON on AArch64), with a plain C fallback
+for everything else. Source and destination may have any alignment.
+*/
+
+
+/*
+Copies interleaved samples to planar layout: all samples of channel 0 first, then all samples
+of channel 1 etc. sample_size is the size of one sample in bytes (2, 3 or 4 for the formats
+mpg123 outputs; other sizes use the fallback). Source and destination must not overlap.
+*/
+void gst_mpg123_deinterleave(gpointer dest, gconstpointer src, gsize num_frames, guint num_channels, guint sample_size);
+
+
+/*
+Sample format conversions from the formats mpg123 synthesizes natively. mpg123 creates 24 bit and
+unsigned output by decoding to signed 32 or 16 bit and then converting with generic scalar code, so
+doing the same conversions here gives bit-exact results: 24 bit samples are the upper three bytes of
+the 32 bit ones (truncated, not rounded), and unsigned samples have their sign bit flipped.
+*/
+typedef enum
+{
+	GST_MPG123_CONVERSION_NONE,
+	GST_MPG123_CONVERSION_S32_TO_S24,
+	GST_MPG123_CONVERSION_S32_TO_U24,
+	GST_MPG123_CONVERSION_S32_TO_U32,
+	GST_MPG123_CONVERSION_S16_TO_U16
+}
+GstMpg123Conversion;
+
+/* Size of one sample in bytes before and after the conversion; 0 for GST_MPG123_CONVERSION_NONE */
+guint gst_mpg123_conversion_get_source_size(GstMpg123Conversion conversion);
+guint gst_mpg123_conversion_get_dest_size(GstMpg123Conversion conversion);
+
+/*
+Converts num_samples samples (counted over all channels) from src to dest. 24 bit samples are packed and
+in native byte order. The conversion can be done in place (dest == src), since no destination sample
+is larger than its source sample; other overlaps are not allowed. With GST_MPG123_CONVERSION_NONE,
+nothing is done.
+*/
+void gst_mpg123_convert(gpointer dest, gconstpointer src, gsize num_samples, GstMpg123Conversion conversion);
+
+
+G_END_DECLS
+
+
+#endif
@@ -0,0 +1,131 @@
+/*
+*   MP3 decoding plugin for GStreamer using the mpg123 library
+*   Copyright (C) 2012 Carlos Rafael Giani
+*
+*   This library is free software; you can redistribute it and/or
+*   modify it under the terms of the GNU Lesser General Public
+*   License as published by the Free Software Foundation; either
+*   version 2.1 of the License, or (at your option) any later version.
+*
+*   This library is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+*   Lesser General Public License for more details.
+*
+*   You should have received a copy of the GNU Lesser General Public
+*   License along with this library; if not, write to the Free Software
+*   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+
+#include "gstmpg123spscqueue.h"
+
+
+typedef struct
+{
+	gpointer item;
+	gint tag;
+}
+GstMpg123SpscQueueSlot;
+
+
+struct _GstMpg123SpscQueue
+{
+	GstMpg123SpscQueueSlot *slots;
+	guint capacity, mask;
+
+	/*
+	Both counters increase monotonically and wrap around; their difference is the fill level.
+	head is only written by the consumer, tail only by the producer. The atomic accesses also act
+	as memory barriers, so a slot is fully written before the consumer can see the new tail value,
+	and fully read before the producer can see the new head value.
+	*/
+	volatile gint head;
+	volatile gint tail;
+};
+
+
+GstMpg123SpscQueue* gst_mpg123_spsc_queue_new(guint min_capacity)
+{
+	GstMpg123SpscQueue *queue;
+	guint capacity;
+
+	/* The capacity is rounded up to a power of two, so indices can be masked instead of using a modulo */
+	capacity = 1;
+	while (capacity < MAX(min_capacity, 1))
+		capacity <<= 1;
+
+	queue = g_slice_new0(GstMpg123SpscQueue);
+	queue->slots = g_new0(GstMpg123SpscQueueSlot, capacity);
+	queue->capacity = capacity;
+	queue->mask = capacity - 1;
+
+	return queue;
+}
+
+
+void gst_mpg123_spsc_queue_free(GstMpg123SpscQueue *queue)
+{
+	if (queue == NULL)
+		return;
+
+	g_free(queue->slots);
+	g_slice_free(GstMpg123SpscQueue, queue);
+}
+
+
+guint gst_mpg123_spsc_queue_get_capacity(GstMpg123SpscQueue *queue)
+{
+	return queue->capacity;
+}
+
+
+guint gst_mpg123_spsc_queue_get_fill_level(GstMpg123SpscQueue *queue)
+{
+	return (guint)g_atomic_int_get(&(queue->tail)) - (guint)g_atomic_int_get(&(queue->head));
+}
+
+
+gsize gst_mpg123_spsc_queue_get_memory_usage(GstMpg123SpscQueue *queue)
+{
+	return sizeof(GstMpg123SpscQueue) + queue->capacity * sizeof(GstMpg123SpscQueueSlot);
+}
+
+
+gboolean gst_mpg123_spsc_queue_push(GstMpg123SpscQueue *queue, gpointer item, gint tag)
+{
+	guint head, tail;
+
+	tail = (guint)g_atomic_int_get(&(queue->tail));
+	head = (guint)g_atomic_int_get(&(queue->head));
+
+	if ((tail - head) >= queue->capacity)
+		return FALSE;
+
+	queue->slots[tail & queue->mask].item = item;
+	queue->slots[tail & queue->mask].tag = tag;
+
+	g_atomic_int_set(&(queue->tail), (gint)(tail + 1));
+
+	return TRUE;
+}
+
+
+gboolean gst_mpg123_spsc_queue_pop(GstMpg123SpscQueue *queue, gpointer *item, gint *tag)
+{
+	guint head, tail;
+
+	head = (guint)g_atomic_int_get(&(queue->head));
+	tail = (guint)g_atomic_int_get(&(queue->tail));
+
+	if (head == tail)
+		return FALSE;
+
+	*item = queue->slots[head & queue->mask].item;
+	*tag = queue->slots[head & queue->mask].tag;
+
+	g_atomic_int_set(&(queue->head), (gint)(head + 1));
+
+	return TRUE;
+}
@@ -0,0 +1,54 @@
+/*
+*   MP3 decoding plugin for GStreamer using the mpg123 library
+*   Copyright (C) 2012 Carlos Rafael Giani
+*
+*   This library is free software; you can redistribute it and/or
+*   modify it under the terms of the GNU Lesser General Public
+*   License as published by the Free Software Foundation; either
+*   version 2.1 of the License, or (at your option) any later version.
+*
+*   This library is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+*   Lesser General Public License for more details.
+*
+*   You should have received a copy of the GNU Lesser General Public
+*   License along with this library; if not, write to the Free Software
+*   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+
+#ifndef GSTMPG123SPSCQUEUE_H
+#define GSTMPG123SPSCQUEUE_H
+
+#include <glib.h>
+
+
+G_BEGIN_DECLS
+
+
+/*
+Bounded lock-free single-producer single-consumer queue. Each entry is a pointer (which may be NULL)
+plus an integer tag. Exactly one thread may push, and exactly one thread may pop; the queue does not
+block, so waiting for space or data is up to the caller.
+*/
+typedef struct _GstMpg123SpscQueue GstMpg123SpscQueue;
+
+
+GstMpg123SpscQueue* gst_mpg123_spsc_queue_new(guint min_capacity);
+void gst_mpg123_spsc_queue_free(GstMpg123SpscQueue *queue);
+
+guint gst_mpg123_spsc_queue_get_capacity(GstMpg123SpscQueue *queue);
+guint gst_mpg123_spsc_queue_get_fill_level(GstMpg123SpscQueue *queue);
+/* Size of the queue itself in bytes, not including whatever the queued items point to */
+gsize gst_mpg123_spsc_queue_get_memory_usage(GstMpg123SpscQueue *queue);
+
+gboolean gst_mpg123_spsc_queue_push(GstMpg123SpscQueue *queue, gpointer item, gint tag);
+gboolean gst_mpg123_spsc_queue_pop(GstMpg123SpscQueue *queue, gpointer *item, gint *tag);
+
+
+G_END_DECLS
+
+
+#endif
@@ -0,0 +1,328 @@
+/*
+*   MP3 decoding plugin for GStreamer using the mpg123 library
+*   Copyright (C) 2012 Carlos Rafael Giani
+*
+*   This library is free software; you can redistribute it and/or
+*   modify it under the terms of the GNU Lesser General Public
+*   License as published by the Free Software Foundation; either
+*   version 2.1 of the License, or (at your option) any later version.
+*
+*   This library is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+*   Lesser General Public License for more details.
+*
+*   You should have received a copy of the GNU Lesser General Public
+*   License along with this library; if not, write to the Free Software
+*   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+
+
+#include <string.h>
+#include "gstmpg123tracer.h"
+
+
+#if GST_CHECK_VERSION(1, 8, 0)
+
+#include <gst/gsttracer.h>
+#include <gst/gsttracerrecord.h>
+
+
+GST_DEBUG_CATEGORY_STATIC(mpg123_tracer_debug);
+#define GST_CAT_DEFAULT mpg123_tracer_debug
+
+
+typedef struct _GstMpg123Tracer GstMpg123Tracer;
+typedef struct _GstMpg123TracerClass GstMpg123TracerClass;
+
+
+struct _GstMpg123Tracer
+{
+	GstTracer parent;
+
+	/* Periodic logging (the "interval" parameter, in seconds; 0 = off) */
+	guint interval;
+	GThread *log_thread;
+	GMutex log_mutex;
+	GCond log_cond;
+	gboolean log_thread_quit;
+};
+
+
+struct _GstMpg123TracerClass
+{
+	GstTracerClass parent_class;
+};
+
+
+/* Histogram buckets are powers of two in nanoseconds; the last bucket also collects everything longer */
+#define GST_MPG123_TRACER_NUM_BUCKETS 32
+
+
+typedef struct
+{
+	guint64 count;
+	GstClockTime total, min, max;
+	guint64 buckets[GST_MPG123_TRACER_NUM_BUCKETS];
+}
+GstMpg123TracePhaseStats;
+
+
+static char const * const phase_names[GST_MPG123_TRACE_NUM_PHASES] =
+{
+	"input-map",
+	"feed",
+	"decode",
+	"output",
+	"finish-frame"
+};
+
+
+/*
+Statistics are process-wide, since the elements have no way of telling which tracer instance they
+should report to. Recording only happens while at least one tracer is active.
+*/
+volatile gint gst_mpg123_num_active_tracers = 0;
+static GMutex phase_stats_mutex;
+static GstMpg123TracePhaseStats phase_stats[GST_MPG123_TRACE_NUM_PHASES];
+static GstTracerRecord *phase_stats_record = NULL;
+
+
+static void gst_mpg123_tracer_constructed(GObject *object);
+static void gst_mpg123_tracer_finalize(GObject *object);
+static void gst_mpg123_tracer_log_stats(void);
+static gpointer gst_mpg123_tracer_log_thread_func(gpointer user_data);
+static void gst_mpg123_tracer_state_change_post(GObject *self, GstClockTime ts, GstElement *element, GstStateChange transition, GstStateChangeReturn result);
+
+
+G_DEFINE_TYPE(GstMpg123Tracer, gst_mpg123_tracer, GST_TYPE_TRACER)
+
+
+static void gst_mpg123_tracer_class_init(GstMpg123TracerClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS(klass);
+
+	GST_DEBUG_CATEGORY_INIT(mpg123_tracer_debug, "mpg123stats", 0, "mpg123 decoding phase statistics");
+
+	object_class->constructed = GST_DEBUG_FUNCPTR(gst_mpg123_tracer_constructed);
+	object_class->finalize    = GST_DEBUG_FUNCPTR(gst_mpg123_tracer_finalize);
+
+	phase_stats_record = gst_tracer_record_new(
+		"mpg123-phase.class",
+		"phase", GST_TYPE_STRUCTURE, gst_structure_new("value",
+			"type", G_TYPE_GTYPE, G_TYPE_STRING,
+			"description", G_TYPE_STRING, "decoding phase",
+			NULL),
+		"count", GST_TYPE_STRUCTURE, gst_structure_new("value",
+			"type", G_TYPE_GTYPE, G_TYPE_UINT64,
+			"description", G_TYPE_STRING, "number of times the phase ran",
+			NULL),
+		"average", GST_TYPE_STRUCTURE, gst_structure_new("value",
+			"type", G_TYPE_GTYPE, G_TYPE_UINT64,
+			"description", G_TYPE_STRING, "average duration in nanoseconds",
+			NULL),
+		"min", GST_TYPE_STRUCTURE, gst_structure_new("value",
+			"type", G_TYPE_GTYPE, G_TYPE_UINT64,
+			"description", G_TYPE_STRING, "minimum duration in nanoseconds",
+			NULL),
+		"max", GST_TYPE_STRUCTURE, gst_structure_new("value",
+			"type", G_TYPE_GTYPE, G_TYPE_UINT64,
+			"description", G_TYPE_STRING, "maximum duration in nanoseconds",
+			NULL),
+		"histogram", GST_TYPE_STRUCTURE, gst_structure_new("value",
+			"type", G_TYPE_GTYPE, G_TYPE_STRING,
+			"description", G_TYPE_STRING, "comma-separated counts of durations below 2^1, 2^2, ... 2^32 nanoseconds",
+			NULL),
+		NULL
+	);
+}
+
+
+static void gst_mpg123_tracer_init(GstMpg123Tracer *tracer)
+{
+	tracer->interval = 0;
+	tracer->log_thread = NULL;
+	g_mutex_init(&(tracer->log_mutex));
+	g_cond_init(&(tracer->log_cond));
+	tracer->log_thread_quit = FALSE;
+
+	g_mutex_lock(&phase_stats_mutex);
+	if (g_atomic_int_get(&gst_mpg123_num_active_tracers) == 0)
+	{
+		guint i;
+		memset(phase_stats, 0, sizeof(phase_stats));
+		for (i = 0; i < GST_MPG123_TRACE_NUM_PHASES; ++i)
+			phase_stats[i].min = GST_CLOCK_TIME_NONE;
+	}
+	g_atomic_int_inc(&gst_mpg123_num_active_tracers);
+	g_mutex_unlock(&phase_stats_mutex);
+}
+
+
+static void gst_mpg123_tracer_constructed(GObject *object)
+{
+	GstMpg123Tracer *tracer = (GstMpg123Tracer *)object;
+	gchar *params = NULL;
+
+	G_OBJECT_CLASS(gst_mpg123_tracer_parent_class)->constructed(object);
+
+	/* Parameters are given like this: GST_TRACERS="mpg123stats(interval=10)" */
+	g_object_get(object, "params", &params, NULL);
+	if (params != NULL)
+	{
+		gchar *structure_string = g_strdup_printf("mpg123stats,%s", params);
+		GstStructure *structure = gst_structure_from_string(structure_string, NULL);
+
+		if (structure != NULL)
+		{
+			gst_structure_get_uint(structure, "interval", &(tracer->interval));
+			gst_structure_free(structure);
+		}
+		else
+			GST_WARNING_OBJECT(tracer, "could not parse tracer parameters \"%s\"", params);
+
+		g_free(structure_string);
+		g_free(params);
+	}
+
+	/*
+	Long-running processes rarely call gst_deinit(), so the statistics are also logged whenever a pipeline
+	stops, and optionally every interval seconds. The values are cumulative since the tracer was created.
+	*/
+	gst_tracing_register_hook(GST_TRACER(tracer), "element-change-state-post", G_CALLBACK(gst_mpg123_tracer_state_change_post));
+
+	if (tracer->interval > 0)
+	{
+		GST_INFO_OBJECT(tracer, "logging statistics every %u seconds", tracer->interval);
+		tracer->log_thread = g_thread_new("mpg123stats", gst_mpg123_tracer_log_thread_func, tracer);
+	}
+}
+
+
+static void gst_mpg123_tracer_log_stats(void)
+{
+	guint phase;
+
+	g_mutex_lock(&phase_stats_mutex);
+
+	for (phase = 0; phase < GST_MPG123_TRACE_NUM_PHASES; ++phase)
+	{
+		GstMpg123TracePhaseStats *stats = &(phase_stats[phase]);
+		GString *histogram;
+		guint i;
+
+		if (stats->count == 0)
+			continue;
+
+		histogram = g_string_new("");
+		for (i = 0; i < GST_MPG123_TRACER_NUM_BUCKETS; ++i)
+			g_string_append_printf(histogram, "%s%" G_GUINT64_FORMAT, (i > 0) ? "," : "", stats->buckets[i]);
+
+		gst_tracer_record_log(phase_stats_record, phase_names[phase], stats->count, stats->total / stats->count, stats->min, stats->max, histogram->str);
+
+		GST_INFO(
+			"%s: %" G_GUINT64_FORMAT " times, average %" GST_TIME_FORMAT ", min %" GST_TIME_FORMAT ", max %" GST_TIME_FORMAT,
+			phase_names[phase],
+			stats->count,
+			GST_TIME_ARGS(stats->total / stats->count),
+			GST_TIME_ARGS(stats->min),
+			GST_TIME_ARGS(stats->max)
+		);
+
+		g_string_free(histogram, TRUE);
+	}
+
+	g_mutex_unlock(&phase_stats_mutex);
+}
+
+
+static gpointer gst_mpg123_tracer_log_thread_func(gpointer user_data)
+{
+	GstMpg123Tracer *tracer = (GstMpg123Tracer *)user_data;
+	gint64 next_log_time = g_get_monotonic_time() + (gint64)(tracer->interval) * G_TIME_SPAN_SECOND;
+
+	g_mutex_lock(&(tracer->log_mutex));
+
+	while (!(tracer->log_thread_quit))
+	{
+		if (g_cond_wait_until(&(tracer->log_cond), &(tracer->log_mutex), next_log_time))
+			continue;
+
+		g_mutex_unlock(&(tracer->log_mutex));
+		gst_mpg123_tracer_log_stats();
+		g_mutex_lock(&(tracer->log_mutex));
+
+		next_log_time += (gint64)(tracer->interval) * G_TIME_SPAN_SECOND;
+	}
+
+	g_mutex_unlock(&(tracer->log_mutex));
+
+	return NULL;
+}
+
+
+static void gst_mpg123_tracer_state_change_post(GObject *self, GstClockTime ts, GstElement *element, GstStateChange transition, GstStateChangeReturn result)
+{
+	(void)self;
+	(void)ts;
+
+	/* Only top-level pipelines, so that stopping a pipeline logs the statistics once, and not once per element */
+	if ((transition == GST_STATE_CHANGE_PAUSED_TO_READY) && (result != GST_STATE_CHANGE_FAILURE) && GST_IS_PIPELINE(element) && (GST_OBJECT_PARENT(element) == NULL))
+		gst_mpg123_tracer_log_stats();
+}
+
+
+static void gst_mpg123_tracer_finalize(GObject *object)
+{
+	GstMpg123Tracer *tracer = (GstMpg123Tracer *)object;
+
+	if (tracer->log_thread != NULL)
+	{
+		g_mutex_lock(&(tracer->log_mutex));
+		tracer->log_thread_quit = TRUE;
+		g_cond_signal(&(tracer->log_cond));
+		g_mutex_unlock(&(tracer->log_mutex));
+		g_thread_join(tracer->log_thread);
+	}
+
+	gst_mpg123_tracer_log_stats();
+
+	g_mutex_lock(&phase_stats_mutex);
+	g_atomic_int_add(&gst_mpg123_num_active_tracers, -1);
+	g_mutex_unlock(&phase_stats_mutex);
+
+	g_cond_clear(&(tracer->log_cond));
+	g_mutex_clear(&(tracer->log_mutex));
+
+	G_OBJECT_CLASS(gst_mpg123_tracer_parent_class)->finalize(object);
+}
+
+
+void gst_mpg123_tracer_record(GstMpg123TracePhase phase, GstClockTime duration)
+{
+	GstMpg123TracePhaseStats *stats;
+	guint bucket;
+
+	g_assert(phase < GST_MPG123_TRACE_NUM_PHASES);
+
+	/* Index of the highest set bit, so bucket N holds durations in [2^N, 2^(N+1)) */
+	bucket = 0;
+	while ((bucket < (GST_MPG123_TRACER_NUM_BUCKETS - 1)) && ((duration >> (bucket + 1)) != 0))
+		bucket++;
+
+	g_mutex_lock(&phase_stats_mutex);
+
+	stats = &(phase_stats[phase]);
+	stats->count++;
+	stats->total += duration;
+	stats->min = MIN(stats->min, duration);
+	stats->max = MAX(stats->max, duration);
+	stats->buckets[bucket]++;
+
+	g_mutex_unlock(&phase_stats_mutex);
+}
+
+
+#endif
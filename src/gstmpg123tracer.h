@@ -0,0 +1,120 @@
+/*
+*   MP3 decoding plugin for GStreamer using the mpg123 library
+*   Copyright (C) 2012 Carlos Rafael Giani
+*
+*   This library is free software; you can redistribute it and/or
+*   modify it under the terms of the GNU Lesser General Public
+*   License as published by the Free Software Foundation; either
+*   version 2.1 of the License, or (at your option) any later version.
+*
+*   This library is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+*   Lesser General Public License for more details.
+*
+*   You should have received a copy of the GNU Lesser General Public
+*   License along with this library; if not, write to the Free Software
+*   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+
+
+#ifndef GSTMPG123TRACER_H
+#define GSTMPG123TRACER_H
+
+#include <config.h>
+#include <gst/gst.h>
+
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+#endif
+
+
+G_BEGIN_DECLS
+
+
+/*
+Instrumentation of the decoding hot path
+
+There are two independent mechanisms:
+
+1. The "mpg123stats" tracer (GStreamer 1.8 and newer), enabled with GST_TRACERS=mpg123stats.
+   It collects per-phase timing histograms and logs them as tracer records whenever a pipeline goes
+   from PAUSED to READY, every N seconds if started as GST_TRACERS="mpg123stats(interval=N)", and
+   when it is destroyed (at gst_deinit()); they show up with GST_DEBUG=GST_TRACER:7. The values are
+   cumulative. If no such tracer is active, each instrumentation point costs one atomic load.
+
+2. USDT probes (provider "gstmpg123"), if the plugin was configured with --enable-usdt. These
+   are no-op instructions until a tool like perf or bpftrace attaches to them. Each phase has
+   a <phase>__start and a <phase>__done probe; the arguments are listed below.
+*/
+
+
+typedef enum
+{
+	GST_MPG123_TRACE_PHASE_INPUT_MAP,    /* gst_buffer_map() of the input buffer */
+	GST_MPG123_TRACE_PHASE_FEED,         /* feeding input into mpg123; probe argument: number of bytes */
+	GST_MPG123_TRACE_PHASE_DECODE,       /* decoding a frame; done probe arguments: mpg123 result code, number of decoded bytes */
+	GST_MPG123_TRACE_PHASE_OUTPUT,       /* allocating the output buffer and copying the decoded samples; probe argument: number of bytes */
+	GST_MPG123_TRACE_PHASE_FINISH_FRAME, /* gst_audio_decoder_finish_frame() */
+
+	GST_MPG123_TRACE_NUM_PHASES
+}
+GstMpg123TracePhase;
+
+
+#ifdef HAVE_SYS_SDT_H
+#define GST_MPG123_PROBE(name)              DTRACE_PROBE(gstmpg123, name)
+#define GST_MPG123_PROBE1(name, a)          DTRACE_PROBE1(gstmpg123, name, a)
+#define GST_MPG123_PROBE2(name, a, b)       DTRACE_PROBE2(gstmpg123, name, a, b)
+#else
+#define GST_MPG123_PROBE(name)              G_STMT_START { } G_STMT_END
+#define GST_MPG123_PROBE1(name, a)          G_STMT_START { } G_STMT_END
+#define GST_MPG123_PROBE2(name, a, b)       G_STMT_START { } G_STMT_END
+#endif
+
+
+#if GST_CHECK_VERSION(1, 8, 0)
+
+#define GST_TYPE_MPG123_TRACER             (gst_mpg123_tracer_get_type())
+
+GType gst_mpg123_tracer_get_type(void);
+
+/* Number of active mpg123stats tracers; only read through gst_mpg123_trace_start() */
+extern volatile gint gst_mpg123_num_active_tracers;
+
+void gst_mpg123_tracer_record(GstMpg123TracePhase phase, GstClockTime duration);
+
+/* Returns the start timestamp of a phase, or GST_CLOCK_TIME_NONE if no tracer is active */
+static inline GstClockTime gst_mpg123_trace_start(void)
+{
+	return G_UNLIKELY(g_atomic_int_get(&gst_mpg123_num_active_tracers) > 0) ? gst_util_get_timestamp() : GST_CLOCK_TIME_NONE;
+}
+
+static inline void gst_mpg123_trace_stop(GstMpg123TracePhase phase, GstClockTime start)
+{
+	if (G_UNLIKELY(GST_CLOCK_TIME_IS_VALID(start)))
+		gst_mpg123_tracer_record(phase, gst_util_get_timestamp() - start);
+}
+
+#else
+
+static inline GstClockTime gst_mpg123_trace_start(void)
+{
+	return GST_CLOCK_TIME_NONE;
+}
+
+static inline void gst_mpg123_trace_stop(GstMpg123TracePhase phase, GstClockTime start)
+{
+	(void)phase;
+	(void)start;
+}
+
+#endif
+
+
+G_END_DECLS
+
+
+#endif
@@ -0,0 +1,1253 @@
+/*
+*   MP3 decoding plugin for GStreamer using the mpg123 library
+*   Copyright (C) 2012 Carlos Rafael Giani
+*
+*   This library is free software; you can redistribute it and/or
+*   modify it under the terms of the GNU Lesser General Public
+*   License as published by the Free Software Foundation; either
+*   version 2.1 of the License, or (at your option) any later version.
+*
+*   This library is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+*   Lesser General Public License for more details.
+*
+*   You should have received a copy of the GNU Lesser General Public
+*   License along with this library; if not, write to the Free Software
+*   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+
+
+
+/*
+Benchmarks for the mpg123 element and the decoding core. Each benchmark is a subcommand:
+
+  mpg123bench stress [--instances=1,2,4,8] [--seconds=10] [--props="async-decode=true"] [--file=song.mp3]
+  mpg123bench density [--instances=1,10,100,1000] [--props="feed-pool-size=0 feed-buffer-size=1024"]
+  mpg123bench scan [--files=100] [--seconds=240] [--file=song.mp3]
+  mpg123bench direct [--loops=10] [--file=song.mp3]
+  mpg123bench framebyframe [--loops=10] [--file=song.mp3]
+  mpg123bench resample [--rate=48000] [--loops=10] [--file=song.mp3]
+
+All commands accept --plugin=FILE to benchmark the mpg123 element from a specific plugin file, for example
+to compare a build using the system libmpg123 with one using a bundled mpg123 (see README.rst).
+
+Without --file, the input is a synthetic layer I stream (see gstmpg123testutils.h). Layer I is much
+cheaper to decode than layer III, so absolute numbers are only meaningful with real MP3 files, but the
+synthetic streams are good enough for spotting scaling problems.
+*/
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <gst/gst.h>
+#include <gst/audio/audio.h>
+#include <gst/app/gstappsrc.h>
+#include "gstmpg123core.h"
+#include "gstmpg123testutils.h"
+
+
+/* Frames pushed into the appsrc per need-data callback */
+#define GST_MPG123_BENCH_PUSH_FRAMES 32
+/* Frames a density benchmark pipeline decodes before it idles */
+#define GST_MPG123_BENCH_DENSITY_FRAMES 8
+/* Range of the delay search between resampled outputs, in output frames */
+#define GST_MPG123_BENCH_MAX_LAG 64
+
+
+typedef struct
+{
+	GstElement *pipeline;
+	GstElement *appsrc;
+	GstElement *decoder;
+	GstBus *bus;
+	GstMpg123TestStream *stream;
+	guint next_frame;
+	/* The stream is pushed this many times in a row (0 and 1 = once) */
+	guint num_loops, loop;
+	/* If nonzero, only this many frames are pushed, and no EOS follows, so the pipeline stays active */
+	guint max_frames;
+	gboolean done, failed;
+}
+GstMpg123BenchPipeline;
+
+
+typedef struct
+{
+	gchar const *name;
+	gchar const *description;
+	GOptionEntry const *entries;
+	int (*run)(void);
+}
+GstMpg123BenchCommand;
+
+
+static gchar *gst_mpg123_bench_file = NULL;
+static gdouble gst_mpg123_bench_seconds = 10.0;
+static gchar *gst_mpg123_bench_props = NULL;
+static gchar *gst_mpg123_bench_plugin = NULL;
+static gchar *gst_mpg123_bench_instances = NULL;
+static gint gst_mpg123_bench_num_files = 100;
+static gint gst_mpg123_bench_num_loops = 10;
+static gint gst_mpg123_bench_rate = 48000;
+
+
+static gboolean gst_mpg123_bench_load_plugin(void);
+static GstMpg123TestStream* gst_mpg123_bench_load_stream(void);
+static void gst_mpg123_bench_need_data(GstAppSrc *appsrc, guint length, gpointer user_data);
+static GstMpg123BenchPipeline* gst_mpg123_bench_pipeline_new(GstMpg123TestStream *stream, gchar const *decoder, gchar const *tail);
+static void gst_mpg123_bench_pipeline_free(GstMpg123BenchPipeline *bench_pipeline);
+static gboolean gst_mpg123_bench_pipeline_poll(GstMpg123BenchPipeline *bench_pipeline);
+static gboolean gst_mpg123_bench_run_pipelines(GPtrArray *pipelines, guint64 *peak_rss);
+static gboolean gst_mpg123_bench_start_idle_pipelines(GPtrArray *pipelines, GstMpg123TestStream *stream, gchar const *decoder, guint count);
+static guint* gst_mpg123_bench_parse_instances(gchar const *instances, gchar const *default_instances, guint *num_counts);
+static int gst_mpg123_bench_stress(void);
+static int gst_mpg123_bench_density(void);
+static gboolean gst_mpg123_bench_scan_files(GstMpg123TestStream *stream, gboolean fast_scan, gdouble *wall_time, gint64 *duration);
+static int gst_mpg123_bench_scan(void);
+static gboolean gst_mpg123_bench_decode_direct(GstMpg123TestStream *stream, GstMpg123CoreConfig const *config, guint num_loops, gdouble *wall_time);
+static gboolean gst_mpg123_bench_decode_pipeline(GstMpg123TestStream *stream, guint num_loops, gdouble *wall_time);
+static int gst_mpg123_bench_direct(void);
+static int gst_mpg123_bench_frame_by_frame(void);
+static void gst_mpg123_bench_handoff(GstElement *sink, GstBuffer *buffer, GstPad *pad, gpointer user_data);
+static gboolean gst_mpg123_bench_decode_resampled(GstMpg123TestStream *stream, gchar const *decoder, gchar const *resampler, gint rate, guint num_loops, GByteArray *output, guint64 *cpu_time);
+static gdouble gst_mpg123_bench_get_snr(GByteArray const *reference, GByteArray const *output, gint channels, gint *lag);
+static int gst_mpg123_bench_resample(void);
+
+
+static GOptionEntry const gst_mpg123_bench_common_entries[] =
+{
+	{ "file", 'f', 0, G_OPTION_ARG_FILENAME, &gst_mpg123_bench_file, "MPEG audio file to decode instead of a synthetic stream", "FILE" },
+	{ "seconds", 's', 0, G_OPTION_ARG_DOUBLE, &gst_mpg123_bench_seconds, "Length of the synthetic stream (default: 10)", "SECONDS" },
+	{ "props", 'p', 0, G_OPTION_ARG_STRING, &gst_mpg123_bench_props, "Properties for the mpg123 element, in gst-launch syntax", "PROPS" },
+	{ "plugin", 0, 0, G_OPTION_ARG_FILENAME, &gst_mpg123_bench_plugin, "Plugin file to take the mpg123 element from, instead of the registry", "FILE" },
+	{ NULL, 0, 0, 0, NULL, NULL, NULL }
+};
+
+static GOptionEntry const gst_mpg123_bench_stress_entries[] =
+{
+	{ "instances", 'n', 0, G_OPTION_ARG_STRING, &gst_mpg123_bench_instances, "Comma-separated numbers of concurrent pipelines (default: 1,2,4,8,16,32,64)", "N,N,..." },
+	{ NULL, 0, 0, 0, NULL, NULL, NULL }
+};
+
+static GOptionEntry const gst_mpg123_bench_density_entries[] =
+{
+	{ "instances", 'n', 0, G_OPTION_ARG_STRING, &gst_mpg123_bench_instances, "Comma-separated numbers of active decoders (default: 1,10,100,1000)", "N,N,..." },
+	{ NULL, 0, 0, 0, NULL, NULL, NULL }
+};
+
+static GOptionEntry const gst_mpg123_bench_scan_entries[] =
+{
+	{ "files", 'n', 0, G_OPTION_ARG_INT, &gst_mpg123_bench_num_files, "Number of files to discover per mode; each one is the input stream (default: 100)", "N" },
+	{ NULL, 0, 0, 0, NULL, NULL, NULL }
+};
+
+static GOptionEntry const gst_mpg123_bench_direct_entries[] =
+{
+	{ "loops", 'l', 0, G_OPTION_ARG_INT, &gst_mpg123_bench_num_loops, "Number of times the input stream is decoded in a row (default: 10)", "N" },
+	{ NULL, 0, 0, 0, NULL, NULL, NULL }
+};
+
+static GOptionEntry const gst_mpg123_bench_resample_entries[] =
+{
+	{ "rate", 'r', 0, G_OPTION_ARG_INT, &gst_mpg123_bench_rate, "Output rate; must differ from the input rate (default: 48000)", "RATE" },
+	{ "loops", 'l', 0, G_OPTION_ARG_INT, &gst_mpg123_bench_num_loops, "Number of times the input stream is decoded in a row for the CPU time (default: 10)", "N" },
+	{ NULL, 0, 0, 0, NULL, NULL, NULL }
+};
+
+static GstMpg123BenchCommand const gst_mpg123_bench_commands[] =
+{
+	{ "stress", "N concurrent pipelines: aggregate realtime factor, RSS per instance and context switches", gst_mpg123_bench_stress_entries, gst_mpg123_bench_stress },
+	{ "density", "N idle but active decoders: RSS per decoder, and the memory-usage property", gst_mpg123_bench_density_entries, gst_mpg123_bench_density },
+	{ "scan", "Metadata-only discovery: files/s for the duration query with and without fast-scan", gst_mpg123_bench_scan_entries, gst_mpg123_bench_scan },
+	{ "direct", "Time per frame through a pipeline and through the direct decoding API", gst_mpg123_bench_direct_entries, gst_mpg123_bench_direct },
+	{ "framebyframe", "Time per frame with mpg123's frame-by-frame API and with mpg123_decode_frame()", gst_mpg123_bench_direct_entries, gst_mpg123_bench_frame_by_frame },
+	{ "resample", "CPU time and SNR of force-rate compared to audioresample", gst_mpg123_bench_resample_entries, gst_mpg123_bench_resample },
+	{ NULL, NULL, NULL, NULL }
+};
+
+
+
+
+/*
+Loads the plugin given with --plugin, if any, and prints which file the mpg123 element comes from, so
+results of different builds can be told apart. A plugin file with the same name as the one in the
+registry replaces it.
+*/
+static gboolean gst_mpg123_bench_load_plugin(void)
+{
+	GstElementFactory *factory;
+	GstPluginFeature *feature;
+	GstPlugin *plugin;
+	gboolean ok = TRUE;
+
+	if (gst_mpg123_bench_plugin != NULL)
+	{
+		GError *error = NULL;
+
+		plugin = gst_plugin_load_file(gst_mpg123_bench_plugin, &error);
+		if (plugin == NULL)
+		{
+			g_printerr("Could not load %s: %s\n", gst_mpg123_bench_plugin, error->message);
+			g_error_free(error);
+			return FALSE;
+		}
+		gst_object_unref(GST_OBJECT(plugin));
+	}
+
+	factory = gst_element_factory_find("mpg123");
+	if (factory == NULL)
+	{
+		g_printerr("The mpg123 element is not available; set GST_PLUGIN_PATH or use --plugin\n");
+		return FALSE;
+	}
+
+	feature = gst_plugin_feature_load(GST_PLUGIN_FEATURE(factory));
+	plugin = (feature != NULL) ? gst_plugin_feature_get_plugin(feature) : NULL;
+	if (plugin == NULL)
+	{
+		g_printerr("Could not load the mpg123 element\n");
+		ok = FALSE;
+	}
+	else
+	{
+		gchar const *filename = gst_plugin_get_filename(plugin);
+
+		g_print("plugin: %s\n", (filename != NULL) ? filename : "(static)");
+
+		if ((gst_mpg123_bench_plugin != NULL) && (g_strcmp0(filename, gst_mpg123_bench_plugin) != 0))
+		{
+			g_printerr("The mpg123 element comes from another plugin than %s\n", gst_mpg123_bench_plugin);
+			ok = FALSE;
+		}
+
+		gst_object_unref(GST_OBJECT(plugin));
+	}
+
+	if (feature != NULL)
+		gst_object_unref(GST_OBJECT(feature));
+	gst_object_unref(GST_OBJECT(factory));
+
+	return ok;
+}
+
+
+static GstMpg123TestStream* gst_mpg123_bench_load_stream(void)
+{
+	GstMpg123TestStream *stream;
+
+	if (gst_mpg123_bench_file != NULL)
+	{
+		GError *error = NULL;
+
+		stream = gst_mpg123_test_stream_new_from_file(gst_mpg123_bench_file, &error);
+		if (stream == NULL)
+		{
+			g_printerr("Could not load %s: %s\n", gst_mpg123_bench_file, error->message);
+			g_error_free(error);
+		}
+	}
+	else
+		stream = gst_mpg123_test_stream_new_synthetic(44100, 2, (guint)(gst_mpg123_bench_seconds * 44100 / 384) + 1, 0);
+
+	if (stream != NULL)
+	{
+		gchar *caps_str = gst_caps_to_string(stream->caps);
+		g_print("input: %u frames, %.1f s, %s\n", stream->frames->len, (gdouble)gst_mpg123_test_stream_get_duration(stream) / GST_SECOND, caps_str);
+		g_free(caps_str);
+	}
+
+	return stream;
+}
+
+
+static void gst_mpg123_bench_need_data(GstAppSrc *appsrc, G_GNUC_UNUSED guint length, gpointer user_data)
+{
+	GstMpg123BenchPipeline *bench_pipeline = user_data;
+	guint i, num_frames;
+
+	num_frames = bench_pipeline->stream->frames->len;
+	if (bench_pipeline->max_frames != 0)
+		num_frames = MIN(num_frames, bench_pipeline->max_frames);
+
+	/* The frames are only read, so all pipelines can share them */
+	for (i = 0; i < GST_MPG123_BENCH_PUSH_FRAMES; ++i)
+	{
+		GstBuffer *frame;
+
+		if (bench_pipeline->next_frame == num_frames)
+		{
+			if ((bench_pipeline->loop + 1 >= bench_pipeline->num_loops) || (bench_pipeline->max_frames != 0))
+				break;
+			++(bench_pipeline->loop);
+			bench_pipeline->next_frame = 0;
+		}
+
+		frame = g_ptr_array_index(bench_pipeline->stream->frames, bench_pipeline->next_frame++);
+		if (gst_app_src_push_buffer(appsrc, gst_buffer_ref(frame)) != GST_FLOW_OK)
+			return;
+	}
+
+	if ((bench_pipeline->next_frame == num_frames) && (bench_pipeline->loop + 1 >= bench_pipeline->num_loops) && (bench_pipeline->max_frames == 0))
+		gst_app_src_end_of_stream(appsrc);
+}
+
+
+/*
+decoder must be named "dec"; NULL means the mpg123 element with the properties from --props
+*/
+static GstMpg123BenchPipeline* gst_mpg123_bench_pipeline_new(GstMpg123TestStream *stream, gchar const *decoder, gchar const *tail)
+{
+	GstMpg123BenchPipeline *bench_pipeline;
+	GstAppSrcCallbacks callbacks;
+	GError *error = NULL;
+	gchar *description;
+
+	if (decoder != NULL)
+		description = g_strdup_printf("appsrc name=src format=time ! %s ! %s", decoder, tail);
+	else
+		description = g_strdup_printf("appsrc name=src format=time ! mpg123 name=dec %s ! %s", (gst_mpg123_bench_props != NULL) ? gst_mpg123_bench_props : "", tail);
+
+	bench_pipeline = g_new0(GstMpg123BenchPipeline, 1);
+	bench_pipeline->pipeline = gst_parse_launch(description, &error);
+	g_free(description);
+
+	if (bench_pipeline->pipeline == NULL)
+	{
+		g_printerr("Could not create pipeline: %s\n", error->message);
+		g_error_free(error);
+		g_free(bench_pipeline);
+		return NULL;
+	}
+	else if (error != NULL)
+	{
+		/* A recoverable error, for example an unknown property */
+		g_printerr("Warning: %s\n", error->message);
+		g_error_free(error);
+	}
+
+	bench_pipeline->appsrc = gst_bin_get_by_name(GST_BIN(bench_pipeline->pipeline), "src");
+	bench_pipeline->decoder = gst_bin_get_by_name(GST_BIN(bench_pipeline->pipeline), "dec");
+	bench_pipeline->bus = gst_element_get_bus(bench_pipeline->pipeline);
+	bench_pipeline->stream = stream;
+
+	memset(&callbacks, 0, sizeof(callbacks));
+	callbacks.need_data = gst_mpg123_bench_need_data;
+	gst_app_src_set_caps(GST_APP_SRC(bench_pipeline->appsrc), stream->caps);
+	gst_app_src_set_callbacks(GST_APP_SRC(bench_pipeline->appsrc), &callbacks, bench_pipeline, NULL);
+
+	return bench_pipeline;
+}
+
+
+static void gst_mpg123_bench_pipeline_free(GstMpg123BenchPipeline *bench_pipeline)
+{
+	gst_element_set_state(bench_pipeline->pipeline, GST_STATE_NULL);
+	gst_object_unref(GST_OBJECT(bench_pipeline->bus));
+	gst_object_unref(GST_OBJECT(bench_pipeline->decoder));
+	gst_object_unref(GST_OBJECT(bench_pipeline->appsrc));
+	gst_object_unref(GST_OBJECT(bench_pipeline->pipeline));
+	g_free(bench_pipeline);
+}
+
+
+static gboolean gst_mpg123_bench_pipeline_poll(GstMpg123BenchPipeline *bench_pipeline)
+{
+	GstMessage *msg;
+
+	if (bench_pipeline->done)
+		return TRUE;
+
+	msg = gst_bus_pop_filtered(bench_pipeline->bus, GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+	if (msg == NULL)
+		return FALSE;
+
+	if (GST_MESSAGE_TYPE(msg) == GST_MESSAGE_ERROR)
+	{
+		GError *error;
+		gchar *debug_info;
+
+		gst_message_parse_error(msg, &error, &debug_info);
+		g_printerr("Error from %s: %s (%s)\n", GST_OBJECT_NAME(GST_MESSAGE_SRC(msg)), error->message, (debug_info != NULL) ? debug_info : "");
+		g_error_free(error);
+		g_free(debug_info);
+		bench_pipeline->failed = TRUE;
+	}
+
+	gst_message_unref(msg);
+	bench_pipeline->done = TRUE;
+
+	return TRUE;
+}
+
+
+static gboolean gst_mpg123_bench_run_pipelines(GPtrArray *pipelines, guint64 *peak_rss)
+{
+	guint i, num_done;
+	gboolean ok = TRUE;
+
+	for (i = 0; i < pipelines->len; ++i)
+	{
+		GstMpg123BenchPipeline *bench_pipeline = g_ptr_array_index(pipelines, i);
+		if (gst_element_set_state(bench_pipeline->pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE)
+		{
+			g_printerr("Could not start pipeline %u\n", i);
+			return FALSE;
+		}
+	}
+
+	/* Polling keeps this thread out of the way; it mostly sleeps while the streaming threads decode */
+	do
+	{
+		guint64 rss;
+
+		num_done = 0;
+		for (i = 0; i < pipelines->len; ++i)
+		{
+			if (gst_mpg123_bench_pipeline_poll(g_ptr_array_index(pipelines, i)))
+				++num_done;
+		}
+
+		rss = gst_mpg123_test_get_rss();
+		if ((peak_rss != NULL) && (rss > *peak_rss))
+			*peak_rss = rss;
+
+		if (num_done < pipelines->len)
+			g_usleep(5000);
+	}
+	while (num_done < pipelines->len);
+
+	for (i = 0; i < pipelines->len; ++i)
+		ok = ok && !((GstMpg123BenchPipeline *)g_ptr_array_index(pipelines, i))->failed;
+
+	return ok;
+}
+
+
+/*
+Creates count pipelines, adds them to the array, and waits until each of them has decoded
+GST_MPG123_BENCH_DENSITY_FRAMES frames and prerolled. They then stay in PLAYING, waiting for more input.
+*/
+static gboolean gst_mpg123_bench_start_idle_pipelines(GPtrArray *pipelines, GstMpg123TestStream *stream, gchar const *decoder, guint count)
+{
+	guint i, first = pipelines->len;
+
+	for (i = 0; i < count; ++i)
+	{
+		GstMpg123BenchPipeline *bench_pipeline = gst_mpg123_bench_pipeline_new(stream, decoder, "fakesink sync=false");
+		if (bench_pipeline == NULL)
+			return FALSE;
+
+		bench_pipeline->max_frames = GST_MPG123_BENCH_DENSITY_FRAMES;
+		g_ptr_array_add(pipelines, bench_pipeline);
+
+		if (gst_element_set_state(bench_pipeline->pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE)
+		{
+			g_printerr("Could not start pipeline %u\n", i);
+			return FALSE;
+		}
+	}
+
+	/* Starting all pipelines first and waiting afterwards lets them preroll in parallel */
+	for (i = first; i < pipelines->len; ++i)
+	{
+		GstMpg123BenchPipeline *bench_pipeline = g_ptr_array_index(pipelines, i);
+		if (gst_element_get_state(bench_pipeline->pipeline, NULL, NULL, 30 * GST_SECOND) != GST_STATE_CHANGE_SUCCESS)
+		{
+			gst_mpg123_bench_pipeline_poll(bench_pipeline);
+			g_printerr("Pipeline %u did not start decoding\n", i - first);
+			return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+
+static guint* gst_mpg123_bench_parse_instances(gchar const *instances, gchar const *default_instances, guint *num_counts)
+{
+	gchar **tokens;
+	guint *counts;
+	guint i;
+
+	tokens = g_strsplit((instances != NULL) ? instances : default_instances, ",", -1);
+	*num_counts = g_strv_length(tokens);
+	counts = g_new0(guint, *num_counts);
+
+	for (i = 0; i < *num_counts; ++i)
+		counts[i] = MAX(strtoul(tokens[i], NULL, 10), 1);
+
+	g_strfreev(tokens);
+
+	return counts;
+}
+
+
+
+
+/*
+stress: runs N pipelines concurrently, each decoding the whole input as fast as possible, and reports
+how the aggregate throughput, the memory per instance and the context switches develop with N.
+Realtime factors are aggregate (N streams decoded in the wall-clock time it took for all of them);
+RSS per instance is the peak RSS growth during the run divided by N. With perfect scaling, the
+realtime factor grows linearly up to the number of CPU cores and then stays flat.
+*/
+
+
+static int gst_mpg123_bench_stress(void)
+{
+	GstMpg123TestStream *stream;
+	guint *counts, num_counts, i;
+	gdouble duration, first_realtime_factor = 0.0;
+	int retval = 0;
+
+	stream = gst_mpg123_bench_load_stream();
+	if (stream == NULL)
+		return 1;
+
+	duration = (gdouble)gst_mpg123_test_stream_get_duration(stream) / GST_SECOND;
+	counts = gst_mpg123_bench_parse_instances(gst_mpg123_bench_instances, "1,2,4,8,16,32,64", &num_counts);
+
+	g_print("%9s %9s %9s %9s %9s %12s %12s %12s\n", "instances", "wall [s]", "realtime", "speedup", "cpu load", "RSS/inst [K]", "vol. cs/s", "invol. cs/s");
+
+	for (i = 0; i < num_counts; ++i)
+	{
+		GPtrArray *pipelines;
+		GstMpg123TestResourceUsage usage_before, usage_after;
+		guint64 rss_before, peak_rss;
+		gint64 start_time;
+		gdouble wall_time, realtime_factor;
+		guint j;
+		gboolean ok;
+
+		pipelines = g_ptr_array_new_with_free_func((GDestroyNotify)gst_mpg123_bench_pipeline_free);
+
+		rss_before = peak_rss = gst_mpg123_test_get_rss();
+		gst_mpg123_test_get_resource_usage(&usage_before);
+		start_time = g_get_monotonic_time();
+
+		for (j = 0; j < counts[i]; ++j)
+		{
+			GstMpg123BenchPipeline *bench_pipeline = gst_mpg123_bench_pipeline_new(stream, NULL, "fakesink sync=false");
+			if (bench_pipeline == NULL)
+				break;
+			g_ptr_array_add(pipelines, bench_pipeline);
+		}
+
+		ok = (pipelines->len == counts[i]) && gst_mpg123_bench_run_pipelines(pipelines, &peak_rss);
+
+		wall_time = (gdouble)(g_get_monotonic_time() - start_time) / G_USEC_PER_SEC;
+		gst_mpg123_test_get_resource_usage(&usage_after);
+
+		g_ptr_array_unref(pipelines);
+
+		if (!ok)
+		{
+			retval = 1;
+			break;
+		}
+
+		realtime_factor = duration * counts[i] / wall_time;
+		if (i == 0)
+			first_realtime_factor = realtime_factor;
+
+		g_print(
+			"%9u %9.2f %9.1f %9.2f %9.2f %12.0f %12.0f %12.0f\n",
+			counts[i],
+			wall_time,
+			realtime_factor,
+			realtime_factor / first_realtime_factor,
+			(gdouble)(usage_after.cpu_time - usage_before.cpu_time) / G_USEC_PER_SEC / wall_time,
+			(gdouble)(peak_rss - rss_before) / 1024.0 / counts[i],
+			(gdouble)(usage_after.voluntary_context_switches - usage_before.voluntary_context_switches) / wall_time,
+			(gdouble)(usage_after.involuntary_context_switches - usage_before.involuntary_context_switches) / wall_time
+		);
+	}
+
+	g_free(counts);
+	gst_mpg123_test_stream_free(stream);
+
+	return retval;
+}
+
+
+
+
+/*
+density: keeps N decoders active at once, each having decoded a few frames and then waiting for more
+input, like a server with many mostly idle streams. To separate the decoder from the rest of the
+pipeline, N pipelines with identity instead of mpg123 are started first and kept running while the
+N mpg123 pipelines are added; the difference of the two RSS increases is the RSS per decoder.
+Freed memory from a previous, smaller count is reused by the following ones, which skews their
+figures downwards, so for exact numbers run one count per invocation.
+*/
+
+
+static int gst_mpg123_bench_density(void)
+{
+	GstMpg123TestStream *stream;
+	GPtrArray *pipelines;
+	guint *counts, num_counts, i;
+	int retval = 0;
+
+	stream = gst_mpg123_bench_load_stream();
+	if (stream == NULL)
+		return 1;
+
+	counts = gst_mpg123_bench_parse_instances(gst_mpg123_bench_instances, "1,10,100,1000", &num_counts);
+
+	/* Load the plugins and initialize mpg123's global tables before measuring anything */
+	pipelines = g_ptr_array_new_with_free_func((GDestroyNotify)gst_mpg123_bench_pipeline_free);
+	if (!gst_mpg123_bench_start_idle_pipelines(pipelines, stream, "identity name=dec", 1) || !gst_mpg123_bench_start_idle_pipelines(pipelines, stream, NULL, 1))
+		retval = 1;
+	g_ptr_array_unref(pipelines);
+
+	if (retval == 0)
+		g_print("%9s %14s %14s %14s %16s %14s\n", "instances", "pipeline [K]", "+mpg123 [K]", "decoder [K]", "memory-usage [K]", "startup [ms]");
+
+	for (i = 0; (i < num_counts) && (retval == 0); ++i)
+	{
+		guint64 rss_before, rss_baseline, rss_decoders, memory_usage = 0;
+		gint64 start_time, end_time = 0;
+		gdouble baseline_per_instance, decoder_per_instance;
+		guint j;
+
+		pipelines = g_ptr_array_new_with_free_func((GDestroyNotify)gst_mpg123_bench_pipeline_free);
+
+		rss_before = gst_mpg123_test_get_rss();
+		if (gst_mpg123_bench_start_idle_pipelines(pipelines, stream, "identity name=dec", counts[i]))
+		{
+			rss_baseline = gst_mpg123_test_get_rss();
+			start_time = g_get_monotonic_time();
+			if (gst_mpg123_bench_start_idle_pipelines(pipelines, stream, NULL, counts[i]))
+				end_time = g_get_monotonic_time();
+		}
+
+		if (end_time == 0)
+		{
+			g_ptr_array_unref(pipelines);
+			retval = 1;
+			break;
+		}
+
+		rss_decoders = gst_mpg123_test_get_rss();
+
+		for (j = counts[i]; j < pipelines->len; ++j)
+		{
+			guint64 usage;
+			g_object_get(G_OBJECT(((GstMpg123BenchPipeline *)g_ptr_array_index(pipelines, j))->decoder), "memory-usage", &usage, NULL);
+			memory_usage += usage;
+		}
+
+		baseline_per_instance = (gdouble)(rss_baseline - rss_before) / counts[i];
+		decoder_per_instance = ((gdouble)rss_decoders - (gdouble)rss_baseline) / counts[i];
+
+		g_print(
+			"%9u %14.1f %14.1f %14.1f %16.1f %14.3f\n",
+			counts[i],
+			baseline_per_instance / 1024.0,
+			decoder_per_instance / 1024.0,
+			(decoder_per_instance - baseline_per_instance) / 1024.0,
+			(gdouble)memory_usage / counts[i] / 1024.0,
+			(gdouble)(end_time - start_time) / 1000.0 / counts[i]
+		);
+
+		g_ptr_array_unref(pipelines);
+	}
+
+	g_free(counts);
+	gst_mpg123_test_stream_free(stream);
+
+	return retval;
+}
+
+
+
+
+/*
+scan: measures metadata discovery the way GstDiscoverer-like applications do it, with one pipeline per
+file which runs until EOS and is then queried for the duration. Without fast-scan, every frame is
+decoded; with it, only the first one is, and the others are just parsed. Both must report the same
+duration.
+*/
+
+
+static gboolean gst_mpg123_bench_scan_files(GstMpg123TestStream *stream, gboolean fast_scan, gdouble *wall_time, gint64 *duration)
+{
+	gchar *decoder;
+	gint64 start_time;
+	gint i;
+	gboolean ok = TRUE;
+
+	decoder = g_strdup_printf("mpg123 name=dec fast-scan=%s %s", fast_scan ? "true" : "false", (gst_mpg123_bench_props != NULL) ? gst_mpg123_bench_props : "");
+	*duration = -1;
+
+	start_time = g_get_monotonic_time();
+
+	for (i = 0; ok && (i < gst_mpg123_bench_num_files); ++i)
+	{
+		GstMpg123BenchPipeline *bench_pipeline;
+		GPtrArray *pipelines;
+		GstPad *srcpad;
+		gint64 file_duration;
+
+		bench_pipeline = gst_mpg123_bench_pipeline_new(stream, decoder, "fakesink sync=false");
+		if (bench_pipeline == NULL)
+		{
+			ok = FALSE;
+			break;
+		}
+
+		pipelines = g_ptr_array_new_with_free_func((GDestroyNotify)gst_mpg123_bench_pipeline_free);
+		g_ptr_array_add(pipelines, bench_pipeline);
+
+		ok = gst_mpg123_bench_run_pipelines(pipelines, NULL);
+
+		/* The decoder answers the query itself once the scan is complete, that is, after EOS */
+		srcpad = gst_element_get_static_pad(bench_pipeline->decoder, "src");
+		if (ok && !gst_pad_query_duration(srcpad, GST_FORMAT_TIME, &file_duration))
+		{
+			g_printerr("Duration query failed\n");
+			ok = FALSE;
+		}
+		gst_object_unref(GST_OBJECT(srcpad));
+
+		if (ok)
+			*duration = file_duration;
+
+		g_ptr_array_unref(pipelines);
+	}
+
+	*wall_time = (gdouble)(g_get_monotonic_time() - start_time) / G_USEC_PER_SEC;
+
+	g_free(decoder);
+
+	return ok;
+}
+
+
+static int gst_mpg123_bench_scan(void)
+{
+	GstMpg123TestStream *stream;
+	gdouble wall_time[2], stream_duration;
+	gint64 duration[2];
+	int mode;
+
+	stream = gst_mpg123_bench_load_stream();
+	if (stream == NULL)
+		return 1;
+
+	stream_duration = (gdouble)gst_mpg123_test_stream_get_duration(stream) / GST_SECOND;
+	gst_mpg123_bench_num_files = MAX(gst_mpg123_bench_num_files, 1);
+
+	g_print("%10s %9s %9s %9s %12s %14s\n", "mode", "files", "wall [s]", "files/s", "realtime", "duration [s]");
+
+	for (mode = 0; mode < 2; ++mode)
+	{
+		if (!gst_mpg123_bench_scan_files(stream, mode == 1, &wall_time[mode], &duration[mode]))
+		{
+			gst_mpg123_test_stream_free(stream);
+			return 1;
+		}
+
+		g_print(
+			"%10s %9d %9.2f %9.1f %12.1f %14.6f\n",
+			(mode == 1) ? "fast-scan" : "decode",
+			gst_mpg123_bench_num_files,
+			wall_time[mode],
+			gst_mpg123_bench_num_files / wall_time[mode],
+			stream_duration * gst_mpg123_bench_num_files / wall_time[mode],
+			(gdouble)duration[mode] / GST_SECOND
+		);
+	}
+
+	gst_mpg123_test_stream_free(stream);
+
+	g_print("fast-scan speedup: %.2f\n", wall_time[0] / wall_time[1]);
+
+	if (duration[0] != duration[1])
+	{
+		g_printerr("Duration mismatch: %" GST_TIME_FORMAT " when decoding, %" GST_TIME_FORMAT " with fast-scan\n", GST_TIME_ARGS(duration[0]), GST_TIME_ARGS(duration[1]));
+		return 1;
+	}
+
+	return 0;
+}
+
+
+
+
+/*
+direct: decodes the same input through a pipeline (appsrc ! mpg123 ! fakesink) and with the direct
+decoding API in gstmpg123core.h, both with frame-by-frame decoding to S16 at the stream rate, which
+is what the element does with such caps. The difference is the cost of GstBuffer handling, pad pushes
+and the GstAudioDecoder base class per frame. The input is decoded --loops times in a row to make the
+pipeline startup negligible.
+*/
+
+
+static gboolean gst_mpg123_bench_decode_direct(GstMpg123TestStream *stream, GstMpg123CoreConfig const *config, guint num_loops, gdouble *wall_time)
+{
+	GstMpg123Core *core;
+	GstMapInfo *maps;
+	unsigned char *output = NULL;
+	size_t output_size;
+	gint64 start_time;
+	guint i, loop;
+	int error;
+	gboolean ok = TRUE;
+
+	core = gst_mpg123_core_new(config, &error);
+	if (core == NULL)
+	{
+		g_printerr("Could not create decoding core: %s\n", mpg123_plain_strerror(error));
+		return FALSE;
+	}
+
+	error = gst_mpg123_core_set_output_format(core, stream->header.rate, stream->header.channels, MPG123_ENC_SIGNED_16);
+	if (error != MPG123_OK)
+	{
+		g_printerr("Could not set output format: %s\n", gst_mpg123_core_get_error_string(core));
+		gst_mpg123_core_free(core);
+		return FALSE;
+	}
+
+	/* Applications using the direct API have the input in memory already */
+	maps = g_new0(GstMapInfo, stream->frames->len);
+	for (i = 0; i < stream->frames->len; ++i)
+		gst_buffer_map(g_ptr_array_index(stream->frames, i), &maps[i], GST_MAP_READ);
+
+	output_size = gst_mpg123_core_get_max_output_size(core);
+	output = g_malloc(output_size);
+
+	start_time = g_get_monotonic_time();
+
+	for (loop = 0; ok && (loop < num_loops); ++loop)
+	{
+		for (i = 0; ok && (i < stream->frames->len); ++i)
+		{
+			size_t num_output_bytes;
+
+			error = gst_mpg123_core_decode(core, maps[i].data, maps[i].size, output, output_size, &num_output_bytes);
+			while ((error == MPG123_OK) || (error == MPG123_NEW_FORMAT))
+				error = gst_mpg123_core_decode(core, NULL, 0, output, output_size, &num_output_bytes);
+
+			if (error != MPG123_NEED_MORE)
+			{
+				g_printerr("Decoding failed: %s\n", gst_mpg123_core_get_error_string(core));
+				ok = FALSE;
+			}
+		}
+	}
+
+	*wall_time = (gdouble)(g_get_monotonic_time() - start_time) / G_USEC_PER_SEC;
+
+	for (i = 0; i < stream->frames->len; ++i)
+		gst_buffer_unmap(g_ptr_array_index(stream->frames, i), &maps[i]);
+	g_free(maps);
+	g_free(output);
+	gst_mpg123_core_free(core);
+
+	return ok;
+}
+
+
+static gboolean gst_mpg123_bench_decode_pipeline(GstMpg123TestStream *stream, guint num_loops, gdouble *wall_time)
+{
+	GstMpg123BenchPipeline *bench_pipeline;
+	GPtrArray *pipelines;
+	gchar *tail;
+	gint64 start_time;
+	gboolean ok;
+
+	tail = g_strdup_printf("audio/x-raw, format=%s ! fakesink sync=false", GST_AUDIO_NE(S16));
+	bench_pipeline = gst_mpg123_bench_pipeline_new(stream, NULL, tail);
+	g_free(tail);
+	if (bench_pipeline == NULL)
+		return FALSE;
+
+	bench_pipeline->num_loops = num_loops;
+	pipelines = g_ptr_array_new_with_free_func((GDestroyNotify)gst_mpg123_bench_pipeline_free);
+	g_ptr_array_add(pipelines, bench_pipeline);
+
+	start_time = g_get_monotonic_time();
+	ok = gst_mpg123_bench_run_pipelines(pipelines, NULL);
+	*wall_time = (gdouble)(g_get_monotonic_time() - start_time) / G_USEC_PER_SEC;
+
+	g_ptr_array_unref(pipelines);
+
+	return ok;
+}
+
+
+static int gst_mpg123_bench_direct(void)
+{
+	GstMpg123TestStream *stream;
+	GstMpg123CoreConfig config;
+	gdouble wall_time[2], num_frames, duration;
+	int i;
+
+	stream = gst_mpg123_bench_load_stream();
+	if (stream == NULL)
+		return 1;
+
+	gst_mpg123_bench_num_loops = MAX(gst_mpg123_bench_num_loops, 1);
+	num_frames = (gdouble)stream->frames->len * gst_mpg123_bench_num_loops;
+	duration = (gdouble)gst_mpg123_test_stream_get_duration(stream) / GST_SECOND * gst_mpg123_bench_num_loops;
+
+	/* The same settings the element uses by default */
+	gst_mpg123_core_global_init();
+	gst_mpg123_core_config_init(&config);
+	config.frame_by_frame = 1;
+
+	if (!gst_mpg123_bench_decode_pipeline(stream, gst_mpg123_bench_num_loops, &wall_time[0]) || !gst_mpg123_bench_decode_direct(stream, &config, gst_mpg123_bench_num_loops, &wall_time[1]))
+	{
+		gst_mpg123_test_stream_free(stream);
+		return 1;
+	}
+
+	g_print("%10s %9s %9s %12s %12s\n", "path", "frames", "wall [s]", "ns/frame", "realtime");
+	for (i = 0; i < 2; ++i)
+		g_print("%10s %9.0f %9.3f %12.0f %12.1f\n", (i == 0) ? "pipeline" : "direct", num_frames, wall_time[i], wall_time[i] * 1e9 / num_frames, duration / wall_time[i]);
+	g_print("pipeline overhead: %.0f ns/frame (%.1f%%)\n", (wall_time[0] - wall_time[1]) * 1e9 / num_frames, (wall_time[0] / wall_time[1] - 1.0) * 100.0);
+
+	gst_mpg123_test_stream_free(stream);
+
+	return 0;
+}
+
+
+
+
+/*
+framebyframe: compares the ways the decoding core can read parsed input, using the direct API so the
+pipeline overhead does not dilute the difference: mpg123_decode_frame() with the seek buffer, which is
+what the element did before it switched to frame-by-frame decoding, and the frame-by-frame API with
+and without the seek buffer.
+*/
+
+
+static int gst_mpg123_bench_frame_by_frame(void)
+{
+	static struct
+	{
+		gchar const *name;
+		int frame_by_frame, seek_buffer;
+	}
+	const modes[] =
+	{
+		{ "decode_frame", 0, 1 },
+		{ "framebyframe", 1, 1 },
+		{ "fbf, no seekbuffer", 1, 0 }
+	};
+
+	GstMpg123TestStream *stream;
+	gdouble wall_time, first_wall_time = 0.0, num_frames, duration;
+	guint i;
+
+	stream = gst_mpg123_bench_load_stream();
+	if (stream == NULL)
+		return 1;
+
+	gst_mpg123_bench_num_loops = MAX(gst_mpg123_bench_num_loops, 1);
+	num_frames = (gdouble)stream->frames->len * gst_mpg123_bench_num_loops;
+	duration = (gdouble)gst_mpg123_test_stream_get_duration(stream) / GST_SECOND * gst_mpg123_bench_num_loops;
+
+	gst_mpg123_core_global_init();
+
+	g_print("%18s %9s %9s %12s %12s %9s\n", "mode", "frames", "wall [s]", "ns/frame", "realtime", "speedup");
+
+	for (i = 0; i < G_N_ELEMENTS(modes); ++i)
+	{
+		GstMpg123CoreConfig config;
+
+		gst_mpg123_core_config_init(&config);
+		config.frame_by_frame = modes[i].frame_by_frame;
+		config.seek_buffer = modes[i].seek_buffer;
+
+		if (!gst_mpg123_bench_decode_direct(stream, &config, gst_mpg123_bench_num_loops, &wall_time))
+		{
+			gst_mpg123_test_stream_free(stream);
+			return 1;
+		}
+
+		if (i == 0)
+			first_wall_time = wall_time;
+
+		g_print("%18s %9.0f %9.3f %12.0f %12.1f %9.2f\n", modes[i].name, num_frames, wall_time, wall_time * 1e9 / num_frames, duration / wall_time, first_wall_time / wall_time);
+	}
+
+	gst_mpg123_test_stream_free(stream);
+
+	return 0;
+}
+
+
+
+
+/*
+resample: converts the input to another rate with force-rate (mpg123's NtoM synthesis) and with
+audioresample after the decoder, and compares them with decoding at the input rate, all to F32. The
+CPU time of each is measured over --loops passes; the difference to plain decoding is the cost of
+resampling. The quality is the SNR against audioresample at its highest quality, measured over a
+single pass after aligning the outputs, since the resamplers have different delays. The first and
+last frames are left out, where the filters are not settled yet.
+*/
+
+
+static void gst_mpg123_bench_handoff(G_GNUC_UNUSED GstElement *sink, GstBuffer *buffer, G_GNUC_UNUSED GstPad *pad, gpointer user_data)
+{
+	GByteArray *output = user_data;
+	GstMapInfo map;
+
+	if (gst_buffer_map(buffer, &map, GST_MAP_READ))
+	{
+		g_byte_array_append(output, map.data, map.size);
+		gst_buffer_unmap(buffer, &map);
+	}
+}
+
+
+static gboolean gst_mpg123_bench_decode_resampled(GstMpg123TestStream *stream, gchar const *decoder, gchar const *resampler, gint rate, guint num_loops, GByteArray *output, guint64 *cpu_time)
+{
+	GstMpg123BenchPipeline *bench_pipeline;
+	GstMpg123TestResourceUsage usage_before, usage_after;
+	GPtrArray *pipelines;
+	gchar *tail;
+	gboolean ok;
+
+	tail = g_strdup_printf(
+		"%s audio/x-raw, format=%s, rate=%d ! fakesink name=sink sync=false signal-handoffs=%s",
+		resampler,
+		GST_AUDIO_NE(F32),
+		rate,
+		(output != NULL) ? "true" : "false"
+	);
+	bench_pipeline = gst_mpg123_bench_pipeline_new(stream, decoder, tail);
+	g_free(tail);
+	if (bench_pipeline == NULL)
+		return FALSE;
+
+	bench_pipeline->num_loops = num_loops;
+	pipelines = g_ptr_array_new_with_free_func((GDestroyNotify)gst_mpg123_bench_pipeline_free);
+	g_ptr_array_add(pipelines, bench_pipeline);
+
+	if (output != NULL)
+	{
+		GstElement *sink = gst_bin_get_by_name(GST_BIN(bench_pipeline->pipeline), "sink");
+		g_signal_connect(G_OBJECT(sink), "handoff", G_CALLBACK(gst_mpg123_bench_handoff), output);
+		gst_object_unref(GST_OBJECT(sink));
+	}
+
+	gst_mpg123_test_get_resource_usage(&usage_before);
+	ok = gst_mpg123_bench_run_pipelines(pipelines, NULL);
+	gst_mpg123_test_get_resource_usage(&usage_after);
+
+	if (cpu_time != NULL)
+		*cpu_time = usage_after.cpu_time - usage_before.cpu_time;
+
+	g_ptr_array_unref(pipelines);
+
+	return ok;
+}
+
+
+static gdouble gst_mpg123_bench_get_snr(GByteArray const *reference, GByteArray const *output, gint channels, gint *lag)
+{
+	gfloat const *reference_samples = (gfloat const *)(reference->data);
+	gfloat const *output_samples = (gfloat const *)(output->data);
+	gsize num_frames, margin, i;
+	gdouble signal_energy = 0.0, min_error_energy = -1.0;
+	gint cur_lag, c;
+
+	/* Skip the first and last 4096 frames; the search needs at least GST_MPG123_BENCH_MAX_LAG of them on each side */
+	margin = 4096;
+	num_frames = MIN(reference->len, output->len) / sizeof(gfloat) / channels;
+	if (num_frames <= 3 * margin)
+		return 0.0;
+	num_frames -= 2 * margin;
+
+	for (i = margin; i < margin + num_frames; ++i)
+	{
+		for (c = 0; c < channels; ++c)
+			signal_energy += (gdouble)reference_samples[i * channels + c] * reference_samples[i * channels + c];
+	}
+
+	for (cur_lag = -GST_MPG123_BENCH_MAX_LAG; cur_lag <= GST_MPG123_BENCH_MAX_LAG; ++cur_lag)
+	{
+		gdouble error_energy = 0.0;
+
+		for (i = margin; i < margin + num_frames; ++i)
+		{
+			for (c = 0; c < channels; ++c)
+			{
+				gdouble diff = (gdouble)reference_samples[i * channels + c] - output_samples[(i + cur_lag) * channels + c];
+				error_energy += diff * diff;
+			}
+		}
+
+		if ((min_error_energy < 0.0) || (error_energy < min_error_energy))
+		{
+			min_error_energy = error_energy;
+			*lag = cur_lag;
+		}
+	}
+
+	if (min_error_energy == 0.0)
+		return HUGE_VAL;
+
+	return 10.0 * log10(signal_energy / min_error_energy);
+}
+
+
+static int gst_mpg123_bench_resample(void)
+{
+	static struct
+	{
+		gchar const *name;
+		gchar const *decoder_props;
+		gchar const *resampler;
+		gboolean resamples;
+	}
+	const modes[] =
+	{
+		{ "decode only", "", "", FALSE },
+		{ "force-rate", "force-rate=true", "", TRUE },
+		{ "audioresample", "", "audioresample !", TRUE },
+		{ "reference", "", "audioresample quality=10 !", TRUE }
+	};
+
+	GstMpg123TestStream *stream;
+	GByteArray *outputs[G_N_ELEMENTS(modes)];
+	guint64 cpu_time[G_N_ELEMENTS(modes)];
+	gdouble duration;
+	guint i;
+	int retval = 0;
+
+	stream = gst_mpg123_bench_load_stream();
+	if (stream == NULL)
+		return 1;
+
+	if (stream->header.rate == gst_mpg123_bench_rate)
+	{
+		g_printerr("The output rate must differ from the input rate (%d Hz)\n", stream->header.rate);
+		gst_mpg123_test_stream_free(stream);
+		return 1;
+	}
+
+	gst_mpg123_bench_num_loops = MAX(gst_mpg123_bench_num_loops, 1);
+	duration = (gdouble)gst_mpg123_test_stream_get_duration(stream) / GST_SECOND * gst_mpg123_bench_num_loops;
+
+	for (i = 0; i < G_N_ELEMENTS(modes); ++i)
+	{
+		gchar *decoder = g_strdup_printf("mpg123 name=dec %s %s", modes[i].decoder_props, (gst_mpg123_bench_props != NULL) ? gst_mpg123_bench_props : "");
+		gint rate = modes[i].resamples ? gst_mpg123_bench_rate : stream->header.rate;
+
+		outputs[i] = g_byte_array_new();
+
+		if (
+			!gst_mpg123_bench_decode_resampled(stream, decoder, modes[i].resampler, rate, gst_mpg123_bench_num_loops, NULL, &cpu_time[i]) ||
+			!gst_mpg123_bench_decode_resampled(stream, decoder, modes[i].resampler, rate, 1, outputs[i], NULL)
+		)
+			retval = 1;
+
+		g_free(decoder);
+
+		if (retval != 0)
+		{
+			g_byte_array_unref(outputs[i]);
+			break;
+		}
+	}
+
+	if (retval == 0)
+	{
+		g_print("%d Hz -> %d Hz, F32\n", stream->header.rate, gst_mpg123_bench_rate);
+		g_print("%14s %12s %12s %16s %10s %10s\n", "mode", "cpu [s]", "realtime", "resampling [s]", "SNR [dB]", "lag");
+
+		for (i = 0; i < G_N_ELEMENTS(modes); ++i)
+		{
+			gdouble cpu_seconds = (gdouble)cpu_time[i] / G_USEC_PER_SEC;
+
+			g_print("%14s %12.3f %12.1f", modes[i].name, cpu_seconds, duration / cpu_seconds);
+
+			if (i == 0)
+				g_print(" %16s", "-");
+			else
+				g_print(" %16.3f", cpu_seconds - (gdouble)cpu_time[0] / G_USEC_PER_SEC);
+
+			if ((i == 0) || (i == G_N_ELEMENTS(modes) - 1))
+				g_print(" %10s %10s\n", "-", "-");
+			else
+			{
+				gint lag = 0;
+				gdouble snr = gst_mpg123_bench_get_snr(outputs[G_N_ELEMENTS(modes) - 1], outputs[i], stream->header.channels, &lag);
+				g_print(" %10.1f %10d\n", snr, lag);
+			}
+		}
+	}
+
+	while (i > 0)
+		g_byte_array_unref(outputs[--i]);
+	gst_mpg123_test_stream_free(stream);
+
+	return retval;
+}
+
+
+
+
+int main(int argc, char *argv[])
+{
+	GstMpg123BenchCommand const *command = NULL;
+	GOptionContext *context;
+	GError *error = NULL;
+	gchar *parameter_string;
+	int retval, i;
+
+	gst_init(&argc, &argv);
+
+	if (argc >= 2)
+	{
+		for (i = 0; gst_mpg123_bench_commands[i].name != NULL; ++i)
+		{
+			if (strcmp(argv[1], gst_mpg123_bench_commands[i].name) == 0)
+				command = &(gst_mpg123_bench_commands[i]);
+		}
+	}
+
+	if (command == NULL)
+	{
+		g_printerr("Usage: %s COMMAND [OPTIONS]\n\nCommands:\n", argv[0]);
+		for (i = 0; gst_mpg123_bench_commands[i].name != NULL; ++i)
+			g_printerr("  %-14s %s\n", gst_mpg123_bench_commands[i].name, gst_mpg123_bench_commands[i].description);
+		g_printerr("\nUse %s COMMAND --help for the options of a command\n", argv[0]);
+		return 1;
+	}
+
+	/* The command name stays in argv[1], where GOption ignores it as a non-option argument */
+	parameter_string = g_strdup_printf("%s - %s", command->name, command->description);
+	context = g_option_context_new(parameter_string);
+	g_free(parameter_string);
+	g_option_context_add_main_entries(context, gst_mpg123_bench_common_entries, NULL);
+	if (command->entries != NULL)
+		g_option_context_add_main_entries(context, command->entries, NULL);
+
+	if (!g_option_context_parse(context, &argc, &argv, &error))
+	{
+		g_printerr("%s\n", error->message);
+		g_error_free(error);
+		g_option_context_free(context);
+		return 1;
+	}
+	g_option_context_free(context);
+
+	retval = gst_mpg123_bench_load_plugin() ? command->run() : 1;
+
+	gst_deinit();
+
+	return retval;
+}
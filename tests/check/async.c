@@ -0,0 +1,298 @@
+/*
+*   MP3 decoding plugin for GStreamer using the mpg123 library
+*   Copyright (C) 2012 Carlos Rafael Giani
+*
+*   This library is free software; you can redistribute it and/or
+*   modify it under the terms of the GNU Lesser General Public
+*   License as published by the Free Software Foundation; either
+*   version 2.1 of the License, or (at your option) any later version.
+*
+*   This library is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+*   Lesser General Public License for more details.
+*
+*   You should have received a copy of the GNU Lesser General Public
+*   License along with this library; if not, write to the Free Software
+*   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+
+
+
+/*
+Checks async-decode (decoding in a separate thread, with the input and output passed through queues)
+against decoding in the streaming thread, with a sequence that exercises the serialization: part of a
+stream, a flush while frames are still queued, more of the stream, new caps with another rate, a second
+stream, and EOS.
+
+The events and buffers leaving the element are logged by a probe on its source pad. Before the flush,
+async mode outputs fewer buffers, since the flush drops the frames still queued; these must be a prefix
+of what synchronous decoding outputs. From the flush on, both logs must be the same, event for event
+and buffer for buffer, and contain every frame fed after the flush.
+*/
+
+
+#include <gst/check/gstcheck.h>
+#include "gstmpg123checkutils.h"
+
+
+#define FRAMES_BEFORE_FLUSH 20
+#define FRAMES_AFTER_FLUSH 20
+#define SECOND_STREAM_FRAMES 30
+/* Small enough for the streaming thread to wait for the decoding thread, and output buffers meanwhile, before the flush */
+#define QUEUE_DEPTH 4
+
+
+typedef struct
+{
+	/* GST_EVENT_UNKNOWN for buffers */
+	GstEventType type;
+	/* for buffers: number of samples per channel, and the rate of the current caps */
+	guint num_samples;
+	gint rate;
+}
+LogEntry;
+
+
+typedef struct
+{
+	GArray *entries;
+	GstAudioInfo info;
+	gboolean have_info;
+}
+Log;
+
+
+
+
+static GstPadProbeReturn log_probe(G_GNUC_UNUSED GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+	Log *log = user_data;
+	LogEntry entry;
+
+	/* Output is only pushed from the streaming thread, in both modes, which is the thread of this test */
+	if (info->type & GST_PAD_PROBE_TYPE_BUFFER)
+	{
+		GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+
+		fail_unless(log->have_info, "buffer before caps");
+		entry.type = GST_EVENT_UNKNOWN;
+		entry.num_samples = gst_buffer_get_size(buffer) / GST_AUDIO_INFO_BPF(&(log->info));
+		entry.rate = GST_AUDIO_INFO_RATE(&(log->info));
+	}
+	else
+	{
+		GstEvent *event = GST_PAD_PROBE_INFO_EVENT(info);
+
+		/* Tags depend on the frames decoded so far, which is not of interest here */
+		if (GST_EVENT_TYPE(event) == GST_EVENT_TAG)
+			return GST_PAD_PROBE_OK;
+
+		if (GST_EVENT_TYPE(event) == GST_EVENT_CAPS)
+		{
+			GstCaps *caps;
+			gst_event_parse_caps(event, &caps);
+			fail_unless(gst_audio_info_from_caps(&(log->info), caps));
+			log->have_info = TRUE;
+		}
+
+		entry.type = GST_EVENT_TYPE(event);
+		entry.num_samples = 0;
+		entry.rate = 0;
+	}
+
+	g_array_append_val(log->entries, entry);
+
+	return GST_PAD_PROBE_OK;
+}
+
+
+static void push_frames(GstHarness *harness, GstMpg123TestStream const *stream, guint first_frame, guint num_frames)
+{
+	guint i;
+
+	for (i = first_frame; i < first_frame + num_frames; ++i)
+		fail_unless_equals_int(gst_harness_push(harness, gst_buffer_ref(g_ptr_array_index(stream->frames, i))), GST_FLOW_OK);
+
+	/* The output is checked through the log; keeping it in the harness queue is of no use */
+	while (gst_harness_buffers_in_queue(harness) > 0)
+		gst_buffer_unref(gst_harness_pull(harness));
+}
+
+
+/* Runs the sequence described at the top, and returns the log of the output */
+static GArray* run_sequence(GstMpg123TestStream const *first, GstMpg123TestStream const *second, gboolean async_decode, gboolean shared_thread_pool)
+{
+	GstHarness *harness;
+	GstPad *srcpad;
+	GstSegment segment;
+	Log log;
+
+	log.entries = g_array_new(FALSE, FALSE, sizeof(LogEntry));
+	log.have_info = FALSE;
+
+	harness = gst_mpg123_check_harness_new(
+		first,
+		"audio/x-raw, format = (string) " GST_AUDIO_NE(S16) ", layout = (string) interleaved",
+		"async-decode", async_decode,
+		"async-queue-depth", QUEUE_DEPTH,
+		"shared-thread-pool", shared_thread_pool,
+		NULL
+	);
+
+	srcpad = gst_element_get_static_pad(harness->element, "src");
+	gst_pad_add_probe(srcpad, GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM | GST_PAD_PROBE_TYPE_EVENT_FLUSH, log_probe, &log, NULL);
+	gst_object_unref(GST_OBJECT(srcpad));
+
+	push_frames(harness, first, 0, FRAMES_BEFORE_FLUSH);
+
+	/* A flushing seek, as far as the decoder is concerned; playback continues where it left off */
+	fail_unless(gst_harness_push_event(harness, gst_event_new_flush_start()));
+	fail_unless(gst_harness_push_event(harness, gst_event_new_flush_stop(TRUE)));
+	gst_segment_init(&segment, GST_FORMAT_TIME);
+	fail_unless(gst_harness_push_event(harness, gst_event_new_segment(&segment)));
+
+	push_frames(harness, first, FRAMES_BEFORE_FLUSH, FRAMES_AFTER_FLUSH);
+
+	/* The next stream has another rate, so the output caps change as well */
+	fail_unless(gst_harness_push_event(harness, gst_event_new_caps(second->caps)));
+	push_frames(harness, second, 0, second->frames->len);
+
+	fail_unless(gst_harness_push_event(harness, gst_event_new_eos()));
+	while (gst_harness_buffers_in_queue(harness) > 0)
+		gst_buffer_unref(gst_harness_pull(harness));
+
+	gst_harness_teardown(harness);
+
+	return log.entries;
+}
+
+
+static guint find_entry(GArray *log, GstEventType type)
+{
+	guint i;
+
+	for (i = 0; (i < log->len) && (g_array_index(log, LogEntry, i).type != type); ++i);
+	fail_unless(i < log->len, "no %s event in the output", gst_event_type_get_name(type));
+
+	return i;
+}
+
+
+/* Number of samples per channel in the buffers from entry start on (up to end), with the given rate (0 = any) */
+static guint64 count_samples(GArray *log, guint start, guint end, gint rate)
+{
+	guint64 num_samples = 0;
+	guint i;
+
+	for (i = start; i < end; ++i)
+	{
+		LogEntry const *entry = &g_array_index(log, LogEntry, i);
+		if ((entry->type == GST_EVENT_UNKNOWN) && ((rate == 0) || (entry->rate == rate)))
+			num_samples += entry->num_samples;
+	}
+
+	return num_samples;
+}
+
+
+static void check_async_decode(gboolean shared_thread_pool)
+{
+	GstMpg123TestStream *first, *second;
+	GArray *sync_log, *async_log;
+	guint sync_flush, async_flush, i, j;
+	guint spf;
+
+	first = gst_mpg123_test_stream_new_synthetic(44100, 2, FRAMES_BEFORE_FLUSH + FRAMES_AFTER_FLUSH, 1);
+	second = gst_mpg123_test_stream_new_synthetic(48000, 2, SECOND_STREAM_FRAMES, 2);
+	fail_unless((first != NULL) && (second != NULL));
+	spf = first->header.samples_per_frame;
+
+	sync_log = run_sequence(first, second, FALSE, FALSE);
+	async_log = run_sequence(first, second, TRUE, shared_thread_pool);
+
+	/* Up to the flush, the buffers of async mode are a prefix of those of synchronous decoding */
+	sync_flush = find_entry(sync_log, GST_EVENT_FLUSH_START);
+	async_flush = find_entry(async_log, GST_EVENT_FLUSH_START);
+	fail_unless(count_samples(async_log, 0, async_flush, 0) > 0, "async mode output nothing before the flush");
+	for (i = 0, j = 0; i < async_flush; ++i)
+	{
+		LogEntry const *entry = &g_array_index(async_log, LogEntry, i);
+		if (entry->type != GST_EVENT_UNKNOWN)
+			continue;
+
+		while ((j < sync_flush) && (g_array_index(sync_log, LogEntry, j).type != GST_EVENT_UNKNOWN))
+			++j;
+		fail_unless(j < sync_flush, "async mode output more buffers before the flush than synchronous decoding");
+		fail_unless_equals_int(entry->num_samples, g_array_index(sync_log, LogEntry, j).num_samples);
+		++j;
+	}
+
+	/* mpg123 holds the last frame fed back until the next one arrives, and the flush drops it */
+	fail_unless_equals_uint64(count_samples(sync_log, 0, sync_flush, 0), (guint64)(FRAMES_BEFORE_FLUSH - 1) * spf);
+
+	/* From the flush on, the output must be the same */
+	fail_unless_equals_int(async_log->len - async_flush, sync_log->len - sync_flush);
+	for (i = 0; i < sync_log->len - sync_flush; ++i)
+	{
+		LogEntry const *sync_entry = &g_array_index(sync_log, LogEntry, sync_flush + i);
+		LogEntry const *async_entry = &g_array_index(async_log, LogEntry, async_flush + i);
+
+		fail_unless(
+			(async_entry->type == sync_entry->type) && (async_entry->num_samples == sync_entry->num_samples) && (async_entry->rate == sync_entry->rate),
+			"entry %u after the flush differs: %s with %u samples at %d Hz in async mode, %s with %u samples at %d Hz otherwise",
+			i,
+			(async_entry->type == GST_EVENT_UNKNOWN) ? "buffer" : gst_event_type_get_name(async_entry->type), async_entry->num_samples, async_entry->rate,
+			(sync_entry->type == GST_EVENT_UNKNOWN) ? "buffer" : gst_event_type_get_name(sync_entry->type), sync_entry->num_samples, sync_entry->rate
+		);
+	}
+
+	/* Nothing is output between the flush events, and the log ends with EOS */
+	fail_unless_equals_int(g_array_index(async_log, LogEntry, async_flush + 1).type, GST_EVENT_FLUSH_STOP);
+	fail_unless_equals_int(g_array_index(async_log, LogEntry, async_log->len - 1).type, GST_EVENT_EOS);
+
+	/* All frames of the first stream fed after the flush come out before the caps change, and the second stream after it */
+	fail_unless_equals_uint64(count_samples(async_log, async_flush, async_log->len, 44100), (guint64)FRAMES_AFTER_FLUSH * spf);
+	fail_unless(count_samples(async_log, async_flush, async_log->len, 48000) > 0, "nothing of the second stream was output");
+
+	g_array_unref(async_log);
+	g_array_unref(sync_log);
+	gst_mpg123_test_stream_free(second);
+	gst_mpg123_test_stream_free(first);
+}
+
+
+
+
+GST_START_TEST(test_decoding_thread)
+{
+	check_async_decode(FALSE);
+}
+GST_END_TEST
+
+
+GST_START_TEST(test_shared_thread_pool)
+{
+	check_async_decode(TRUE);
+}
+GST_END_TEST
+
+
+static Suite* async_suite(void)
+{
+	Suite *suite = suite_create("async");
+	TCase *tcase = tcase_create("general");
+
+	tcase_set_timeout(tcase, 60);
+
+	suite_add_tcase(suite, tcase);
+	tcase_add_test(tcase, test_decoding_thread);
+	tcase_add_test(tcase, test_shared_thread_pool);
+
+	return suite;
+}
+
+
+GST_CHECK_MAIN(async)
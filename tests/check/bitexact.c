@@ -0,0 +1,442 @@
+/*
+*   MP3 decoding plugin for GStreamer using the mpg123 library
+*   Copyright (C) 2012 Carlos Rafael Giani
+*
+*   This library is free software; you can redistribute it and/or
+*   modify it under the terms of the GNU Lesser General Public
+*   License as published by the Free Software Foundation; either
+*   version 2.1 of the License, or (at your option) any later version.
+*
+*   This library is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+*   Lesser General Public License for more details.
+*
+*   You should have received a copy of the GNU Lesser General Public
+*   License along with this library; if not, write to the Free Software
+*   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+
+
+
+/*
+Checks that the element's output is bit-exact, in all formats and layouts, to what mpg123 outputs
+natively. The element decodes to S32 or S16 and converts to the other integer formats itself, with
+the vectorized code in gstmpg123simd.c, which is also checked directly here against plain C versions,
+with all kinds of lengths and alignments, so that each SIMD loop and its scalar tail are covered.
+*/
+
+
+#include <string.h>
+#include <gst/check/gstcheck.h>
+#include "gstmpg123core.h"
+#include "gstmpg123simd.h"
+#include "gstmpg123checkutils.h"
+
+
+#define SYNTHETIC_FRAMES 40
+/* Long enough for several iterations of the widest vector loop (16 samples) plus every tail length */
+#define MAX_SAMPLES 70
+#define MAX_MISALIGNMENT 4
+#define GUARD_SIZE 16
+#define GUARD_VALUE 0xA5
+
+
+typedef struct
+{
+	GstAudioFormat format;
+	int encoding;
+}
+FormatMapping;
+
+
+static FormatMapping const format_mappings[] =
+{
+	{ GST_AUDIO_FORMAT_S16, MPG123_ENC_SIGNED_16 },
+	{ GST_AUDIO_FORMAT_U16, MPG123_ENC_UNSIGNED_16 },
+	{ GST_AUDIO_FORMAT_S24, MPG123_ENC_SIGNED_24 },
+	{ GST_AUDIO_FORMAT_U24, MPG123_ENC_UNSIGNED_24 },
+	{ GST_AUDIO_FORMAT_S32, MPG123_ENC_SIGNED_32 },
+	{ GST_AUDIO_FORMAT_U32, MPG123_ENC_UNSIGNED_32 },
+	{ GST_AUDIO_FORMAT_F32, MPG123_ENC_FLOAT_32 }
+};
+
+
+static GstMpg123Conversion const conversions[] =
+{
+	GST_MPG123_CONVERSION_S32_TO_S24,
+	GST_MPG123_CONVERSION_S32_TO_U24,
+	GST_MPG123_CONVERSION_S32_TO_U32,
+	GST_MPG123_CONVERSION_S16_TO_U16
+};
+
+
+
+
+/* Straightforward versions of the conversions, as described in gstmpg123simd.h */
+static void convert_scalar(guint8 *dest, guint8 const *src, gsize num_samples, GstMpg123Conversion conversion)
+{
+	gsize i;
+
+	for (i = 0; i < num_samples; ++i)
+	{
+		switch (conversion)
+		{
+			case GST_MPG123_CONVERSION_S32_TO_S24:
+			case GST_MPG123_CONVERSION_S32_TO_U24:
+			{
+				guint32 sample;
+				memcpy(&sample, src + i * 4, 4);
+				if (conversion == GST_MPG123_CONVERSION_S32_TO_U24)
+					sample ^= 0x80000000u;
+				sample >>= 8;
+#if G_BYTE_ORDER == G_LITTLE_ENDIAN
+				dest[i * 3 + 0] = sample & 0xFF;
+				dest[i * 3 + 1] = (sample >> 8) & 0xFF;
+				dest[i * 3 + 2] = (sample >> 16) & 0xFF;
+#else
+				dest[i * 3 + 0] = (sample >> 16) & 0xFF;
+				dest[i * 3 + 1] = (sample >> 8) & 0xFF;
+				dest[i * 3 + 2] = sample & 0xFF;
+#endif
+				break;
+			}
+
+			case GST_MPG123_CONVERSION_S32_TO_U32:
+			{
+				guint32 sample;
+				memcpy(&sample, src + i * 4, 4);
+				sample ^= 0x80000000u;
+				memcpy(dest + i * 4, &sample, 4);
+				break;
+			}
+
+			case GST_MPG123_CONVERSION_S16_TO_U16:
+			{
+				guint16 sample;
+				memcpy(&sample, src + i * 2, 2);
+				sample ^= 0x8000;
+				memcpy(dest + i * 2, &sample, 2);
+				break;
+			}
+
+			default:
+				g_assert_not_reached();
+		}
+	}
+}
+
+
+static void deinterleave_scalar(guint8 *dest, guint8 const *src, gsize num_frames, guint num_channels, guint sample_size)
+{
+	gsize i;
+	guint c;
+
+	for (i = 0; i < num_frames; ++i)
+	{
+		for (c = 0; c < num_channels; ++c)
+			memcpy(dest + (c * num_frames + i) * sample_size, src + (i * num_channels + c) * sample_size, sample_size);
+	}
+}
+
+
+static void fill_random(guint8 *data, gsize size, GRand *rand)
+{
+	gsize i;
+	for (i = 0; i < size; ++i)
+		data[i] = g_rand_int_range(rand, 0, 256);
+}
+
+
+/* The bytes around the output must not be touched */
+static void check_guards(guint8 const *memory, gsize offset, gsize size)
+{
+	gsize i;
+
+	for (i = 0; i < GUARD_SIZE + offset; ++i)
+		fail_unless_equals_int(memory[i], GUARD_VALUE);
+	for (i = GUARD_SIZE + offset + size; i < GUARD_SIZE + offset + size + GUARD_SIZE; ++i)
+		fail_unless_equals_int(memory[i], GUARD_VALUE);
+}
+
+
+
+
+GST_START_TEST(test_convert)
+{
+	guint8 src[MAX_SAMPLES * 4 + MAX_MISALIGNMENT];
+	guint8 expected[MAX_SAMPLES * 4];
+	guint8 dest[GUARD_SIZE + MAX_MISALIGNMENT + MAX_SAMPLES * 4 + GUARD_SIZE];
+	guint8 in_place[MAX_SAMPLES * 4 + MAX_MISALIGNMENT];
+	GRand *rand = g_rand_new_with_seed(44);
+	guint i, src_offset, dest_offset;
+	gsize num_samples;
+
+	for (i = 0; i < G_N_ELEMENTS(conversions); ++i)
+	{
+		guint src_size = gst_mpg123_conversion_get_source_size(conversions[i]);
+		guint dest_size = gst_mpg123_conversion_get_dest_size(conversions[i]);
+
+		for (num_samples = 0; num_samples <= MAX_SAMPLES; ++num_samples)
+		{
+			for (src_offset = 0; src_offset < MAX_MISALIGNMENT; ++src_offset)
+			{
+				fill_random(src + src_offset, num_samples * src_size, rand);
+				convert_scalar(expected, src + src_offset, num_samples, conversions[i]);
+
+				for (dest_offset = 0; dest_offset < MAX_MISALIGNMENT; ++dest_offset)
+				{
+					memset(dest, GUARD_VALUE, sizeof(dest));
+					gst_mpg123_convert(dest + GUARD_SIZE + dest_offset, src + src_offset, num_samples, conversions[i]);
+
+					fail_unless(
+						memcmp(dest + GUARD_SIZE + dest_offset, expected, num_samples * dest_size) == 0,
+						"conversion %d differs from the scalar version with %" G_GSIZE_FORMAT " samples, source offset %u, destination offset %u",
+						conversions[i], num_samples, src_offset, dest_offset
+					);
+					check_guards(dest, dest_offset, num_samples * dest_size);
+				}
+
+				/* In place, which is how the element converts */
+				memcpy(in_place + src_offset, src + src_offset, num_samples * src_size);
+				gst_mpg123_convert(in_place + src_offset, in_place + src_offset, num_samples, conversions[i]);
+				fail_unless(
+					memcmp(in_place + src_offset, expected, num_samples * dest_size) == 0,
+					"in-place conversion %d differs from the scalar version with %" G_GSIZE_FORMAT " samples, offset %u",
+					conversions[i], num_samples, src_offset
+				);
+			}
+		}
+	}
+
+	g_rand_free(rand);
+}
+GST_END_TEST
+
+
+GST_START_TEST(test_deinterleave)
+{
+	static guint const sample_sizes[] = { 2, 3, 4 };
+	guint8 src[MAX_SAMPLES * 3 * 4 + MAX_MISALIGNMENT];
+	guint8 expected[MAX_SAMPLES * 3 * 4];
+	guint8 dest[GUARD_SIZE + MAX_MISALIGNMENT + MAX_SAMPLES * 3 * 4 + GUARD_SIZE];
+	GRand *rand = g_rand_new_with_seed(45);
+	guint i, num_channels, offset;
+	gsize num_frames, size;
+
+	for (i = 0; i < G_N_ELEMENTS(sample_sizes); ++i)
+	{
+		for (num_channels = 1; num_channels <= 3; ++num_channels)
+		{
+			for (num_frames = 0; num_frames <= MAX_SAMPLES; ++num_frames)
+			{
+				size = num_frames * num_channels * sample_sizes[i];
+
+				for (offset = 0; offset < MAX_MISALIGNMENT; ++offset)
+				{
+					fill_random(src + offset, size, rand);
+					deinterleave_scalar(expected, src + offset, num_frames, num_channels, sample_sizes[i]);
+
+					memset(dest, GUARD_VALUE, sizeof(dest));
+					/* Misalign the source and the destination differently */
+					gst_mpg123_deinterleave(dest + GUARD_SIZE + (MAX_MISALIGNMENT - 1 - offset), src + offset, num_frames, num_channels, sample_sizes[i]);
+
+					fail_unless(
+						memcmp(dest + GUARD_SIZE + (MAX_MISALIGNMENT - 1 - offset), expected, size) == 0,
+						"deinterleaving %u channels of %u byte samples differs from the scalar version with %" G_GSIZE_FORMAT " frames, offset %u",
+						num_channels, sample_sizes[i], num_frames, offset
+					);
+					check_guards(dest, MAX_MISALIGNMENT - 1 - offset, size);
+				}
+			}
+		}
+	}
+
+	g_rand_free(rand);
+}
+GST_END_TEST
+
+
+
+
+static gboolean is_encoding_supported(int encoding)
+{
+	const int *encodings;
+	size_t num, i;
+
+	mpg123_encodings(&encodings, &num);
+	for (i = 0; i < num; ++i)
+	{
+		if (encodings[i] == encoding)
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+
+/* Decodes with the direct API, which leaves the format conversion to mpg123 */
+static GstBuffer* decode_native(GstMpg123TestStream *stream, gchar const *decoder, int encoding)
+{
+	GstMpg123CoreConfig config;
+	GstMpg123Core *core;
+	GstBuffer *output;
+	unsigned char *pcm;
+	size_t pcm_size;
+	int error;
+	guint i;
+
+	fail_unless_equals_int(gst_mpg123_core_global_init(), MPG123_OK);
+
+	/* The same settings as the element uses */
+	gst_mpg123_core_config_init(&config);
+	config.frame_by_frame = 1;
+	config.decoder = decoder;
+
+	core = gst_mpg123_core_new(&config, &error);
+	fail_unless(core != NULL, "could not create core with decoder %s: %s", decoder, mpg123_plain_strerror(error));
+	fail_unless_equals_int(gst_mpg123_core_set_output_format(core, stream->header.rate, stream->header.channels, encoding), MPG123_OK);
+
+	pcm_size = gst_mpg123_core_get_max_output_size(core);
+	pcm = g_malloc(pcm_size);
+	output = gst_buffer_new();
+
+	for (i = 0; i < stream->frames->len; ++i)
+	{
+		GstBuffer *frame = g_ptr_array_index(stream->frames, i);
+		GstMapInfo map;
+		size_t num_pcm_bytes;
+
+		gst_buffer_map(frame, &map, GST_MAP_READ);
+		error = gst_mpg123_core_decode(core, map.data, map.size, pcm, pcm_size, &num_pcm_bytes);
+		gst_buffer_unmap(frame, &map);
+
+		while ((error == MPG123_OK) || (error == MPG123_NEW_FORMAT))
+		{
+			if (num_pcm_bytes > 0)
+			{
+				GstBuffer *pcm_buffer = gst_buffer_new_allocate(NULL, num_pcm_bytes, NULL);
+				gst_buffer_fill(pcm_buffer, 0, pcm, num_pcm_bytes);
+				output = gst_buffer_append(output, pcm_buffer);
+			}
+			error = gst_mpg123_core_decode(core, NULL, 0, pcm, pcm_size, &num_pcm_bytes);
+		}
+
+		fail_unless_equals_int(error, MPG123_NEED_MORE);
+	}
+
+	g_free(pcm);
+	gst_mpg123_core_free(core);
+
+	return output;
+}
+
+
+static void check_element_against_native(gint rate, gint channels)
+{
+	static gchar const * const layouts[] = {
+		"interleaved",
+#if GST_CHECK_VERSION(1, 16, 0)
+		"non-interleaved",
+#endif
+		NULL
+	};
+	GstMpg123TestStream *stream;
+	gchar **decoders;
+	guint i, j, k;
+
+	stream = gst_mpg123_test_stream_new_synthetic(rate, channels, SYNTHETIC_FRAMES, 2);
+	fail_unless(stream != NULL);
+
+	{
+		GstElement *element = gst_element_factory_make("mpg123", NULL);
+		fail_unless(element != NULL);
+		g_object_get(G_OBJECT(element), "supported-decoders", &decoders, NULL);
+		gst_object_unref(GST_OBJECT(element));
+		fail_unless((decoders != NULL) && (decoders[0] != NULL));
+	}
+
+	for (i = 0; decoders[i] != NULL; ++i)
+	{
+		for (j = 0; j < G_N_ELEMENTS(format_mappings); ++j)
+		{
+			gchar const *format = gst_audio_format_to_string(format_mappings[j].format);
+			GstBuffer *native;
+			GstMapInfo native_map;
+
+			/* Not every mpg123 build supports every format; the element only offers the supported ones */
+			if (!is_encoding_supported(format_mappings[j].encoding))
+				continue;
+
+			native = decode_native(stream, decoders[i], format_mappings[j].encoding);
+			gst_buffer_map(native, &native_map, GST_MAP_READ);
+
+			for (k = 0; layouts[k] != NULL; ++k)
+			{
+				GstHarness *harness;
+				GstBuffer *output;
+				GstAudioInfo info;
+				GstMapInfo map;
+				gchar *caps;
+
+				caps = g_strdup_printf("audio/x-raw, format = (string) %s, layout = (string) %s", format, layouts[k]);
+				harness = gst_mpg123_check_harness_new(stream, caps, "decoder", decoders[i], NULL);
+				g_free(caps);
+
+				output = gst_mpg123_check_harness_decode(harness, stream, 0, stream->frames->len, TRUE, &info);
+				gst_harness_teardown(harness);
+
+				gst_buffer_map(output, &map, GST_MAP_READ);
+				fail_unless_equals_uint64(map.size, native_map.size);
+				fail_unless(
+					memcmp(map.data, native_map.data, map.size) == 0,
+					"%s %s output of core %s differs from mpg123's native output", format, layouts[k], decoders[i]
+				);
+				gst_buffer_unmap(output, &map);
+				gst_buffer_unref(output);
+			}
+
+			gst_buffer_unmap(native, &native_map);
+			gst_buffer_unref(native);
+		}
+	}
+
+	g_strfreev(decoders);
+	gst_mpg123_test_stream_free(stream);
+}
+
+
+GST_START_TEST(test_element_stereo)
+{
+	check_element_against_native(44100, 2);
+}
+GST_END_TEST
+
+
+GST_START_TEST(test_element_mono)
+{
+	check_element_against_native(22050, 1);
+}
+GST_END_TEST
+
+
+static Suite* bitexact_suite(void)
+{
+	Suite *suite = suite_create("bitexact");
+	TCase *tcase = tcase_create("general");
+
+	tcase_set_timeout(tcase, 300);
+
+	suite_add_tcase(suite, tcase);
+	tcase_add_test(tcase, test_convert);
+	tcase_add_test(tcase, test_deinterleave);
+	tcase_add_test(tcase, test_element_stereo);
+	tcase_add_test(tcase, test_element_mono);
+
+	return suite;
+}
+
+
+GST_CHECK_MAIN(bitexact)
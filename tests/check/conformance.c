@@ -0,0 +1,412 @@
+/*
+*   MP3 decoding plugin for GStreamer using the mpg123 library
+*   Copyright (C) 2012 Carlos Rafael Giani
+*
+*   This library is free software; you can redistribute it and/or
+*   modify it under the terms of the GNU Lesser General Public
+*   License as published by the Free Software Foundation; either
+*   version 2.1 of the License, or (at your option) any later version.
+*
+*   This library is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+*   Lesser General Public License for more details.
+*
+*   You should have received a copy of the GNU Lesser General Public
+*   License along with this library; if not, write to the Free Software
+*   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+
+
+
+/*
+Decodes with every decoder core mpg123 supports on this CPU to every sample format the element
+offers, and checks the output against reference PCM using the accuracy criteria of ISO/IEC 11172-4
+(see gst_mpg123_check_get_limits()). Each combination is printed with its error and its speed.
+
+Without assets, the input is synthetic (layer I, II and III, see gst_mpg123_test_stream_new_synthetic_layer()),
+and the reference is the output of the generic core as F32.
+For actual conformance testing, set GST_MPG123_CONFORMANCE_DIR to a directory with MPEG audio streams
+(.mp1, .mp2, .mp3, .mpg or .bit files), each with its reference output next to it: same name, with a
+.f32 suffix, containing raw interleaved 32 bit float samples in little endian byte order. The
+ISO/IEC 11172-4 compliance streams can be used this way after converting their reference output.
+*/
+
+
+#include <string.h>
+#include <gst/check/gstcheck.h>
+#include "gstmpg123checkutils.h"
+
+
+#define SYNTHETIC_SECONDS 2
+
+
+/*
+These cores synthesize with integer arithmetic, or add dither noise to 16 bit output, so they are
+only expected to reach limited accuracy
+*/
+static gchar const * const limited_accuracy_cores[] = { "i586", "i586_dither", "MMX", "3DNow", "3DNowExt", NULL };
+
+
+static gchar** get_supported_decoders(void)
+{
+	GstElement *element;
+	gchar **decoders;
+
+	element = gst_element_factory_make("mpg123", NULL);
+	fail_unless(element != NULL);
+	g_object_get(G_OBJECT(element), "supported-decoders", &decoders, NULL);
+	gst_object_unref(GST_OBJECT(element));
+
+	fail_unless((decoders != NULL) && (decoders[0] != NULL), "mpg123 does not report any decoder cores");
+
+	return decoders;
+}
+
+
+static GPtrArray* get_template_formats(void)
+{
+	GstElement *element;
+	GstPad *srcpad;
+	GstCaps *caps;
+	GValue const *formats;
+	GPtrArray *format_names;
+	guint i;
+
+	element = gst_element_factory_make("mpg123", NULL);
+	fail_unless(element != NULL);
+	srcpad = gst_element_get_static_pad(element, "src");
+	caps = gst_pad_get_pad_template_caps(srcpad);
+
+	format_names = g_ptr_array_new_with_free_func(g_free);
+	formats = gst_structure_get_value(gst_caps_get_structure(caps, 0), "format");
+	fail_unless(formats != NULL);
+
+	if (GST_VALUE_HOLDS_LIST(formats))
+	{
+		for (i = 0; i < gst_value_list_get_size(formats); ++i)
+			g_ptr_array_add(format_names, g_value_dup_string(gst_value_list_get_value(formats, i)));
+	}
+	else
+		g_ptr_array_add(format_names, g_value_dup_string(formats));
+
+	gst_caps_unref(caps);
+	gst_object_unref(GST_OBJECT(srcpad));
+	gst_object_unref(GST_OBJECT(element));
+
+	return format_names;
+}
+
+
+static gboolean is_full_accuracy_expected(gchar const *decoder, GstAudioInfo const *info)
+{
+	guint i;
+
+	for (i = 0; limited_accuracy_cores[i] != NULL; ++i)
+	{
+		if (g_ascii_strcasecmp(decoder, limited_accuracy_cores[i]) == 0)
+			return FALSE;
+	}
+
+	if ((strstr(decoder, "dither") != NULL) && (GST_AUDIO_INFO_WIDTH(info) == 16))
+		return FALSE;
+
+	return TRUE;
+}
+
+
+static GstBuffer* decode_stream(GstMpg123TestStream *stream, gchar const *decoder, gchar const *format, GstAudioInfo *info, gdouble *realtime_factor)
+{
+	GstHarness *harness;
+	GstBuffer *output;
+	gchar *caps;
+	gint64 start_time, end_time;
+
+	caps = g_strdup_printf("audio/x-raw, format = (string) %s, layout = (string) interleaved", format);
+	harness = gst_mpg123_check_harness_new(stream, caps, "decoder", decoder, NULL);
+	g_free(caps);
+
+	start_time = g_get_monotonic_time();
+	output = gst_mpg123_check_harness_decode(harness, stream, 0, stream->frames->len, TRUE, info);
+	end_time = g_get_monotonic_time();
+
+	gst_harness_teardown(harness);
+
+	fail_unless(gst_buffer_get_size(output) > 0, "no output from core %s with format %s", decoder, format);
+	fail_unless_equals_string(GST_AUDIO_INFO_NAME(info), format);
+
+	if (realtime_factor != NULL)
+		*realtime_factor = (gdouble)gst_mpg123_test_stream_get_duration(stream) / GST_USECOND / MAX(end_time - start_time, 1);
+
+	return output;
+}
+
+
+/*
+Checks all cores and formats against the reference; if reference is NULL, the generic core's F32
+output is used, or, if mpg123 was built without it, the output of its default core
+*/
+static void check_stream(GstMpg123TestStream *stream, gchar const *name, GstBuffer *reference, GstAudioInfo const *reference_info)
+{
+	gchar **decoders;
+	GPtrArray *formats;
+	GstAudioInfo generic_info;
+	gdouble *reference_samples;
+	gsize num_reference_samples, max_length_difference;
+	guint i, j, num_failures = 0;
+
+	decoders = get_supported_decoders();
+	formats = get_template_formats();
+
+	if (reference == NULL)
+	{
+		gchar const *reference_decoder = NULL;
+
+		for (i = 0; decoders[i] != NULL; ++i)
+		{
+			if (strcmp(decoders[i], "generic") == 0)
+				reference_decoder = decoders[i];
+		}
+
+		reference = decode_stream(stream, reference_decoder, GST_AUDIO_NE(F32), &generic_info, NULL);
+		reference_info = &generic_info;
+		/* Same decoder, same frames, so the length must match exactly */
+		max_length_difference = 0;
+	}
+	else
+	{
+		gst_buffer_ref(reference);
+		/* Reference decoders may handle the end of the stream differently */
+		max_length_difference = stream->header.samples_per_frame * stream->header.channels;
+	}
+
+	reference_samples = gst_mpg123_check_buffer_to_f64(reference, reference_info, &num_reference_samples);
+
+	g_print("%s: %u frames, %d Hz, %d channel(s)\n", name, stream->frames->len, stream->header.rate, stream->header.channels);
+	g_print("  %-18s %-7s %10s %10s %10s %10s %9s %8s\n", "core", "format", "rms", "rms limit", "max", "max limit", "realtime", "accuracy");
+
+	for (i = 0; decoders[i] != NULL; ++i)
+	{
+		for (j = 0; j < formats->len; ++j)
+		{
+			gchar const *format = g_ptr_array_index(formats, j);
+			GstAudioInfo info;
+			GstBuffer *output;
+			gdouble *samples, realtime_factor, rms, max_error, max_rms, max_allowed_error;
+			gsize num_samples, length_difference;
+			gboolean full_accuracy, ok;
+
+			output = decode_stream(stream, decoders[i], format, &info, &realtime_factor);
+			samples = gst_mpg123_check_buffer_to_f64(output, &info, &num_samples);
+			gst_buffer_unref(output);
+
+			fail_unless_equals_int(GST_AUDIO_INFO_CHANNELS(&info), GST_AUDIO_INFO_CHANNELS(reference_info));
+			fail_unless_equals_int(GST_AUDIO_INFO_RATE(&info), GST_AUDIO_INFO_RATE(reference_info));
+
+			full_accuracy = is_full_accuracy_expected(decoders[i], &info);
+			gst_mpg123_check_get_limits(&info, full_accuracy, &max_rms, &max_allowed_error);
+			gst_mpg123_check_compare(samples, reference_samples, MIN(num_samples, num_reference_samples), &rms, &max_error);
+			g_free(samples);
+
+			length_difference = (num_samples > num_reference_samples) ? (num_samples - num_reference_samples) : (num_reference_samples - num_samples);
+			ok = (rms <= max_rms) && (max_error <= max_allowed_error) && (length_difference <= max_length_difference);
+			if (!ok)
+				++num_failures;
+
+			g_print(
+				"  %-18s %-7s %10.3e %10.3e %10.3e %10.3e %8.1fx %8s%s\n",
+				decoders[i], format,
+				rms, max_rms,
+				max_error, max_allowed_error,
+				realtime_factor,
+				full_accuracy ? "full" : "limited",
+				ok ? "" : ((length_difference > max_length_difference) ? "  FAILED (length)" : "  FAILED")
+			);
+		}
+	}
+
+	g_free(reference_samples);
+	gst_buffer_unref(reference);
+	g_ptr_array_unref(formats);
+	g_strfreev(decoders);
+
+	fail_unless_equals_int(num_failures, 0);
+}
+
+
+static void check_synthetic_stream(gint layer, gint rate, gint channels)
+{
+	static gchar const * const version_names[] = { "1", "2", "2.5" };
+	static gchar const * const layer_names[] = { "I", "II", "III" };
+	GstMpg123TestStream *stream;
+	guint samples_per_frame;
+	gchar *name;
+
+	samples_per_frame = (layer == 1) ? 384 : (((layer == 3) && (rate < 32000)) ? 576 : 1152);
+	stream = gst_mpg123_test_stream_new_synthetic_layer(layer, rate, channels, SYNTHETIC_SECONDS * rate / samples_per_frame, 1);
+	fail_unless(stream != NULL);
+
+	name = g_strdup_printf("synthetic MPEG-%s layer %s", version_names[stream->header.version - 1], layer_names[stream->header.layer - 1]);
+	check_stream(stream, name, NULL, NULL);
+	g_free(name);
+
+	gst_mpg123_test_stream_free(stream);
+}
+
+
+GST_START_TEST(test_conformance_mpeg1_stereo)
+{
+	check_synthetic_stream(1, 44100, 2);
+}
+GST_END_TEST
+
+
+GST_START_TEST(test_conformance_mpeg2_mono)
+{
+	check_synthetic_stream(1, 24000, 1);
+}
+GST_END_TEST
+
+
+GST_START_TEST(test_conformance_layer2_stereo)
+{
+	check_synthetic_stream(2, 44100, 2);
+}
+GST_END_TEST
+
+
+GST_START_TEST(test_conformance_layer2_mono)
+{
+	check_synthetic_stream(2, 48000, 1);
+}
+GST_END_TEST
+
+
+GST_START_TEST(test_conformance_layer3_stereo)
+{
+	check_synthetic_stream(3, 44100, 2);
+}
+GST_END_TEST
+
+
+GST_START_TEST(test_conformance_layer3_mono)
+{
+	check_synthetic_stream(3, 32000, 1);
+}
+GST_END_TEST
+
+
+GST_START_TEST(test_conformance_layer3_mpeg2_stereo)
+{
+	check_synthetic_stream(3, 22050, 2);
+}
+GST_END_TEST
+
+
+GST_START_TEST(test_conformance_layer3_mpeg25_mono)
+{
+	check_synthetic_stream(3, 8000, 1);
+}
+GST_END_TEST
+
+
+GST_START_TEST(test_conformance_reference_files)
+{
+	static gchar const * const suffixes[] = { ".mp1", ".mp2", ".mp3", ".mpg", ".bit", NULL };
+	gchar const *directory_name, *filename;
+	GDir *directory;
+	GError *error = NULL;
+	guint num_checked = 0;
+
+	directory_name = g_getenv("GST_MPG123_CONFORMANCE_DIR");
+	if (directory_name == NULL)
+	{
+		g_print("GST_MPG123_CONFORMANCE_DIR is not set, skipping the reference file conformance test\n");
+		return;
+	}
+
+	directory = g_dir_open(directory_name, 0, &error);
+	fail_unless(directory != NULL, "could not open %s: %s", directory_name, (error != NULL) ? error->message : "");
+
+	while ((filename = g_dir_read_name(directory)) != NULL)
+	{
+		GstMpg123TestStream *stream;
+		GstAudioInfo reference_info;
+		GstBuffer *reference;
+		gchar *path, *basename, *reference_path, *reference_data;
+		gsize reference_size;
+		guint i;
+
+		for (i = 0; suffixes[i] != NULL; ++i)
+		{
+			if (g_str_has_suffix(filename, suffixes[i]))
+				break;
+		}
+		if (suffixes[i] == NULL)
+			continue;
+
+		path = g_build_filename(directory_name, filename, NULL);
+		basename = g_strndup(filename, strlen(filename) - strlen(suffixes[i]));
+		reference_path = g_strdup_printf("%s%c%s.f32", directory_name, G_DIR_SEPARATOR, basename);
+
+		stream = gst_mpg123_test_stream_new_from_file(path, &error);
+		if (stream == NULL)
+		{
+			/* For example free format streams, which the frame splitter does not support */
+			g_print("%s: skipped, %s\n", filename, error->message);
+			g_clear_error(&error);
+		}
+		else if (!g_file_get_contents(reference_path, &reference_data, &reference_size, NULL))
+			g_print("%s: skipped, no reference output %s\n", filename, reference_path);
+		else
+		{
+			gst_audio_info_init(&reference_info);
+			gst_audio_info_set_format(&reference_info, GST_AUDIO_FORMAT_F32LE, stream->header.rate, stream->header.channels, NULL);
+			reference = gst_buffer_new_wrapped(reference_data, reference_size);
+
+			check_stream(stream, filename, reference, &reference_info);
+			++num_checked;
+
+			gst_buffer_unref(reference);
+		}
+
+		if (stream != NULL)
+			gst_mpg123_test_stream_free(stream);
+		g_free(reference_path);
+		g_free(basename);
+		g_free(path);
+	}
+
+	g_dir_close(directory);
+
+	fail_unless(num_checked > 0, "no streams with reference output found in %s", directory_name);
+}
+GST_END_TEST
+
+
+static Suite* conformance_suite(void)
+{
+	Suite *suite = suite_create("conformance");
+	TCase *tcase = tcase_create("general");
+
+	/* Every core is run with every format, which takes a while, especially with valgrind */
+	tcase_set_timeout(tcase, 600);
+
+	suite_add_tcase(suite, tcase);
+	tcase_add_test(tcase, test_conformance_mpeg1_stereo);
+	tcase_add_test(tcase, test_conformance_mpeg2_mono);
+	tcase_add_test(tcase, test_conformance_layer2_stereo);
+	tcase_add_test(tcase, test_conformance_layer2_mono);
+	tcase_add_test(tcase, test_conformance_layer3_stereo);
+	tcase_add_test(tcase, test_conformance_layer3_mono);
+	tcase_add_test(tcase, test_conformance_layer3_mpeg2_stereo);
+	tcase_add_test(tcase, test_conformance_layer3_mpeg25_mono);
+	tcase_add_test(tcase, test_conformance_reference_files);
+
+	return suite;
+}
+
+
+GST_CHECK_MAIN(conformance)
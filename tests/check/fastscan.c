@@ -0,0 +1,115 @@
+/*
+*   MP3 decoding plugin for GStreamer using the mpg123 library
+*   Copyright (C) 2012 Carlos Rafael Giani
+*
+*   This library is free software; you can redistribute it and/or
+*   modify it under the terms of the GNU Lesser General Public
+*   License as published by the Free Software Foundation; either
+*   version 2.1 of the License, or (at your option) any later version.
+*
+*   This library is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+*   Lesser General Public License for more details.
+*
+*   You should have received a copy of the GNU Lesser General Public
+*   License along with this library; if not, write to the Free Software
+*   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+
+
+
+/*
+Checks the duration the fast-scan property determines. With fast-scan, only the first frame is decoded,
+and the rest are only parsed and counted; once the stream is drained, the element answers duration
+queries with the exact length, which must be the number of frames times the samples per frame.
+*/
+
+
+#include <gst/check/gstcheck.h>
+#include "gstmpg123checkutils.h"
+
+
+#define SYNTHETIC_FRAMES 50
+
+
+
+
+static void check_scanned_duration(gint layer, gint rate, gint channels, gboolean async_decode)
+{
+	GstMpg123TestStream *stream;
+	GstHarness *harness;
+	GstBuffer *output;
+	GstAudioInfo info;
+	gint64 duration = -1;
+	GstClockTime expected_duration;
+
+	stream = gst_mpg123_test_stream_new_synthetic_layer(layer, rate, channels, SYNTHETIC_FRAMES, 1);
+	fail_unless(stream != NULL);
+
+	harness = gst_mpg123_check_harness_new(stream, NULL, "fast-scan", TRUE, "async-decode", async_decode, NULL);
+	output = gst_mpg123_check_harness_decode(harness, stream, 0, stream->frames->len, TRUE, &info);
+	fail_unless(gst_buffer_get_size(output) > 0, "the first frame was not decoded");
+
+	fail_unless(gst_element_query_duration(harness->element, GST_FORMAT_TIME, &duration));
+	expected_duration = gst_util_uint64_scale_int((guint64)stream->frames->len * stream->header.samples_per_frame, GST_SECOND, stream->header.rate);
+	GST_INFO("layer %d, %d Hz, %d channel(s): duration %" GST_TIME_FORMAT ", expected %" GST_TIME_FORMAT, layer, rate, channels, GST_TIME_ARGS(duration), GST_TIME_ARGS(expected_duration));
+	fail_unless_equals_uint64((guint64)duration, expected_duration);
+
+	gst_buffer_unref(output);
+	gst_harness_teardown(harness);
+	gst_mpg123_test_stream_free(stream);
+}
+
+
+
+
+GST_START_TEST(test_scan_layer1)
+{
+	check_scanned_duration(1, 44100, 2, FALSE);
+}
+GST_END_TEST
+
+
+GST_START_TEST(test_scan_layer3)
+{
+	check_scanned_duration(3, 48000, 2, FALSE);
+}
+GST_END_TEST
+
+
+GST_START_TEST(test_scan_layer3_mpeg2)
+{
+	/* MPEG-2 layer III frames have half as many samples */
+	check_scanned_duration(3, 22050, 1, FALSE);
+}
+GST_END_TEST
+
+
+GST_START_TEST(test_scan_layer3_async)
+{
+	check_scanned_duration(3, 44100, 2, TRUE);
+}
+GST_END_TEST
+
+
+static Suite* fastscan_suite(void)
+{
+	Suite *suite = suite_create("fastscan");
+	TCase *tcase = tcase_create("general");
+
+	tcase_set_timeout(tcase, 60);
+
+	suite_add_tcase(suite, tcase);
+	tcase_add_test(tcase, test_scan_layer1);
+	tcase_add_test(tcase, test_scan_layer3);
+	tcase_add_test(tcase, test_scan_layer3_mpeg2);
+	tcase_add_test(tcase, test_scan_layer3_async);
+
+	return suite;
+}
+
+
+GST_CHECK_MAIN(fastscan)
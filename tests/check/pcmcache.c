@@ -0,0 +1,442 @@
+/*
+*   MP3 decoding plugin for GStreamer using the mpg123 library
+*   Copyright (C) 2012 Carlos Rafael Giani
+*
+*   This library is free software; you can redistribute it and/or
+*   modify it under the terms of the GNU Lesser General Public
+*   License as published by the Free Software Foundation; either
+*   version 2.1 of the License, or (at your option) any later version.
+*
+*   This library is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+*   Lesser General Public License for more details.
+*
+*   You should have received a copy of the GNU Lesser General Public
+*   License along with this library; if not, write to the Free Software
+*   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+
+
+
+/*
+Checks the PCM cache (the pcm-cache-size property) by playing streams repeatedly, in separate element
+instances, as an application replaying the same asset would: when the whole stream is cached, when only
+a prefix is, and when a cached prefix is followed by frames that were never decoded before, so that
+mpg123 has to catch up in the middle of the stream.
+
+Up to the frame after which mpg123 catches up, the output must be the same as without the cache, byte
+for byte. From there on, it only has to meet the full accuracy criteria of ISO/IEC 11172-4: mpg123
+restarts when catching up, and the position in the ring buffer of its synthesis filter then differs
+from regular decoding, which changes the order in which the filter taps are summed, and so the rounding.
+
+The cache is process-wide; since check runs each test in a separate process by default, every test
+starts with an empty cache. The statistics are compared as differences anyway, so the tests also
+work with CK_FORK=no.
+
+By default, the streams are generated (layer I). To also test with a real stream, for example layer
+III with its bit reservoir, set GST_MPG123_TEST_FILE to the path of an MPEG audio file.
+*/
+
+
+#include <string.h>
+#include <gst/check/gstcheck.h>
+#include "gstmpg123checkutils.h"
+
+
+#define SYNTHETIC_FRAMES 40
+#define CACHE_SIZE ((guint64)(64 << 20))
+
+
+static gchar const * const output_caps_s16 = "audio/x-raw, format = (string) " GST_AUDIO_NE(S16) ", layout = (string) interleaved";
+static gchar const * const output_caps_s32 = "audio/x-raw, format = (string) " GST_AUDIO_NE(S32) ", layout = (string) interleaved";
+
+
+typedef struct
+{
+	guint64 hits, misses, insertions;
+}
+CacheStats;
+
+
+
+
+static void get_cache_stats(CacheStats *stats)
+{
+	GstElement *element;
+	GstStructure *structure;
+
+	element = gst_element_factory_make("mpg123", NULL);
+	fail_unless(element != NULL);
+	g_object_get(G_OBJECT(element), "pcm-cache-stats", &structure, NULL);
+	gst_object_unref(GST_OBJECT(element));
+
+	fail_unless(structure != NULL);
+	fail_unless(gst_structure_get_uint64(structure, "hits", &(stats->hits)));
+	fail_unless(gst_structure_get_uint64(structure, "misses", &(stats->misses)));
+	fail_unless(gst_structure_get_uint64(structure, "insertions", &(stats->insertions)));
+	gst_structure_free(structure);
+}
+
+
+/* Plays the whole stream in the harness, which is torn down afterwards */
+static GstBuffer* play_in(GstHarness *harness, GstMpg123TestStream const *stream, GstAudioInfo *info, CacheStats *stats)
+{
+	GstBuffer *output;
+	GstAudioInfo output_info;
+	CacheStats before;
+
+	get_cache_stats(&before);
+
+	output = gst_mpg123_check_harness_decode(harness, stream, 0, stream->frames->len, TRUE, &output_info);
+	gst_harness_teardown(harness);
+
+	fail_unless(gst_buffer_get_size(output) > 0);
+	if (info != NULL)
+		*info = output_info;
+
+	if (stats != NULL)
+	{
+		get_cache_stats(stats);
+		stats->hits -= before.hits;
+		stats->misses -= before.misses;
+		stats->insertions -= before.insertions;
+		GST_INFO("%u frames: %" G_GUINT64_FORMAT " hits, %" G_GUINT64_FORMAT " misses, %" G_GUINT64_FORMAT " insertions", stream->frames->len, stats->hits, stats->misses, stats->insertions);
+	}
+
+	return output;
+}
+
+
+/* Plays the whole stream in a new element, with the cache if cache_size is nonzero */
+static GstBuffer* play(GstMpg123TestStream const *stream, gchar const *output_caps, guint64 cache_size, GstAudioInfo *info, CacheStats *stats)
+{
+	return play_in(gst_mpg123_check_harness_new(stream, output_caps, "pcm-cache-size", cache_size, NULL), stream, info, stats);
+}
+
+
+/* The first num_exact_frames frames must be identical to the reference, the rest accurate enough */
+static void check_output(GstBuffer *output, GstBuffer *reference, GstAudioInfo const *info, GstMpg123TestStream const *stream, guint num_exact_frames, gchar const *description)
+{
+	GstMapInfo output_map, reference_map;
+	gsize i, num_exact_bytes;
+	gdouble *output_samples, *reference_samples;
+	gsize num_samples, num_reference_samples, num_exact_samples;
+	gdouble rms, max_error, max_rms, max_allowed_error;
+
+	gst_buffer_map(output, &output_map, GST_MAP_READ);
+	gst_buffer_map(reference, &reference_map, GST_MAP_READ);
+
+	fail_unless(
+		output_map.size == reference_map.size,
+		"%s: %" G_GSIZE_FORMAT " bytes of output, but %" G_GSIZE_FORMAT " without the cache",
+		description, output_map.size, reference_map.size
+	);
+
+	num_exact_bytes = MIN((gsize)num_exact_frames * stream->header.samples_per_frame * GST_AUDIO_INFO_BPF(info), output_map.size);
+	for (i = 0; (i < num_exact_bytes) && (output_map.data[i] == reference_map.data[i]); ++i);
+	fail_unless(i == num_exact_bytes, "%s: output differs from the output without the cache at byte %" G_GSIZE_FORMAT, description, i);
+
+	gst_buffer_unmap(reference, &reference_map);
+	gst_buffer_unmap(output, &output_map);
+
+	if (num_exact_bytes == gst_buffer_get_size(output))
+		return;
+
+	output_samples = gst_mpg123_check_buffer_to_f64(output, info, &num_samples);
+	reference_samples = gst_mpg123_check_buffer_to_f64(reference, info, &num_reference_samples);
+	fail_unless_equals_uint64(num_samples, num_reference_samples);
+
+	num_exact_samples = num_exact_bytes / GST_AUDIO_INFO_BPS(info);
+	gst_mpg123_check_compare(output_samples + num_exact_samples, reference_samples + num_exact_samples, num_samples - num_exact_samples, &rms, &max_error);
+	gst_mpg123_check_get_limits(info, TRUE, &max_rms, &max_allowed_error);
+	fail_unless(
+		(rms < max_rms) && (max_error <= max_allowed_error),
+		"%s: output after catching up differs too much from the output without the cache (rms %g, max %g)",
+		description, rms, max_error
+	);
+
+	g_free(reference_samples);
+	g_free(output_samples);
+}
+
+
+/* A stream with num_first_frames frames of first, followed by the frames of second starting with second_start */
+static GstMpg123TestStream* splice_streams(GstMpg123TestStream const *first, guint num_first_frames, GstMpg123TestStream const *second, guint second_start)
+{
+	GstMpg123TestStream *stream;
+	guint i;
+
+	stream = g_new0(GstMpg123TestStream, 1);
+	stream->frames = g_ptr_array_new_with_free_func((GDestroyNotify)gst_buffer_unref);
+	stream->caps = gst_caps_ref(first->caps);
+	stream->header = first->header;
+
+	for (i = 0; i < num_first_frames; ++i)
+		g_ptr_array_add(stream->frames, gst_buffer_ref(g_ptr_array_index(first->frames, i)));
+	for (i = second_start; i < second->frames->len; ++i)
+		g_ptr_array_add(stream->frames, gst_buffer_ref(g_ptr_array_index(second->frames, i)));
+
+	return stream;
+}
+
+
+
+
+static void check_play_twice(GstMpg123TestStream const *stream)
+{
+	GstBuffer *reference, *first, *second;
+	GstAudioInfo info;
+	CacheStats stats;
+	guint num_frames = stream->frames->len;
+
+	reference = play(stream, output_caps_s16, 0, &info, NULL);
+
+	/* Nothing is cached yet, so the element simply decodes */
+	first = play(stream, output_caps_s16, CACHE_SIZE, NULL, &stats);
+	check_output(first, reference, &info, stream, num_frames, "first play");
+	fail_unless(stats.insertions > 0, "nothing was inserted into the cache");
+
+	/*
+	mpg123 only reports the format for the first frame, and the output lags one frame behind the input,
+	so every frame but the first two can be taken from the cache. The last frame is output when draining,
+	after catching up.
+	*/
+	second = play(stream, output_caps_s16, CACHE_SIZE, NULL, &stats);
+	check_output(second, reference, &info, stream, num_frames - 1, "second play");
+	fail_unless(
+		stats.hits + 2 >= stream->frames->len,
+		"only %" G_GUINT64_FORMAT " cache hits with %u frames", stats.hits, stream->frames->len
+	);
+
+	gst_buffer_unref(second);
+	gst_buffer_unref(first);
+	gst_buffer_unref(reference);
+}
+
+
+/*
+Plays cached first, then spliced, which starts with the first num_prefix_frames frames of cached, and
+compares against playing spliced without the cache. The first new frame (or draining) makes mpg123
+catch up and output the last frame of the prefix.
+*/
+static void check_spliced(GstMpg123TestStream const *cached, GstMpg123TestStream const *spliced, guint num_prefix_frames, gboolean expect_misses)
+{
+	GstBuffer *reference, *output;
+	GstAudioInfo info;
+	CacheStats stats;
+
+	reference = play(spliced, output_caps_s16, 0, &info, NULL);
+	gst_buffer_unref(play(cached, output_caps_s16, CACHE_SIZE, NULL, NULL));
+
+	output = play(spliced, output_caps_s16, CACHE_SIZE, NULL, &stats);
+	check_output(output, reference, &info, spliced, num_prefix_frames - 1, "spliced stream");
+	fail_unless(stats.hits > 0, "the prefix was not taken from the cache");
+	if (expect_misses)
+		fail_unless(stats.misses > 0);
+	gst_buffer_unref(output);
+
+	/* Now the rest is cached as well */
+	output = play(spliced, output_caps_s16, CACHE_SIZE, NULL, NULL);
+	check_output(output, reference, &info, spliced, num_prefix_frames - 1, "spliced stream, second play");
+	gst_buffer_unref(output);
+
+	gst_buffer_unref(reference);
+}
+
+
+
+
+GST_START_TEST(test_play_twice)
+{
+	GstMpg123TestStream *stream = gst_mpg123_test_stream_new_synthetic(44100, 2, SYNTHETIC_FRAMES, 1);
+	fail_unless(stream != NULL);
+	check_play_twice(stream);
+	gst_mpg123_test_stream_free(stream);
+}
+GST_END_TEST
+
+
+GST_START_TEST(test_shared_prefix)
+{
+	GstMpg123TestStream *first, *second, *spliced;
+
+	first = gst_mpg123_test_stream_new_synthetic(44100, 2, SYNTHETIC_FRAMES, 2);
+	second = gst_mpg123_test_stream_new_synthetic(44100, 2, SYNTHETIC_FRAMES, 3);
+	fail_unless((first != NULL) && (second != NULL));
+
+	/* The cached frames are followed by new ones, which are decoded after mpg123 caught up */
+	spliced = splice_streams(first, SYNTHETIC_FRAMES / 2, second, SYNTHETIC_FRAMES / 2);
+	check_spliced(first, spliced, SYNTHETIC_FRAMES / 2, TRUE);
+
+	gst_mpg123_test_stream_free(spliced);
+	gst_mpg123_test_stream_free(second);
+	gst_mpg123_test_stream_free(first);
+}
+GST_END_TEST
+
+
+GST_START_TEST(test_cached_prefix_only)
+{
+	GstMpg123TestStream *stream, *prefix;
+
+	stream = gst_mpg123_test_stream_new_synthetic(22050, 1, SYNTHETIC_FRAMES, 4);
+	fail_unless(stream != NULL);
+
+	/* Every frame is a hit; the last one is only output when draining, after catching up */
+	prefix = splice_streams(stream, SYNTHETIC_FRAMES / 2, stream, stream->frames->len);
+	check_spliced(stream, prefix, SYNTHETIC_FRAMES / 2, FALSE);
+
+	gst_mpg123_test_stream_free(prefix);
+	gst_mpg123_test_stream_free(stream);
+}
+GST_END_TEST
+
+
+GST_START_TEST(test_format_is_part_of_key)
+{
+	GstMpg123TestStream *stream;
+	GstBuffer *reference, *output;
+	GstAudioInfo info;
+	CacheStats stats;
+
+	stream = gst_mpg123_test_stream_new_synthetic(44100, 2, SYNTHETIC_FRAMES, 5);
+	fail_unless(stream != NULL);
+
+	reference = play(stream, output_caps_s32, 0, &info, NULL);
+	gst_buffer_unref(play(stream, output_caps_s16, CACHE_SIZE, NULL, NULL));
+
+	/* Without hits, there is no catching up, so all of the output must be identical */
+	output = play(stream, output_caps_s32, CACHE_SIZE, NULL, &stats);
+	check_output(output, reference, &info, stream, stream->frames->len, "other format");
+	fail_unless_equals_uint64(stats.hits, 0);
+
+	gst_buffer_unref(output);
+	gst_buffer_unref(reference);
+	gst_mpg123_test_stream_free(stream);
+}
+GST_END_TEST
+
+
+GST_START_TEST(test_resampling_is_part_of_key)
+{
+	GstMpg123TestStream *stream;
+	GstBuffer *reference, *output;
+	GstAudioInfo info;
+	CacheStats stats;
+	gchar const *output_caps = "audio/x-raw, format = (string) " GST_AUDIO_NE(S16) ", layout = (string) interleaved, rate = (int) 22050";
+
+	stream = gst_mpg123_test_stream_new_synthetic(44100, 2, SYNTHETIC_FRAMES, 6);
+	fail_unless(stream != NULL);
+
+	/* Halving the rate and resampling to the same rate with NtoM give the same output format, but different samples */
+	reference = play_in(gst_mpg123_check_harness_new(stream, output_caps, "force-rate", TRUE, NULL), stream, &info, NULL);
+	gst_buffer_unref(play_in(gst_mpg123_check_harness_new(stream, output_caps, "pcm-cache-size", CACHE_SIZE, "down-sample", 1, NULL), stream, NULL, NULL));
+
+	output = play_in(gst_mpg123_check_harness_new(stream, output_caps, "pcm-cache-size", CACHE_SIZE, "force-rate", TRUE, NULL), stream, NULL, &stats);
+	check_output(output, reference, &info, stream, stream->frames->len, "resampled");
+	fail_unless_equals_uint64(stats.hits, 0);
+
+	gst_buffer_unref(output);
+	gst_buffer_unref(reference);
+	gst_mpg123_test_stream_free(stream);
+}
+GST_END_TEST
+
+
+GST_START_TEST(test_decoder_is_part_of_key)
+{
+	GstMpg123TestStream *stream;
+	GstBuffer *reference, *output;
+	GstAudioInfo info;
+	CacheStats stats;
+	gchar **decoders;
+
+	{
+		GstElement *element = gst_element_factory_make("mpg123", NULL);
+		fail_unless(element != NULL);
+		g_object_get(G_OBJECT(element), "supported-decoders", &decoders, NULL);
+		gst_object_unref(GST_OBJECT(element));
+		fail_unless((decoders != NULL) && (decoders[0] != NULL));
+	}
+
+	if (decoders[1] == NULL)
+	{
+		g_print("only one mpg123 decoder core is supported, skipping the PCM cache test with different cores\n");
+		g_strfreev(decoders);
+		return;
+	}
+
+	stream = gst_mpg123_test_stream_new_synthetic(44100, 2, SYNTHETIC_FRAMES, 7);
+	fail_unless(stream != NULL);
+
+	/* The cores round differently, so samples cached by one must not be output by another */
+	reference = play_in(gst_mpg123_check_harness_new(stream, output_caps_s16, "decoder", decoders[1], NULL), stream, &info, NULL);
+	gst_buffer_unref(play_in(gst_mpg123_check_harness_new(stream, output_caps_s16, "pcm-cache-size", CACHE_SIZE, "decoder", decoders[0], NULL), stream, NULL, NULL));
+
+	output = play_in(gst_mpg123_check_harness_new(stream, output_caps_s16, "pcm-cache-size", CACHE_SIZE, "decoder", decoders[1], NULL), stream, NULL, &stats);
+	check_output(output, reference, &info, stream, stream->frames->len, "other decoder");
+	fail_unless_equals_uint64(stats.hits, 0);
+
+	gst_buffer_unref(output);
+	gst_buffer_unref(reference);
+	gst_mpg123_test_stream_free(stream);
+	g_strfreev(decoders);
+}
+GST_END_TEST
+
+
+GST_START_TEST(test_file)
+{
+	gchar const *filename;
+	GstMpg123TestStream *stream, *spliced;
+	GError *error = NULL;
+	guint num_frames;
+
+	filename = g_getenv("GST_MPG123_TEST_FILE");
+	if (filename == NULL)
+	{
+		g_print("GST_MPG123_TEST_FILE is not set, skipping the PCM cache test with a file\n");
+		return;
+	}
+
+	stream = gst_mpg123_test_stream_new_from_file(filename, &error);
+	fail_unless(stream != NULL, "could not read %s: %s", filename, (error != NULL) ? error->message : "unknown error");
+	num_frames = stream->frames->len;
+	fail_unless(num_frames >= 4, "%s is too short", filename);
+
+	check_play_twice(stream);
+
+	/* Skipping a part of the stream after the cached prefix breaks the bit reservoir, like a real cut would */
+	spliced = splice_streams(stream, num_frames / 2, stream, num_frames * 3 / 4);
+	check_spliced(stream, spliced, num_frames / 2, TRUE);
+
+	gst_mpg123_test_stream_free(spliced);
+	gst_mpg123_test_stream_free(stream);
+}
+GST_END_TEST
+
+
+static Suite* pcmcache_suite(void)
+{
+	Suite *suite = suite_create("pcmcache");
+	TCase *tcase = tcase_create("general");
+
+	tcase_set_timeout(tcase, 120);
+
+	suite_add_tcase(suite, tcase);
+	tcase_add_test(tcase, test_play_twice);
+	tcase_add_test(tcase, test_shared_prefix);
+	tcase_add_test(tcase, test_cached_prefix_only);
+	tcase_add_test(tcase, test_format_is_part_of_key);
+	tcase_add_test(tcase, test_resampling_is_part_of_key);
+	tcase_add_test(tcase, test_decoder_is_part_of_key);
+	tcase_add_test(tcase, test_file);
+
+	return suite;
+}
+
+
+GST_CHECK_MAIN(pcmcache)
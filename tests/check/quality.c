@@ -0,0 +1,146 @@
+/*
+*   MP3 decoding plugin for GStreamer using the mpg123 library
+*   Copyright (C) 2012 Carlos Rafael Giani
+*
+*   This library is free software; you can redistribute it and/or
+*   modify it under the terms of the GNU Lesser General Public
+*   License as published by the Free Software Foundation; either
+*   version 2.1 of the License, or (at your option) any later version.
+*
+*   This library is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+*   Lesser General Public License for more details.
+*
+*   You should have received a copy of the GNU Lesser General Public
+*   License along with this library; if not, write to the Free Software
+*   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+
+
+
+/*
+Checks the adaptive quality of the cpu-budget property. A quality level change switches the output
+rate (and maybe the channel count) in the middle of the stream, and restarts mpg123 with the new
+format; this must not lose or duplicate any audio, so the output, with each buffer counted at its
+own rate, must add up to exactly the length of the input.
+
+The decoder only lowers the quality if decoding takes longer than the budget, or if downstream reports
+late buffers through QoS events. The test relies on the latter, which does not depend on the speed of
+the machine: it sends a QoS event with a positive jitter, so the next level change lowers the quality.
+*/
+
+
+#include <gst/check/gstcheck.h>
+#include "gstmpg123checkutils.h"
+
+
+#define SYNTHETIC_FRAMES 200
+/* The element keeps a level for 50 frames before considering a change */
+#define LATE_FRAME 20
+
+
+static gchar const * const output_caps_s16 = "audio/x-raw, format = (string) " GST_AUDIO_NE(S16) ", layout = (string) interleaved";
+
+
+
+
+/* Adds the length of the buffers the harness got so far, at the rate of the stream */
+static void pull_output(GstHarness *harness, gint stream_rate, guint64 *num_samples, guint *num_reduced_buffers)
+{
+	GstBuffer *buffer;
+
+	while ((buffer = gst_harness_try_pull(harness)) != NULL)
+	{
+		GstCaps *caps;
+		GstAudioInfo info;
+		guint64 num_buffer_samples;
+
+		caps = gst_pad_get_current_caps(harness->sinkpad);
+		fail_unless(caps != NULL);
+		fail_unless(gst_audio_info_from_caps(&info, caps));
+		gst_caps_unref(caps);
+
+		/* The reduced rates are integer fractions of the stream rate, so this is exact */
+		num_buffer_samples = gst_buffer_get_size(buffer) / GST_AUDIO_INFO_BPF(&info);
+		fail_unless((stream_rate % GST_AUDIO_INFO_RATE(&info)) == 0);
+		*num_samples += num_buffer_samples * (stream_rate / GST_AUDIO_INFO_RATE(&info));
+
+		if (GST_AUDIO_INFO_RATE(&info) != stream_rate)
+			(*num_reduced_buffers)++;
+
+		gst_buffer_unref(buffer);
+	}
+}
+
+
+static void check_quality_change(gint layer, gint rate, gint channels)
+{
+	GstMpg123TestStream *stream;
+	GstHarness *harness;
+	guint64 num_samples = 0;
+	guint num_reduced_buffers = 0;
+	guint i;
+
+	stream = gst_mpg123_test_stream_new_synthetic_layer(layer, rate, channels, SYNTHETIC_FRAMES, 1);
+	fail_unless(stream != NULL);
+
+	/* The whole budget, so that the quality goes back up once the QoS event is handled */
+	harness = gst_mpg123_check_harness_new(stream, output_caps_s16, "cpu-budget", 100, NULL);
+
+	for (i = 0; i < stream->frames->len; ++i)
+	{
+		fail_unless_equals_int(gst_harness_push(harness, gst_buffer_ref(g_ptr_array_index(stream->frames, i))), GST_FLOW_OK);
+		pull_output(harness, rate, &num_samples, &num_reduced_buffers);
+
+		if (i == LATE_FRAME)
+			fail_unless(gst_harness_push_upstream_event(harness, gst_event_new_qos(GST_QOS_TYPE_UNDERFLOW, 1.5, 10 * GST_MSECOND, 0)));
+	}
+
+	fail_unless(gst_harness_push_event(harness, gst_event_new_eos()));
+	pull_output(harness, rate, &num_samples, &num_reduced_buffers);
+
+	GST_INFO("layer %d, %d Hz, %d channel(s): %u buffers at reduced quality", layer, rate, channels, num_reduced_buffers);
+	fail_unless(num_reduced_buffers > 0, "the quality was not lowered");
+	fail_unless_equals_uint64(num_samples, (guint64)stream->frames->len * stream->header.samples_per_frame);
+
+	gst_harness_teardown(harness);
+	gst_mpg123_test_stream_free(stream);
+}
+
+
+
+
+GST_START_TEST(test_quality_change_layer1)
+{
+	check_quality_change(1, 44100, 2);
+}
+GST_END_TEST
+
+
+GST_START_TEST(test_quality_change_layer3)
+{
+	/* The bit reservoir reaches back over several frames, so the replay after the change needs all of them */
+	check_quality_change(3, 48000, 2);
+}
+GST_END_TEST
+
+
+static Suite* quality_suite(void)
+{
+	Suite *suite = suite_create("quality");
+	TCase *tcase = tcase_create("general");
+
+	tcase_set_timeout(tcase, 120);
+
+	suite_add_tcase(suite, tcase);
+	tcase_add_test(tcase, test_quality_change_layer1);
+	tcase_add_test(tcase, test_quality_change_layer3);
+
+	return suite;
+}
+
+
+GST_CHECK_MAIN(quality)
@@ -0,0 +1,214 @@
+/*
+*   MP3 decoding plugin for GStreamer using the mpg123 library
+*   Copyright (C) 2012 Carlos Rafael Giani
+*
+*   This library is free software; you can redistribute it and/or
+*   modify it under the terms of the GNU Lesser General Public
+*   License as published by the Free Software Foundation; either
+*   version 2.1 of the License, or (at your option) any later version.
+*
+*   This library is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+*   Lesser General Public License for more details.
+*
+*   You should have received a copy of the GNU Lesser General Public
+*   License along with this library; if not, write to the Free Software
+*   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+
+
+
+/*
+Checks handing a stream over from one decoder to another with the save-state and restore-state action
+signals, as a player switching to a standby decoder would. The saved position marks where the output
+of the first decoder ends; the second decoder gets the input frames from there on, and the output of
+both together must be exactly as long as that of a single decoder, with no frame lost or repeated.
+
+Up to the position, the output is the one of a single decoder. After it, it only has to meet the full
+accuracy criteria of ISO/IEC 11172-4: the second decoder starts from scratch when it replays the saved
+frames, so the position in the ring buffer of its synthesis filter differs, which changes the rounding.
+
+With async-decode, frames may still be queued for the decoding thread when the state is saved. These are
+not part of the state, so the position may be any frame boundary before the last pushed frame.
+*/
+
+
+#include <gst/check/gstcheck.h>
+#include "gstmpg123checkutils.h"
+
+
+#define SYNTHETIC_FRAMES 60
+#define HANDOVER_FRAME 30
+#define STATE_HISTORY_SIZE 8
+
+
+static gchar const * const output_caps_s16 = "audio/x-raw, format = (string) " GST_AUDIO_NE(S16) ", layout = (string) interleaved";
+
+
+
+
+/* Gives the frames consecutive timestamps, since the saved position is based on them */
+static void set_timestamps(GstMpg123TestStream *stream)
+{
+	guint i;
+
+	for (i = 0; i < stream->frames->len; ++i)
+	{
+		GstBuffer *frame = gst_buffer_make_writable(g_ptr_array_index(stream->frames, i));
+		GstClockTime start = gst_util_uint64_scale_int((guint64)i * stream->header.samples_per_frame, GST_SECOND, stream->header.rate);
+		GstClockTime end = gst_util_uint64_scale_int((guint64)(i + 1) * stream->header.samples_per_frame, GST_SECOND, stream->header.rate);
+
+		GST_BUFFER_PTS(frame) = start;
+		GST_BUFFER_DURATION(frame) = end - start;
+		stream->frames->pdata[i] = frame;
+	}
+}
+
+
+static guint get_frame_at(GstMpg123TestStream const *stream, GstClockTime position)
+{
+	guint i;
+
+	for (i = 0; i < stream->frames->len; ++i)
+	{
+		GstBuffer *frame = g_ptr_array_index(stream->frames, i);
+		if (GST_BUFFER_PTS(frame) == position)
+			return i;
+	}
+
+	fail("position %" GST_TIME_FORMAT " is not at a frame boundary", GST_TIME_ARGS(position));
+	return 0;
+}
+
+
+static void check_handover(gint layer, gboolean async_decode)
+{
+	GstMpg123TestStream *stream;
+	GstHarness *harness;
+	GstBuffer *reference, *first, *second, *output;
+	GstAudioInfo info, first_info, second_info;
+	GstStructure *state = NULL;
+	guint64 position;
+	guint resume_frame;
+	gsize bpf, num_first_bytes;
+	gboolean restored = FALSE;
+	GstMapInfo output_map, reference_map;
+	gsize i, num_samples, num_reference_samples, num_exact_samples;
+	gdouble *output_samples, *reference_samples;
+	gdouble rms, max_error, max_rms, max_allowed_error;
+
+	stream = gst_mpg123_test_stream_new_synthetic_layer(layer, 44100, 2, SYNTHETIC_FRAMES, 1);
+	fail_unless(stream != NULL);
+	set_timestamps(stream);
+
+	harness = gst_mpg123_check_harness_new(stream, output_caps_s16, "async-decode", FALSE, NULL);
+	reference = gst_mpg123_check_harness_decode(harness, stream, 0, stream->frames->len, TRUE, &info);
+	gst_harness_teardown(harness);
+	bpf = GST_AUDIO_INFO_BPF(&info);
+
+	/* The first decoder gets the frames up to the hand-over, and its state is saved right away */
+	harness = gst_mpg123_check_harness_new(stream, output_caps_s16, "state-history-size", STATE_HISTORY_SIZE, "async-decode", async_decode, NULL);
+	first = gst_mpg123_check_harness_decode(harness, stream, 0, HANDOVER_FRAME, FALSE, &first_info);
+	g_signal_emit_by_name(harness->element, "save-state", &state);
+	fail_unless(state != NULL, "no state was saved");
+	fail_unless(gst_structure_get_uint64(state, "position", &position));
+	resume_frame = get_frame_at(stream, position);
+	GST_INFO("layer %d%s: state saved at frame %u of %u pushed frames", layer, async_decode ? ", async" : "", resume_frame, HANDOVER_FRAME);
+
+	/* The frame mpg123 holds back is not part of the state */
+	fail_unless(resume_frame < HANDOVER_FRAME);
+	num_first_bytes = (gsize)resume_frame * stream->header.samples_per_frame * bpf;
+	if (async_decode)
+	{
+		/* Some of the output up to the position may not have been published yet; draining gets all of it */
+		first = gst_buffer_append(first, gst_mpg123_check_harness_decode(harness, stream, 0, 0, TRUE, &first_info));
+		fail_unless(gst_buffer_get_size(first) >= num_first_bytes);
+	}
+	else
+		fail_unless_equals_uint64(gst_buffer_get_size(first), num_first_bytes);
+	gst_harness_teardown(harness);
+
+	/* The second decoder continues from the position */
+	harness = gst_mpg123_check_harness_new(stream, output_caps_s16, "async-decode", async_decode, NULL);
+	g_signal_emit_by_name(harness->element, "restore-state", state, &restored);
+	fail_unless(restored);
+	second = gst_mpg123_check_harness_decode(harness, stream, resume_frame, stream->frames->len - resume_frame, TRUE, &second_info);
+	gst_harness_teardown(harness);
+
+	output = gst_buffer_append(gst_buffer_copy_region(first, GST_BUFFER_COPY_MEMORY, 0, num_first_bytes), second);
+	fail_unless_equals_uint64(gst_buffer_get_size(output), gst_buffer_get_size(reference));
+
+	gst_buffer_map(output, &output_map, GST_MAP_READ);
+	gst_buffer_map(reference, &reference_map, GST_MAP_READ);
+	for (i = 0; (i < num_first_bytes) && (output_map.data[i] == reference_map.data[i]); ++i);
+	fail_unless(i == num_first_bytes, "output before the hand-over differs from the reference at byte %" G_GSIZE_FORMAT, i);
+	gst_buffer_unmap(reference, &reference_map);
+	gst_buffer_unmap(output, &output_map);
+
+	output_samples = gst_mpg123_check_buffer_to_f64(output, &info, &num_samples);
+	reference_samples = gst_mpg123_check_buffer_to_f64(reference, &info, &num_reference_samples);
+	fail_unless_equals_uint64(num_samples, num_reference_samples);
+
+	num_exact_samples = num_first_bytes / GST_AUDIO_INFO_BPS(&info);
+	gst_mpg123_check_compare(output_samples + num_exact_samples, reference_samples + num_exact_samples, num_samples - num_exact_samples, &rms, &max_error);
+	gst_mpg123_check_get_limits(&info, TRUE, &max_rms, &max_allowed_error);
+	fail_unless(
+		(rms < max_rms) && (max_error <= max_allowed_error),
+		"output after the hand-over differs too much from the reference (rms %g, max %g)",
+		rms, max_error
+	);
+
+	g_free(reference_samples);
+	g_free(output_samples);
+	gst_buffer_unref(output);
+	gst_buffer_unref(first);
+	gst_buffer_unref(reference);
+	gst_structure_free(state);
+	gst_mpg123_test_stream_free(stream);
+}
+
+
+
+
+GST_START_TEST(test_handover_layer1)
+{
+	check_handover(1, FALSE);
+}
+GST_END_TEST
+
+
+GST_START_TEST(test_handover_layer3)
+{
+	/* The saved frames have to cover the bit reservoir of the first frame after the hand-over */
+	check_handover(3, FALSE);
+}
+GST_END_TEST
+
+
+GST_START_TEST(test_handover_layer3_async)
+{
+	check_handover(3, TRUE);
+}
+GST_END_TEST
+
+
+static Suite* savestate_suite(void)
+{
+	Suite *suite = suite_create("savestate");
+	TCase *tcase = tcase_create("general");
+
+	tcase_set_timeout(tcase, 120);
+
+	suite_add_tcase(suite, tcase);
+	tcase_add_test(tcase, test_handover_layer1);
+	tcase_add_test(tcase, test_handover_layer3);
+	tcase_add_test(tcase, test_handover_layer3_async);
+
+	return suite;
+}
+
+
+GST_CHECK_MAIN(savestate)
@@ -0,0 +1,332 @@
+/*
+*   MP3 decoding plugin for GStreamer using the mpg123 library
+*   Copyright (C) 2012 Carlos Rafael Giani
+*
+*   This library is free software; you can redistribute it and/or
+*   modify it under the terms of the GNU Lesser General Public
+*   License as published by the Free Software Foundation; either
+*   version 2.1 of the License, or (at your option) any later version.
+*
+*   This library is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+*   Lesser General Public License for more details.
+*
+*   You should have received a copy of the GNU Lesser General Public
+*   License along with this library; if not, write to the Free Software
+*   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+
+
+
+/*
+Checks skipping of leading ID3v2 tags through the core API (skip_id3v2 in GstMpg123CoreConfig), with a
+stream as it would come from a network socket: a multi-megabyte tag with embedded cover art, a second
+small tag, and the MPEG frames, fed in fixed-size chunks regardless of where tags and frames begin.
+The output must be the same as that of the stream without tags, whether the tags are skipped or left
+to mpg123. The startup test also prints how much input and time it takes until the first sample is
+decoded, and how much input mpg123 buffers meanwhile.
+*/
+
+
+#include <config.h>
+#include <string.h>
+#include <gst/check/gstcheck.h>
+#include "gstmpg123core.h"
+#include "gstmpg123testutils.h"
+
+
+#define SYNTHETIC_FRAMES 40
+#define COVER_ART_TAG_SIZE (2 * 1024 * 1024)
+#define SECOND_TAG_SIZE 1024
+#define CHUNK_SIZE 4096
+
+
+typedef struct
+{
+	GByteArray *pcm;
+	/* Input fed until the first sample was decoded, and the time that took */
+	gsize num_bytes_until_first_sample;
+	gint64 time_until_first_sample;
+	/* Largest amount of input mpg123 held at once; -1 if mpg123 cannot report it */
+	glong max_buffer_fill;
+	gsize num_skipped_tag_bytes;
+}
+DecodeResult;
+
+
+
+
+static void append_id3v2_size(GByteArray *data, guint32 size, gboolean syncsafe)
+{
+	guint8 bytes[4];
+
+	if (syncsafe)
+	{
+		bytes[0] = (size >> 21) & 0x7F;
+		bytes[1] = (size >> 14) & 0x7F;
+		bytes[2] = (size >> 7) & 0x7F;
+		bytes[3] = size & 0x7F;
+	}
+	else
+	{
+		bytes[0] = (size >> 24) & 0xFF;
+		bytes[1] = (size >> 16) & 0xFF;
+		bytes[2] = (size >> 8) & 0xFF;
+		bytes[3] = size & 0xFF;
+	}
+
+	g_byte_array_append(data, bytes, 4);
+}
+
+
+/*
+Appends an ID3v2 tag of tag_size bytes in total, with one APIC frame holding pseudo-random "image"
+data, which is likely to contain bytes that look like MPEG frame headers
+*/
+static void append_cover_art_tag(GByteArray *data, guint tag_size, guint8 major_version, GRand *rand)
+{
+	static guint8 const picture_header[] = { 0x00, 'i', 'm', 'a', 'g', 'e', '/', 'j', 'p', 'e', 'g', 0x00, 0x03, 0x00 };
+	guint8 version[3] = { major_version, 0x00, 0x00 };
+	guint8 frame_flags[2] = { 0x00, 0x00 };
+	guint frame_size, picture_size, i;
+
+	g_assert(tag_size > 10 + 10 + sizeof(picture_header));
+	frame_size = tag_size - 10 - 10;
+	picture_size = frame_size - sizeof(picture_header);
+
+	/* Tag header; the tag size is always syncsafe, and does not include the header */
+	g_byte_array_append(data, (guint8 const *)"ID3", 3);
+	g_byte_array_append(data, version, 3);
+	append_id3v2_size(data, tag_size - 10, TRUE);
+
+	/* Frame header; the frame size is only syncsafe from version 2.4 on */
+	g_byte_array_append(data, (guint8 const *)"APIC", 4);
+	append_id3v2_size(data, frame_size, major_version >= 4);
+	g_byte_array_append(data, frame_flags, 2);
+
+	g_byte_array_append(data, picture_header, sizeof(picture_header));
+	for (i = 0; i < picture_size; ++i)
+	{
+		guint8 byte = g_rand_int_range(rand, 0, 256);
+		g_byte_array_append(data, &byte, 1);
+	}
+}
+
+
+static GByteArray* create_input(GstMpg123TestStream const *stream, gboolean with_tags)
+{
+	GByteArray *data = g_byte_array_new();
+	guint i;
+
+	if (with_tags)
+	{
+		GRand *rand = g_rand_new_with_seed(36);
+		append_cover_art_tag(data, COVER_ART_TAG_SIZE, 4, rand);
+		append_cover_art_tag(data, SECOND_TAG_SIZE, 3, rand);
+		g_rand_free(rand);
+	}
+
+	for (i = 0; i < stream->frames->len; ++i)
+	{
+		GstBuffer *frame = g_ptr_array_index(stream->frames, i);
+		GstMapInfo map;
+
+		gst_buffer_map(frame, &map, GST_MAP_READ);
+		g_byte_array_append(data, map.data, map.size);
+		gst_buffer_unmap(frame, &map);
+	}
+
+	return data;
+}
+
+
+static void update_max_buffer_fill(GstMpg123Core *core, DecodeResult *result)
+{
+#ifdef HAVE_MPG123_BUFFERFILL
+	long buffer_fill;
+
+	if (mpg123_getstate(gst_mpg123_core_get_handle(core), MPG123_BUFFERFILL, &buffer_fill, NULL) == MPG123_OK)
+		result->max_buffer_fill = MAX(result->max_buffer_fill, buffer_fill);
+#else
+	(void)core;
+	(void)result;
+#endif
+}
+
+
+static void decode(GByteArray const *input, gsize chunk_size, gboolean skip_id3v2, GstMpg123TestStream const *stream, DecodeResult *result)
+{
+	GstMpg123CoreConfig config;
+	GstMpg123Core *core;
+	unsigned char *pcm;
+	size_t pcm_size, num_pcm_bytes;
+	gsize offset;
+	gint64 start_time;
+	int error;
+
+	memset(result, 0, sizeof(DecodeResult));
+	result->pcm = g_byte_array_new();
+	result->max_buffer_fill = -1;
+
+	fail_unless_equals_int(gst_mpg123_core_global_init(), MPG123_OK);
+
+	gst_mpg123_core_config_init(&config);
+	config.skip_id3v2 = skip_id3v2;
+
+	core = gst_mpg123_core_new(&config, &error);
+	fail_unless(core != NULL, "could not create core: %s", mpg123_plain_strerror(error));
+	fail_unless_equals_int(gst_mpg123_core_set_output_format(core, stream->header.rate, stream->header.channels, MPG123_ENC_SIGNED_16), MPG123_OK);
+
+	pcm_size = gst_mpg123_core_get_max_output_size(core);
+	pcm = g_malloc(pcm_size);
+
+	start_time = g_get_monotonic_time();
+
+	for (offset = 0; offset < input->len; offset += chunk_size)
+	{
+		gsize size = MIN(chunk_size, input->len - offset);
+
+		error = gst_mpg123_core_decode(core, input->data + offset, size, pcm, pcm_size, &num_pcm_bytes);
+		update_max_buffer_fill(core, result);
+
+		while ((error == MPG123_OK) || (error == MPG123_NEW_FORMAT))
+		{
+			if (num_pcm_bytes > 0)
+			{
+				if (result->pcm->len == 0)
+				{
+					result->time_until_first_sample = g_get_monotonic_time() - start_time;
+					result->num_bytes_until_first_sample = offset + size;
+				}
+				g_byte_array_append(result->pcm, pcm, num_pcm_bytes);
+			}
+			error = gst_mpg123_core_decode(core, NULL, 0, pcm, pcm_size, &num_pcm_bytes);
+		}
+
+		fail_unless(error == MPG123_NEED_MORE, "decoding failed: %s", gst_mpg123_core_get_error_string(core));
+	}
+
+	result->num_skipped_tag_bytes = gst_mpg123_core_get_num_skipped_tag_bytes(core);
+
+	g_free(pcm);
+	gst_mpg123_core_free(core);
+}
+
+
+static void check_pcm(DecodeResult const *result, DecodeResult const *reference, gchar const *description)
+{
+	fail_unless(reference->pcm->len > 0);
+	fail_unless(
+		result->pcm->len == reference->pcm->len,
+		"%s: %u bytes of output, but %u without tags", description, result->pcm->len, reference->pcm->len
+	);
+	fail_unless(memcmp(result->pcm->data, reference->pcm->data, reference->pcm->len) == 0, "%s: output differs from the output without tags", description);
+}
+
+
+
+
+GST_START_TEST(test_skip_id3v2)
+{
+	/* 5 bytes split the 10 byte tag headers, 4096 bytes are a typical read size */
+	static gsize const chunk_sizes[] = { 5, CHUNK_SIZE };
+	GstMpg123TestStream *stream;
+	GByteArray *plain_input, *tagged_input;
+	DecodeResult reference, result;
+	guint i;
+
+	stream = gst_mpg123_test_stream_new_synthetic(44100, 2, SYNTHETIC_FRAMES, 1);
+	fail_unless(stream != NULL);
+	plain_input = create_input(stream, FALSE);
+	tagged_input = create_input(stream, TRUE);
+
+	for (i = 0; i < G_N_ELEMENTS(chunk_sizes); ++i)
+	{
+		decode(plain_input, chunk_sizes[i], FALSE, stream, &reference);
+
+		decode(tagged_input, chunk_sizes[i], TRUE, stream, &result);
+		check_pcm(&result, &reference, "tags skipped");
+		fail_unless_equals_uint64(result.num_skipped_tag_bytes, COVER_ART_TAG_SIZE + SECOND_TAG_SIZE);
+		g_byte_array_unref(result.pcm);
+
+		decode(tagged_input, chunk_sizes[i], FALSE, stream, &result);
+		check_pcm(&result, &reference, "tags parsed by mpg123");
+		fail_unless_equals_uint64(result.num_skipped_tag_bytes, 0);
+		g_byte_array_unref(result.pcm);
+
+		/* Without a tag, nothing must be held back or dropped */
+		decode(plain_input, chunk_sizes[i], TRUE, stream, &result);
+		check_pcm(&result, &reference, "no tags");
+		fail_unless_equals_uint64(result.num_skipped_tag_bytes, 0);
+		g_byte_array_unref(result.pcm);
+
+		g_byte_array_unref(reference.pcm);
+	}
+
+	g_byte_array_unref(tagged_input);
+	g_byte_array_unref(plain_input);
+	gst_mpg123_test_stream_free(stream);
+}
+GST_END_TEST
+
+
+GST_START_TEST(test_startup_latency)
+{
+	GstMpg123TestStream *stream;
+	GByteArray *input;
+	DecodeResult parsed, skipped;
+	gsize max_frame_size;
+
+	stream = gst_mpg123_test_stream_new_synthetic(44100, 2, SYNTHETIC_FRAMES, 2);
+	fail_unless(stream != NULL);
+	input = create_input(stream, TRUE);
+	/* Layer I frames are padded with a slot of 4 bytes */
+	max_frame_size = stream->header.frame_size + 4;
+
+	decode(input, CHUNK_SIZE, FALSE, stream, &parsed);
+	decode(input, CHUNK_SIZE, TRUE, stream, &skipped);
+
+	g_print("time until the first sample with %u bytes of ID3v2 tags, fed in %u byte chunks:\n", COVER_ART_TAG_SIZE + SECOND_TAG_SIZE, CHUNK_SIZE);
+	g_print(
+		"  tags parsed by mpg123: %" G_GSIZE_FORMAT " bytes fed, %.3f ms, up to %ld bytes buffered\n",
+		parsed.num_bytes_until_first_sample, parsed.time_until_first_sample / 1000.0, parsed.max_buffer_fill
+	);
+	g_print(
+		"  tags skipped:          %" G_GSIZE_FORMAT " bytes fed, %.3f ms, up to %ld bytes buffered\n",
+		skipped.num_bytes_until_first_sample, skipped.time_until_first_sample / 1000.0, skipped.max_buffer_fill
+	);
+
+	/* The first sample must be available once the tags and a few frames went through */
+	fail_unless(skipped.num_bytes_until_first_sample <= COVER_ART_TAG_SIZE + SECOND_TAG_SIZE + 3 * max_frame_size + CHUNK_SIZE);
+
+	/* With skipping, mpg123 never sees the tags, so it must not buffer more than the frames of a few chunks */
+	if (skipped.max_buffer_fill >= 0)
+		fail_unless(skipped.max_buffer_fill <= (glong)(3 * max_frame_size + CHUNK_SIZE), "mpg123 buffered %ld bytes", skipped.max_buffer_fill);
+
+	g_byte_array_unref(skipped.pcm);
+	g_byte_array_unref(parsed.pcm);
+	g_byte_array_unref(input);
+	gst_mpg123_test_stream_free(stream);
+}
+GST_END_TEST
+
+
+static Suite* startup_suite(void)
+{
+	Suite *suite = suite_create("startup");
+	TCase *tcase = tcase_create("general");
+
+	tcase_set_timeout(tcase, 120);
+
+	suite_add_tcase(suite, tcase);
+	tcase_add_test(tcase, test_skip_id3v2);
+	tcase_add_test(tcase, test_startup_latency);
+
+	return suite;
+}
+
+
+GST_CHECK_MAIN(startup)
@@ -0,0 +1,214 @@
+/*
+*   MP3 decoding plugin for GStreamer using the mpg123 library
+*   Copyright (C) 2012 Carlos Rafael Giani
+*
+*   This library is free software; you can redistribute it and/or
+*   modify it under the terms of the GNU Lesser General Public
+*   License as published by the Free Software Foundation; either
+*   version 2.1 of the License, or (at your option) any later version.
+*
+*   This library is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+*   Lesser General Public License for more details.
+*
+*   You should have received a copy of the GNU Lesser General Public
+*   License along with this library; if not, write to the Free Software
+*   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+
+
+
+#include <string.h>
+#include <math.h>
+#include <gst/check/gstcheck.h>
+#include "gstmpg123checkutils.h"
+
+
+static GstBuffer* gst_mpg123_check_interleave(GstBuffer *buffer, GstAudioInfo const *info);
+
+
+
+
+GstHarness* gst_mpg123_check_harness_new(GstMpg123TestStream const *stream, gchar const *output_caps, gchar const *first_property_name, ...)
+{
+	GstElement *element;
+	GstHarness *harness;
+	va_list args;
+
+	element = gst_element_factory_make("mpg123", NULL);
+	fail_unless(element != NULL);
+
+	/* Some properties, like the decoder core, only take effect when the element starts, which the harness does right away */
+	va_start(args, first_property_name);
+	if (first_property_name != NULL)
+		g_object_set_valist(G_OBJECT(element), first_property_name, args);
+	va_end(args);
+
+	harness = gst_harness_new_with_element(element, "sink", "src");
+	gst_object_unref(GST_OBJECT(element));
+
+	gst_harness_set_src_caps(harness, gst_caps_copy(stream->caps));
+	if (output_caps != NULL)
+		gst_harness_set_sink_caps_str(harness, output_caps);
+
+	return harness;
+}
+
+
+static GstBuffer* gst_mpg123_check_interleave(GstBuffer *buffer, GstAudioInfo const *info)
+{
+#if GST_CHECK_VERSION(1, 16, 0)
+	if (GST_AUDIO_INFO_LAYOUT(info) == GST_AUDIO_LAYOUT_NON_INTERLEAVED)
+	{
+		GstAudioBuffer audio_buffer;
+		GstBuffer *interleaved;
+		GstMapInfo map;
+		gint channels, bps, c;
+		gsize i;
+
+		fail_unless(gst_audio_buffer_map(&audio_buffer, info, buffer, GST_MAP_READ));
+
+		channels = GST_AUDIO_INFO_CHANNELS(info);
+		bps = GST_AUDIO_INFO_BPS(info);
+		interleaved = gst_buffer_new_allocate(NULL, audio_buffer.n_samples * channels * bps, NULL);
+		gst_buffer_map(interleaved, &map, GST_MAP_WRITE);
+
+		for (c = 0; c < channels; ++c)
+		{
+			guint8 const *plane = audio_buffer.planes[c];
+			for (i = 0; i < audio_buffer.n_samples; ++i)
+				memcpy(map.data + (i * channels + c) * bps, plane + i * bps, bps);
+		}
+
+		gst_buffer_unmap(interleaved, &map);
+		gst_audio_buffer_unmap(&audio_buffer);
+		gst_buffer_unref(buffer);
+
+		return interleaved;
+	}
+#else
+	(void)info;
+#endif
+
+	return buffer;
+}
+
+
+GstBuffer* gst_mpg123_check_harness_decode(GstHarness *harness, GstMpg123TestStream const *stream, guint first_frame, guint num_frames, gboolean drain, GstAudioInfo *info)
+{
+	GstBuffer *output, *buffer;
+	GstAudioInfo output_info;
+	gboolean have_info = FALSE;
+	guint i;
+
+	fail_unless(first_frame + num_frames <= stream->frames->len);
+
+	output = gst_buffer_new();
+
+	for (i = 0; i <= num_frames; ++i)
+	{
+		if (i < num_frames)
+		{
+			GstBuffer *frame = g_ptr_array_index(stream->frames, first_frame + i);
+			fail_unless_equals_int(gst_harness_push(harness, gst_buffer_ref(frame)), GST_FLOW_OK);
+		}
+		else if (drain)
+			fail_unless(gst_harness_push_event(harness, gst_event_new_eos()));
+
+		/* Pulling the output right away keeps the harness queue short */
+		while ((buffer = gst_harness_try_pull(harness)) != NULL)
+		{
+			if (!have_info)
+			{
+				GstCaps *caps = gst_pad_get_current_caps(harness->sinkpad);
+				fail_unless(caps != NULL);
+				fail_unless(gst_audio_info_from_caps(&output_info, caps));
+				gst_caps_unref(caps);
+				have_info = TRUE;
+			}
+
+			output = gst_buffer_append(output, gst_mpg123_check_interleave(buffer, &output_info));
+		}
+	}
+
+	if (have_info)
+	{
+		output_info.layout = GST_AUDIO_LAYOUT_INTERLEAVED;
+		*info = output_info;
+	}
+
+	return output;
+}
+
+
+gdouble* gst_mpg123_check_buffer_to_f64(GstBuffer *buffer, GstAudioInfo const *info, gsize *num_samples)
+{
+	GstAudioFormatInfo const *format_info = info->finfo;
+	GstMapInfo map;
+	gdouble *samples;
+	gsize i, n;
+
+	fail_unless(gst_buffer_map(buffer, &map, GST_MAP_READ));
+
+	n = map.size / GST_AUDIO_INFO_BPF(info) * GST_AUDIO_INFO_CHANNELS(info);
+	samples = g_new(gdouble, MAX(n, 1));
+
+	/* The unpack functions produce either doubles, or 32 bit integers scaled to the full range */
+	if (format_info->unpack_format == GST_AUDIO_FORMAT_F64)
+		format_info->unpack_func(format_info, GST_AUDIO_PACK_FLAG_NONE, samples, map.data, n);
+	else
+	{
+		gint32 *unpacked = g_new(gint32, MAX(n, 1));
+
+		fail_unless(format_info->unpack_format == GST_AUDIO_FORMAT_S32);
+		format_info->unpack_func(format_info, GST_AUDIO_PACK_FLAG_NONE, unpacked, map.data, n);
+		for (i = 0; i < n; ++i)
+			samples[i] = unpacked[i] / 2147483648.0;
+
+		g_free(unpacked);
+	}
+
+	gst_buffer_unmap(buffer, &map);
+
+	*num_samples = n;
+	return samples;
+}
+
+
+void gst_mpg123_check_compare(gdouble const *output, gdouble const *reference, gsize num_samples, gdouble *rms, gdouble *max_error)
+{
+	gdouble sum = 0.0, max = 0.0;
+	gsize i;
+
+	for (i = 0; i < num_samples; ++i)
+	{
+		gdouble diff = fabs(output[i] - reference[i]);
+		sum += diff * diff;
+		max = MAX(max, diff);
+	}
+
+	*rms = (num_samples > 0) ? sqrt(sum / num_samples) : 0.0;
+	*max_error = max;
+}
+
+
+void gst_mpg123_check_get_limits(GstAudioInfo const *info, gboolean full_accuracy, gdouble *max_rms, gdouble *max_error)
+{
+	gdouble lsb;
+
+	lsb = GST_AUDIO_INFO_IS_FLOAT(info) ? 0.0 : ldexp(1.0, 1 - GST_AUDIO_INFO_DEPTH(info));
+
+	if (full_accuracy)
+	{
+		*max_rms = (ldexp(1.0, -15) + lsb) / sqrt(12.0);
+		*max_error = ldexp(1.0, -14) + lsb;
+	}
+	else
+	{
+		*max_rms = (ldexp(1.0, -11) + lsb) / sqrt(12.0);
+		*max_error = HUGE_VAL;
+	}
+}
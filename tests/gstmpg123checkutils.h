@@ -0,0 +1,75 @@
+/*
+*   MP3 decoding plugin for GStreamer using the mpg123 library
+*   Copyright (C) 2012 Carlos Rafael Giani
+*
+*   This library is free software; you can redistribute it and/or
+*   modify it under the terms of the GNU Lesser General Public
+*   License as published by the Free Software Foundation; either
+*   version 2.1 of the License, or (at your option) any later version.
+*
+*   This library is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+*   Lesser General Public License for more details.
+*
+*   You should have received a copy of the GNU Lesser General Public
+*   License along with this library; if not, write to the Free Software
+*   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+
+
+
+#ifndef GSTMPG123CHECKUTILS_H
+#define GSTMPG123CHECKUTILS_H
+
+#include <gst/gst.h>
+#include <gst/audio/audio.h>
+#include <gst/check/gstharness.h>
+#include "gstmpg123testutils.h"
+
+
+G_BEGIN_DECLS
+
+
+/*
+Helpers for the tests in tests/check/, which run the mpg123 element in a GstHarness and compare its
+output, converted to doubles in the range [-1, 1), against reference output.
+*/
+
+
+/*
+Creates a harness around a new mpg123 element with the given properties (NULL-terminated list of
+name/value pairs), which are set before the element starts. The harness source pad gets the caps
+of the stream; output_caps restricts what the harness sink pad accepts (NULL = anything).
+*/
+GstHarness* gst_mpg123_check_harness_new(GstMpg123TestStream const *stream, gchar const *output_caps, gchar const *first_property_name, ...) G_GNUC_NULL_TERMINATED;
+
+/*
+Pushes num_frames frames of the stream, starting with first_frame, and then EOS if drain is TRUE.
+Returns all output produced meanwhile in one buffer, always interleaved (planar output is interleaved
+here), and the format of the output in info. If there was no output, the buffer is empty and info
+is left untouched.
+*/
+GstBuffer* gst_mpg123_check_harness_decode(GstHarness *harness, GstMpg123TestStream const *stream, guint first_frame, guint num_frames, gboolean drain, GstAudioInfo *info);
+
+/* Converts interleaved samples in any format to doubles in the range [-1, 1); returns the number of samples (over all channels) */
+gdouble* gst_mpg123_check_buffer_to_f64(GstBuffer *buffer, GstAudioInfo const *info, gsize *num_samples);
+
+/* RMS and absolute maximum of the difference between the two sample arrays */
+void gst_mpg123_check_compare(gdouble const *output, gdouble const *reference, gsize num_samples, gdouble *rms, gdouble *max_error);
+
+/*
+Limits for the difference to a reference decoder according to ISO/IEC 11172-4. Full accuracy requires
+an RMS below 2^-15/sqrt(12) and a maximum of 2^-14 (relative to full scale); limited accuracy an RMS
+below 2^-11/sqrt(12), with no maximum. For integer formats, the quantization to the format's
+resolution is allowed on top of this: one LSB more for both.
+*/
+void gst_mpg123_check_get_limits(GstAudioInfo const *info, gboolean full_accuracy, gdouble *max_rms, gdouble *max_error);
+
+
+G_END_DECLS
+
+
+#endif
@@ -0,0 +1,767 @@
+/*
+*   MP3 decoding plugin for GStreamer using the mpg123 library
+*   Copyright (C) 2012 Carlos Rafael Giani
+*
+*   This library is free software; you can redistribute it and/or
+*   modify it under the terms of the GNU Lesser General Public
+*   License as published by the Free Software Foundation; either
+*   version 2.1 of the License, or (at your option) any later version.
+*
+*   This library is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+*   Lesser General Public License for more details.
+*
+*   You should have received a copy of the GNU Lesser General Public
+*   License along with this library; if not, write to the Free Software
+*   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+
+
+
+#include <string.h>
+#include <stdio.h>
+#include <glib.h>
+#ifdef G_OS_UNIX
+#include <sys/time.h>
+#include <sys/resource.h>
+#endif
+#include "gstmpg123testutils.h"
+
+
+/* Only the lower subbands carry data in the synthetic streams; this is still far more than speech needs */
+#define GST_MPG123_TEST_NUM_SUBBANDS 12
+
+
+static const guint16 gst_mpg123_test_bitrates[2][3][15] =
+{
+	/* MPEG-1 */
+	{
+		{ 0, 32, 64, 96, 128, 160, 192, 224, 256, 288, 320, 352, 384, 416, 448 },
+		{ 0, 32, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384 },
+		{ 0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320 }
+	},
+	/* MPEG-2 and MPEG-2.5 */
+	{
+		{ 0, 32, 48, 56, 64, 80, 96, 112, 128, 144, 160, 176, 192, 224, 256 },
+		{ 0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160 },
+		{ 0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160 }
+	}
+};
+
+static const gint gst_mpg123_test_rates[3] = { 44100, 48000, 32000 };
+
+
+typedef struct
+{
+	guint8 *data;
+	gsize size;
+	gsize bit_pos;
+}
+GstMpg123TestBitWriter;
+
+
+static void gst_mpg123_test_put_bits(GstMpg123TestBitWriter *writer, guint32 value, guint num_bits);
+static GstCaps* gst_mpg123_test_create_caps(GstMpg123TestFrameHeader const *header);
+static GstMpg123TestStream* gst_mpg123_test_stream_new(GstMpg123TestFrameHeader const *header);
+static void gst_mpg123_test_add_layer1_frames(GstMpg123TestStream *stream, guint8 const *header_bytes, guint num_frames, GRand *rand);
+static void gst_mpg123_test_add_layer2_frames(GstMpg123TestStream *stream, guint8 const *header_bytes, guint num_frames, GRand *rand);
+static void gst_mpg123_test_add_layer3_frames(GstMpg123TestStream *stream, guint8 const *header_bytes, guint num_frames, GRand *rand);
+
+
+
+
+gboolean gst_mpg123_test_parse_frame_header(guint8 const *data, gsize size, GstMpg123TestFrameHeader *header)
+{
+	guint version_bits, layer_bits, bitrate_index, rate_index, padding, mode;
+	guint bitrate;
+
+	if ((size < 4) || (data[0] != 0xFF) || ((data[1] & 0xE0) != 0xE0))
+		return FALSE;
+
+	version_bits = (data[1] >> 3) & 0x3;
+	layer_bits = (data[1] >> 1) & 0x3;
+	bitrate_index = data[2] >> 4;
+	rate_index = (data[2] >> 2) & 0x3;
+	padding = (data[2] >> 1) & 0x1;
+	mode = data[3] >> 6;
+
+	/* Reserved values, and free format, which has no fixed frame size */
+	if ((version_bits == 1) || (layer_bits == 0) || (bitrate_index == 0) || (bitrate_index == 15) || (rate_index == 3))
+		return FALSE;
+
+	header->version = (version_bits == 3) ? 1 : ((version_bits == 2) ? 2 : 3);
+	header->layer = 4 - layer_bits;
+	header->rate = gst_mpg123_test_rates[rate_index] >> (header->version - 1);
+	header->channels = (mode == 3) ? 1 : 2;
+
+	bitrate = gst_mpg123_test_bitrates[(header->version == 1) ? 0 : 1][header->layer - 1][bitrate_index] * 1000;
+
+	switch (header->layer)
+	{
+		case 1:
+			header->frame_size = (12 * bitrate / header->rate + padding) * 4;
+			header->samples_per_frame = 384;
+			break;
+		case 2:
+			header->frame_size = 144 * bitrate / header->rate + padding;
+			header->samples_per_frame = 1152;
+			break;
+		default:
+			header->frame_size = ((header->version == 1) ? 144 : 72) * bitrate / header->rate + padding;
+			header->samples_per_frame = (header->version == 1) ? 1152 : 576;
+			break;
+	}
+
+	return TRUE;
+}
+
+
+GstMpg123TestStream* gst_mpg123_test_stream_new_synthetic(gint rate, gint channels, guint num_frames, guint32 seed)
+{
+	return gst_mpg123_test_stream_new_synthetic_layer(1, rate, channels, num_frames, seed);
+}
+
+
+GstMpg123TestStream* gst_mpg123_test_stream_new_synthetic_layer(gint layer, gint rate, gint channels, guint num_frames, guint32 seed)
+{
+	GstMpg123TestStream *stream;
+	GstMpg123TestFrameHeader header;
+	GRand *rand;
+	guint8 header_bytes[4];
+	gint version = 0, max_version, rate_index = 0;
+	guint bitrate_index, mode;
+
+	g_return_val_if_fail((layer >= 1) && (layer <= 3), NULL);
+	g_return_val_if_fail((channels == 1) || (channels == 2), NULL);
+
+	/* Layer I exists for MPEG-1 and MPEG-2, layer III also for MPEG-2.5; only MPEG-1 is generated for layer II */
+	max_version = (layer == 1) ? 2 : ((layer == 2) ? 1 : 3);
+	for (version = 1; version <= max_version; ++version)
+	{
+		for (rate_index = 0; rate_index < 3; ++rate_index)
+		{
+			if ((gst_mpg123_test_rates[rate_index] >> (version - 1)) == rate)
+				break;
+		}
+		if (rate_index < 3)
+			break;
+	}
+	g_return_val_if_fail(version <= max_version, NULL);
+
+	/*
+	Layer I and II use high bitrates, so that the lower subbands have room for fine quantization; with
+	these, layer II uses allocation table a or b. Layer III uses typical bitrates, at which the content
+	has to draw on the bit reservoir now and then.
+	*/
+	switch (layer)
+	{
+		case 1: bitrate_index = (version == 1) ? 12 : 14; break;
+		case 2: bitrate_index = (channels == 2) ? 14 : 10; break;
+		default:
+			if (version == 1)
+				bitrate_index = (channels == 2) ? 9 : 5;
+			else
+				bitrate_index = (channels == 2) ? 8 : 4;
+			break;
+	}
+
+	/* Stereo layer III streams use joint stereo with mid/side coding; the other layers plain stereo */
+	if (channels == 1)
+		mode = 0x3 << 6;
+	else if (layer == 3)
+		mode = (0x1 << 6) | (0x2 << 4);
+	else
+		mode = 0x0;
+
+	header_bytes[0] = 0xFF;
+	header_bytes[1] = 0xE0 | ((version == 1) ? 0x18 : ((version == 2) ? 0x10 : 0x00)) | ((4 - layer) << 1) | 0x1; /* no CRC */
+	header_bytes[2] = (bitrate_index << 4) | (rate_index << 2);
+	header_bytes[3] = mode;
+
+	gst_mpg123_test_parse_frame_header(header_bytes, sizeof(header_bytes), &header);
+	stream = gst_mpg123_test_stream_new(&header);
+	rand = g_rand_new_with_seed(seed);
+
+	switch (layer)
+	{
+		case 1: gst_mpg123_test_add_layer1_frames(stream, header_bytes, num_frames, rand); break;
+		case 2: gst_mpg123_test_add_layer2_frames(stream, header_bytes, num_frames, rand); break;
+		default: gst_mpg123_test_add_layer3_frames(stream, header_bytes, num_frames, rand); break;
+	}
+
+	g_rand_free(rand);
+
+	return stream;
+}
+
+
+GstMpg123TestStream* gst_mpg123_test_stream_new_from_data(guint8 const *data, gsize size)
+{
+	GstMpg123TestStream *stream = NULL;
+	gsize pos = 0, end = size;
+
+	/* ID3v2 tag at the beginning; the size is a 28 bit "synchsafe" integer, plus header and optional footer */
+	if ((size >= 10) && (memcmp(data, "ID3", 3) == 0))
+	{
+		gsize tag_size = ((gsize)(data[6] & 0x7F) << 21) | ((gsize)(data[7] & 0x7F) << 14) | ((gsize)(data[8] & 0x7F) << 7) | (gsize)(data[9] & 0x7F);
+		pos = tag_size + 10 + ((data[5] & 0x10) ? 10 : 0);
+	}
+
+	/* ID3v1 tag at the end */
+	if ((end >= 128) && (memcmp(data + end - 128, "TAG", 3) == 0))
+		end -= 128;
+
+	while ((pos < end) && ((end - pos) >= 4))
+	{
+		GstMpg123TestFrameHeader header, next_header;
+		GstBuffer *frame;
+		gsize next_pos;
+
+		/* A frame counts if its successor starts with a valid header as well (or if it is the last one) */
+		if (
+			!gst_mpg123_test_parse_frame_header(data + pos, end - pos, &header) ||
+			(header.frame_size > (end - pos)) ||
+			((stream != NULL) && ((header.version != stream->header.version) || (header.layer != stream->header.layer) || (header.rate != stream->header.rate) || (header.channels != stream->header.channels)))
+		)
+		{
+			++pos;
+			continue;
+		}
+
+		next_pos = pos + header.frame_size;
+		if (((end - next_pos) >= 4) && !gst_mpg123_test_parse_frame_header(data + next_pos, end - next_pos, &next_header))
+		{
+			++pos;
+			continue;
+		}
+
+		if (stream == NULL)
+			stream = gst_mpg123_test_stream_new(&header);
+
+		frame = gst_buffer_new_allocate(NULL, header.frame_size, NULL);
+		gst_buffer_fill(frame, 0, data + pos, header.frame_size);
+		g_ptr_array_add(stream->frames, frame);
+		pos = next_pos;
+	}
+
+	return stream;
+}
+
+
+GstMpg123TestStream* gst_mpg123_test_stream_new_from_file(gchar const *filename, GError **error)
+{
+	GstMpg123TestStream *stream;
+	gchar *contents;
+	gsize size;
+
+	if (!g_file_get_contents(filename, &contents, &size, error))
+		return NULL;
+
+	stream = gst_mpg123_test_stream_new_from_data((guint8 const *)contents, size);
+	g_free(contents);
+
+	if (stream == NULL)
+		g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_INVAL, "%s does not contain MPEG audio frames", filename);
+
+	return stream;
+}
+
+
+void gst_mpg123_test_stream_free(GstMpg123TestStream *stream)
+{
+	if (stream == NULL)
+		return;
+
+	g_ptr_array_unref(stream->frames);
+	gst_caps_unref(stream->caps);
+	g_free(stream);
+}
+
+
+GstClockTime gst_mpg123_test_stream_get_duration(GstMpg123TestStream const *stream)
+{
+	return gst_util_uint64_scale_int((guint64)(stream->frames->len) * stream->header.samples_per_frame, GST_SECOND, stream->header.rate);
+}
+
+
+void gst_mpg123_test_get_resource_usage(GstMpg123TestResourceUsage *usage)
+{
+#ifdef G_OS_UNIX
+	struct rusage rusage;
+
+	if (getrusage(RUSAGE_SELF, &rusage) == 0)
+	{
+		usage->cpu_time = (guint64)(rusage.ru_utime.tv_sec + rusage.ru_stime.tv_sec) * G_USEC_PER_SEC + rusage.ru_utime.tv_usec + rusage.ru_stime.tv_usec;
+		usage->voluntary_context_switches = rusage.ru_nvcsw;
+		usage->involuntary_context_switches = rusage.ru_nivcsw;
+		return;
+	}
+#endif
+
+	memset(usage, 0, sizeof(GstMpg123TestResourceUsage));
+}
+
+
+guint64 gst_mpg123_test_get_rss(void)
+{
+	guint64 rss = 0;
+#ifdef __linux__
+	gchar *status;
+
+	if (g_file_get_contents("/proc/self/status", &status, NULL, NULL))
+	{
+		gchar const *line = strstr(status, "VmRSS:");
+		guint64 rss_kb;
+
+		if ((line != NULL) && (sscanf(line + 6, "%" G_GUINT64_FORMAT, &rss_kb) == 1))
+			rss = rss_kb * 1024;
+
+		g_free(status);
+	}
+#endif
+
+	return rss;
+}
+
+
+
+
+static void gst_mpg123_test_put_bits(GstMpg123TestBitWriter *writer, guint32 value, guint num_bits)
+{
+	g_assert((writer->bit_pos + num_bits) <= (writer->size * 8));
+
+	while (num_bits > 0)
+	{
+		--num_bits;
+		if (value & (1u << num_bits))
+			writer->data[writer->bit_pos >> 3] |= 0x80 >> (writer->bit_pos & 7);
+		++(writer->bit_pos);
+	}
+}
+
+
+static GstMpg123TestBitWriter gst_mpg123_test_start_frame(GstMpg123TestStream const *stream, guint8 const *header_bytes)
+{
+	GstMpg123TestBitWriter writer;
+
+	writer.data = g_malloc0(stream->header.frame_size);
+	writer.size = stream->header.frame_size;
+	memcpy(writer.data, header_bytes, 4);
+	writer.bit_pos = 4 * 8;
+
+	return writer;
+}
+
+
+static void gst_mpg123_test_add_layer1_frames(GstMpg123TestStream *stream, guint8 const *header_bytes, guint num_frames, GRand *rand)
+{
+	guint channels = stream->header.channels;
+	guint i;
+
+	for (i = 0; i < num_frames; ++i)
+	{
+		GstMpg123TestBitWriter writer = gst_mpg123_test_start_frame(stream, header_bytes);
+		guint num_bits[32][2];
+		guint sb, ch, s;
+
+		/* Bit allocation; samples have (allocation + 1) bits */
+		for (sb = 0; sb < 32; ++sb)
+		{
+			for (ch = 0; ch < channels; ++ch)
+			{
+				num_bits[sb][ch] = (sb < GST_MPG123_TEST_NUM_SUBBANDS) ? (guint)g_rand_int_range(rand, 4, 9) : 0;
+				gst_mpg123_test_put_bits(&writer, (num_bits[sb][ch] > 0) ? (num_bits[sb][ch] - 1) : 0, 4);
+			}
+		}
+
+		/*
+		Scalefactors; index 15 corresponds to 2^-4, and each step is -2 dB. 12 subbands at most at 2^-4 add
+		up to less than 0.75, which leaves enough headroom for the ripple of the synthesis filterbank.
+		*/
+		for (sb = 0; sb < 32; ++sb)
+		{
+			for (ch = 0; ch < channels; ++ch)
+			{
+				if (num_bits[sb][ch] > 0)
+					gst_mpg123_test_put_bits(&writer, g_rand_int_range(rand, 15, 22), 6);
+			}
+		}
+
+		/* 12 samples per subband; the all-ones code is forbidden */
+		for (s = 0; s < 12; ++s)
+		{
+			for (sb = 0; sb < 32; ++sb)
+			{
+				for (ch = 0; ch < channels; ++ch)
+				{
+					if (num_bits[sb][ch] > 0)
+						gst_mpg123_test_put_bits(&writer, g_rand_int_range(rand, 0, (1 << num_bits[sb][ch]) - 1), num_bits[sb][ch]);
+				}
+			}
+		}
+
+		g_ptr_array_add(stream->frames, gst_buffer_new_wrapped(writer.data, writer.size));
+	}
+}
+
+
+/*
+Layer II quantization classes used by the generator, from allocation tables a and b (ISO/IEC 11172-3
+table B.2a/b): the allocation index and the number of levels; 3, 5 and 9 levels are coded in groups of
+three samples. Subbands 0-2 and 3-10 have different classes; the generator leaves the others empty.
+*/
+typedef struct
+{
+	guint8 allocation;
+	guint8 num_levels;
+}
+GstMpg123TestLayer2Class;
+
+static const GstMpg123TestLayer2Class gst_mpg123_test_layer2_classes_low[] = { { 1, 3 }, { 2, 7 }, { 3, 15 }, { 4, 31 } };
+static const GstMpg123TestLayer2Class gst_mpg123_test_layer2_classes_mid[] = { { 1, 3 }, { 2, 5 }, { 3, 7 }, { 4, 9 }, { 5, 15 }, { 6, 31 } };
+
+#define GST_MPG123_TEST_LAYER2_NUM_SUBBANDS 11
+
+
+static void gst_mpg123_test_add_layer2_frames(GstMpg123TestStream *stream, guint8 const *header_bytes, guint num_frames, GRand *rand)
+{
+	/* The tables have the same layout in the lower subbands; b has 30 subbands, a (used at 48 kHz) only 27 */
+	static const guint8 num_scalefactors[4] = { 3, 2, 1, 2 };
+	guint channels = stream->header.channels;
+	guint num_subbands = (stream->header.rate == 48000) ? 27 : 30;
+	guint i;
+
+	for (i = 0; i < num_frames; ++i)
+	{
+		GstMpg123TestBitWriter writer = gst_mpg123_test_start_frame(stream, header_bytes);
+		GstMpg123TestLayer2Class const *classes[GST_MPG123_TEST_LAYER2_NUM_SUBBANDS][2];
+		guint scfsi[GST_MPG123_TEST_LAYER2_NUM_SUBBANDS][2];
+		guint sb, ch, gr, s, j;
+
+		/* Bit allocation, with 4 bits in subbands 0-10, 3 bits in 11-22 and 2 bits above */
+		for (sb = 0; sb < num_subbands; ++sb)
+		{
+			for (ch = 0; ch < channels; ++ch)
+			{
+				guint allocation = 0;
+
+				if (sb < GST_MPG123_TEST_LAYER2_NUM_SUBBANDS)
+				{
+					if (sb < 3)
+						classes[sb][ch] = &gst_mpg123_test_layer2_classes_low[g_rand_int_range(rand, 0, G_N_ELEMENTS(gst_mpg123_test_layer2_classes_low))];
+					else
+						classes[sb][ch] = &gst_mpg123_test_layer2_classes_mid[g_rand_int_range(rand, 0, G_N_ELEMENTS(gst_mpg123_test_layer2_classes_mid))];
+					allocation = classes[sb][ch]->allocation;
+				}
+
+				gst_mpg123_test_put_bits(&writer, allocation, (sb < 11) ? 4 : ((sb < 23) ? 3 : 2));
+			}
+		}
+
+		/* Scalefactor selection: how many of the three parts of the frame get their own scalefactor */
+		for (sb = 0; sb < GST_MPG123_TEST_LAYER2_NUM_SUBBANDS; ++sb)
+		{
+			for (ch = 0; ch < channels; ++ch)
+			{
+				scfsi[sb][ch] = g_rand_int_range(rand, 0, 4);
+				gst_mpg123_test_put_bits(&writer, scfsi[sb][ch], 2);
+			}
+		}
+
+		/* Scalefactors, with the same scale and headroom as in layer I */
+		for (sb = 0; sb < GST_MPG123_TEST_LAYER2_NUM_SUBBANDS; ++sb)
+		{
+			for (ch = 0; ch < channels; ++ch)
+			{
+				for (j = 0; j < num_scalefactors[scfsi[sb][ch]]; ++j)
+					gst_mpg123_test_put_bits(&writer, g_rand_int_range(rand, 15, 22), 6);
+			}
+		}
+
+		/* 12 granules of 3 samples per subband */
+		for (gr = 0; gr < 12; ++gr)
+		{
+			for (sb = 0; sb < GST_MPG123_TEST_LAYER2_NUM_SUBBANDS; ++sb)
+			{
+				for (ch = 0; ch < channels; ++ch)
+				{
+					guint num_levels = classes[sb][ch]->num_levels;
+
+					if ((num_levels == 3) || (num_levels == 5) || (num_levels == 9))
+					{
+						guint code = 0, num_bits = (num_levels == 3) ? 5 : ((num_levels == 5) ? 7 : 10);
+
+						for (s = 0; s < 3; ++s)
+							code = code * num_levels + g_rand_int_range(rand, 0, num_levels);
+						gst_mpg123_test_put_bits(&writer, code, num_bits);
+					}
+					else
+					{
+						guint num_bits = g_bit_storage(num_levels);
+
+						for (s = 0; s < 3; ++s)
+							gst_mpg123_test_put_bits(&writer, g_rand_int_range(rand, 0, num_levels), num_bits);
+					}
+				}
+			}
+		}
+
+		g_ptr_array_add(stream->frames, gst_buffer_new_wrapped(writer.data, writer.size));
+	}
+}
+
+
+/* Granule side info of a layer III channel; the generator uses Huffman table 1 and count1 table B throughout */
+typedef struct
+{
+	guint part2_3_length;
+	guint big_values;
+	guint global_gain;
+	guint scalefac_compress;
+	guint block_type;
+	guint subblock_gain[3];
+	guint scalefac_scale;
+}
+GstMpg123TestGranuleInfo;
+
+/* Scalefactor lengths of MPEG-1 layer III, indexed by scalefac_compress */
+static const guint8 gst_mpg123_test_slen[2][16] =
+{
+	{ 0, 0, 0, 0, 3, 1, 1, 1, 2, 2, 2, 3, 3, 3, 4, 4 },
+	{ 0, 1, 2, 3, 0, 1, 2, 3, 1, 2, 3, 1, 2, 3, 2, 3 }
+};
+
+/* Huffman code table 1 (ISO/IEC 11172-3 table B.7), indexed by 2 * x + y: code, length */
+static const guint8 gst_mpg123_test_huffman_table1[4][2] = { { 0x1, 1 }, { 0x1, 3 }, { 0x1, 2 }, { 0x0, 3 } };
+
+
+/*
+Writes the scalefactors and Huffman coded values of one granule of one channel, until about target_bits
+bits are written. The values are all 0 or +-1; their level is set by the global gain, which together
+with the scalefactors keeps the output around -30 dBFS, so integer formats do not clip.
+*/
+static void gst_mpg123_test_write_layer3_granule(GstMpg123TestBitWriter *writer, GstMpg123TestGranuleInfo *info, gint version, guint target_bits, GRand *rand)
+{
+	gsize start = writer->bit_pos;
+	guint num_lines = 0, i, num_scalefactors[2];
+
+	info->global_gain = g_rand_int_range(rand, 160, 171);
+	info->scalefac_scale = g_rand_int_range(rand, 0, 2);
+	for (i = 0; i < 3; ++i)
+		info->subblock_gain[i] = (info->block_type == 2) ? (guint)g_rand_int_range(rand, 0, 3) : 0;
+
+	/* Scalefactors (all bands sent); MPEG-2/2.5 use scalefac_compress 0, which means no scalefactors */
+	info->scalefac_compress = (version == 1) ? (guint)g_rand_int_range(rand, 0, 16) : 0;
+	if (version == 1)
+	{
+		num_scalefactors[0] = (info->block_type == 2) ? 18 : 11;
+		num_scalefactors[1] = (info->block_type == 2) ? 18 : 10;
+		for (i = 0; i < 2; ++i)
+		{
+			guint slen = gst_mpg123_test_slen[i][info->scalefac_compress];
+			guint j;
+
+			for (j = 0; j < num_scalefactors[i]; ++j)
+				gst_mpg123_test_put_bits(writer, (slen > 0) ? g_rand_int_range(rand, 0, 1 << slen) : 0, slen);
+		}
+	}
+
+	/* Pairs in the big values region, with a sign bit after each nonzero value */
+	info->big_values = 0;
+	while ((info->big_values < 200) && ((writer->bit_pos - start) < (target_bits * 7 / 10)))
+	{
+		guint x = g_rand_int_range(rand, 0, 2), y = g_rand_int_range(rand, 0, 2);
+
+		gst_mpg123_test_put_bits(writer, gst_mpg123_test_huffman_table1[2 * x + y][0], gst_mpg123_test_huffman_table1[2 * x + y][1]);
+		if (x != 0)
+			gst_mpg123_test_put_bits(writer, g_rand_int_range(rand, 0, 2), 1);
+		if (y != 0)
+			gst_mpg123_test_put_bits(writer, g_rand_int_range(rand, 0, 2), 1);
+
+		++(info->big_values);
+		num_lines += 2;
+	}
+
+	/* Quadruples in the count1 region; with table B, the code is the inverted 4-bit value */
+	while (((num_lines + 4) <= 576) && ((writer->bit_pos - start) < target_bits))
+	{
+		guint value = 0;
+
+		for (i = 0; i < 4; ++i)
+			value = (value << 1) | ((g_rand_int_range(rand, 0, 4) == 0) ? 1 : 0);
+
+		gst_mpg123_test_put_bits(writer, 15 - value, 4);
+		for (i = 0; i < 4; ++i)
+		{
+			if (value & (0x8 >> i))
+				gst_mpg123_test_put_bits(writer, g_rand_int_range(rand, 0, 2), 1);
+		}
+
+		num_lines += 4;
+	}
+
+	info->part2_3_length = writer->bit_pos - start;
+}
+
+
+static void gst_mpg123_test_write_layer3_granule_info(GstMpg123TestBitWriter *writer, GstMpg123TestGranuleInfo const *info, gint version)
+{
+	guint i;
+
+	gst_mpg123_test_put_bits(writer, info->part2_3_length, 12);
+	gst_mpg123_test_put_bits(writer, info->big_values, 9);
+	gst_mpg123_test_put_bits(writer, info->global_gain, 8);
+	gst_mpg123_test_put_bits(writer, info->scalefac_compress, (version == 1) ? 4 : 9);
+
+	if (info->block_type != 0)
+	{
+		/* Window switching; the region boundaries are implicit */
+		gst_mpg123_test_put_bits(writer, 1, 1);
+		gst_mpg123_test_put_bits(writer, info->block_type, 2);
+		gst_mpg123_test_put_bits(writer, 0, 1);
+		for (i = 0; i < 2; ++i)
+			gst_mpg123_test_put_bits(writer, 1, 5);
+		for (i = 0; i < 3; ++i)
+			gst_mpg123_test_put_bits(writer, info->subblock_gain[i], 3);
+	}
+	else
+	{
+		gst_mpg123_test_put_bits(writer, 0, 1);
+		for (i = 0; i < 3; ++i)
+			gst_mpg123_test_put_bits(writer, 1, 5);
+		gst_mpg123_test_put_bits(writer, 7, 4);
+		gst_mpg123_test_put_bits(writer, 7, 3);
+	}
+
+	/* preflag (MPEG-1 only), scalefac_scale, count1table_select */
+	if (version == 1)
+		gst_mpg123_test_put_bits(writer, 0, 1);
+	gst_mpg123_test_put_bits(writer, info->scalefac_scale, 1);
+	gst_mpg123_test_put_bits(writer, 1, 1);
+}
+
+
+static void gst_mpg123_test_add_layer3_frames(GstMpg123TestStream *stream, guint8 const *header_bytes, guint num_frames, GRand *rand)
+{
+	gint version = stream->header.version;
+	guint channels = stream->header.channels;
+	guint num_granules = (version == 1) ? 2 : 1;
+	gsize side_info_size = (version == 1) ? ((channels == 1) ? 17 : 32) : ((channels == 1) ? 9 : 17);
+	gsize main_data_size = stream->header.frame_size - 4 - side_info_size;
+	gsize max_main_data_begin = (version == 1) ? 511 : 255;
+	guint8 *main_data, **frames;
+	gsize main_data_end = 0;
+	guint block_type = 0;
+	guint i, gr, ch;
+
+	/*
+	The main data of all frames is laid out in one buffer, which is split up into the frames at the end.
+	The main data of a frame starts as early as main_data_begin allows (right after that of the previous
+	frame), so that the unused space of earlier frames, the bit reservoir, is used. Loud frames take
+	more space than a frame has, quiet ones less.
+	*/
+	main_data = g_malloc0(num_frames * main_data_size + 1);
+	frames = g_new(guint8*, num_frames);
+
+	for (i = 0; i < num_frames; ++i)
+	{
+		GstMpg123TestGranuleInfo infos[2][2];
+		GstMpg123TestBitWriter writer, side_info_writer;
+		gsize frame_start = i * main_data_size, start, available, target_bits;
+
+		start = MAX(main_data_end, (frame_start > max_main_data_begin) ? (frame_start - max_main_data_begin) : 0);
+		available = frame_start + main_data_size - start;
+		target_bits = (g_rand_int_range(rand, 0, 4) == 0) ? (available * 8 * 9 / 10) : (main_data_size * 8 / 2);
+
+		/* Long blocks, with sequences of start, short and stop blocks in between; both channels switch together */
+		for (gr = 0; gr < num_granules; ++gr)
+		{
+			switch (block_type)
+			{
+				case 0: block_type = (g_rand_int_range(rand, 0, 8) == 0) ? 1 : 0; break;
+				case 1: block_type = 2; break;
+				case 2: block_type = (g_rand_int_range(rand, 0, 2) == 0) ? 2 : 3; break;
+				default: block_type = 0; break;
+			}
+			for (ch = 0; ch < channels; ++ch)
+				infos[gr][ch].block_type = block_type;
+		}
+
+		/* Start over with less data if the first attempt does not fit */
+		writer.data = NULL;
+		do
+		{
+			g_free(writer.data);
+			writer.size = available + 64;
+			writer.data = g_malloc0(writer.size);
+			writer.bit_pos = 0;
+
+			for (gr = 0; gr < num_granules; ++gr)
+			{
+				for (ch = 0; ch < channels; ++ch)
+					gst_mpg123_test_write_layer3_granule(&writer, &(infos[gr][ch]), version, target_bits / (num_granules * channels), rand);
+			}
+
+			target_bits /= 2;
+		}
+		while (((writer.bit_pos + 7) / 8) > available);
+
+		memcpy(main_data + start, writer.data, (writer.bit_pos + 7) / 8);
+		main_data_end = start + (writer.bit_pos + 7) / 8;
+		g_free(writer.data);
+
+		side_info_writer = gst_mpg123_test_start_frame(stream, header_bytes);
+		gst_mpg123_test_put_bits(&side_info_writer, frame_start - start, (version == 1) ? 9 : 8);
+		/* Private bits, and (MPEG-1) scfsi, which is 0: each granule has all of its scalefactors */
+		gst_mpg123_test_put_bits(&side_info_writer, 0, (version == 1) ? ((channels == 1) ? 5 : 3) : ((channels == 1) ? 1 : 2));
+		if (version == 1)
+			gst_mpg123_test_put_bits(&side_info_writer, 0, 4 * channels);
+		for (gr = 0; gr < num_granules; ++gr)
+		{
+			for (ch = 0; ch < channels; ++ch)
+				gst_mpg123_test_write_layer3_granule_info(&side_info_writer, &(infos[gr][ch]), version);
+		}
+		g_assert(side_info_writer.bit_pos == (4 + side_info_size) * 8);
+
+		frames[i] = side_info_writer.data;
+	}
+
+	for (i = 0; i < num_frames; ++i)
+	{
+		memcpy(frames[i] + 4 + side_info_size, main_data + i * main_data_size, main_data_size);
+		g_ptr_array_add(stream->frames, gst_buffer_new_wrapped(frames[i], stream->header.frame_size));
+	}
+
+	g_free(frames);
+	g_free(main_data);
+}
+
+
+static GstCaps* gst_mpg123_test_create_caps(GstMpg123TestFrameHeader const *header)
+{
+	return gst_caps_new_simple(
+		"audio/mpeg",
+		"mpegversion", G_TYPE_INT, 1,
+		"mpegaudioversion", G_TYPE_INT, header->version,
+		"layer", G_TYPE_INT, header->layer,
+		"rate", G_TYPE_INT, header->rate,
+		"channels", G_TYPE_INT, header->channels,
+		"parsed", G_TYPE_BOOLEAN, TRUE,
+		NULL
+	);
+}
+
+
+static GstMpg123TestStream* gst_mpg123_test_stream_new(GstMpg123TestFrameHeader const *header)
+{
+	GstMpg123TestStream *stream = g_new0(GstMpg123TestStream, 1);
+
+	stream->frames = g_ptr_array_new_with_free_func((GDestroyNotify)gst_buffer_unref);
+	stream->caps = gst_mpg123_test_create_caps(header);
+	stream->header = *header;
+
+	return stream;
+}
@@ -0,0 +1,112 @@
+/*
+*   MP3 decoding plugin for GStreamer using the mpg123 library
+*   Copyright (C) 2012 Carlos Rafael Giani
+*
+*   This library is free software; you can redistribute it and/or
+*   modify it under the terms of the GNU Lesser General Public
+*   License as published by the Free Software Foundation; either
+*   version 2.1 of the License, or (at your option) any later version.
+*
+*   This library is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+*   Lesser General Public License for more details.
+*
+*   You should have received a copy of the GNU Lesser General Public
+*   License along with this library; if not, write to the Free Software
+*   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+
+
+
+#ifndef GSTMPG123TESTUTILS_H
+#define GSTMPG123TESTUTILS_H
+
+#include <gst/gst.h>
+
+
+G_BEGIN_DECLS
+
+
+/*
+Helpers shared by the tests in tests/check/ and the benchmarks in tests/bench/. Input streams are
+either generated (layer I, II or III with pseudo-random content, so no assets are needed), or read
+from MP3 files and split into frames, so they can be pushed as parsed input without mpegaudioparse.
+*/
+
+
+typedef struct
+{
+	/* 1 = MPEG-1, 2 = MPEG-2, 3 = MPEG-2.5 */
+	gint version;
+	gint layer;
+	gint rate, channels;
+	gsize frame_size;
+	guint samples_per_frame;
+}
+GstMpg123TestFrameHeader;
+
+
+typedef struct
+{
+	/* One buffer per MPEG frame */
+	GPtrArray *frames;
+	/* Parsed audio/mpeg caps matching the frames */
+	GstCaps *caps;
+	GstMpg123TestFrameHeader header;
+}
+GstMpg123TestStream;
+
+
+/* Parses the MPEG audio frame header at the beginning of data; returns FALSE if there is none */
+gboolean gst_mpg123_test_parse_frame_header(guint8 const *data, gsize size, GstMpg123TestFrameHeader *header);
+
+/*
+Generates a stream with pseudo-random content. The output stays well below full scale, so integer
+sample formats do not clip. The same seed gives the same stream on all platforms.
+
+Layer I (MPEG-1/2) and layer II (MPEG-1 only) streams have content in the lower subbands, at the
+highest bitrates. Layer II uses grouped and ungrouped quantization, and all scalefactor selections.
+Layer III (MPEG-1/2/2.5) streams are at typical bitrates (128 kbps stereo and 64 kbps mono for MPEG-1,
+half that otherwise), with mid/side stereo, long, start, short and stop blocks, scalefactors (MPEG-1),
+big values and count1 regions, and loud frames that need the bit reservoir.
+*/
+GstMpg123TestStream* gst_mpg123_test_stream_new_synthetic_layer(gint layer, gint rate, gint channels, guint num_frames, guint32 seed);
+
+/* Same as gst_mpg123_test_stream_new_synthetic_layer() with layer I */
+GstMpg123TestStream* gst_mpg123_test_stream_new_synthetic(gint rate, gint channels, guint num_frames, guint32 seed);
+
+/*
+Splits MPEG audio data into frames, skipping a leading ID3v2 tag, a trailing ID3v1 tag, and anything
+between frames that is not a frame. All frames must have the same version, layer, rate and channels
+as the first one. Returns NULL if no frame is found.
+*/
+GstMpg123TestStream* gst_mpg123_test_stream_new_from_data(guint8 const *data, gsize size);
+GstMpg123TestStream* gst_mpg123_test_stream_new_from_file(gchar const *filename, GError **error);
+
+void gst_mpg123_test_stream_free(GstMpg123TestStream *stream);
+
+GstClockTime gst_mpg123_test_stream_get_duration(GstMpg123TestStream const *stream);
+
+
+typedef struct
+{
+	/* User and system CPU time of the process, in microseconds */
+	guint64 cpu_time;
+	/* Voluntary (waiting) and involuntary (preempted) context switches of the process */
+	guint64 voluntary_context_switches, involuntary_context_switches;
+}
+GstMpg123TestResourceUsage;
+
+void gst_mpg123_test_get_resource_usage(GstMpg123TestResourceUsage *usage);
+
+/* Resident set size of the process in bytes; 0 if it cannot be determined (only implemented for Linux) */
+guint64 gst_mpg123_test_get_rss(void);
+
+
+G_END_DECLS
+
+
+#endif